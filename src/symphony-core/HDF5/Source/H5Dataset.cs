@@ -38,6 +38,28 @@ namespace HDF5
             }
         }
 
+        public H5T.H5TClass DatatypeClass
+        {
+            get
+            {
+                H5DataSetId did = null;
+                H5DataTypeId tid = null;
+                try
+                {
+                    did = H5D.open(File.Fid, Path);
+                    tid = H5D.getType(did);
+                    return H5T.getClass(tid);
+                }
+                finally
+                {
+                    if (tid != null && tid.Id > 0)
+                        H5T.close(tid);
+                    if (did != null && did.Id > 0)
+                        H5D.close(did);
+                }
+            }
+        }
+
         public void SetData<T>(T[] data)
         {
             H5DataSetId did = null;
@@ -114,6 +136,11 @@ namespace HDF5
             }
         }
 
+        public void Delete()
+        {
+            File.Delete(Path);
+        }
+
         public void Extend(long[] newDims)
         {
             H5DataSetId did = null;
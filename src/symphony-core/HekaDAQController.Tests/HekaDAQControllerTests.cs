@@ -438,6 +438,121 @@ namespace Heka
             Assert.That(c.Configuration.ContainsKey("sampleRate"));
         }
 
+        [Test]
+        public void ShouldStoreDeviceNumbersForMultipleUnits()
+        {
+            var c = new HekaDAQController(ITCMM.ITC18_ID, new uint[] { 1, 0 }, new SystemClock());
+
+            Assert.That(c.DeviceNumber, Is.EqualTo(1));
+            Assert.That(c.DeviceNumbers, Is.EqualTo(new uint[] { 1, 0 }));
+            Assert.That(c.Configuration.ContainsKey("deviceNumbers"));
+            Assert.That(c.NativeStreaming, Is.True);
+        }
+
+        [Test]
+        public void SingleUnitShouldNotForceNativeStreaming()
+        {
+            var c = new HekaDAQController(ITCMM.ITC18_ID, 2);
+
+            Assert.That(c.DeviceNumbers, Is.EqualTo(new uint[] { 2 }));
+            Assert.That(c.NativeStreaming, Is.False);
+        }
+
+        [Test]
+        public void FifoWatermarksShouldDefaultToDisabled()
+        {
+            var c = new HekaDAQController();
+
+            Assert.That(c.FifoLowWatermark, Is.EqualTo(TimeSpan.Zero));
+            Assert.That(c.FifoStopWatermark, Is.EqualTo(TimeSpan.Zero));
+
+            c.FifoLowWatermark = TimeSpan.FromMilliseconds(200);
+            c.FifoStopWatermark = TimeSpan.FromMilliseconds(20);
+
+            Assert.That(c.FifoLowWatermark, Is.EqualTo(TimeSpan.FromMilliseconds(200)));
+            Assert.That(c.FifoStopWatermark, Is.EqualTo(TimeSpan.FromMilliseconds(20)));
+        }
+
+        [Test]
+        public void SimulatedControllerShouldPresentItc18Streams()
+        {
+            var daq = new HekaDAQController(new HekaSimulationOptions(), new SystemClock());
+            daq.InitHardware();
+
+            try
+            {
+                Assert.That(daq.StreamsOfType(StreamType.AI).Count(), Is.EqualTo(ITCMM.ITC18_NUMBEROFADCINPUTS));
+                Assert.That(daq.StreamsOfType(StreamType.AO).Count(), Is.EqualTo(ITCMM.ITC18_NUMBEROFDACOUTPUTS));
+                Assert.That(daq.NativeStreaming, Is.False);
+            }
+            finally
+            {
+                daq.CloseHardware();
+            }
+        }
+
+        [Test]
+        [Timeout(10 * 1000)]
+        public void SimulatedControllerShouldLoopOutputBackToInput()
+        {
+            var daq = new HekaDAQController(new HekaSimulationOptions(), new SystemClock());
+            RunSimulated(daq, 2);
+
+            // The simulated unit acquires each output sample 3 samples late
+            var input = InputDevice.InputData[InputStream].SelectMany(d => d.Data).ToList();
+            var output = Data.Data;
+            Assert.That(input.Count, Is.GreaterThanOrEqualTo((int)daq.ProcessInterval.Samples(daq.SampleRate)));
+            for (int i = 3; i < input.Count; i++)
+            {
+                Assert.That((double)input[i].QuantityInBaseUnits,
+                            Is.EqualTo((double)output[i - 3].QuantityInBaseUnits).Within(1e-3),
+                            "Sample " + i);
+            }
+        }
+
+        [Test]
+        [Timeout(10 * 1000)]
+        public void SimulatedControllerShouldRunFasterThanRealTime()
+        {
+            var daq = new HekaDAQController(new HekaSimulationOptions { Speed = 10 }, new SystemClock());
+            daq.NativeStreaming = true;
+
+            var elapsed = System.Diagnostics.Stopwatch.StartNew();
+            RunSimulated(daq, 4);
+            elapsed.Stop();
+
+            Assert.That(elapsed.Elapsed, Is.LessThan(TimeSpan.FromTicks(4 * daq.ProcessInterval.Ticks)));
+        }
+
+        // Runs the controller for the given number of process iterations, well within the fixture's output
+        private void RunSimulated(HekaDAQController daq, int iterations)
+        {
+            try
+            {
+                Exception failure = null;
+                int completed = 0;
+
+                FixtureForController(daq, durationSeconds: 10.0);
+                InputDevice.InputData[InputStream] = new List<IInputData>();
+
+                daq.ExceptionalStop += (c, args) => failure = args.Exception;
+                daq.ProcessIteration += (c, args) =>
+                                            {
+                                                if (Interlocked.Increment(ref completed) >= iterations)
+                                                    daq.RequestStop();
+                                            };
+
+                daq.Start(false);
+                Assert.That(() => daq.IsRunning, Is.False.After(8000, 10));
+                Assert.That(failure, Is.Null);
+            }
+            finally
+            {
+                if (daq.IsHardwareReady)
+                    daq.CloseHardware();
+            }
+        }
+
     }
 
 }
@@ -17,6 +17,17 @@ namespace Heka
         {
             Assert.AreEqual(HekaDAQInputStream.DAQCountUnits, HekaDAQOutputStream.DAQCountUnits);
         }
+
+        [Test]
+        public void StreamsShouldDefaultToPrimaryUnit()
+        {
+            var controller = new HekaDAQController();
+
+            Assert.AreEqual(0, new HekaDAQInputStream("IN", StreamType.AI, 0, controller).DeviceIndex);
+            Assert.AreEqual(0, new HekaDAQOutputStream("OUT", StreamType.AO, 0, controller).DeviceIndex);
+            Assert.AreEqual(2, new HekaDAQInputStream("dev2_ai0", StreamType.AI, 0, 2, controller).DeviceIndex);
+            Assert.AreEqual(1, new HekaDigitalDAQOutputStream("dev1_doport0", 0, 1, controller).DeviceIndex);
+        }
     }
     [TestFixture]
     class HekaDAQOutputStreamTests
@@ -109,6 +120,64 @@ namespace Heka
             Assert.AreEqual(0, info.Gain);
             Assert.AreEqual(IntPtr.Zero, info.FIFOPointer);
         }
+
+        [Test]
+        public void ToCountsShouldConvertVolts()
+        {
+            Converters.Clear();
+            HekaDAQOutputStream.RegisterConverters();
+
+            var volts = Enumerable.Range(-1000, 2001).Select(i => new Measurement(i, -3, "V")).ToList();
+            var data = new OutputData(volts, new Measurement(10000, "Hz"), false);
+
+            var expected = volts.Select(m => (short)Math.Round((double)m.QuantityInBaseUnits * ITCMM.ANALOGVOLT)).ToArray();
+
+            Assert.AreEqual(expected, HekaDAQOutputStream.ToCounts(data));
+        }
+
+        [Test]
+        public void ToCountsShouldRejectOutOfRangeVolts()
+        {
+            var data = new OutputData(new[] { new Measurement(11, "V") }, new Measurement(10000, "Hz"), false);
+
+            Assert.Throws<DAQException>(() => HekaDAQOutputStream.ToCounts(data));
+        }
+
+        [Test]
+        public void ToCountsShouldWriteVoltsIntoBuffer()
+        {
+            var volts = Enumerable.Range(-100, 201).Select(i => i / 100.0).ToArray();
+            var data = new OutputData(new SampleData(volts, 0, "V"), new Measurement(10000, "Hz"), false);
+
+            var counts = new short[volts.Length + 10];
+            int n = HekaDAQOutputStream.ToCounts(data, counts, 10);
+
+            var expected = volts.Select(v => (short)Math.Round(v * ITCMM.ANALOGVOLT)).ToArray();
+            Assert.AreEqual(volts.Length, n);
+            Assert.AreEqual(expected, counts.Skip(10).ToArray());
+            Assert.AreEqual(new short[10], counts.Take(10).ToArray());
+        }
+
+        [Test]
+        public void ToCountsShouldCopyCountsIntoBuffer()
+        {
+            var samples = new short[] { -5, 0, 7, 32767 };
+            var data = new OutputData(new SampleData(samples, 0, HekaDAQOutputStream.DAQCountUnits), new Measurement(10000, "Hz"), false);
+
+            var counts = new short[6];
+            int n = HekaDAQOutputStream.ToCounts(data, counts, 2);
+
+            Assert.AreEqual(4, n);
+            Assert.AreEqual(new short[] { 0, 0, -5, 0, 7, 32767 }, counts);
+        }
+
+        [Test]
+        public void ToCountsIntoBufferShouldRejectOutOfRangeVolts()
+        {
+            var data = new OutputData(new SampleData(new[] { 0.5, -10.5 }, 0, "V"), new Measurement(10000, "Hz"), false);
+
+            Assert.Throws<DAQException>(() => HekaDAQOutputStream.ToCounts(data, new short[2], 0));
+        }
     }
 
     [TestFixture]
@@ -167,6 +236,28 @@ namespace Heka
             var pull2 = s.PullOutputData(duration);
             Assert.AreEqual(expected, pull2.Data);
         }
+
+        [Test]
+        public void ShouldRejectNonBinaryPulledOutputData()
+        {
+            var controller = new HekaDAQController();
+            var s = new HekaDigitalDAQOutputStream("OUT", 0, controller);
+            controller.SampleRate = new Measurement(10000, 1, "Hz");
+
+            TimeSpan duration = TimeSpan.FromSeconds(0.5);
+
+            var dataQueue = new Dictionary<IDAQOutputStream, Queue<IOutputData>>();
+            dataQueue[s] = new Queue<IOutputData>();
+            var data = new OutputData(Enumerable.Range(0, 5000).Select(i => new Measurement(i == 4000 ? 2 : 0, Measurement.UNITLESS)).ToList(),
+                s.SampleRate, false);
+            dataQueue[s].Enqueue(data);
+
+            TestDevice dev = new TestDevice("OUT-DEVICE", dataQueue);
+            dev.BindStream(s);
+            s.BitPositions[dev] = 3;
+
+            Assert.Throws<DAQException>(() => s.PullOutputData(duration));
+        }
     }
 
     [TestFixture]
@@ -212,6 +303,33 @@ namespace Heka
             Assert.That(s.SampleRate, Is.EqualTo(c.SampleRate));
             Assert.Throws<NotSupportedException>(() => s.SampleRate = srate);
         }
+
+        [Test]
+        public void MeasurementsShouldConvertCountsToVolts()
+        {
+            var c = new HekaDAQController();
+            var s = new HekaDAQInputStream("IN", StreamType.AI, 0, c);
+
+            var counts = Enumerable.Range(short.MinValue, ushort.MaxValue + 1).Select(i => (short)i).ToArray();
+
+            var expected = counts.Select(v => new Measurement(v / (decimal)ITCMM.ANALOGVOLT, "V")).ToList();
+
+            Assert.AreEqual(expected, s.Measurements(counts, counts.Length));
+        }
+
+        [Test]
+        public void MeasurementsShouldLeaveUnitlessCountsUnconverted()
+        {
+            var c = new HekaDAQController();
+            var s = new HekaDAQInputStream("IN", StreamType.DI_PORT, 0, c);
+
+            var counts = new short[] { 1, 2, 3, 4 };
+
+            var result = s.Measurements(counts, 3);
+
+            Assert.AreEqual(new[] { 1m, 2m, 3m }, result.Select(m => m.QuantityInBaseUnits).ToArray());
+            Assert.That(result.All(m => m.BaseUnits == HekaDAQInputStream.DAQCountUnits));
+        }
     }
 
     [TestFixture]
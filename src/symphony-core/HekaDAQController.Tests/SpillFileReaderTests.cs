@@ -0,0 +1,217 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+
+namespace Heka
+{
+    using Heka.NativeInterop;
+    using Moq;
+    using NUnit.Framework;
+    using Symphony.Core;
+
+    [TestFixture]
+    class SpillFileReaderTests
+    {
+        private const double SAMPLE_RATE = 10000;
+        private const long TICK_FREQUENCY = 10000000;
+        private const long TICKS_PER_SAMPLE = 1000;
+        private const long START_TICKS = 5000;
+        private const int BLOCK_SAMPLES = 100;
+        private const int BLOCKS = 3;
+
+        private static readonly DateTimeOffset StartTime = new DateTimeOffset(2014, 6, 1, 12, 0, 0, TimeSpan.Zero);
+
+        private string _directory;
+
+        [SetUp]
+        public void SetUp()
+        {
+            _directory = Path.Combine(Path.GetTempPath(), "SpillFileReaderTests-" + Guid.NewGuid());
+            Directory.CreateDirectory(_directory);
+        }
+
+        [TearDown]
+        public void TearDown()
+        {
+            Directory.Delete(_directory, true);
+        }
+
+        // Analog input 0 of the first unit and digital input port 0 of the second
+        private static short Sample(int channel, int i)
+        {
+            return (short)(channel == 0 ? i * 7 - 1000 : i % 16);
+        }
+
+        // Writes the layout of HekaIOBridge/SpillFile.h. The file has a partial block after its committed
+        // blocks, as left by a process dying mid-write.
+        private string WriteSpill(string name, bool closed)
+        {
+            var path = Path.Combine(_directory, name + SpillFileReader.Extension);
+            var channels = new[]
+                               {
+                                   new ushort[] {ITCMM.D2H, 0, 0},
+                                   new ushort[] {ITCMM.DIGITAL_INPUT, 0, 1}
+                               };
+
+            using (var w = new BinaryWriter(File.Create(path)))
+            {
+                int headerBytes = 64 + channels.Length * 8;
+
+                w.Write(Encoding.ASCII.GetBytes("SYMSPILL"));
+                w.Write((uint)1);
+                w.Write((uint)channels.Length);
+                w.Write((uint)headerBytes);
+                w.Write((uint)(closed ? 1 : 0));
+                w.Write(SAMPLE_RATE);
+                w.Write(TICK_FREQUENCY);
+                w.Write(START_TICKS);
+                w.Write(StartTime.ToFileTime());
+                long committedBytes = w.BaseStream.Position;
+                w.Write(0L);
+
+                foreach (var c in channels)
+                {
+                    w.Write(c[0]);
+                    w.Write(c[1]);
+                    w.Write(c[2]);
+                    w.Write((ushort)0);
+                }
+
+                for (int b = 0; b <= BLOCKS; b++)
+                {
+                    if (b == BLOCKS)
+                    {
+                        long end = w.BaseStream.Position;
+                        w.BaseStream.Position = committedBytes;
+                        w.Write(end);
+                        w.BaseStream.Position = end;
+                    }
+
+                    // 50 samples were waiting in the FIFO when each block was read; sample 0 was
+                    // acquired 2 ms after the file was created
+                    long first = b * BLOCK_SAMPLES;
+                    long clockSample = first + BLOCK_SAMPLES + 50;
+                    w.Write((uint)0x314B4C42);
+                    w.Write((uint)BLOCK_SAMPLES);
+                    w.Write(first);
+                    w.Write(clockSample);
+                    w.Write(START_TICKS + 20000 + clockSample * TICKS_PER_SAMPLE);
+
+                    for (int c = 0; c < channels.Length; c++)
+                    {
+                        for (int i = 0; i < (b == BLOCKS ? BLOCK_SAMPLES / 2 : BLOCK_SAMPLES); i++)
+                        {
+                            w.Write(Sample(c, (int)first + i));
+                        }
+                    }
+                }
+            }
+
+            return path;
+        }
+
+        [Test]
+        public void ShouldReadCommittedBlocks()
+        {
+            using (var reader = new SpillFileReader(WriteSpill("orphan", false)))
+            {
+                Assert.IsFalse(reader.Closed);
+                Assert.AreEqual(SAMPLE_RATE, reader.SampleRate);
+                Assert.AreEqual(StartTime, reader.StartTime);
+                Assert.AreEqual(BLOCKS * BLOCK_SAMPLES, reader.Samples);
+
+                Assert.AreEqual(2, reader.Channels.Count);
+                Assert.AreEqual(ITCMM.D2H, reader.Channels[0].ChannelType);
+                Assert.AreEqual(ITCMM.DIGITAL_INPUT, reader.Channels[1].ChannelType);
+                Assert.AreEqual(1, reader.Channels[1].DeviceIndex);
+
+                for (int c = 0; c < 2; c++)
+                {
+                    CollectionAssert.AreEqual(Enumerable.Range(0, BLOCKS * BLOCK_SAMPLES).Select(i => Sample(c, i)),
+                                              reader.ReadChannel(c));
+                }
+
+                var times = reader.BlockTimes.ToList();
+                Assert.AreEqual(BLOCKS, times.Count);
+                Assert.AreEqual(BLOCK_SAMPLES, times[1].FirstSample);
+                Assert.AreEqual(START_TICKS + 20000 + BLOCK_SAMPLES * TICKS_PER_SAMPLE, times[1].HostTicks);
+                Assert.AreEqual(StartTime + TimeSpan.FromMilliseconds(2), reader.FirstSampleTime);
+            }
+        }
+
+        [Test]
+        public void ShouldBuildRecoveredEpoch()
+        {
+            using (var reader = new SpillFileReader(WriteSpill("orphan", false)))
+            {
+                var epoch = reader.ToEpoch("protocol");
+
+                Assert.AreEqual("protocol", epoch.ProtocolID);
+                Assert.That(epoch.Keywords, Has.Member(SpillFileReader.RecoveredKeyword));
+                Assert.AreEqual(reader.FirstSampleTime, (DateTimeOffset)epoch.StartTime);
+                Assert.AreEqual(TimeSpan.FromSeconds(BLOCKS * BLOCK_SAMPLES / SAMPLE_RATE), (TimeSpan)epoch.Duration);
+
+                var responses = epoch.Responses.ToDictionary(kv => kv.Key.Name, kv => kv.Value);
+                CollectionAssert.AreEquivalent(new[] {"ai0", "dev1_diport0"}, responses.Keys);
+                Assert.IsTrue(epoch.Responses.Keys.All(d => d.Manufacturer == SpillFileReader.RecoveredManufacturer));
+
+                var volts = responses["ai0"].Data.ToList();
+                Assert.AreEqual(BLOCKS * BLOCK_SAMPLES, volts.Count);
+                Assert.AreEqual("V", volts[10].BaseUnits);
+                Assert.AreEqual(Sample(0, 10) / SampleConverter.COUNTS_PER_VOLT, (double)volts[10].QuantityInBaseUnits, 1e-9);
+
+                var port = responses["dev1_diport0"].Data.ToList();
+                Assert.AreEqual(Measurement.UNITLESS, port[10].BaseUnits);
+                Assert.AreEqual(Sample(1, 10), (double)port[10].QuantityInBaseUnits);
+            }
+        }
+
+        [Test]
+        public void ShouldFindOnlyOrphans()
+        {
+            var orphan = WriteSpill("orphan", false);
+            WriteSpill("closed", true);
+            File.WriteAllText(Path.Combine(_directory, "other" + SpillFileReader.Extension), "not a spill file");
+
+            CollectionAssert.AreEqual(new[] {orphan}, SpillFileReader.FindOrphans(_directory));
+        }
+
+        [Test]
+        public void ShouldFindFilesKeptByFailedRuns()
+        {
+            var kept = WriteSpill("kept", true);
+            WriteSpill("closed", true);
+
+            SpillFileReader.MarkKept(kept);
+
+            using (var reader = new SpillFileReader(kept))
+            {
+                Assert.IsTrue(reader.Closed);
+                Assert.IsTrue(reader.Kept);
+            }
+            CollectionAssert.AreEqual(new[] {kept}, SpillFileReader.FindOrphans(_directory));
+        }
+
+        [Test]
+        public void ShouldRecoverOrphansIntoCurrentEpochBlock()
+        {
+            var orphan = WriteSpill("orphan", false);
+            var closed = WriteSpill("closed", true);
+
+            var block = new Mock<IPersistentEpochBlock>();
+            block.Setup(b => b.ProtocolID).Returns("protocol");
+
+            var persistor = new Mock<IEpochPersistor>();
+            persistor.Setup(p => p.CurrentEpochBlock).Returns(block.Object);
+
+            Assert.AreEqual(1, SpillFileReader.RecoverOrphans(_directory, persistor.Object));
+
+            persistor.Verify(p => p.Serialize(It.Is<Epoch>(e => e.ProtocolID == "protocol" && e.Responses.Count == 2)),
+                             Times.Once());
+            Assert.IsFalse(File.Exists(orphan));
+            Assert.IsTrue(File.Exists(closed));
+        }
+    }
+}
@@ -0,0 +1,317 @@
+﻿using System;
+using System.Runtime.ExceptionServices;
+using System.Runtime.InteropServices;
+using System.Threading;
+
+namespace Heka
+{
+    /// <summary>
+    /// Dedicated thread on which a device's driver calls run one at a time, in submission order.
+    ///
+    /// Callers block until their call completes. Calls are queued on a lock-free multi-producer,
+    /// single-consumer queue and carried by command objects cached per calling thread, so
+    /// dispatch allocates nothing and does not wait on the ThreadPool. The thread runs at
+    /// elevated priority and may be pinned to one processor. A call made from the device thread
+    /// itself runs inline.
+    /// </summary>
+    sealed class DeviceThread : IDisposable
+    {
+        // Spins before blocking, on both the device thread and callers; a driver call is
+        // typically tens of microseconds
+        private const int SPIN_COUNT = 200;
+
+        private readonly Thread _thread;
+        private readonly Action _enter;
+        private readonly Action _exit;
+        private readonly int _processor;
+
+        // Intrusive MPSC queue: producers swap themselves in at _head, the device thread takes
+        // from _tail. _stub keeps the queue non-empty so that taken commands are fully detached.
+        private readonly Command _stub = new StubCommand();
+        private Command _head;
+        private Command _tail;
+
+        private readonly ManualResetEventSlim _signal = new ManualResetEventSlim(false, SPIN_COUNT);
+        private volatile bool _stopping;
+
+        // Set once the thread has exited. Commands still queued then are failed by whichever of
+        // Dispose and their caller gets to them first.
+        private int _stopped;
+        private readonly object _drainLock = new object();
+
+        /// <summary>
+        /// Starts the device thread.
+        /// </summary>
+        /// <param name="name">Thread name</param>
+        /// <param name="enter">Run on the device thread before each call, or null</param>
+        /// <param name="exit">Run on the device thread after each call, or null</param>
+        /// <param name="processor">Processor the thread is pinned to, or -1 to leave it unpinned</param>
+        public DeviceThread(string name, Action enter, Action exit, int processor)
+        {
+            if (processor >= Math.Min(Environment.ProcessorCount, 64))
+                throw new ArgumentOutOfRangeException("processor");
+
+            _enter = enter;
+            _exit = exit;
+            _processor = processor;
+            _head = _stub;
+            _tail = _stub;
+
+            _thread = new Thread(Run)
+                          {
+                              Name = name,
+                              IsBackground = true,
+                              Priority = ThreadPriority.Highest
+                          };
+            _thread.Start();
+        }
+
+        public void Call(Action fn)
+        {
+            Call(InvokeAction, fn);
+        }
+
+        public T Call<T>(Func<T> fn)
+        {
+            return Call(InvokeFunc<T>.Instance, fn);
+        }
+
+        /// <summary>
+        /// Runs fn(arg) on the device thread. With a cached fn, nothing is allocated.
+        /// </summary>
+        public T Call<TArg, T>(Func<TArg, T> fn, TArg arg)
+        {
+            if (Thread.CurrentThread == _thread)
+                return fn(arg);
+
+            if (_stopping)
+                throw new ObjectDisposedException(_thread.Name);
+
+            var command = Command<TArg, T>.Take();
+            command.Fn = fn;
+            command.Arg = arg;
+
+            Enqueue(command);
+
+            // A caller that passed the _stopping check as Dispose began may have linked its
+            // command after the thread drained the queue for the last time
+            Thread.MemoryBarrier();
+            if (Volatile.Read(ref _stopped) != 0)
+                FailQueued();
+
+            command.Done.Wait();
+
+            return command.Complete();
+        }
+
+        /// <summary>
+        /// Runs the calls already queued, then stops the thread. Calls started once Dispose is
+        /// throw ObjectDisposedException.
+        /// </summary>
+        public void Dispose()
+        {
+            if (_stopping)
+                return;
+
+            _stopping = true;
+            _signal.Set();
+            _thread.Join();
+
+            Interlocked.Exchange(ref _stopped, 1);
+            FailQueued();
+        }
+
+        // Fails the commands queued after the thread exited. The thread no longer dequeues, so
+        // the lock makes its holder the single consumer.
+        private void FailQueued()
+        {
+            lock (_drainLock)
+            {
+                Command command;
+                while ((command = Dequeue()) != null)
+                {
+                    command.Error = ExceptionDispatchInfo.Capture(new ObjectDisposedException(_thread.Name));
+                    command.Done.Set();
+                }
+            }
+        }
+
+        private void Enqueue(Command command)
+        {
+            command.Next = null;
+            var previous = Interlocked.Exchange(ref _head, command);
+            previous.Next = command;
+
+            _signal.Set();
+        }
+
+        // Only the device thread dequeues. Returns null if the queue is empty, or if a producer has
+        // swapped in at _head but not yet linked its command.
+        private Command Dequeue()
+        {
+            var tail = _tail;
+            var next = tail.Next;
+
+            if (tail == _stub)
+            {
+                if (next == null)
+                    return null;
+
+                _tail = next;
+                tail = next;
+                next = next.Next;
+            }
+
+            if (next != null)
+            {
+                _tail = next;
+                return tail;
+            }
+
+            if (tail != Volatile.Read(ref _head))
+                return null;
+
+            Enqueue(_stub);
+
+            next = tail.Next;
+            if (next != null)
+            {
+                _tail = next;
+                return tail;
+            }
+
+            return null;
+        }
+
+        private void Run()
+        {
+            if (_processor >= 0)
+            {
+                Thread.BeginThreadAffinity();
+                NativeMethods.SetThreadAffinityMask(NativeMethods.GetCurrentThread(), new UIntPtr(1UL << _processor));
+            }
+
+            while (true)
+            {
+                _signal.Reset();
+
+                Command command;
+                while ((command = Dequeue()) != null)
+                {
+                    Execute(command);
+                }
+
+                if (_stopping && Volatile.Read(ref _head) == _tail && _tail.Next == null)
+                    break;
+
+                _signal.Wait();
+            }
+
+            if (_processor >= 0)
+            {
+                Thread.EndThreadAffinity();
+            }
+        }
+
+        private void Execute(Command command)
+        {
+            try
+            {
+                if (_enter != null)
+                    _enter();
+
+                try
+                {
+                    command.Execute();
+                }
+                finally
+                {
+                    if (_exit != null)
+                        _exit();
+                }
+            }
+            catch (Exception e)
+            {
+                command.Error = ExceptionDispatchInfo.Capture(e);
+            }
+
+            command.Done.Set();
+        }
+
+
+        private static readonly Func<Action, int> InvokeAction = fn =>
+                                                                     {
+                                                                         fn();
+                                                                         return 0;
+                                                                     };
+
+        private static class InvokeFunc<T>
+        {
+            public static readonly Func<Func<T>, T> Instance = fn => fn();
+        }
+
+        private abstract class Command
+        {
+            public volatile Command Next;
+            public readonly ManualResetEventSlim Done = new ManualResetEventSlim(false, SPIN_COUNT);
+            public ExceptionDispatchInfo Error;
+
+            public abstract void Execute();
+        }
+
+        private sealed class StubCommand : Command
+        {
+            public override void Execute()
+            {
+            }
+        }
+
+        private sealed class Command<TArg, T> : Command
+        {
+            // A caller waits on its command until the call completes, so one per thread suffices
+            [ThreadStatic]
+            private static Command<TArg, T> _cached;
+
+            public Func<TArg, T> Fn;
+            public TArg Arg;
+            private T _result;
+
+            public static Command<TArg, T> Take()
+            {
+                return _cached ?? (_cached = new Command<TArg, T>());
+            }
+
+            public override void Execute()
+            {
+                _result = Fn(Arg);
+            }
+
+            // Resets the command for its next call, returning the result or rethrowing the error
+            public T Complete()
+            {
+                var result = _result;
+                var error = Error;
+
+                Fn = null;
+                Arg = default(TArg);
+                _result = default(T);
+                Error = null;
+                Done.Reset();
+
+                if (error != null)
+                    error.Throw();
+
+                return result;
+            }
+        }
+
+        private static class NativeMethods
+        {
+            [DllImport("kernel32.dll")]
+            public static extern IntPtr GetCurrentThread();
+
+            [DllImport("kernel32.dll", SetLastError = true)]
+            public static extern UIntPtr SetThreadAffinityMask(IntPtr hThread, UIntPtr dwThreadAffinityMask);
+        }
+    }
+}
@@ -1,7 +1,9 @@
 ﻿using System;
 using System.Collections.Concurrent;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.Diagnostics.Contracts;
+using System.IO;
 using System.Linq;
 using System.Threading;
 using System.Threading.Tasks;
@@ -28,12 +30,14 @@ namespace Heka
 
     /// <summary>
     /// Heka/Instrutech-specific details of a DAQ stream. Gives the
-    /// channel type and number and the ITCChannelInfo for this stream.
+    /// channel type and number, the index of the ITC unit it belongs to,
+    /// and the ITCChannelInfo for this stream.
     /// </summary>
     public interface HekaDAQStream : IDAQStream
     {
         StreamType ChannelType { get; }
         ushort ChannelNumber { get; }
+        ushort DeviceIndex { get; }
         ITCMM.ITCChannelInfo ChannelInfo { get; }
     }
 
@@ -63,6 +67,121 @@ namespace Heka
                                                                         int nsamples,
                                                                         CancellationToken token);
 
+        /// <summary>
+        /// Zero-copy ReadWrite. Output and input buffers are handed directly to the ITC driver; each input
+        /// buffer must hold at least nsamples samples and is filled in place.
+        /// </summary>
+        /// <returns>Number of samples read into each input buffer</returns>
+        int ReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                      IDictionary<ChannelIdentifier, short[]> input,
+                      int nsamples,
+                      CancellationToken token);
+
+        /// <summary>
+        /// Zero-copy ReadWrite of a whole process loop block in one call. Each output buffer holds
+        /// deficitSamples followed by nsamples samples; the deficit part is written to the FIFO at once
+        /// and the rest transferred while nsamples of input are read.
+        /// </summary>
+        /// <returns>Number of samples read into each input buffer</returns>
+        int ReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                      int deficitSamples,
+                      IDictionary<ChannelIdentifier, short[]> input,
+                      int nsamples,
+                      CancellationToken token);
+
+        /// <summary>
+        /// Starts servicing the hardware FIFOs of the given streams continuously from a native thread.
+        /// The hardware must be running. While streaming, use StreamReadWrite instead of ReadWrite/Write.
+        /// </summary>
+        void StartStreaming(IEnumerable<HekaDAQStream> streams);
+        void StopStreaming();
+
+        /// <summary>
+        /// File to which StartStreaming also spills the streamed input, or null (see IOBridge.SpillPath).
+        /// Set only while not streaming. SpillFailed is true if spilling failed during the last run.
+        /// </summary>
+        string SpillPath { get; set; }
+        bool SpillFailed { get; }
+
+        /// <summary>
+        /// Queues output on, and collects nsamples of input from, the native streaming thread.
+        /// </summary>
+        /// <returns>Number of samples read into each input buffer</returns>
+        int StreamReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                            IDictionary<ChannelIdentifier, short[]> input,
+                            int nsamples,
+                            CancellationToken token);
+
+        /// <summary>
+        /// Wait strategy used while the hardware FIFO is short of a transfer block.
+        /// </summary>
+        PollingMode Polling { get; set; }
+
+        /// <summary>
+        /// Samples moved per driver FIFO transfer; zero selects auto-tuning.
+        /// </summary>
+        uint TransferBlockSamples { get; set; }
+
+        /// <summary>
+        /// Block size used by the most recent transfer (the tuned size when auto-tuning).
+        /// </summary>
+        uint ActiveTransferBlockSamples { get; }
+
+        /// <summary>
+        /// Time spent waiting on, and servicing, the hardware FIFO since the last ResetPollingStatistics.
+        /// </summary>
+        TimeSpan PollWaitTime { get; }
+        TimeSpan TransferTime { get; }
+        void ResetPollingStatistics();
+
+        /// <summary>
+        /// Driver call durations, FIFO levels and samples moved by the transfer loop since the last
+        /// ResetPollingStatistics.
+        /// </summary>
+        TransferStatistics TransferStatistics { get; }
+
+        /// <summary>
+        /// If true, recent FIFO passes are kept for DumpTransferTrace. Set only while not streaming.
+        /// </summary>
+        bool TraceTransfers { get; set; }
+        TransferTraceEntry[] DumpTransferTrace();
+
+        /// <summary>
+        /// Sets the output margins (samples per channel queued ahead of the hardware) below which the
+        /// transfer loop counts a low-margin event and, while streaming, ends the output cleanly with
+        /// the stream backgrounds. Zero disables either check. Set only while not streaming.
+        /// </summary>
+        void ConfigureFifoWatchdog(uint lowSamples, uint stopSamples);
+
+        /// <summary>
+        /// Output margins seen by the FIFO watchdog since the last ResetPollingStatistics.
+        /// </summary>
+        FifoMarginStatus FifoMargin { get; }
+
+        /// <summary>
+        /// Transfer passes between hardware run-state checks.
+        /// </summary>
+        uint StatusCheckInterval { get; set; }
+
+        /// <summary>
+        /// Number of ITCMM calls of each kind made by the transfer loop since the last ResetDriverCalls.
+        /// </summary>
+        DriverCallCounts DriverCalls { get; }
+        void ResetDriverCalls();
+
+        /// <summary>
+        /// Sample index and estimated host acquisition time (Stopwatch ticks) of the first sample of the
+        /// input block most recently returned by ReadWrite or StreamReadWrite, from the hardware sample
+        /// counter observed on every FIFO transfer. Sample indexes count from StartHardware.
+        /// </summary>
+        InputBlockTime LastInputBlock { get; }
+
+        /// <summary>
+        /// Drift of the hardware sample clock from the nominal sampling rate, in parts per million of the
+        /// host clock, estimated continuously since StartHardware.
+        /// </summary>
+        double SampleClockDriftPpm { get; }
+
         void SetStreamBackgroundAsyncIO(HekaDAQOutputStream stream);
 
         //Now gets the current time from the ITC clock
@@ -79,12 +198,49 @@ namespace Heka
         ITCMM.GlobalDeviceInfo DeviceInfo { get; }
         ITCMM.ITCChannelInfo ChannelInfo(StreamType channelType, ushort channelNumber);
 
+        /// <summary>
+        /// Hardware FIFO depth of the given channel, in samples.
+        /// </summary>
+        int MaxAvailableSamples(StreamType channelType, ushort channelNumber);
+
+        /// <summary>
+        /// Hardware FIFO depth of the given stream's channel on the stream's unit, in samples.
+        /// </summary>
+        int MaxAvailableSamples(HekaDAQStream stream);
+
         IInputData ReadStreamAsyncIO(HekaDAQInputStream instream);
         void Preload(IDictionary<ChannelIdentifier, short[]> output);
+
+        /// <summary>
+        /// Preloads the first nsamples of each output buffer in a single driver call. Buffers may be
+        /// longer than nsamples.
+        /// </summary>
+        void Preload(IDictionary<ChannelIdentifier, short[]> output, int nsamples);
         void Write(IDictionary<ChannelIdentifier, short[]> output);
     }
 
 
+    /// <summary>
+    /// Describes a fall of the hardware output margin below HekaDAQController.FifoLowWatermark.
+    /// </summary>
+    public class FifoMarginEventArgs : TimeStampedEventArgs
+    {
+        public FifoMarginEventArgs(IClock clock, FifoMarginStatus margin, TimeSpan minMargin)
+            : base(clock)
+        {
+            Margin = margin;
+            MinMargin = minMargin;
+        }
+
+        public FifoMarginStatus Margin { get; private set; }
+
+        /// <summary>
+        /// Smallest margin seen, as output time left before the hardware would underrun.
+        /// </summary>
+        public TimeSpan MinMargin { get; private set; }
+    }
+
+
     /// <summary>
     /// DAQController for the Heka/Instrutech DAQ interface. We currently support only
     /// the PCI/USB-18, but the system uses the "new style" ITC driver, so support for
@@ -105,9 +261,35 @@ namespace Heka
 
         private IHekaDevice Device { get; set; }
 
+        // Per-channel input buffers reused across ProcessLoopIteration calls; reallocated only when the iteration length changes.
+        private readonly IDictionary<ChannelIdentifier, short[]> _inputBuffers = new Dictionary<ChannelIdentifier, short[]>();
+
+        // Per-channel output buffers reused across ProcessLoopIteration calls, as for _inputBuffers.
+        private readonly IDictionary<ChannelIdentifier, short[]> _outputBuffers = new Dictionary<ChannelIdentifier, short[]>();
+
+        // Per-channel preload buffers reused across epochs; reallocated only when the preload grows.
+        private readonly IDictionary<ChannelIdentifier, short[]> _preloadBuffers = new Dictionary<ChannelIdentifier, short[]>();
+
+        // Clock time and host performance counter read together at hardware start; input block
+        // timestamps are Stopwatch ticks mapped through this pair into the controller's Clock.
+        private DateTimeOffset _clockEpoch;
+        private long _ticksEpoch;
+
         private const string SAMPLE_RATE_KEY = "sampleRate";
         private const string DEVICE_TYPE_KEY = "deviceType";
         private const string DEVICE_NUMBER_KEY = "deviceNumber";
+        private const string DEVICE_NUMBERS_KEY = "deviceNumbers";
+        private const string NATIVE_STREAMING_KEY = "nativeStreaming";
+        private const string TRANSFER_BLOCK_SAMPLES_KEY = "transferBlockSamples";
+        private const string PRELOAD_FULL_FIFO_KEY = "preloadFullFifo";
+
+        private PollingMode _polling = PollingMode.Hybrid;
+        private bool _traceTransfers;
+        private TimeSpan _fifoLowWatermark = TimeSpan.Zero;
+        private TimeSpan _fifoStopWatermark = TimeSpan.Zero;
+        private long _lowMarginEvents;
+        private string _spillDirectory;
+        private string _spillPath;
 
         /// <summary>
         /// Common sampling rate for all analog and digital streams
@@ -167,7 +349,7 @@ namespace Heka
         }
 
         /// <summary>
-        /// ITC device number
+        /// ITC device number (of the primary unit, for a multi-unit controller)
         /// </summary>
         public uint DeviceNumber
         {
@@ -178,6 +360,198 @@ namespace Heka
             private set { Configuration[DEVICE_NUMBER_KEY] = value; }
         }
 
+        /// <summary>
+        /// ITC device numbers of all units acquired by this controller, primary first.
+        /// </summary>
+        public IList<uint> DeviceNumbers
+        {
+            get
+            {
+                return Configuration.ContainsKey(DEVICE_NUMBERS_KEY)
+                           ? (uint[])Configuration[DEVICE_NUMBERS_KEY]
+                           : new[] { DeviceNumber };
+            }
+            private set { Configuration[DEVICE_NUMBERS_KEY] = value.ToArray(); }
+        }
+
+        /// <summary>
+        /// If true, the hardware FIFOs are serviced continuously by a native thread in the IOBridge
+        /// and each process loop iteration only exchanges data with that thread. Defaults to false.
+        /// A controller acquiring from several units always streams natively.
+        /// </summary>
+        public bool NativeStreaming
+        {
+            get
+            {
+                return DeviceNumbers.Count > 1 ||
+                    Configuration.ContainsKey(NATIVE_STREAMING_KEY) && (bool)Configuration[NATIVE_STREAMING_KEY];
+            }
+            set { Configuration[NATIVE_STREAMING_KEY] = value; }
+        }
+
+        /// <summary>
+        /// If true, output streams are preloaded with as many process intervals of data as fit in the
+        /// hardware output FIFO, less one interval of headroom, rather than two process intervals. This
+        /// lowers the risk of underrun at the cost of pulling more data before the hardware starts.
+        /// Defaults to false.
+        /// </summary>
+        public bool PreloadFullFifo
+        {
+            get
+            {
+                return Configuration.ContainsKey(PRELOAD_FULL_FIFO_KEY) && (bool)Configuration[PRELOAD_FULL_FIFO_KEY];
+            }
+            set { Configuration[PRELOAD_FULL_FIFO_KEY] = value; }
+        }
+
+        /// <summary>
+        /// How the controller waits while the hardware FIFO is short of a transfer block: Spin re-polls
+        /// immediately, Sleep waits out the expected time using a high-resolution timer, and Hybrid (the
+        /// default) timer-waits most of that time before re-polling.
+        /// </summary>
+        public PollingMode Polling
+        {
+            get { return _polling; }
+            set
+            {
+                _polling = value;
+                if (Device != null)
+                    Device.Polling = value;
+            }
+        }
+
+        /// <summary>
+        /// Number of samples moved per driver FIFO transfer. Zero auto-tunes the block size from
+        /// the sampling rate, channel count and measured driver call cost. Either way the block is
+        /// capped to a fraction of the hardware FIFO depth. Defaults to IOBridge.TRANSFER_BLOCK_SAMPLES.
+        /// </summary>
+        public uint TransferBlockSamples
+        {
+            get
+            {
+                return Configuration.ContainsKey(TRANSFER_BLOCK_SAMPLES_KEY)
+                           ? (uint)Configuration[TRANSFER_BLOCK_SAMPLES_KEY]
+                           : IOBridge.TRANSFER_BLOCK_SAMPLES;
+            }
+            set { Configuration[TRANSFER_BLOCK_SAMPLES_KEY] = value; }
+        }
+
+        /// <summary>
+        /// If true, the most recent FIFO passes of the transfer loop are traced, without allocation, and
+        /// kept in LastFailureTrace if the controller stops with an exception. Defaults to false.
+        /// </summary>
+        public bool TraceTransfers
+        {
+            get { return _traceTransfers; }
+            set
+            {
+                if (IsRunning)
+                    throw new HekaDAQException("Cannot change transfer tracing while running");
+
+                _traceTransfers = value;
+            }
+        }
+
+        /// <summary>
+        /// Output time left queued ahead of the hardware (in its output FIFO, and when streaming natively,
+        /// in the streaming queues) below which FifoMarginLow is raised, once per fall, from the process
+        /// loop. Zero (the default) disables the warning.
+        /// </summary>
+        public TimeSpan FifoLowWatermark
+        {
+            get { return _fifoLowWatermark; }
+            set
+            {
+                if (IsRunning)
+                    throw new HekaDAQException("Cannot change the FIFO watermarks while running");
+
+                _fifoLowWatermark = value;
+            }
+        }
+
+        /// <summary>
+        /// With NativeStreaming, if the output margin falls below this and no further output has been
+        /// queued, the streaming thread pads each output with one transfer block of its Background,
+        /// marks it as the last FIFO data and reads the remaining input, so the controller stops
+        /// cleanly instead of failing on a hardware underrun. Zero (the default) disables this.
+        /// </summary>
+        public TimeSpan FifoStopWatermark
+        {
+            get { return _fifoStopWatermark; }
+            set
+            {
+                if (IsRunning)
+                    throw new HekaDAQException("Cannot change the FIFO watermarks while running");
+
+                _fifoStopWatermark = value;
+            }
+        }
+
+        /// <summary>
+        /// With NativeStreaming, if set, each run's input is also spilled, as it is read from the hardware,
+        /// to a memory-mapped file in this directory so that it survives the process dying mid-epoch. The
+        /// file of a run that stops normally is deleted; a run that stops on an exception keeps its file,
+        /// marked for recovery. Kept files and files left by a process that died can be converted to epochs
+        /// with SpillFileReader.RecoverOrphans.
+        /// Defaults to null (no spill file).
+        /// </summary>
+        public string SpillDirectory
+        {
+            get { return _spillDirectory; }
+            set
+            {
+                if (IsRunning)
+                    throw new HekaDAQException("Cannot change the spill directory while running");
+
+                _spillDirectory = value;
+            }
+        }
+
+        /// <summary>
+        /// Raised from the process loop when the hardware output margin has fallen below FifoLowWatermark
+        /// since the previous iteration.
+        /// </summary>
+        public event EventHandler<FifoMarginEventArgs> FifoMarginLow;
+
+        /// <summary>
+        /// Output margins seen since the controller was last started.
+        /// </summary>
+        public FifoMarginStatus FifoMargin
+        {
+            get { return Device.FifoMargin; }
+        }
+
+        /// <summary>
+        /// Transfer loop timing and FIFO levels since the controller was last started.
+        /// </summary>
+        public TransferStatistics TransferStatistics
+        {
+            get { return Device.TransferStatistics; }
+        }
+
+        /// <summary>
+        /// Traced FIFO passes (oldest first) leading up to the last exceptional stop, or empty if
+        /// TraceTransfers was off.
+        /// </summary>
+        public IList<TransferTraceEntry> LastFailureTrace { get; private set; }
+
+        /// <summary>
+        /// Number of ITCMM calls of each kind made by the transfer loop since the controller was last started.
+        /// </summary>
+        public DriverCallCounts DriverCalls
+        {
+            get { return Device.DriverCalls; }
+        }
+
+        /// <summary>
+        /// Drift of the hardware sample clock from SampleRate, in parts per million of the host clock,
+        /// estimated since the controller was last started. Positive when the hardware runs slow.
+        /// </summary>
+        public double SampleClockDriftPpm
+        {
+            get { return Device.SampleClockDriftPpm; }
+        }
+
         /// <summary>
         /// Indicates if the ITC hardware is running
         /// </summary>
@@ -222,14 +596,60 @@ namespace Heka
         /// <param name="deviceNumber"></param>
         /// <param name="clock"></param>
         public HekaDAQController(uint deviceType, uint deviceNumber, IClock clock)
+            : this(deviceType, new[] { deviceNumber }, clock)
+        {
+        }
+
+        /// <summary>
+        /// Constructs a new HekaDAQController acquiring synchronously from several ITC units of the
+        /// given type, using the given clock. The first unit is the primary; the others must take their
+        /// start trigger from it. Streams of the secondary units are named with a "devN_" prefix, where
+        /// N is the unit's index in deviceNumbers.
+        /// </summary>
+        /// <param name="deviceType">Heka device type (e.g. ITCMM.ITC18_ID)</param>
+        /// <param name="deviceNumbers">Device numbers (0-indexed), primary first</param>
+        /// <param name="clock"></param>
+        public HekaDAQController(uint deviceType, IList<uint> deviceNumbers, IClock clock)
         {
+            if (deviceNumbers == null || deviceNumbers.Count == 0)
+                throw new ArgumentException("At least one device number is required", "deviceNumbers");
+
             this.DeviceType = deviceType;
-            this.DeviceNumber = deviceNumber;
+            this.DeviceNumber = deviceNumbers[0];
+            if (deviceNumbers.Count > 1)
+                this.DeviceNumbers = deviceNumbers;
             this.IsHardwareReady = false;
             this.ProcessInterval = TimeSpan.FromSeconds(DEFAULT_TRANSFER_BLOCK_SECONDS);
             this.Clock = clock;
+            this.LastFailureTrace = new TransferTraceEntry[0];
         }
 
+        /// <summary>
+        /// Constructs a HekaDAQController over simulated ITC-18 units rather than hardware, for load
+        /// testing the acquisition pipeline. Data moves through the IOBridge exactly as for hardware;
+        /// only the bridge's driver calls go to the simulation.
+        /// </summary>
+        /// <param name="simulation">Simulated units and their timing</param>
+        /// <param name="clock"></param>
+        public HekaDAQController(HekaSimulationOptions simulation, IClock clock)
+            : this(ITCMM.ITC18_ID, SimulatedDeviceNumbers(simulation), clock)
+        {
+            this.Simulation = simulation;
+        }
+
+        private static IList<uint> SimulatedDeviceNumbers(HekaSimulationOptions simulation)
+        {
+            if (simulation == null)
+                throw new ArgumentNullException("simulation");
+
+            return Enumerable.Range(0, simulation.DeviceCount).Select(i => (uint)i).ToList();
+        }
+
+        /// <summary>
+        /// Simulation this controller runs against, or null for hardware.
+        /// </summary>
+        public HekaSimulationOptions Simulation { get; private set; }
+
         /// <summary>
         /// Initializes the Heka/Instructech hardware.
         /// </summary>
@@ -277,51 +697,75 @@ namespace Heka
         {
             if (!this.IsHardwareReady)
             {
-                var deviceInfo = OpenDevice();
+                var deviceInfos = OpenDevice();
                 
                 if (!DAQStreams.Any())
                 {
-                    //set-up ADC channels
-                    for (ushort i = 0; i < deviceInfo.NumberOfADCs; i++)
+                    for (ushort d = 0; d < deviceInfos.Length; d++)
                     {
-                        string name = String.Format("{0}{1}", "ai", i);
-                        this.DAQStreams.Add(new HekaDAQInputStream(name, StreamType.AI, i, this));
+                        AddStreams(deviceInfos[d], d);
                     }
+                }
 
+                this.IsHardwareReady = true;
+            }
+        }
 
-                    for (ushort i = 0; i < deviceInfo.NumberOfDACs; i++)
-                    {
-                        string name = String.Format("{0}{1}", "ao", i);
-                        this.DAQStreams.Add(new HekaDAQOutputStream(name, StreamType.AO, i, this));
-                    }
+        private void AddStreams(ITCMM.GlobalDeviceInfo deviceInfo, ushort deviceIndex)
+        {
+            string prefix = deviceIndex > 0 ? String.Format("dev{0}_", deviceIndex) : "";
 
-                    for (ushort i = 0; i < deviceInfo.NumberOfDIs; i++)
-                    {
-                        string name = String.Format("{0}{1}", "diport", i);
-                        this.DAQStreams.Add(new HekaDigitalDAQInputStream(name, i, this));
-                    }
+            //set-up ADC channels
+            for (ushort i = 0; i < deviceInfo.NumberOfADCs; i++)
+            {
+                string name = String.Format("{0}{1}{2}", prefix, "ai", i);
+                this.DAQStreams.Add(new HekaDAQInputStream(name, StreamType.AI, i, deviceIndex, this));
+            }
 
-                    for (ushort i = 0; i < deviceInfo.NumberOfDOs; i++)
-                    {
-                        string name = String.Format("{0}{1}", "doport", i);
-                        this.DAQStreams.Add(new HekaDigitalDAQOutputStream(name, i, this));
-                    }
-                }
 
-                this.IsHardwareReady = true;
+            for (ushort i = 0; i < deviceInfo.NumberOfDACs; i++)
+            {
+                string name = String.Format("{0}{1}{2}", prefix, "ao", i);
+                this.DAQStreams.Add(new HekaDAQOutputStream(name, StreamType.AO, i, deviceIndex, this));
+            }
+
+            for (ushort i = 0; i < deviceInfo.NumberOfDIs; i++)
+            {
+                string name = String.Format("{0}{1}{2}", prefix, "diport", i);
+                this.DAQStreams.Add(new HekaDigitalDAQInputStream(name, i, deviceIndex, this));
+            }
+
+            for (ushort i = 0; i < deviceInfo.NumberOfDOs; i++)
+            {
+                string name = String.Format("{0}{1}{2}", prefix, "doport", i);
+                this.DAQStreams.Add(new HekaDigitalDAQOutputStream(name, i, deviceIndex, this));
             }
         }
 
-        private ITCMM.GlobalDeviceInfo OpenDevice()
+        private ITCMM.GlobalDeviceInfo[] OpenDevice()
         {
-            ITCMM.GlobalDeviceInfo deviceInfo;
-            this.Device = QueuedHekaHardwareDevice.OpenDevice(DeviceType, DeviceNumber, out deviceInfo);
+            ITCMM.GlobalDeviceInfo[] deviceInfos;
+            if (Simulation != null)
+            {
+                this.Device = SimulatedHekaDevice.Open(Simulation, out deviceInfos);
+            }
+            else if (DeviceNumbers.Count > 1)
+            {
+                this.Device = QueuedHekaHardwareDevice.OpenDevices(DeviceType, DeviceNumbers, out deviceInfos);
+            }
+            else
+            {
+                ITCMM.GlobalDeviceInfo deviceInfo;
+                this.Device = QueuedHekaHardwareDevice.OpenDevice(DeviceType, DeviceNumber, out deviceInfo);
+                deviceInfos = new[] { deviceInfo };
+            }
             IsHardwareReady = true;
-            return deviceInfo;
+            return deviceInfos;
         }
 
         /// <summary>
-        /// Closes the ITC driver connection to this controller's Heka device.
+        /// Closes the ITC driver connection to this controller's Heka device. Hardware units are kept
+        /// open and initialized by HekaDeviceDiscovery while HekaDeviceDiscovery.KeepUnitsWarm is set.
         /// </summary>
         public void CloseHardware()
         {
@@ -343,45 +787,103 @@ namespace Heka
         {
             Stop();
             CloseHardware();
+
+            // Open the units afresh rather than taking back the ones that just failed
+            if (Simulation == null)
+                HekaDeviceDiscovery.CloseWarmUnits(DeviceType, DeviceNumbers);
+
             OpenDevice();
             SetStreamsBackground();
         }
 
         protected override void StartHardware(bool waitForTrigger)
         {
+            _clockEpoch = Clock.Now;
+            _ticksEpoch = Stopwatch.GetTimestamp();
+
             Device.StartHardware(waitForTrigger);
+
+            if (NativeStreaming)
+            {
+                _spillPath = SpillDirectory == null
+                                 ? null
+                                 : Path.Combine(SpillDirectory,
+                                                DateTime.UtcNow.ToString("yyyyMMdd'T'HHmmssfff") + SpillFileReader.Extension);
+                Device.SpillPath = _spillPath;
+                Device.StartStreaming(ActiveStreams.Cast<HekaDAQStream>());
+            }
         }
 
 
         private void PreloadStreams()
         {
+            var streams = ActiveOutputStreams.Cast<HekaDAQOutputStream>().ToList();
+            int pulls = PreloadIntervals(streams);
 
             IDictionary<ChannelIdentifier, short[]> output = new Dictionary<ChannelIdentifier, short[]>();
+            int nsamples = -1;
 
-            foreach (var s in ActiveOutputStreams.Cast<HekaDAQOutputStream>())
+            foreach (var s in streams)
             {
                 s.Reset();
-                var outputSamples = new List<short>();
-                while (TimeSpanExtensions.FromSamples((uint)outputSamples.Count(), s.SampleRate).Ticks < ProcessInterval.Ticks * 2) // && s.HasMoreData
+
+                var channel = ChannelIdentifierFor(s);
+                var buffer = PreloadBuffer(channel, pulls * (int)ProcessInterval.Samples(s.SampleRate));
+
+                // Counts are written straight into the reused buffer, one process interval at a time
+                int filled = 0;
+                for (int i = 0; i < pulls; i++)
                 {
-                    var nextOutputDataForStream = NextOutputDataForStream(s);
-                    var nextSamples = nextOutputDataForStream.DataWithUnits(HekaDAQOutputStream.DAQCountUnits).Data.
-                        Select(
-                            (m) => (short)m.QuantityInBaseUnits);
+                    var next = NextOutputDataForStream(s);
 
-                    outputSamples = outputSamples.Concat(nextSamples).ToList();
+                    if (filled + next.Data.Count > buffer.Length)
+                    {
+                        Array.Resize(ref buffer, filled + next.Data.Count);
+                        _preloadBuffers[channel] = buffer;
+                    }
 
+                    filled += HekaDAQOutputStream.ToCounts(next, buffer, filled);
                 }
 
-                if (!outputSamples.Any())
+                if (filled == 0)
                     throw new HekaDAQException("Unable to pull data to preload stream " + s.Name);
 
+                if (nsamples >= 0 && filled != nsamples)
+                    throw new HekaDAQException("Preload sample buffers must be homogenous in length");
 
-                output[new ChannelIdentifier { ChannelNumber = s.ChannelNumber, ChannelType = (ushort)s.ChannelType }] =
-                    outputSamples.ToArray();
+                nsamples = filled;
+                output[channel] = buffer;
             }
 
-            Device.Preload(output);
+            Device.Preload(output, Math.Max(nsamples, 0));
+        }
+
+        private int PreloadIntervals(IEnumerable<HekaDAQOutputStream> streams)
+        {
+            const int defaultIntervals = 2;
+
+            if (!PreloadFullFifo)
+                return defaultIntervals;
+
+            var fifoIntervals = streams
+                .Select(s => Device.MaxAvailableSamples(s) / (int)ProcessInterval.Samples(s.SampleRate))
+                .DefaultIfEmpty(0)
+                .Min();
+
+            // Leave one interval free for the first iteration's deficit write
+            return Math.Max(defaultIntervals, fifoIntervals - 1);
+        }
+
+        private short[] PreloadBuffer(ChannelIdentifier channel, int nsamples)
+        {
+            short[] buffer;
+            if (!_preloadBuffers.TryGetValue(channel, out buffer) || buffer.Length < nsamples)
+            {
+                buffer = new short[nsamples];
+                _preloadBuffers[channel] = buffer;
+            }
+
+            return buffer;
         }
 
         public override void Start(bool waitForTrigger)
@@ -390,11 +892,23 @@ namespace Heka
                 OpenDevice();
 
             Device.ConfigureChannels(this.ActiveStreams.Cast<HekaDAQStream>());
+            Device.Polling = Polling;
+            Device.TraceTransfers = TraceTransfers;
+            Device.TransferBlockSamples = TransferBlockSamples;
+            Device.ConfigureFifoWatchdog(WatermarkSamples(FifoLowWatermark), WatermarkSamples(FifoStopWatermark));
+            Device.ResetPollingStatistics();
+            _lowMarginEvents = 0;
+            Device.ResetDriverCalls();
             PreloadStreams();
 
             base.Start(waitForTrigger);
         }
 
+        private uint WatermarkSamples(TimeSpan watermark)
+        {
+            return watermark > TimeSpan.Zero ? (uint)watermark.Samples(SampleRate) : 0;
+        }
+
         protected override bool ShouldStop()
         {
             return IsStopRequested;
@@ -404,7 +918,25 @@ namespace Heka
         {
             if (IsRunning)
             {
+                Device.StopStreaming();
                 Device.StopHardware();
+
+                log.DebugFormat("FIFO polling ({0}, {1} sample blocks): {2} waiting, {3} transferring",
+                                Device.Polling, Device.ActiveTransferBlockSamples, Device.PollWaitTime, Device.TransferTime);
+                log.DebugFormat("ITCMM calls: {0} GetState, {1} UpdateNow, {2} GetDataAvailable, {3} ReadWriteFIFO",
+                                Device.DriverCalls.GetState, Device.DriverCalls.UpdateNow,
+                                Device.DriverCalls.GetDataAvailable, Device.DriverCalls.ReadWriteFIFO);
+                log.DebugFormat("Sample clock drift: {0:F1} ppm", Device.SampleClockDriftPpm);
+                LogTransferStatistics(false);
+            }
+
+            if (_spillPath != null)
+            {
+                if (Device.SpillFailed)
+                    log.WarnFormat("Spilling input to {0} failed during the run", _spillPath);
+
+                File.Delete(_spillPath);
+                _spillPath = null;
             }
 
             base.CommonStop();
@@ -413,8 +945,39 @@ namespace Heka
         protected override void StopWithException(Exception e)
         {
             log.ErrorFormat("Hardware reset required due to exception: {0}", e);
+
+            // Stopping closes the spill file; it is marked kept once closed
+            string keptSpill = _spillPath;
+            _spillPath = null;
+
+            // Resetting the hardware replaces the device, so collect its diagnostics first
+            if (IsHardwareReady)
+            {
+                LogTransferStatistics(true);
+                LastFailureTrace = Device.DumpTransferTrace();
+                foreach (var pass in LastFailureTrace)
+                {
+                    log.DebugFormat("FIFO pass at {0}: poll {1}, FIFO call {2}, output space {3}, input fill {4}, moved {5} out/{6} in",
+                                    pass.StartTicks, pass.PollTime, pass.FifoCallTime, pass.OutputFifoSpace,
+                                    pass.InputFifoFill, pass.OutputSamples, pass.InputSamples);
+                }
+            }
+
             ResetHardware();
 
+            if (keptSpill != null)
+            {
+                try
+                {
+                    SpillFileReader.MarkKept(keptSpill);
+                    log.InfoFormat("Input of the failed run is kept in spill file {0}", keptSpill);
+                }
+                catch (Exception x)
+                {
+                    log.WarnFormat("Unable to keep spill file {0} of the failed run: {1}", keptSpill, x.Message);
+                }
+            }
+
             base.StopWithException(e);
 
         }
@@ -422,56 +985,67 @@ namespace Heka
         private static readonly ILog log = LogManager.GetLogger(typeof(HekaDAQController));
         private bool _disposed = false;
 
-        protected override IDictionary<IDAQInputStream, IInputData> ProcessLoopIteration(IDictionary<IDAQOutputStream, IOutputData> outData, TimeSpan deficit, CancellationToken token)
+        private void LogTransferStatistics(bool failed)
         {
-            IDictionary<ChannelIdentifier, short[]> output = new Dictionary<ChannelIdentifier, short[]>();
-            IDictionary<ChannelIdentifier, short[]> deficitOutput = new Dictionary<ChannelIdentifier, short[]>();
-
-            foreach (var s in ActiveOutputStreams.Cast<HekaDAQOutputStream>())
-            {
-                var outputData = outData[s];
-
-                var cons = outputData.DataWithUnits(HekaDAQOutputStream.DAQCountUnits).SplitData(deficit);
-
-                short[] deficitOutputSamples = cons.Head.Data.Select((m) => (short)m.QuantityInBaseUnits).ToArray();
-                deficitOutput[new ChannelIdentifier { ChannelNumber = s.ChannelNumber, ChannelType = (ushort)s.ChannelType }] =
-                    deficitOutputSamples;
-
-                short[] outputSamples = cons.Rest.Data.Select((m) => (short)m.QuantityInBaseUnits).ToArray();
-                output[new ChannelIdentifier { ChannelNumber = s.ChannelNumber, ChannelType = (ushort)s.ChannelType }] =
-                    outputSamples;
-            }
+            var transfers = Device.TransferStatistics;
+            var loop = LoopStatistics;
+
+            string message = string.Format(
+                "Transfer loop: {0} passes, max poll {1}, max FIFO call {2}, max pass interval {3}, " +
+                "min output FIFO fill {4} ({5} to underrun), max input FIFO fill {6}. " +
+                "Process loop: {7} iterations, mean {8}, max {9}, max jitter {10}, max deficit {11}",
+                transfers.Passes, transfers.MaxPollTime, transfers.MaxFifoCallTime, transfers.MaxPassInterval,
+                transfers.MinOutputFifoFill, transfers.MinTimeToUnderrun, transfers.MaxInputFifoFill,
+                loop.Iterations, loop.MeanIterationTime, loop.MaxIterationTime, loop.MaxPeriodJitter, loop.MaxDeficit);
+
+            if (failed)
+                log.Error(message);
+            else
+                log.Debug(message);
+        }
 
-            if(deficitOutput.Any())
-            {
-                Device.Write(deficitOutput);
-            }
+        protected override IDictionary<IDAQInputStream, IInputData> ProcessLoopIteration(IDictionary<IDAQOutputStream, IOutputData> outData, TimeSpan deficit, CancellationToken token)
+        {
+            var outputStreams = ActiveOutputStreams.Cast<HekaDAQOutputStream>().ToList();
+            IDictionary<ChannelIdentifier, short[]> output = OutputBuffers(outputStreams, outData);
 
             var inputChannels =
                 ActiveInputStreams.
                 Cast<HekaDAQInputStream>().
-                Select((s) => new ChannelIdentifier { ChannelNumber = s.ChannelNumber, ChannelType = (ushort)s.ChannelType }).
+                Select(ChannelIdentifierFor).
                 ToList();
 
+            // Each output block is converted whole; the deficit (the part of the block the process loop
+            // has fallen behind on) is written at once by the same driver call that streams the rest.
+            int deficitSamples = 0;
             int nsamples;
             if (output.Values.Any())
             {
-                if(output.Values.Select(a => a.Length).Distinct().Count() > 1)
-                    throw new HekaDAQException("Output buffers are not equal length.");
-
-                nsamples = output.Values.Select((a) => a.Length).Distinct().First(); 
+                int blockSamples = output.Values.First().Length;
+                deficitSamples = DeficitSamples(deficit, outputStreams.First().SampleRate, blockSamples);
+                nsamples = blockSamples - deficitSamples;
             }
             else
             {
                 nsamples = (int)ProcessInterval.Samples(SampleRate);
             }
 
-            IEnumerable<KeyValuePair<ChannelIdentifier, short[]>> input = Device.ReadWrite(output, inputChannels, nsamples, token);
+            IDictionary<ChannelIdentifier, short[]> input = InputBuffers(inputChannels, nsamples);
+
+            // The streaming thread queues the whole block, so only the input count reflects the deficit
+            int nread = NativeStreaming
+                            ? Device.StreamReadWrite(output, input, nsamples, token)
+                            : Device.ReadWrite(output, deficitSamples, input, nsamples, token);
+
+            CheckFifoMargin();
+
+            // Every stream's block starts on the same hardware sample
+            DateTimeOffset inputTime = InputBlockStartTime(Device.LastInputBlock);
 
             var result = new ConcurrentDictionary<IDAQInputStream, IInputData>();
             Parallel.ForEach(input, (kvp) =>
                                         {
-                                            var s = StreamWithIdentifier(kvp.Key) as IDAQInputStream;
+                                            var s = StreamWithIdentifier(kvp.Key) as HekaDAQInputStream;
                                             if (s == null)
                                             {
                                                 throw new DAQException(
@@ -481,10 +1055,9 @@ namespace Heka
                                             //Create the raw input data
 
                                             IInputData rawData = new InputData(
-                                                kvp.Value.Select(
-                                                    v => MeasurementPool.GetMeasurement(v, 0, HekaDAQInputStream.DAQCountUnits)).ToList(),
-                                                StreamWithIdentifier(kvp.Key).SampleRate,
-                                                Clock.Now
+                                                s.Measurements(kvp.Value, nread),
+                                                s.SampleRate,
+                                                inputTime
                                                 ).DataWithNodeConfiguration("Heka.HekaDAQController", Configuration);
 
 
@@ -495,11 +1068,120 @@ namespace Heka
 
             return result;
         }
+
+        private void CheckFifoMargin()
+        {
+            var margin = Device.FifoMargin;
+
+            if (margin.LowMarginEvents > _lowMarginEvents)
+            {
+                _lowMarginEvents = margin.LowMarginEvents;
+
+                var minMargin = TimeSpanExtensions.FromSamples((uint)Math.Max(margin.MinMargin, 0), SampleRate);
+                log.WarnFormat("Output FIFO margin fell below {0} (minimum {1})", FifoLowWatermark, minMargin);
+
+                var evt = FifoMarginLow;
+                if (evt != null)
+                    evt(this, new FifoMarginEventArgs(Clock, margin, minMargin));
+            }
+
+            if (margin.OutputEnded && !IsStopRequested)
+            {
+                log.Warn("Output FIFO margin fell below the stop watermark; output ended with stream backgrounds");
+                RequestStop();
+            }
+        }
+
+        /// <summary>
+        /// Clock time at which the first sample of the given input block was acquired. Falls back to
+        /// Clock.Now before the hardware sample counter has been observed.
+        /// </summary>
+        private DateTimeOffset InputBlockStartTime(InputBlockTime block)
+        {
+            if (block.HostTicks == 0)
+                return Clock.Now;
+
+            return HostTicksToClock(block.HostTicks, _clockEpoch, _ticksEpoch, Stopwatch.Frequency);
+        }
+
+        private static DateTimeOffset HostTicksToClock(long hostTicks, DateTimeOffset clockEpoch, long ticksEpoch, long frequency)
+        {
+            double seconds = (double)(hostTicks - ticksEpoch) / frequency;
+            return clockEpoch + TimeSpan.FromTicks((long)Math.Round(seconds * TimeSpan.TicksPerSecond));
+        }
+
+        private IDictionary<ChannelIdentifier, short[]> OutputBuffers(IList<HekaDAQOutputStream> streams,
+                                                                     IDictionary<IDAQOutputStream, IOutputData> outData)
+        {
+            foreach (var stale in _outputBuffers.Keys.Except(streams.Select(ChannelIdentifierFor)).ToList())
+            {
+                _outputBuffers.Remove(stale);
+            }
+
+            int blockSamples = -1;
+            foreach (var s in streams)
+            {
+                var data = outData[s];
+                if (blockSamples >= 0 && data.Data.Count != blockSamples)
+                    throw new HekaDAQException("Output buffers are not equal length.");
+
+                blockSamples = data.Data.Count;
+
+                var channel = ChannelIdentifierFor(s);
+                short[] buffer;
+                if (!_outputBuffers.TryGetValue(channel, out buffer) || buffer.Length != blockSamples)
+                {
+                    buffer = new short[blockSamples];
+                    _outputBuffers[channel] = buffer;
+                }
+
+                HekaDAQOutputStream.ToCounts(data, buffer, 0);
+            }
+
+            return _outputBuffers;
+        }
+
+        // Samples of a block covering the given deficit, as OutputData.SplitData would split it
+        private static int DeficitSamples(TimeSpan deficit, IMeasurement sampleRate, int blockSamples)
+        {
+            if (deficit.Ticks <= 0)
+                return 0;
+
+            return (int)Math.Min(deficit.Samples(sampleRate), (ulong)blockSamples);
+        }
+
+        private static ChannelIdentifier ChannelIdentifierFor(HekaDAQStream s)
+        {
+            return new ChannelIdentifier { ChannelNumber = s.ChannelNumber, ChannelType = (ushort)s.ChannelType, DeviceIndex = s.DeviceIndex };
+        }
+
+        private IDictionary<ChannelIdentifier, short[]> InputBuffers(IEnumerable<ChannelIdentifier> inputChannels, int nsamples)
+        {
+            var channels = inputChannels.ToList();
+
+            foreach (var stale in _inputBuffers.Keys.Except(channels).ToList())
+            {
+                _inputBuffers.Remove(stale);
+            }
+
+            foreach (var c in channels)
+            {
+                short[] buffer;
+                if (!_inputBuffers.TryGetValue(c, out buffer) || buffer.Length != nsamples)
+                {
+                    _inputBuffers[c] = new short[nsamples];
+                }
+            }
+
+            return _inputBuffers;
+        }
         
         private HekaDAQStream StreamWithIdentifier(ChannelIdentifier channelIdentifier)
         {
             HekaDAQStream result =
-                Streams.OfType<HekaDAQStream>().First(s => s.ChannelNumber == channelIdentifier.ChannelNumber && s.ChannelType == (StreamType)channelIdentifier.ChannelType);
+                Streams.OfType<HekaDAQStream>().First(s => s.ChannelNumber == channelIdentifier.ChannelNumber &&
+                    s.ChannelType == (StreamType)channelIdentifier.ChannelType &&
+                    s.DeviceIndex == channelIdentifier.DeviceIndex);
 
             if (result == null)
             {
@@ -19,12 +19,19 @@ namespace Heka
 
         public StreamType ChannelType { get; private set; } //should be internal, but testing needs access
         public ushort ChannelNumber { get; private set; } //should be internal, but testing needs access
+        public ushort DeviceIndex { get; private set; }
 
         public HekaDAQInputStream(string name, StreamType streamType, ushort channelNumber, HekaDAQController controller)
+            : this(name, streamType, channelNumber, 0, controller)
+        {
+        }
+
+        public HekaDAQInputStream(string name, StreamType streamType, ushort channelNumber, ushort deviceIndex, HekaDAQController controller)
             : base(name, controller)
         {
             this.ChannelType = streamType;
             this.ChannelNumber = channelNumber;
+            this.DeviceIndex = deviceIndex;
             this.MeasurementConversionTarget = (ChannelType == StreamType.DI_PORT || ChannelType == StreamType.XI) 
                 ? Measurement.UNITLESS : "V";
             this.Controller = controller;
@@ -69,16 +76,50 @@ namespace Heka
             }
         }
 
+        /// <summary>
+        /// Wraps the first n raw samples of a block read from this stream's channel as SampleData.
+        /// When this stream converts to volts, the whole block is converted at once by the
+        /// bridge's SampleConverter; otherwise the samples are left in DAQ counts. The samples
+        /// are copied, so counts may be reused.
+        /// </summary>
+        public IList<IMeasurement> Measurements(short[] counts, int n)
+        {
+            if (MeasurementConversionTarget == "V")
+            {
+                var volts = new double[n];
+                SampleConverter.CountsToVolts(counts, volts, n);
+                return new SampleData(volts, 0, "V");
+            }
+
+            var samples = new short[n];
+            Array.Copy(counts, samples, n);
+            return new SampleData(samples, 0, DAQCountUnits);
+        }
+
+        private static SampleData CountsToVolts(SampleData counts)
+        {
+            if (!counts.IsInt16 || counts.Exponent != 0)
+                return null;
+
+            var segment = counts.Int16Samples;
+            var volts = new double[segment.Count];
+            SampleConverter.CountsToValues(segment.Array, segment.Offset, volts, 0, segment.Count, 1.0 / SampleConverter.COUNTS_PER_VOLT, 0);
+
+            return new SampleData(volts, 0, "V");
+        }
+
         public static void RegisterConverters()
         {
             Converters.Register(DAQCountUnits,
                                 "V",
                                 (m) => MeasurementPool.GetMeasurement(m.QuantityInBaseUnits / (decimal)ITCMM.ANALOGVOLT, 0, "V")
                 );
+            Converters.RegisterBulk(DAQCountUnits, "V", CountsToVolts);
 
             Converters.Register(DAQCountUnits,
                 Measurement.UNITLESS,
                 (m) => m);
+            Converters.RegisterBulk(DAQCountUnits, Measurement.UNITLESS, (s) => s);
 
             Converters.Register(DAQCountUnits,
                 Measurement.NORMALIZED,
@@ -97,7 +138,12 @@ namespace Heka
         public IDictionary<IExternalDevice, ushort> BitPositions { get; private set; }
 
         public HekaDigitalDAQInputStream(string name, ushort channelNumber, HekaDAQController controller) 
-            : base(name, StreamType.DI_PORT, channelNumber, controller)
+            : this(name, channelNumber, 0, controller)
+        {
+        }
+
+        public HekaDigitalDAQInputStream(string name, ushort channelNumber, ushort deviceIndex, HekaDAQController controller)
+            : base(name, StreamType.DI_PORT, channelNumber, deviceIndex, controller)
         {
             BitPositions = new Dictionary<IExternalDevice, ushort>();
         }
@@ -121,16 +167,36 @@ namespace Heka
             if (MeasurementConversionTarget == null)
                 throw new DAQException("Input stream has null MeasurementConversionTarget");
 
-            foreach (ExternalDeviceBase ed in Devices)
+            var devices = Devices.Cast<ExternalDeviceBase>().ToList();
+            if (!devices.Any())
+                return;
+
+            var data = inData.DataWithUnits(MeasurementConversionTarget);
+
+            int n = data.Data.Count;
+            var samples = data.Data as SampleData;
+            short[] port;
+            if (samples != null && samples.IsInt16 && samples.Exponent == 0)
+            {
+                port = samples.ToInt16Array();
+            }
+            else
+            {
+                port = new short[n];
+                for (int i = 0; i < n; i++)
+                {
+                    port[i] = unchecked((short)(long)data.Data[i].QuantityInBaseUnits);
+                }
+            }
+
+            // Split every device's line out of the port in a single pass
+            var lines = devices.Select(ed => new short[n]).ToArray();
+            SampleConverter.UnpackBits(port, n, devices.Select(ed => BitPositions[ed]).ToArray(), lines);
+
+            for (int d = 0; d < devices.Count; d++)
             {
-                var data = inData.DataWithUnits(MeasurementConversionTarget);
-
-                ushort bitPosition = BitPositions[ed];
-                data = new InputData(data,
-                                     data.Data.Select(
-                                         m =>
-                                         MeasurementPool.GetMeasurement(((long) m.QuantityInBaseUnits >> bitPosition) & 1, 0, Measurement.UNITLESS)));
-                ed.PushInputData(this, data.DataWithStreamConfiguration(this, this.Configuration));
+                var line = new SampleData(lines[d], 0, Measurement.UNITLESS);
+                devices[d].PushInputData(this, new InputData(data, line).DataWithStreamConfiguration(this, this.Configuration));
             }
         }
 
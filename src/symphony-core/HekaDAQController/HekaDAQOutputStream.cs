@@ -21,13 +21,20 @@ namespace Heka
 
         public StreamType ChannelType { get; private set; } //should be internal, but testing needs access
         public ushort ChannelNumber { get; private set; } //should be internal, but testing needs access
+        public ushort DeviceIndex { get; private set; }
 
 
         public HekaDAQOutputStream(string name, StreamType streamType, ushort channelNumber, HekaDAQController controller)
+            : this(name, streamType, channelNumber, 0, controller)
+        {
+        }
+
+        public HekaDAQOutputStream(string name, StreamType streamType, ushort channelNumber, ushort deviceIndex, HekaDAQController controller)
             : base(name, controller)
         {
             this.ChannelType = streamType;
             this.ChannelNumber = channelNumber;
+            this.DeviceIndex = deviceIndex;
             this.MeasurementConversionTarget = (ChannelType == StreamType.DO_PORT || ChannelType == StreamType.XO)
                 ? Measurement.UNITLESS : DAQCountUnits;
             this.Controller = controller;
@@ -65,10 +72,12 @@ namespace Heka
                                 DAQCountUnits,
                                 (m) => MeasurementPool.GetMeasurement((decimal)Math.Round((double)m.QuantityInBaseUnits * ITCMM.ANALOGVOLT), 0, DAQCountUnits)
                 );
+            Converters.RegisterBulk("V", DAQCountUnits, VoltsToCounts);
 
             Converters.Register(Measurement.UNITLESS,
                 DAQCountUnits,
                 (m) => m);
+            Converters.RegisterBulk(Measurement.UNITLESS, DAQCountUnits, (s) => s);
 
             Converters.Register(Measurement.NORMALIZED,
                 DAQCountUnits,
@@ -95,6 +104,144 @@ namespace Heka
             }
         }
 
+        /// <summary>
+        /// Pulls output data from the bound devices. When converting to DAQ counts, each device's
+        /// block is converted at once (see ToCounts) rather than measurement by measurement.
+        /// </summary>
+        public override IOutputData PullOutputData(TimeSpan duration)
+        {
+            if (MeasurementConversionTarget != DAQCountUnits)
+                return base.PullOutputData(duration);
+
+            if (!Devices.Any())
+                throw new DAQException("No bound external devices (check configuration)");
+
+            IOutputData outData = null;
+            foreach (var ed in Devices)
+            {
+                var pulled = ed.PullOutputData(this, duration);
+                pulled = new OutputData(pulled, ToCountData(pulled));
+
+                outData = outData == null
+                    ? pulled
+                    : outData.Zip(pulled, (m1, m2) => MeasurementPool.GetMeasurement(m1.QuantityInBaseUnits + m2.QuantityInBaseUnits, 0, m1.BaseUnits));
+            }
+
+            if (!outData.SampleRate.Equals(this.SampleRate))
+                throw new DAQException("Sample rate mismatch.");
+
+            if (outData.IsLast)
+                LastDataPulled = true;
+
+            return outData.DataWithStreamConfiguration(this, this.Configuration);
+        }
+
+        // Counts already converted in bulk (e.g. memoized for a cached stimulus) are used without a copy
+        private static SampleData ToCountData(IOutputData data)
+        {
+            var samples = data.Data as SampleData;
+            SampleData converted;
+            if (samples != null && Converters.TryConvert(samples, DAQCountUnits, out converted) && converted.IsInt16 &&
+                converted.Exponent == 0 && converted.BaseUnits == DAQCountUnits)
+                return converted;
+
+            return new SampleData(ToCounts(data), 0, DAQCountUnits);
+        }
+
+        /// <summary>
+        /// Converts a block of output data to DAQ counts. Data in volts is converted in bulk by
+        /// the bridge's SampleConverter; other units go through the registered converters.
+        /// </summary>
+        /// <exception cref="DAQException">If a voltage is outside the DAQ output range</exception>
+        public static short[] ToCounts(IOutputData data)
+        {
+            var samples = data.Data as SampleData;
+            SampleData converted;
+            if (samples != null && Converters.TryConvert(samples, DAQCountUnits, out converted) && converted.IsInt16)
+                return converted.ToInt16Array();
+
+            var measurements = data.Data;
+            var counts = new short[measurements.Count];
+
+            if (measurements.All(m => m.BaseUnits == "V"))
+            {
+                var volts = new double[measurements.Count];
+                for (int i = 0; i < volts.Length; i++)
+                {
+                    volts[i] = (double)measurements[i].QuantityInBaseUnits;
+
+                    var c = volts[i] * SampleConverter.COUNTS_PER_VOLT;
+                    if (c > short.MaxValue + 0.5 || c < short.MinValue - 0.5)
+                        throw new DAQException("Output value " + measurements[i] + " is outside the DAQ output range");
+                }
+
+                SampleConverter.VoltsToCounts(volts, counts, counts.Length);
+            }
+            else
+            {
+                for (int i = 0; i < counts.Length; i++)
+                {
+                    counts[i] = (short)Converters.Convert(measurements[i], DAQCountUnits).QuantityInBaseUnits;
+                }
+            }
+
+            return counts;
+        }
+
+        /// <summary>
+        /// Converts a block of output data to DAQ counts, writing them into counts starting at index.
+        /// Blocks already in DAQ counts are copied straight from their sample array and blocks of
+        /// volts are converted in place, so no intermediate arrays are allocated for either.
+        /// </summary>
+        /// <returns>Number of samples written</returns>
+        /// <exception cref="DAQException">If a voltage is outside the DAQ output range</exception>
+        public static int ToCounts(IOutputData data, short[] counts, int index)
+        {
+            var samples = data.Data as SampleData;
+            if (samples != null && samples.IsInt16 && samples.Exponent == 0 && samples.BaseUnits == DAQCountUnits)
+            {
+                var segment = samples.Int16Samples;
+                Array.Copy(segment.Array, segment.Offset, counts, index, segment.Count);
+                return segment.Count;
+            }
+
+            if (samples != null && !samples.IsInt16 && samples.BaseUnits == "V")
+            {
+                var segment = samples.DoubleSamples;
+                double scale = SampleConverter.COUNTS_PER_VOLT * Math.Pow(10, samples.Exponent);
+                CheckOutputRange(samples, segment, scale);
+
+                SampleConverter.ValuesToCounts(segment.Array, segment.Offset, counts, index, segment.Count, scale, 0);
+                return segment.Count;
+            }
+
+            var converted = ToCounts(data);
+            Array.Copy(converted, 0, counts, index, converted.Length);
+            return converted.Length;
+        }
+
+        private static SampleData VoltsToCounts(SampleData volts)
+        {
+            var values = volts.ToDoubleArray();
+            double scale = SampleConverter.COUNTS_PER_VOLT * Math.Pow(10, volts.Exponent);
+            CheckOutputRange(volts, new ArraySegment<double>(values), scale);
+
+            var counts = new short[values.Length];
+            SampleConverter.ValuesToCounts(values, 0, counts, 0, counts.Length, scale, 0);
+
+            return new SampleData(counts, 0, DAQCountUnits);
+        }
+
+        private static void CheckOutputRange(SampleData volts, ArraySegment<double> values, double scale)
+        {
+            for (int i = 0; i < values.Count; i++)
+            {
+                var c = values.Array[values.Offset + i] * scale;
+                if (c > short.MaxValue + 0.5 || c < short.MinValue - 0.5)
+                    throw new DAQException("Output value " + volts[i] + " is outside the DAQ output range");
+            }
+        }
+
         public void Preload(IHekaDevice device, IOutputData data)
         {
             PreloadData(device, data);
@@ -105,8 +252,7 @@ namespace Heka
             var inputUnits = (ChannelType == StreamType.DO_PORT || ChannelType == StreamType.XO)
                 ? Measurement.UNITLESS : "V";
 
-            var sampleData = data.DataWithUnits(inputUnits).DataWithUnits(DAQCountUnits);
-            var samples = sampleData.Data.Select(m => (short)m.Quantity).ToList();
+            var samples = ToCounts(data.DataWithUnits(inputUnits));
 
             device.PreloadSamples(ChannelType, ChannelNumber, samples);
         }
@@ -122,7 +268,12 @@ namespace Heka
         public IDictionary<IExternalDevice, ushort> BitPositions { get; private set; }
 
         public HekaDigitalDAQOutputStream(string name, ushort channelNumber, HekaDAQController controller) 
-            : base(name, StreamType.DO_PORT, channelNumber, controller)
+            : this(name, channelNumber, 0, controller)
+        {
+        }
+
+        public HekaDigitalDAQOutputStream(string name, ushort channelNumber, ushort deviceIndex, HekaDAQController controller)
+            : base(name, StreamType.DO_PORT, channelNumber, deviceIndex, controller)
         {
             BitPositions = new Dictionary<IExternalDevice, ushort>();
         }
@@ -145,21 +296,19 @@ namespace Heka
         {
             get
             {
-                IMeasurement background = null;
-                foreach (var ed in Devices)
-                {
-                    var m = Converters.Convert(ed.Background, MeasurementConversionTarget);
-                    if (m.QuantityInBaseUnits != 0 && m.QuantityInBaseUnits != 1)
-                        throw new DAQException(ed.Name + " background must contain a value of 0 or 1");
+                var devices = Devices.ToList();
+                if (!devices.Any())
+                    return null;
 
-                    ushort bitPosition = BitPositions[ed];
-                    m = MeasurementPool.GetMeasurement((long)((long)m.QuantityInBaseUnits << bitPosition), 0, m.BaseUnits);
+                var backgrounds = devices.Select(ed => Converters.Convert(ed.Background, MeasurementConversionTarget)).ToList();
+                var lines = backgrounds.Select(m => new[] { LineSample(m) }).ToArray();
 
-                    background = background == null
-                        ? m
-                        : MeasurementPool.GetMeasurement((long)background.QuantityInBaseUnits | (long)m.QuantityInBaseUnits, 0, background.BaseUnits);
-                }
-                return background;
+                var port = new short[1];
+                int invalid = SampleConverter.PackBits(lines, DeviceBitPositions(devices), port, 1);
+                if (invalid >= 0)
+                    throw new DAQException(devices[invalid].Name + " background must contain a value of 0 or 1");
+
+                return MeasurementPool.GetMeasurement((ushort)port[0], 0, backgrounds[0].BaseUnits);
             }
         }
 
@@ -168,27 +317,31 @@ namespace Heka
             if (!Devices.Any())
                 throw new DAQException("No bound external devices (check configuration)");
 
-            IOutputData outData = null;
-            foreach (var ed in Devices)
-            {
-                var pulled = ed.PullOutputData(this, duration).DataWithUnits(MeasurementConversionTarget);
+            var devices = Devices.ToList();
+            var pulled = devices.Select(ed => ed.PullOutputData(this, duration).DataWithUnits(MeasurementConversionTarget)).ToList();
 
-                ushort bitPosition = BitPositions[ed];
-                pulled = new OutputData(pulled, pulled.Data.Select(m =>
-                {
-                    if (m.QuantityInBaseUnits != 0 && m.QuantityInBaseUnits != 1)
-                        throw new DAQException(ed.Name + " output data must contain only values of 0 and 1");
+            // Zip checks duration/sample rate agreement and merges node configuration
+            IOutputData outData = pulled.Aggregate((d1, d2) => d1.Zip(d2, (m1, m2) => m1));
 
-                    return MeasurementPool.GetMeasurement((long)((long)m.QuantityInBaseUnits << bitPosition), 0, m.BaseUnits);
-                }));
+            int n = outData.Data.Count;
+            var lines = pulled.Select(d => d.Data.Select(LineSample).ToArray()).ToArray();
 
-                outData = outData == null
-                              ? pulled
-                              : outData.Zip(pulled,
-                                            (m1, m2) =>
-                                            MeasurementPool.GetMeasurement((long) m1.QuantityInBaseUnits | (long) m2.QuantityInBaseUnits, 0, m1.BaseUnits));
+            // Merge every device's line into the port in a single pass
+            var port = new short[n];
+            int invalid = SampleConverter.PackBits(lines, DeviceBitPositions(devices), port, n);
+            if (invalid >= 0)
+                throw new DAQException(devices[invalid].Name + " output data must contain only values of 0 and 1");
+
+            // Port values are unsigned
+            var units = outData.Data.Any() ? outData.Data[0].BaseUnits : MeasurementConversionTarget;
+            var values = new double[n];
+            for (int i = 0; i < n; i++)
+            {
+                values[i] = (ushort)port[i];
             }
 
+            outData = new OutputData(outData, new SampleData(values, 0, units));
+
             if (!outData.SampleRate.Equals(this.SampleRate))
                 throw new DAQException("Sample rate mismatch.");
 
@@ -198,6 +351,18 @@ namespace Heka
             return outData.DataWithStreamConfiguration(this, this.Configuration);
         }
 
+        private ushort[] DeviceBitPositions(IEnumerable<IExternalDevice> devices)
+        {
+            return devices.Select(ed => BitPositions[ed]).ToArray();
+        }
+
+        // A line's 0/1 value as a port sample; anything else is passed through for PackBits to reject
+        private static short LineSample(IMeasurement m)
+        {
+            var q = m.QuantityInBaseUnits;
+            return q == 0 || q == 1 ? (short)q : (short)-1;
+        }
+
         public override Maybe<string> Validate()
         {
             if (Devices.Any(d => !BitPositions.ContainsKey(d)))
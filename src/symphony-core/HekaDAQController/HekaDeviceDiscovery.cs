@@ -0,0 +1,304 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading.Tasks;
+using Heka.NativeInterop;
+using log4net;
+
+namespace Heka
+{
+    /// <summary>
+    /// Process-wide record of the ITC units attached to this host.
+    ///
+    /// <para>The device types are enumerated (ITC_Devices) in parallel, once; controllers and
+    /// device opens are then served from the cached unit counts and GlobalDeviceInfo. The ITC driver
+    /// does not report hotplug, so the record is refreshed when a unit turns out to have come or gone
+    /// (an open fails, or a kept unit no longer answers) or when Refresh is called.</para>
+    ///
+    /// <para>Keeping units warm is opt-in. While KeepUnitsWarm is set, closing a hardware device
+    /// keeps its opened, initialized units instead of closing them, and the next open of the same
+    /// unit takes one back without re-running ITC_OpenDevice, ITC_InitDevice and ITC_ConfigDevice.
+    /// Kept units are closed by CloseWarmUnits, by Refresh and when the process exits.</para>
+    /// </summary>
+    public static class HekaDeviceDiscovery
+    {
+        private struct Unit : IEquatable<Unit>
+        {
+            public readonly uint DeviceType;
+            public readonly uint DeviceNumber;
+
+            public Unit(uint deviceType, uint deviceNumber)
+            {
+                DeviceType = deviceType;
+                DeviceNumber = deviceNumber;
+            }
+
+            public bool Equals(Unit other)
+            {
+                return DeviceType == other.DeviceType && DeviceNumber == other.DeviceNumber;
+            }
+
+            public override bool Equals(object obj)
+            {
+                return obj is Unit && Equals((Unit)obj);
+            }
+
+            public override int GetHashCode()
+            {
+                return (int)(DeviceType * 397 ^ DeviceNumber);
+            }
+        }
+
+        // Guards every field below
+        private static readonly object Lock = new object();
+        private static uint[] _deviceCounts; // By device type; null until enumerated
+        private static readonly Dictionary<Unit, ITCMM.GlobalDeviceInfo> DeviceInfos = new Dictionary<Unit, ITCMM.GlobalDeviceInfo>();
+        private static readonly Dictionary<Unit, IntPtr> WarmUnits = new Dictionary<Unit, IntPtr>();
+        private static bool _keepUnitsWarm;
+
+        private static readonly ILog log = LogManager.GetLogger(typeof(HekaDeviceDiscovery));
+
+        static HekaDeviceDiscovery()
+        {
+            AppDomain.CurrentDomain.ProcessExit += (sender, args) => CloseWarmUnits();
+        }
+
+        /// <summary>
+        /// Whether closed hardware devices keep their units open and initialized for the next open.
+        /// A kept unit stays open to this process, so no other application (e.g. Patchmaster) can
+        /// open it until it is released. Clearing it closes the units currently kept. Default false.
+        /// </summary>
+        public static bool KeepUnitsWarm
+        {
+            get { lock (Lock) return _keepUnitsWarm; }
+            set
+            {
+                lock (Lock)
+                    _keepUnitsWarm = value;
+
+                if (!value)
+                    CloseWarmUnits();
+            }
+        }
+
+        /// <summary>
+        /// Attached units as (device type, device number) pairs, enumerating them on first use.
+        /// </summary>
+        /// <exception cref="HekaDAQException">If a device type cannot be enumerated</exception>
+        public static IEnumerable<KeyValuePair<uint, uint>> Units()
+        {
+            EnsureEnumerated();
+
+            lock (Lock)
+            {
+                var result = new List<KeyValuePair<uint, uint>>();
+                for (uint deviceType = 0; deviceType < _deviceCounts.Length; deviceType++)
+                {
+                    for (uint deviceNumber = 0; deviceNumber < _deviceCounts[deviceType]; deviceNumber++)
+                    {
+                        result.Add(new KeyValuePair<uint, uint>(deviceType, deviceNumber));
+                    }
+                }
+
+                return result;
+            }
+        }
+
+        /// <summary>
+        /// Number of attached units of the given type, enumerating them on first use.
+        /// </summary>
+        /// <exception cref="HekaDAQException">If a device type cannot be enumerated</exception>
+        public static uint DeviceCount(uint deviceType)
+        {
+            EnsureEnumerated();
+
+            lock (Lock)
+                return deviceType < _deviceCounts.Length ? _deviceCounts[deviceType] : 0;
+        }
+
+        /// <summary>
+        /// GlobalDeviceInfo reported by the unit when it was last opened.
+        /// </summary>
+        /// <returns>False if the unit has not been opened since the last refresh</returns>
+        public static bool TryGetDeviceInfo(uint deviceType, uint deviceNumber, out ITCMM.GlobalDeviceInfo deviceInfo)
+        {
+            lock (Lock)
+                return DeviceInfos.TryGetValue(new Unit(deviceType, deviceNumber), out deviceInfo);
+        }
+
+        /// <summary>
+        /// Closes the kept units and re-enumerates the attached units. Call after plugging in or
+        /// removing a unit.
+        /// </summary>
+        /// <exception cref="HekaDAQException">If a device type cannot be enumerated</exception>
+        public static void Refresh()
+        {
+            CloseWarmUnits();
+
+            lock (Lock)
+            {
+                _deviceCounts = null;
+                DeviceInfos.Clear();
+            }
+
+            EnsureEnumerated();
+        }
+
+        /// <summary>
+        /// Closes every kept unit.
+        /// </summary>
+        public static void CloseWarmUnits()
+        {
+            List<IntPtr> handles;
+            lock (Lock)
+            {
+                handles = WarmUnits.Values.ToList();
+                WarmUnits.Clear();
+            }
+
+            foreach (var handle in handles)
+            {
+                Close(handle);
+            }
+        }
+
+        /// <summary>
+        /// Closes the kept units among those given, e.g. after a failure that requires the hardware
+        /// to be reset.
+        /// </summary>
+        public static void CloseWarmUnits(uint deviceType, IEnumerable<uint> deviceNumbers)
+        {
+            var handles = new List<IntPtr>();
+            lock (Lock)
+            {
+                foreach (var deviceNumber in deviceNumbers)
+                {
+                    var unit = new Unit(deviceType, deviceNumber);
+                    IntPtr warm;
+                    if (WarmUnits.TryGetValue(unit, out warm))
+                    {
+                        handles.Add(warm);
+                        WarmUnits.Remove(unit);
+                    }
+                }
+            }
+
+            foreach (var handle in handles)
+            {
+                Close(handle);
+            }
+        }
+
+        internal static void EnsureEnumerated()
+        {
+            lock (Lock)
+            {
+                if (_deviceCounts != null)
+                    return;
+
+                // Each device type is a separate bus enumeration in the driver
+                var counts = new uint[ITCMM.MAX_DEVICE_TYPE_NUMBER];
+                var errors = new uint[ITCMM.MAX_DEVICE_TYPE_NUMBER];
+                Parallel.For(0, ITCMM.MAX_DEVICE_TYPE_NUMBER, t =>
+                    {
+                        if (t == ITCMM.ITC00_ID)
+                            return;
+
+                        uint numDevices = 0;
+                        errors[t] = ITCMM.ITC_Devices((uint)t, ref numDevices);
+                        counts[t] = numDevices;
+                    });
+
+                var err = errors.FirstOrDefault(e => e != ITCMM.ACQ_SUCCESS);
+                if (err != ITCMM.ACQ_SUCCESS)
+                {
+                    throw new HekaDAQException("Unable to find devices", err);
+                }
+
+                _deviceCounts = counts;
+                log.DebugFormat("Found ITC units: {0}", string.Join(", ", counts));
+            }
+        }
+
+        /// <summary>
+        /// Records the GlobalDeviceInfo of a unit just opened.
+        /// </summary>
+        internal static void Opened(uint deviceType, uint deviceNumber, ITCMM.GlobalDeviceInfo deviceInfo)
+        {
+            lock (Lock)
+                DeviceInfos[new Unit(deviceType, deviceNumber)] = deviceInfo;
+        }
+
+        /// <summary>
+        /// Takes the kept handle of a unit, checking that the unit still answers. A kept unit that
+        /// does not is closed and the attached units re-enumerated.
+        /// </summary>
+        /// <returns>False if no usable handle was kept</returns>
+        internal static bool TakeWarmUnit(uint deviceType, uint deviceNumber, out IntPtr handle, out ITCMM.GlobalDeviceInfo deviceInfo)
+        {
+            var unit = new Unit(deviceType, deviceNumber);
+            IntPtr warm;
+            lock (Lock)
+            {
+                if (!WarmUnits.TryGetValue(unit, out warm))
+                {
+                    handle = IntPtr.Zero;
+                    deviceInfo = default(ITCMM.GlobalDeviceInfo);
+                    return false;
+                }
+
+                WarmUnits.Remove(unit);
+            }
+
+            var info = new ITCMM.GlobalDeviceInfo();
+            uint err = ITCMM.ITC_GetDeviceInfo(warm, ref info);
+            if (err != ITCMM.ACQ_SUCCESS)
+            {
+                log.InfoFormat("Kept ITC unit ({0},{1}) no longer answers; refreshing attached units", deviceType, deviceNumber);
+                Close(warm);
+                Refresh();
+
+                handle = IntPtr.Zero;
+                deviceInfo = default(ITCMM.GlobalDeviceInfo);
+                return false;
+            }
+
+            handle = warm;
+            deviceInfo = info;
+            return true;
+        }
+
+        /// <summary>
+        /// Keeps an opened, initialized unit for the next open, or closes it if units are not kept
+        /// or one is already kept for the unit.
+        /// </summary>
+        /// <exception cref="HekaDAQException">If the unit is closed and closing it fails</exception>
+        internal static void Release(uint deviceType, uint deviceNumber, IntPtr handle)
+        {
+            var unit = new Unit(deviceType, deviceNumber);
+            lock (Lock)
+            {
+                if (_keepUnitsWarm && !WarmUnits.ContainsKey(unit))
+                {
+                    WarmUnits[unit] = handle;
+                    return;
+                }
+            }
+
+            uint err = ITCMM.ITC_CloseDevice(handle);
+            if (err != ITCMM.ACQ_SUCCESS)
+            {
+                throw new HekaDAQException("Unable to close device", err);
+            }
+        }
+
+        private static void Close(IntPtr handle)
+        {
+            uint err = ITCMM.ITC_CloseDevice(handle);
+            if (err != ITCMM.ACQ_SUCCESS)
+            {
+                log.WarnFormat("Unable to close kept ITC unit: {0}", err);
+            }
+        }
+    }
+}
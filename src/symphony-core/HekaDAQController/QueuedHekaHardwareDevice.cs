@@ -3,7 +3,6 @@ using System.Collections.Generic;
 using System.Linq;
 using System.Runtime.InteropServices;
 using System.Threading;
-using System.Threading.Tasks;
 using Heka.NativeInterop;
 using Symphony.Core;
 using log4net;
@@ -12,52 +11,119 @@ namespace Heka
 {
     sealed class QueuedHekaHardwareDevice : IHekaDevice
     {
-        private IntPtr DevicePtr { get; set; }
+        // Open ITC units, primary first. The primary unit provides the clock and device info.
+        private IList<IntPtr> DevicePtrs { get; set; }
+        private IntPtr DevicePtr { get { return DevicePtrs[0]; } }
+
+        // Units behind DevicePtrs, returned to HekaDeviceDiscovery on close; null for a device made
+        // over handles opened elsewhere, which are closed
+        private uint DeviceType { get; set; }
+        private IList<uint> DeviceNumbers { get; set; }
         private IOBridge Bridge { get; set; }
         DateTimeOffset StartupTime { get; set; }
 
-        private readonly CancellationTokenSource _cts = new CancellationTokenSource();
-        private readonly TaskScheduler _scheduler = new LimitedConcurrencyLevelTaskScheduler(1);
-        private TaskFactory<uint> ItcmmReturnCodeTaskFactory { get; set; }
-        private TaskFactory<IEnumerable<KeyValuePair<ChannelIdentifier, short[]>>> ItcmmReadWriteTaskFactory { get; set; }
+        // Runs every driver call, holding the bridge's driver lock
+        private readonly DeviceThread _deviceThread;
+
+        // Cached for queries made every process loop iteration, so they allocate nothing
+        private readonly Func<IntPtr, double> _getTime;
+        private readonly Func<IntPtr, ITCMM.ITCStatus> _getState;
+        private readonly Func<ChannelIdentifier, int> _getDataAvailable;
+        private readonly ITCMM.ITCChannelDataEx[] _availableQuery = new ITCMM.ITCChannelDataEx[1]; //Device thread only
 
         
         public QueuedHekaHardwareDevice(IntPtr dev, uint maxInputStreams, uint maxOutputStreams)
+            : this(new[] { dev }, maxInputStreams, maxOutputStreams)
         {
-            ItcmmReturnCodeTaskFactory = new TaskFactory<uint>(_cts.Token, TaskCreationOptions.None, TaskContinuationOptions.None, _scheduler);
-            ItcmmReadWriteTaskFactory = new TaskFactory<IEnumerable<KeyValuePair<ChannelIdentifier, short[]>>>(_cts.Token, TaskCreationOptions.None, TaskContinuationOptions.None, _scheduler);
+        }
+
+        /// <summary>
+        /// Device over several ITC units acquiring together. Stream DeviceIndex selects the unit within devs;
+        /// maxInputStreams and maxOutputStreams are totals over all units.
+        /// </summary>
+        public QueuedHekaHardwareDevice(IList<IntPtr> devs, uint maxInputStreams, uint maxOutputStreams)
+        {
+            DevicePtrs = devs.ToList();
+            Bridge = DevicePtrs.Count == 1
+                ? new IOBridge(DevicePtr, maxInputStreams, maxOutputStreams)
+                : new IOBridge(DevicePtrs.ToArray(), maxInputStreams, maxOutputStreams);
+
+            _getTime = GetTime;
+            _getState = GetState;
+            _getDataAvailable = GetDataAvailable;
+            _deviceThread = new DeviceThread("ITC device", Bridge.AcquireDriver, Bridge.ReleaseDriver, DeviceThreadProcessor());
 
-            DevicePtr = dev;
-            Bridge = new IOBridge(DevicePtr, maxInputStreams, maxOutputStreams);
             StartupTime = DateTimeOffset.Now - new TimeSpan((long)Math.Floor(ITCClock * TimeSpan.TicksPerSecond));
 
         }
 
 
-        private void ItcmmCall(Action fn)
+        // Pins the device thread to the last processor, away from processor 0 which typically services
+        // most interrupts; unpinned on a single processor
+        private static int DeviceThreadProcessor()
         {
-            var task = ItcmmReturnCodeTaskFactory.StartNew(() =>
-                                                               {
-                                                                   fn();
-                                                                   return 0;
-                                                               });
+            int processors = Math.Min(Environment.ProcessorCount, 64);
+            return processors > 1 ? processors - 1 : -1;
+        }
 
-            task.Wait();
+        private void ItcmmCall(Action fn)
+        {
+            _deviceThread.Call(fn);
         }
 
-        private uint ItcmmCall(Func<uint> fn)
+        private T ItcmmCall<T>(Func<T> fn)
         {
-            var task = ItcmmReturnCodeTaskFactory.StartNew(fn);
+            return _deviceThread.Call(fn);
+        }
 
-            return task.Result;
+        private T ItcmmCall<TArg, T>(Func<TArg, T> fn, TArg arg)
+        {
+            return _deviceThread.Call(fn, arg);
         }
 
-        private IEnumerable<KeyValuePair<ChannelIdentifier, short[]>> ItcmmCall(Func<IEnumerable<KeyValuePair<ChannelIdentifier, short[]>>> fn)
+
+        // Arguments of a bridge transfer, passed by value to the cached transfer delegates so a
+        // call allocates no closure
+        private struct TransferArgs
         {
-            var task = ItcmmReadWriteTaskFactory.StartNew(fn);
-            return task.Result;
+            public IOBridge Bridge;
+            public IDictionary<ChannelIdentifier, short[]> Output;
+            public IDictionary<ChannelIdentifier, short[]> Input;
+            public IList<ChannelIdentifier> InputChannels;
+            public int DeficitSamples;
+            public int Samples;
+            public CancellationToken Token;
         }
 
+        private static readonly Func<TransferArgs, IEnumerable<KeyValuePair<ChannelIdentifier, short[]>>> ReadWriteChannels =
+            a => a.Bridge.ReadWrite(a.Output, a.InputChannels, a.Samples, a.Token);
+
+        private static readonly Func<TransferArgs, int> ReadWriteInto =
+            a => a.Bridge.ReadWrite(a.Output, a.Input, a.Samples, a.Token);
+
+        private static readonly Func<TransferArgs, int> ReadWriteWithDeficit =
+            a => a.Bridge.ReadWrite(a.Output, a.DeficitSamples, a.Input, a.Samples, a.Token);
+
+        private static readonly Func<TransferArgs, int> PreloadOutput =
+            a =>
+                {
+                    a.Bridge.Preload(a.Output);
+                    return 0;
+                };
+
+        private static readonly Func<TransferArgs, int> PreloadOutputSamples =
+            a =>
+                {
+                    a.Bridge.Preload(a.Output, a.Samples);
+                    return 0;
+                };
+
+        private static readonly Func<TransferArgs, int> WriteOutput =
+            a =>
+                {
+                    a.Bridge.Write(a.Output);
+                    return 0;
+                };
 
         public IEnumerable<KeyValuePair<ChannelIdentifier, short[]>>
             ReadWrite(IDictionary<ChannelIdentifier, short[]> output,
@@ -65,7 +131,189 @@ namespace Heka
                       int nsamples,
                       CancellationToken token)
         {
-            return ItcmmCall(() => Bridge.ReadWrite(output, input, nsamples, token));
+            return ItcmmCall(ReadWriteChannels,
+                             new TransferArgs {Bridge = Bridge, Output = output, InputChannels = input, Samples = nsamples, Token = token});
+        }
+
+        public int ReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                             IDictionary<ChannelIdentifier, short[]> input,
+                             int nsamples,
+                             CancellationToken token)
+        {
+            return ItcmmCall(ReadWriteInto,
+                             new TransferArgs {Bridge = Bridge, Output = output, Input = input, Samples = nsamples, Token = token});
+        }
+
+        public int ReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                             int deficitSamples,
+                             IDictionary<ChannelIdentifier, short[]> input,
+                             int nsamples,
+                             CancellationToken token)
+        {
+            return ItcmmCall(ReadWriteWithDeficit,
+                             new TransferArgs
+                                 {
+                                     Bridge = Bridge,
+                                     Output = output,
+                                     DeficitSamples = deficitSamples,
+                                     Input = input,
+                                     Samples = nsamples,
+                                     Token = token
+                                 });
+        }
+
+        public PollingMode Polling
+        {
+            get { return Bridge.Polling; }
+            set { Bridge.Polling = value; }
+        }
+
+        public uint TransferBlockSamples
+        {
+            get { return Bridge.TransferBlockSamples; }
+            set { Bridge.TransferBlockSamples = value; }
+        }
+
+        public uint ActiveTransferBlockSamples
+        {
+            get { return Bridge.ActiveTransferBlockSamples; }
+        }
+
+        public uint StatusCheckInterval
+        {
+            get { return Bridge.StatusCheckInterval; }
+            set { Bridge.StatusCheckInterval = value; }
+        }
+
+        public DriverCallCounts DriverCalls
+        {
+            get { return Bridge.DriverCalls; }
+        }
+
+        public void ResetDriverCalls()
+        {
+            Bridge.ResetDriverCalls();
+        }
+
+        public TimeSpan PollWaitTime
+        {
+            get { return Bridge.PollWaitTime; }
+        }
+
+        public TransferStatistics TransferStatistics
+        {
+            get { return Bridge.Statistics; }
+        }
+
+        public bool TraceTransfers
+        {
+            get { return Bridge.TraceTransfers; }
+            set { Bridge.TraceTransfers = value; }
+        }
+
+        public TransferTraceEntry[] DumpTransferTrace()
+        {
+            return Bridge.DumpTransferTrace();
+        }
+
+        public InputBlockTime LastInputBlock
+        {
+            get { return Bridge.LastInputBlock; }
+        }
+
+        public double SampleClockDriftPpm
+        {
+            get { return Bridge.SampleClockDriftPpm; }
+        }
+
+        public TimeSpan TransferTime
+        {
+            get { return Bridge.TransferTime; }
+        }
+
+        public void ResetPollingStatistics()
+        {
+            Bridge.ResetPollingStatistics();
+        }
+
+        public void StartStreaming(IEnumerable<HekaDAQStream> streams)
+        {
+            var streamList = streams.ToList();
+            var outputs = streamList
+                .OfType<IDAQOutputStream>()
+                .Cast<HekaDAQStream>()
+                .Select(ChannelIdentifierFor)
+                .ToList();
+            var backgrounds = streamList
+                .OfType<HekaDAQOutputStream>()
+                .Select(s => (short)Converters.Convert(s.Background, HekaDAQOutputStream.DAQCountUnits).QuantityInBaseUnits)
+                .ToList();
+            var inputs = streamList
+                .OfType<IDAQInputStream>()
+                .Cast<HekaDAQStream>()
+                .Select(ChannelIdentifierFor)
+                .ToList();
+
+            int capacity = streamList
+                .Select(MaxAvailableSamples)
+                .DefaultIfEmpty(0)
+                .Max();
+
+            // Not queued through ItcmmCall; the streaming thread takes the driver lock itself
+            Bridge.StartStreaming(outputs, backgrounds, inputs, capacity);
+        }
+
+        public void ConfigureFifoWatchdog(uint lowSamples, uint stopSamples)
+        {
+            Bridge.ConfigureFifoWatchdog(lowSamples, stopSamples);
+        }
+
+        public FifoMarginStatus FifoMargin
+        {
+            get { return Bridge.FifoMargin; }
+        }
+
+        public void StopStreaming()
+        {
+            Bridge.StopStreaming();
+        }
+
+        public string SpillPath
+        {
+            get { return Bridge.SpillPath; }
+            set { Bridge.SpillPath = value; }
+        }
+
+        public bool SpillFailed
+        {
+            get { return Bridge.SpillFailed; }
+        }
+
+        public int StreamReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                                   IDictionary<ChannelIdentifier, short[]> input,
+                                   int nsamples,
+                                   CancellationToken token)
+        {
+            // Only exchanges data with the streaming queues, so it need not hold the driver
+            return Bridge.StreamReadWrite(output, input, nsamples, token);
+        }
+
+        public int DeviceCount
+        {
+            get { return DevicePtrs.Count; }
+        }
+
+        private static ChannelIdentifier ChannelIdentifierFor(HekaDAQStream s)
+        {
+            return new ChannelIdentifier { ChannelNumber = s.ChannelNumber, ChannelType = (ushort)s.ChannelType, DeviceIndex = s.DeviceIndex };
+        }
+
+        private IntPtr DevicePtrFor(HekaDAQStream s)
+        {
+            if (s.DeviceIndex >= DevicePtrs.Count)
+                throw new HekaDAQException("Stream " + s.Name + " belongs to a device that is not open");
+
+            return DevicePtrs[s.DeviceIndex];
         }
 
         public DateTimeOffset Now
@@ -104,7 +352,7 @@ namespace Heka
                                               }
                                       };
 
-                uint err = ItcmmCall(() => ITCMM.ITC_AsyncIO(DevicePtr, 1, channelData));
+                uint err = ItcmmCall(() => ITCMM.ITC_AsyncIO(DevicePtrFor(stream), 1, channelData));
                 if (err != ITCMM.ACQ_SUCCESS)
                 {
                     throw new HekaDAQException("Unable to write AsyncIO", err);
@@ -125,7 +373,7 @@ namespace Heka
                                               }
                                       };
 
-                uint err = ItcmmCall(() => ITCMM.ITC_AsyncIO(DevicePtr, 1, channelData));
+                uint err = ItcmmCall(() => ITCMM.ITC_AsyncIO(DevicePtrFor(stream), 1, channelData));
                 if (err != ITCMM.ACQ_SUCCESS)
                 {
                     throw new HekaDAQException("Unable to read AsyncIO", err);
@@ -144,72 +392,88 @@ namespace Heka
 
         public void Preload(IDictionary<ChannelIdentifier, short[]> output)
         {
-            ItcmmCall(() => Bridge.Preload(output));
+            ItcmmCall(PreloadOutput, new TransferArgs {Bridge = Bridge, Output = output});
         }
 
-        public void Write(IDictionary<ChannelIdentifier, short[]> output)
+        public void Preload(IDictionary<ChannelIdentifier, short[]> output, int nsamples)
         {
+            ItcmmCall(PreloadOutputSamples, new TransferArgs {Bridge = Bridge, Output = output, Samples = nsamples});
+        }
 
-            ItcmmCall(() => Bridge.Write(output));
+        public void Write(IDictionary<ChannelIdentifier, short[]> output)
+        {
+            ItcmmCall(WriteOutput, new TransferArgs {Bridge = Bridge, Output = output});
         }
 
         private double ITCClock
         {
-            get
-            {
-                double seconds = 0;
-                uint err = ItcmmCall(() => ITCMM.ITC_GetTime(DevicePtr, out seconds));
-                if (err != ITCMM.ACQ_SUCCESS)
-                {
-                    throw new HekaDAQException("Unable to get device time", err);
-                }
-                return seconds;
-            }
+            get { return ItcmmCall(_getTime, DevicePtr); }
         }
 
-        private ITCMM.ITCStatus Status
+        private static double GetTime(IntPtr dev)
         {
-            get
+            double seconds;
+            uint err = ITCMM.ITC_GetTime(dev, out seconds);
+            if (err != ITCMM.ACQ_SUCCESS)
             {
+                throw new HekaDAQException("Unable to get device time", err);
+            }
+            return seconds;
+        }
 
-                var status = new ITCMM.ITCStatus
-                                 {
-                                     CommandStatus = ITCMM.READ_ERRORS |
-                                                     ITCMM.READ_RUNNINGMODE |
-                                                     ITCMM.READ_OVERFLOW
-                                 };
-
-                uint err = ItcmmCall(() => ITCMM.ITC_GetState(DevicePtr, ref status));
-                if (err != ITCMM.ACQ_SUCCESS)
-                {
-                    throw new HekaDAQException("Unable to get device status", err);
-                }
+        private ITCMM.ITCStatus Status(IntPtr dev)
+        {
+            return ItcmmCall(_getState, dev);
+        }
 
-                return status;
+        private static ITCMM.ITCStatus GetState(IntPtr dev)
+        {
+            var status = new ITCMM.ITCStatus
+                             {
+                                 CommandStatus = ITCMM.READ_ERRORS |
+                                                 ITCMM.READ_RUNNINGMODE |
+                                                 ITCMM.READ_OVERFLOW
+                             };
+
+            uint err = ITCMM.ITC_GetState(dev, ref status);
+            if (err != ITCMM.ACQ_SUCCESS)
+            {
+                throw new HekaDAQException("Unable to get device status", err);
             }
+
+            return status;
         }
 
+        /// <summary>
+        /// True if every unit is running.
+        /// </summary>
         public bool Running
         {
             get
             {
-                return (Status.RunningMode & ITCMM.RUN_STATE) > 0;
+                return DevicePtrs.All(d => (Status(d).RunningMode & ITCMM.RUN_STATE) > 0);
             }
         }
 
+        /// <summary>
+        /// True if any unit has overflowed.
+        /// </summary>
         public bool Overflow
         {
             get
             {
-                return (Status.Overflow & (ITCMM.ITC_READ_OVERFLOW_H)) > 0;
+                return DevicePtrs.Any(d => (Status(d).Overflow & (ITCMM.ITC_READ_OVERFLOW_H)) > 0);
             }
         }
 
+        /// <summary>
+        /// True if any unit has underrun.
+        /// </summary>
         public bool Underrun
         {
             get
             {
-                return (Status.Overflow & (ITCMM.ITC_WRITE_UNDERRUN_H)) > 0;
+                return DevicePtrs.Any(d => (Status(d).Overflow & (ITCMM.ITC_WRITE_UNDERRUN_H)) > 0);
             }
         }
 
@@ -263,24 +527,41 @@ namespace Heka
 
         public int AvailableSamples(StreamType channelType, ushort channelNumber)
         {
+            var channel = new ChannelIdentifier { ChannelNumber = channelNumber, ChannelType = (ushort)channelType };
+            return ItcmmCall(_getDataAvailable, channel);
+        }
 
-            ItcmmCall(() => ITCMM.ITC_UpdateNow(DevicePtr, System.IntPtr.Zero));
+        // Primary unit
+        private int GetDataAvailable(ChannelIdentifier channel)
+        {
+            ITCMM.ITC_UpdateNow(DevicePtr, System.IntPtr.Zero);
 
-            ITCMM.ITCChannelDataEx[] channelData = new ITCMM.ITCChannelDataEx[1];
+            _availableQuery[0] = new ITCMM.ITCChannelDataEx
+                                     {
+                                         ChannelType = channel.ChannelType,
+                                         ChannelNumber = channel.ChannelNumber
+                                     };
 
-            channelData[0].ChannelType = (ushort)channelType;
-            channelData[0].ChannelNumber = channelNumber;
-
-            uint err = ItcmmCall(() => ITCMM.ITC_GetDataAvailable(DevicePtr, 1, channelData));
+            uint err = ITCMM.ITC_GetDataAvailable(DevicePtr, 1, _availableQuery);
             if (err != ITCMM.ACQ_SUCCESS)
             {
                 throw new HekaDAQException("Unable to get available FIFO points", err);
             }
 
-            return channelData[0].Value;
+            return _availableQuery[0].Value;
+        }
+
+        public int MaxAvailableSamples(HekaDAQStream stream)
+        {
+            return MaxAvailableSamples(DevicePtrFor(stream), stream.ChannelType, stream.ChannelNumber);
         }
 
         public int MaxAvailableSamples(StreamType channelType, ushort channelNumber)
+        {
+            return MaxAvailableSamples(DevicePtr, channelType, channelNumber);
+        }
+
+        private int MaxAvailableSamples(IntPtr dev, StreamType channelType, ushort channelNumber)
         {
 
             ITCMM.ITCChannelDataEx info = new ITCMM.ITCChannelDataEx();
@@ -290,7 +571,7 @@ namespace Heka
 
             var infoArr = new ITCMM.ITCChannelDataEx[1];
             infoArr[0] = info;
-            uint err = ItcmmCall(() => ITCMM.ITC_GetFIFOInformation(DevicePtr, 1, infoArr));
+            uint err = ItcmmCall(() => ITCMM.ITC_GetFIFOInformation(dev, 1, infoArr));
             if (err != ITCMM.ACQ_SUCCESS)
             {
                 throw new HekaDAQException("Unable to get FIFO information", err);
@@ -303,44 +584,94 @@ namespace Heka
 
         public static IEnumerable<HekaDAQController> AvailableControllers()
         {
-            var result = new List<HekaDAQController>();
+            return HekaDeviceDiscovery.Units()
+                .Select(u => new HekaDAQController(u.Key, u.Value))
+                .ToList();
+        }
 
-            for (uint deviceType = 0; deviceType < ITCMM.MAX_DEVICE_TYPE_NUMBER; deviceType++)
-            {
-                if (deviceType == ITCMM.ITC00_ID)
-                    continue;
+        private static readonly ILog log = LogManager.GetLogger(typeof(QueuedHekaHardwareDevice));
 
-                uint numDevices = 0;
-                uint err = ITCMM.ITC_Devices(deviceType, ref numDevices);
-                if (err != ITCMM.ACQ_SUCCESS)
+        internal static IHekaDevice OpenDevice(uint deviceType, uint deviceNumber, out ITCMM.GlobalDeviceInfo deviceInfo)
+        {
+            IntPtr dev = OpenUnit(deviceType, deviceNumber, out deviceInfo);
+            return new QueuedHekaHardwareDevice(dev, InputStreamCount(deviceInfo), OutputStreamCount(deviceInfo))
                 {
-                    throw new HekaDAQException("Unable to find devices", err);
-                }
+                    DeviceType = deviceType,
+                    DeviceNumbers = new[] { deviceNumber }
+                };
+        }
+
+        /// <summary>
+        /// Opens several ITC units as one device. The first unit is the primary; its clock and device
+        /// info are reported by the device. If any unit fails to open, the units already opened are closed.
+        /// </summary>
+        internal static IHekaDevice OpenDevices(uint deviceType, IList<uint> deviceNumbers, out ITCMM.GlobalDeviceInfo[] deviceInfos)
+        {
+            if (deviceNumbers.Count == 0)
+                throw new ArgumentException("At least one device number is required", "deviceNumbers");
 
-                for (uint deviceNumber = 0; deviceNumber < numDevices; deviceNumber++)
+            var devs = new List<IntPtr>();
+            var infos = new List<ITCMM.GlobalDeviceInfo>();
+            try
+            {
+                foreach (var deviceNumber in deviceNumbers)
                 {
-                    result.Add(new HekaDAQController(deviceType, deviceNumber));
+                    ITCMM.GlobalDeviceInfo info;
+                    devs.Add(OpenUnit(deviceType, deviceNumber, out info));
+                    infos.Add(info);
                 }
-
+            }
+            catch (HekaDAQException)
+            {
+                for (int i = 0; i < devs.Count; i++)
+                {
+                    HekaDeviceDiscovery.Release(deviceType, deviceNumbers[i], devs[i]);
+                }
+                throw;
             }
 
-            return result;
+            deviceInfos = infos.ToArray();
+            return new QueuedHekaHardwareDevice(devs,
+                                                (uint)infos.Sum(i => InputStreamCount(i)),
+                                                (uint)infos.Sum(i => OutputStreamCount(i)))
+                {
+                    DeviceType = deviceType,
+                    DeviceNumbers = deviceNumbers.ToList()
+                };
         }
 
-        private static readonly ILog log = LogManager.GetLogger(typeof(QueuedHekaHardwareDevice));
+        private static uint InputStreamCount(ITCMM.GlobalDeviceInfo deviceInfo)
+        {
+            return deviceInfo.NumberOfADCs + deviceInfo.NumberOfDIs + deviceInfo.NumberOfAUXIs;
+        }
 
-        internal static IHekaDevice OpenDevice(uint deviceType, uint deviceNumber, out ITCMM.GlobalDeviceInfo deviceInfo)
+        private static uint OutputStreamCount(ITCMM.GlobalDeviceInfo deviceInfo)
+        {
+            return deviceInfo.NumberOfDACs + deviceInfo.NumberOfDOs + deviceInfo.NumberOfAUXOs;
+        }
+
+        // Takes the unit back from HekaDeviceDiscovery when it was kept warm; otherwise opens, inits
+        // and configures it
+        private static IntPtr OpenUnit(uint deviceType, uint deviceNumber, out ITCMM.GlobalDeviceInfo deviceInfo)
         {
             IntPtr dev;
 
-            uint numDevices = 0;
-            uint err = ITCMM.ITC_Devices(deviceType, ref numDevices);
+            if (HekaDeviceDiscovery.TakeWarmUnit(deviceType, deviceNumber, out dev, out deviceInfo))
+            {
+                HekaDeviceDiscovery.Opened(deviceType, deviceNumber, deviceInfo);
+                return dev;
+            }
+
+            HekaDeviceDiscovery.EnsureEnumerated();
+
+            uint err = ITCMM.ITC_OpenDevice(deviceType, deviceNumber, ITCMM.SMART_MODE, out dev);
             if (err != ITCMM.ACQ_SUCCESS)
             {
-                throw new HekaDAQException("Unable to find devices", err);
+                // The unit may have been plugged in since the units were enumerated
+                HekaDeviceDiscovery.Refresh();
+                err = ITCMM.ITC_OpenDevice(deviceType, deviceNumber, ITCMM.SMART_MODE, out dev);
             }
 
-            err = ITCMM.ITC_OpenDevice(deviceType, deviceNumber, ITCMM.SMART_MODE, out dev);
             if (err != ITCMM.ACQ_SUCCESS)
             {
                 log.Error("Unable to open ITC device");
@@ -359,6 +690,7 @@ namespace Heka
             err = ITCMM.ITC_ConfigDevice(dev, ref config);
             if (err != ITCMM.ACQ_SUCCESS)
             {
+                ITCMM.ITC_CloseDevice(dev);
                 throw new HekaDAQException("Unable to configure device", err);
             }
 
@@ -366,79 +698,142 @@ namespace Heka
             err = ITCMM.ITC_GetDeviceInfo(dev, ref deviceInfo);
             if (err != ITCMM.ACQ_SUCCESS)
             {
+                ITCMM.ITC_CloseDevice(dev);
                 throw new HekaDAQException("Unable to get device info", err);
             }
-            return new QueuedHekaHardwareDevice(dev,
-                                          deviceInfo.NumberOfADCs + deviceInfo.NumberOfDIs +
-                                          deviceInfo.NumberOfAUXIs,
-                                          deviceInfo.NumberOfDACs + deviceInfo.NumberOfDOs +
-                                          deviceInfo.NumberOfAUXOs
-                );
+
+            HekaDeviceDiscovery.Opened(deviceType, deviceNumber, deviceInfo);
+            return dev;
         }
 
+        /// <summary>
+        /// Releases the device's units. Units opened by OpenDevice or OpenDevices are handed back to
+        /// HekaDeviceDiscovery, which keeps them initialized for the next open while
+        /// HekaDeviceDiscovery.KeepUnitsWarm is set.
+        /// </summary>
         public void CloseDevice()
         {
-
-            uint err = ItcmmCall(() => ITCMM.ITC_CloseDevice(DevicePtr));
-            if (err != ITCMM.ACQ_SUCCESS)
+            for (int i = 0; i < DevicePtrs.Count; i++)
             {
-                throw new HekaDAQException("Unable to close device", err);
+                var d = DevicePtrs[i];
+                if (DeviceNumbers != null)
+                {
+                    var deviceNumber = DeviceNumbers[i];
+                    ItcmmCall(() => HekaDeviceDiscovery.Release(DeviceType, deviceNumber, d));
+                    continue;
+                }
+
+                uint err = ItcmmCall(() => ITCMM.ITC_CloseDevice(d));
+                if (err != ITCMM.ACQ_SUCCESS)
+                {
+                    throw new HekaDAQException("Unable to close device", err);
+                }
             }
 
-            _cts.Cancel();
+            _deviceThread.Dispose();
         }
 
         public void ConfigureChannels(IEnumerable<HekaDAQStream> streams)
         {
+            var streamList = streams.ToList();
 
-            uint err = ItcmmCall(() => ITCMM.ITC_ResetChannels(DevicePtr));
-            if (err != ITCMM.ACQ_SUCCESS)
+            for (int i = 0; i < DevicePtrs.Count; i++)
             {
-                throw new HekaDAQException("Channel Reset", err);
-            }
+                var dev = DevicePtrs[i];
 
-            var infoList = streams
-                .Select((s) => s.ChannelInfo);
+                uint err = ItcmmCall(() => ITCMM.ITC_ResetChannels(dev));
+                if (err != ITCMM.ACQ_SUCCESS)
+                {
+                    throw new HekaDAQException("Channel Reset", err);
+                }
 
-            err = ItcmmCall(() => ITCMM.ITC_SetChannels(DevicePtr, (uint)infoList.Count(), infoList.ToArray()));
-            if (err != ITCMM.ACQ_SUCCESS)
-            {
-                throw new HekaDAQException("Set Channels", err);
-            }
+                var unit = i;
+                var infoList = streamList
+                    .Where(s => s.DeviceIndex == unit)
+                    .Select((s) => s.ChannelInfo)
+                    .ToArray();
 
-            err = ItcmmCall(() => ITCMM.ITC_UpdateChannels(DevicePtr));
-            if (err != ITCMM.ACQ_SUCCESS)
-            {
-                throw new HekaDAQException("Update Channels", err);
+                err = ItcmmCall(() => ITCMM.ITC_SetChannels(dev, (uint)infoList.Length, infoList));
+                if (err != ITCMM.ACQ_SUCCESS)
+                {
+                    throw new HekaDAQException("Set Channels", err);
+                }
+
+                err = ItcmmCall(() => ITCMM.ITC_UpdateChannels(dev));
+                if (err != ITCMM.ACQ_SUCCESS)
+                {
+                    throw new HekaDAQException("Update Channels", err);
+                }
             }
+
+            var outputs = streamList
+                .OfType<IDAQOutputStream>()
+                .Cast<HekaDAQStream>()
+                .Select(ChannelIdentifierFor)
+                .ToList();
+            var inputs = streamList
+                .OfType<IDAQInputStream>()
+                .Cast<HekaDAQStream>()
+                .Select(ChannelIdentifierFor)
+                .ToList();
+
+            // Size the bridge's per-channel ring buffers once, to the largest hardware FIFO
+            int capacity = streamList
+                .Select(MaxAvailableSamples)
+                .DefaultIfEmpty(0)
+                .Max();
+
+            ItcmmCall(() => Bridge.ConfigureBuffers(outputs, inputs, capacity));
+
+            // Lets the bridge estimate how long until the next transfer block is ready
+            Bridge.SampleRate = streamList
+                .Where(s => s.SampleRate != null)
+                .Select(s => (double)s.SampleRate.QuantityInBaseUnits)
+                .DefaultIfEmpty(0)
+                .Max();
         }
 
+        /// <summary>
+        /// Starts all units. Secondary units are armed first on their external trigger input, which must be
+        /// wired to the primary unit's trigger output (or to the same external trigger), so that every unit
+        /// starts on the same clock edge as the primary.
+        /// </summary>
         public void StartHardware(bool waitForTrigger)
         {
+            // FIFOs are reset on start, so the hardware sample count restarts from zero
+            Bridge.ResetSampleClock();
 
-            var startInfo = new ITCMM.ITCStartInfo
-                                {
-                                    ExternalTrigger = (uint)(waitForTrigger ? 1 : 0),
-                                    OutputEnable = 1,
-                                    StopOnOverflow = 1,
-                                    StopOnUnderrun = 1,
-                                    ResetFIFOs = 1,
-                                };
-            //TODO test waitForTrigger set
-
-            uint err = ItcmmCall(() => ITCMM.ITC_Start(DevicePtr, ref startInfo));
-            if (err != ITCMM.ACQ_SUCCESS)
+            for (int i = DevicePtrs.Count - 1; i >= 0; i--)
             {
-                throw new HekaDAQException("Unable to start device", err);
+                var dev = DevicePtrs[i];
+                var startInfo = new ITCMM.ITCStartInfo
+                                    {
+                                        ExternalTrigger = (uint)(waitForTrigger || i > 0 ? 1 : 0),
+                                        OutputEnable = 1,
+                                        StopOnOverflow = 1,
+                                        StopOnUnderrun = 1,
+                                        ResetFIFOs = 1,
+                                    };
+                //TODO test waitForTrigger set
+
+                uint err = ItcmmCall(() => ITCMM.ITC_Start(dev, ref startInfo));
+                if (err != ITCMM.ACQ_SUCCESS)
+                {
+                    throw new HekaDAQException("Unable to start device", err);
+                }
             }
         }
 
         public void StopHardware()
         {
-            uint err = ItcmmCall(() => ITCMM.ITC_Stop(DevicePtr, IntPtr.Zero));
-            if (err != ITCMM.ACQ_SUCCESS)
+            foreach (var dev in DevicePtrs)
             {
-                throw new HekaDAQException("Unable to stop device", err);
+                var d = dev;
+                uint err = ItcmmCall(() => ITCMM.ITC_Stop(d, IntPtr.Zero));
+                if (err != ITCMM.ACQ_SUCCESS)
+                {
+                    throw new HekaDAQException("Unable to stop device", err);
+                }
             }
         }
 
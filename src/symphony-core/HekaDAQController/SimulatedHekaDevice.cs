@@ -0,0 +1,508 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading;
+using Heka.NativeInterop;
+using Symphony.Core;
+
+namespace Heka
+{
+    /// <summary>
+    /// Simulated ITC-18 units for a HekaDAQController constructed with
+    /// HekaDAQController(HekaSimulationOptions, IClock).
+    /// </summary>
+    public sealed class HekaSimulationOptions
+    {
+        public HekaSimulationOptions()
+        {
+            DeviceCount = 1;
+            FifoDepth = 16384;
+            Speed = 1;
+            Loopback = true;
+            SyntheticPeriodSamples = 1000;
+        }
+
+        /// <summary>
+        /// Units acquiring together; more than one forces native streaming, as for hardware.
+        /// </summary>
+        public int DeviceCount { get; set; }
+
+        /// <summary>
+        /// Per-channel FIFO depth, in samples.
+        /// </summary>
+        public uint FifoDepth { get; set; }
+
+        /// <summary>
+        /// Sample clock rate as a multiple of the controller's sample rate. Above 1 the pipeline runs
+        /// faster than real time.
+        /// </summary>
+        public double Speed { get; set; }
+
+        /// <summary>
+        /// Host time charged to every driver call, and to every sample moved through the FIFOs.
+        /// </summary>
+        public double CallLatencyMicroseconds { get; set; }
+        public double SampleLatencyNanoseconds { get; set; }
+
+        /// <summary>
+        /// If true (the default), each input acquires the output of the same kind and number a few
+        /// samples late, as a loopback-wired unit does. Other AI channels acquire a sine of
+        /// SyntheticAmplitude DAQ counts every SyntheticPeriodSamples samples.
+        /// </summary>
+        public bool Loopback { get; set; }
+        public double SyntheticAmplitude { get; set; }
+        public double SyntheticPeriodSamples { get; set; }
+    }
+
+    /// <summary>
+    /// IHekaDevice over simulated ITC-18 units (IOBridge's SimulatedDevice), for load testing the
+    /// acquisition pipeline at production rates without hardware. Transfers run through the same
+    /// IOBridge paths as QueuedHekaHardwareDevice, blocking or natively streamed; only the bridge's
+    /// driver calls go to the simulation instead of ITCMM.
+    /// </summary>
+    sealed class SimulatedHekaDevice : IHekaDevice
+    {
+        private IList<SimulatedDevice> Units { get; set; }
+        private SimulatedDevice Primary { get { return Units[0]; } }
+        private IOBridge Bridge { get; set; }
+        private HekaSimulationOptions Options { get; set; }
+        DateTimeOffset StartupTime { get; set; }
+
+        private readonly IDictionary<ChannelIdentifier, ITCMM.ITCChannelInfo> _channelInfos = new Dictionary<ChannelIdentifier, ITCMM.ITCChannelInfo>();
+        private readonly IDictionary<ChannelIdentifier, short> _asyncOutputs = new Dictionary<ChannelIdentifier, short>();
+
+        private SimulatedHekaDevice(HekaSimulationOptions options)
+        {
+            Options = options;
+            Units = Enumerable.Range(0, options.DeviceCount)
+                .Select(i => new SimulatedDevice
+                                 {
+                                     FifoDepth = options.FifoDepth,
+                                     Speed = options.Speed,
+                                     CallLatencyMicroseconds = options.CallLatencyMicroseconds,
+                                     SampleLatencyNanoseconds = options.SampleLatencyNanoseconds,
+                                     Loopback = options.Loopback,
+                                     SyntheticAmplitude = options.SyntheticAmplitude,
+                                     SyntheticPeriodSamples = options.SyntheticPeriodSamples
+                                 })
+                .ToList();
+
+            var info = DeviceInfoFor(0);
+            uint maxInputs = (uint)Units.Count * (info.NumberOfADCs + info.NumberOfDIs + info.NumberOfAUXIs);
+            uint maxOutputs = (uint)Units.Count * (info.NumberOfDACs + info.NumberOfDOs + info.NumberOfAUXOs);
+
+            Bridge = Units.Count == 1
+                ? new IOBridge(Primary.Handle, maxInputs, maxOutputs)
+                : new IOBridge(Units.Select(u => u.Handle).ToArray(), maxInputs, maxOutputs);
+            Bridge.Driver = SimulatedDevice.Driver;
+
+            StartupTime = DateTimeOffset.Now - TimeSpan.FromSeconds(Primary.Time);
+        }
+
+        internal static IHekaDevice Open(HekaSimulationOptions options, out ITCMM.GlobalDeviceInfo[] deviceInfos)
+        {
+            if (options.DeviceCount < 1)
+                throw new HekaDAQException("A simulation requires at least one device");
+
+            var device = new SimulatedHekaDevice(options);
+            deviceInfos = Enumerable.Range(0, options.DeviceCount)
+                .Select(i => device.DeviceInfoFor((uint)i))
+                .ToArray();
+
+            return device;
+        }
+
+        private ITCMM.GlobalDeviceInfo DeviceInfoFor(uint deviceNumber)
+        {
+            return new ITCMM.GlobalDeviceInfo
+                       {
+                           DeviceType = ITCMM.ITC18_ID,
+                           DeviceNumber = deviceNumber,
+                           PrimaryFIFOSize = Options.FifoDepth,
+                           NumberOfDACs = ITCMM.ITC18_NUMBEROFDACOUTPUTS,
+                           NumberOfADCs = ITCMM.ITC18_NUMBEROFADCINPUTS,
+                           NumberOfDOs = ITCMM.ITC18_NUMBEROFDIGOUTPUTS,
+                           NumberOfDIs = ITCMM.ITC18_NUMBEROFDIGINPUTS,
+                           NumberOfAUXOs = ITCMM.ITC18_NUMBEROFAUXOUTPUTS,
+                           NumberOfAUXIs = ITCMM.ITC18_NUMBEROFAUXINPUTS,
+                           MinimumSamplingInterval = ITCMM.ITC18_MINIMUM_SAMPLING_INTERVAL,
+                           MinimumSamplingStep = ITCMM.ITC18_MINIMUM_SAMPLING_STEP
+                       };
+        }
+
+        // Serializes the call with the bridge's native streaming thread, if running
+        private T WithDriver<T>(Func<T> fn)
+        {
+            Bridge.AcquireDriver();
+            try
+            {
+                return fn();
+            }
+            finally
+            {
+                Bridge.ReleaseDriver();
+            }
+        }
+
+        private void WithDriver(Action fn)
+        {
+            WithDriver(() =>
+                           {
+                               fn();
+                               return 0;
+                           });
+        }
+
+
+        public IEnumerable<KeyValuePair<ChannelIdentifier, short[]>>
+            ReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                      IList<ChannelIdentifier> input,
+                      int nsamples,
+                      CancellationToken token)
+        {
+            return WithDriver(() => Bridge.ReadWrite(output, input, nsamples, token));
+        }
+
+        public int ReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                             IDictionary<ChannelIdentifier, short[]> input,
+                             int nsamples,
+                             CancellationToken token)
+        {
+            return WithDriver(() => Bridge.ReadWrite(output, input, nsamples, token));
+        }
+
+        public int ReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                             int deficitSamples,
+                             IDictionary<ChannelIdentifier, short[]> input,
+                             int nsamples,
+                             CancellationToken token)
+        {
+            return WithDriver(() => Bridge.ReadWrite(output, deficitSamples, input, nsamples, token));
+        }
+
+        public void StartStreaming(IEnumerable<HekaDAQStream> streams)
+        {
+            var streamList = streams.ToList();
+            var outputs = streamList
+                .OfType<IDAQOutputStream>()
+                .Cast<HekaDAQStream>()
+                .Select(ChannelIdentifierFor)
+                .ToList();
+            var backgrounds = streamList
+                .OfType<HekaDAQOutputStream>()
+                .Select(s => (short)Converters.Convert(s.Background, HekaDAQOutputStream.DAQCountUnits).QuantityInBaseUnits)
+                .ToList();
+            var inputs = streamList
+                .OfType<IDAQInputStream>()
+                .Cast<HekaDAQStream>()
+                .Select(ChannelIdentifierFor)
+                .ToList();
+
+            Bridge.StartStreaming(outputs, backgrounds, inputs, (int)Options.FifoDepth);
+        }
+
+        public void StopStreaming()
+        {
+            Bridge.StopStreaming();
+        }
+
+        public string SpillPath
+        {
+            get { return Bridge.SpillPath; }
+            set { Bridge.SpillPath = value; }
+        }
+
+        public bool SpillFailed
+        {
+            get { return Bridge.SpillFailed; }
+        }
+
+        public int StreamReadWrite(IDictionary<ChannelIdentifier, short[]> output,
+                                   IDictionary<ChannelIdentifier, short[]> input,
+                                   int nsamples,
+                                   CancellationToken token)
+        {
+            return Bridge.StreamReadWrite(output, input, nsamples, token);
+        }
+
+        public PollingMode Polling
+        {
+            get { return Bridge.Polling; }
+            set { Bridge.Polling = value; }
+        }
+
+        public uint TransferBlockSamples
+        {
+            get { return Bridge.TransferBlockSamples; }
+            set { Bridge.TransferBlockSamples = value; }
+        }
+
+        public uint ActiveTransferBlockSamples
+        {
+            get { return Bridge.ActiveTransferBlockSamples; }
+        }
+
+        public TimeSpan PollWaitTime
+        {
+            get { return Bridge.PollWaitTime; }
+        }
+
+        public TimeSpan TransferTime
+        {
+            get { return Bridge.TransferTime; }
+        }
+
+        public void ResetPollingStatistics()
+        {
+            Bridge.ResetPollingStatistics();
+        }
+
+        public TransferStatistics TransferStatistics
+        {
+            get { return Bridge.Statistics; }
+        }
+
+        public bool TraceTransfers
+        {
+            get { return Bridge.TraceTransfers; }
+            set { Bridge.TraceTransfers = value; }
+        }
+
+        public TransferTraceEntry[] DumpTransferTrace()
+        {
+            return Bridge.DumpTransferTrace();
+        }
+
+        public void ConfigureFifoWatchdog(uint lowSamples, uint stopSamples)
+        {
+            Bridge.ConfigureFifoWatchdog(lowSamples, stopSamples);
+        }
+
+        public FifoMarginStatus FifoMargin
+        {
+            get { return Bridge.FifoMargin; }
+        }
+
+        public uint StatusCheckInterval
+        {
+            get { return Bridge.StatusCheckInterval; }
+            set { Bridge.StatusCheckInterval = value; }
+        }
+
+        public DriverCallCounts DriverCalls
+        {
+            get { return Bridge.DriverCalls; }
+        }
+
+        public void ResetDriverCalls()
+        {
+            Bridge.ResetDriverCalls();
+        }
+
+        public InputBlockTime LastInputBlock
+        {
+            get { return Bridge.LastInputBlock; }
+        }
+
+        public double SampleClockDriftPpm
+        {
+            get { return Bridge.SampleClockDriftPpm; }
+        }
+
+        private static ChannelIdentifier ChannelIdentifierFor(HekaDAQStream s)
+        {
+            return new ChannelIdentifier { ChannelNumber = s.ChannelNumber, ChannelType = (ushort)s.ChannelType, DeviceIndex = s.DeviceIndex };
+        }
+
+        private SimulatedDevice UnitFor(HekaDAQStream s)
+        {
+            if (s.DeviceIndex >= Units.Count)
+                throw new HekaDAQException("Stream " + s.Name + " belongs to a device that is not open");
+
+            return Units[s.DeviceIndex];
+        }
+
+        public DateTimeOffset Now
+        {
+            get { return StartupTime + TimeSpan.FromSeconds(Primary.Time); }
+        }
+
+        public void SetStreamBackgroundAsyncIO(HekaDAQOutputStream stream)
+        {
+            if (stream != null)
+            {
+                UnitFor(stream);
+
+                lock (_asyncOutputs)
+                {
+                    _asyncOutputs[ChannelIdentifierFor(stream)] =
+                        (short)Converters.Convert(stream.Background, HekaDAQOutputStream.DAQCountUnits).QuantityInBaseUnits;
+                }
+            }
+        }
+
+        /// <summary>
+        /// With loopback, reads the value last written by SetStreamBackgroundAsyncIO to the output
+        /// of the same kind and number; otherwise zero.
+        /// </summary>
+        public IInputData ReadStreamAsyncIO(HekaDAQInputStream stream)
+        {
+            UnitFor(stream);
+
+            short value = 0;
+            if (Options.Loopback)
+            {
+                var source = ChannelIdentifierFor(stream);
+                source.ChannelType = (ushort)(source.ChannelType + 1);
+
+                lock (_asyncOutputs)
+                {
+                    _asyncOutputs.TryGetValue(source, out value);
+                }
+            }
+
+            var inData =
+                new InputData(
+                    new List<IMeasurement> { new Measurement(value, 0, HekaDAQInputStream.DAQCountUnits) },
+                    new Measurement(0, 0, "Hz"),
+                    DateTimeOffset.Now)
+                    .DataWithStreamConfiguration(stream, stream.Configuration);
+
+            return inData.DataWithUnits(stream.MeasurementConversionTarget);
+        }
+
+        public bool Running
+        {
+            get { return Units.All(u => u.Running); }
+        }
+
+        public bool Overflow
+        {
+            get { return Units.Any(u => u.Overflow); }
+        }
+
+        public bool Underrun
+        {
+            get { return Units.Any(u => u.Underrun); }
+        }
+
+        public void CloseDevice()
+        {
+            foreach (var unit in Units)
+            {
+                unit.Stop();
+            }
+        }
+
+        public void ConfigureChannels(IEnumerable<HekaDAQStream> streams)
+        {
+            var streamList = streams.ToList();
+
+            _channelInfos.Clear();
+            foreach (var s in streamList)
+            {
+                _channelInfos[ChannelIdentifierFor(s)] = s.ChannelInfo;
+            }
+
+            for (int i = 0; i < Units.Count; i++)
+            {
+                var unit = i;
+                Units[i].SetChannels(streamList
+                                         .Where(s => s.DeviceIndex == unit)
+                                         .Select(s => s.ChannelInfo)
+                                         .ToArray());
+            }
+
+            var outputs = streamList
+                .OfType<IDAQOutputStream>()
+                .Cast<HekaDAQStream>()
+                .Select(ChannelIdentifierFor)
+                .ToList();
+            var inputs = streamList
+                .OfType<IDAQInputStream>()
+                .Cast<HekaDAQStream>()
+                .Select(ChannelIdentifierFor)
+                .ToList();
+
+            WithDriver(() => Bridge.ConfigureBuffers(outputs, inputs, (int)Options.FifoDepth));
+
+            // The bridge paces its polling on the simulated clock, which runs at Speed times the
+            // stream rate
+            Bridge.SampleRate = streamList
+                .Where(s => s.SampleRate != null)
+                .Select(s => (double)s.SampleRate.QuantityInBaseUnits)
+                .DefaultIfEmpty(0)
+                .Max() * Options.Speed;
+        }
+
+        /// <summary>
+        /// Starts all units at once; the simulation does not wait for an external trigger.
+        /// </summary>
+        public void StartHardware(bool waitForTrigger)
+        {
+            Bridge.ResetSampleClock();
+
+            for (int i = Units.Count - 1; i >= 0; i--)
+            {
+                Units[i].Start();
+            }
+        }
+
+        public void StopHardware()
+        {
+            foreach (var unit in Units)
+            {
+                unit.Stop();
+            }
+        }
+
+        public ITCMM.GlobalDeviceInfo DeviceInfo
+        {
+            get { return DeviceInfoFor(0); }
+        }
+
+        public ITCMM.ITCChannelInfo ChannelInfo(StreamType channelType, ushort channelNumber)
+        {
+            var channel = new ChannelIdentifier { ChannelNumber = channelNumber, ChannelType = (ushort)channelType };
+
+            ITCMM.ITCChannelInfo info;
+            if (!_channelInfos.TryGetValue(channel, out info))
+            {
+                info = new ITCMM.ITCChannelInfo { ChannelNumber = channelNumber, ChannelType = (uint)channelType };
+            }
+
+            return info;
+        }
+
+        public int MaxAvailableSamples(StreamType channelType, ushort channelNumber)
+        {
+            return (int)Options.FifoDepth;
+        }
+
+        public int MaxAvailableSamples(HekaDAQStream stream)
+        {
+            return (int)UnitFor(stream).FifoDepth;
+        }
+
+        public void PreloadSamples(StreamType channelType, ushort channelNumber, IList<short> samples)
+        {
+            var channel = new ChannelIdentifier { ChannelNumber = channelNumber, ChannelType = (ushort)channelType };
+            Preload(new Dictionary<ChannelIdentifier, short[]> { { channel, samples.ToArray() } });
+        }
+
+        public void Preload(IDictionary<ChannelIdentifier, short[]> output)
+        {
+            WithDriver(() => Bridge.Preload(output));
+        }
+
+        public void Preload(IDictionary<ChannelIdentifier, short[]> output, int nsamples)
+        {
+            WithDriver(() => Bridge.Preload(output, nsamples));
+        }
+
+        public void Write(IDictionary<ChannelIdentifier, short[]> output)
+        {
+            WithDriver(() => Bridge.Write(output));
+        }
+    }
+}
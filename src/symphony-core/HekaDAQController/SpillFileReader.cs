@@ -0,0 +1,415 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Linq;
+using System.Text;
+using Heka.NativeInterop;
+using log4net;
+using Symphony.Core;
+
+namespace Heka
+{
+    /// <summary>
+    /// Reads a spill file written by the IOBridge while streaming (see HekaDAQController.SpillDirectory):
+    /// the raw input counts of every channel of a streaming run, in the blocks they were read from the
+    /// hardware FIFO, each with the sample clock observation current when it was read.
+    ///
+    /// A spill file the IOBridge did not close is an orphan, left by a process that died while
+    /// acquiring. A file closed by a run that stopped on an exception is marked kept (see MarkKept).
+    /// RecoverOrphans converts orphans and kept files into epochs. Only whole blocks are read, so a file
+    /// cut off mid-block is read up to its last complete block. Files still being written cannot be read.
+    /// </summary>
+    public sealed class SpillFileReader : IDisposable
+    {
+        public const string Extension = ".itcspill";
+
+        /// <summary>
+        /// Manufacturer of the external devices a recovered epoch's responses are recorded against.
+        /// Each device is named after the stream its channel was acquired on (e.g. "ai0", "dev1_ai0").
+        /// </summary>
+        public const string RecoveredManufacturer = "Recovered spill";
+
+        /// <summary>
+        /// Keyword of recovered epochs.
+        /// </summary>
+        public const string RecoveredKeyword = "recovered";
+        public const string RecoveredFromProperty = "recoveredFrom";
+
+        // Layout of SpillFileHeader, SpillChannel and SpillRecord (HekaIOBridge/SpillFile.h)
+        private const string MAGIC = "SYMSPILL";
+        private const uint VERSION = 1;
+        private const uint RECORD_MARKER = 0x314B4C42;
+        private const int HEADER_BYTES = 64;
+        private const int CHANNEL_BYTES = 8;
+        private const int RECORD_BYTES = 32;
+        private const int CLOSED_OFFSET = 20;
+        private const uint CLOSED_KEPT = 2;
+
+        private readonly MemoryMappedFile _file;
+        private readonly MemoryMappedViewAccessor _view;
+        private readonly long _headerBytes;
+        private readonly long _committedBytes;
+        private readonly long _tickFrequency;
+        private readonly long _startTicks;
+        private IList<Block> _blocks;
+
+        private static readonly ILog log = LogManager.GetLogger(typeof(SpillFileReader));
+
+        /// <summary>
+        /// Maps the spill file at path for reading.
+        /// </summary>
+        /// <exception cref="HekaDAQException">If path is not a spill file</exception>
+        public SpillFileReader(string path)
+        {
+            Path = path;
+
+            long length = new FileInfo(path).Length;
+            if (length < HEADER_BYTES)
+                throw new HekaDAQException("Not a spill file: " + path);
+
+            _file = MemoryMappedFile.CreateFromFile(path, FileMode.Open, null, 0, MemoryMappedFileAccess.Read);
+            try
+            {
+                _view = _file.CreateViewAccessor(0, 0, MemoryMappedFileAccess.Read);
+
+                var magic = new byte[MAGIC.Length];
+                _view.ReadArray(0, magic, 0, magic.Length);
+                if (Encoding.ASCII.GetString(magic) != MAGIC)
+                    throw new HekaDAQException("Not a spill file: " + path);
+
+                uint version = _view.ReadUInt32(8);
+                if (version != VERSION)
+                    throw new HekaDAQException("Unsupported spill file version " + version + ": " + path);
+
+                int channelCount = (int)_view.ReadUInt32(12);
+                _headerBytes = _view.ReadUInt32(16);
+                uint closed = _view.ReadUInt32(CLOSED_OFFSET);
+                Closed = closed != 0;
+                Kept = closed == CLOSED_KEPT;
+                SampleRate = _view.ReadDouble(24);
+                _tickFrequency = _view.ReadInt64(32);
+                _startTicks = _view.ReadInt64(40);
+                StartTime = DateTimeOffset.FromFileTime(_view.ReadInt64(48));
+                _committedBytes = Math.Min(_view.ReadInt64(56), length);
+
+                if (_headerBytes < HEADER_BYTES + channelCount * CHANNEL_BYTES || _headerBytes > length)
+                    throw new HekaDAQException("Corrupt spill file header: " + path);
+
+                var channels = new List<ChannelIdentifier>(channelCount);
+                for (int c = 0; c < channelCount; c++)
+                {
+                    long p = HEADER_BYTES + c * CHANNEL_BYTES;
+                    channels.Add(new ChannelIdentifier
+                                     {
+                                         ChannelType = _view.ReadUInt16(p),
+                                         ChannelNumber = _view.ReadUInt16(p + 2),
+                                         DeviceIndex = _view.ReadUInt16(p + 4)
+                                     });
+                }
+                Channels = channels;
+            }
+            catch
+            {
+                Dispose();
+                throw;
+            }
+        }
+
+        public string Path { get; private set; }
+
+        /// <summary>
+        /// Input channels, in the order their samples are stored.
+        /// </summary>
+        public IList<ChannelIdentifier> Channels { get; private set; }
+
+        /// <summary>
+        /// Per-channel sampling rate (Hz).
+        /// </summary>
+        public double SampleRate { get; private set; }
+
+        /// <summary>
+        /// Time the streaming run created the file.
+        /// </summary>
+        public DateTimeOffset StartTime { get; private set; }
+
+        /// <summary>
+        /// False for an orphan.
+        /// </summary>
+        public bool Closed { get; private set; }
+
+        /// <summary>
+        /// True if the file was closed by a failed run and kept for recovery (see MarkKept).
+        /// </summary>
+        public bool Kept { get; private set; }
+
+        /// <summary>
+        /// Samples of each channel in the file.
+        /// </summary>
+        public long Samples
+        {
+            get { return Blocks.Sum(b => (long)b.Samples); }
+        }
+
+        /// <summary>
+        /// First sample of each block with the host time (Stopwatch ticks) it was acquired, estimated
+        /// from the block's sample clock observation; HostTicks is 0 if there was none.
+        /// </summary>
+        public IEnumerable<InputBlockTime> BlockTimes
+        {
+            get
+            {
+                return Blocks.Select(b => new InputBlockTime
+                                              {
+                                                  FirstSample = b.FirstSample,
+                                                  HostTicks = HostTicks(b)
+                                              });
+            }
+        }
+
+        /// <summary>
+        /// Time the first sample in the file was acquired.
+        /// </summary>
+        public DateTimeOffset FirstSampleTime
+        {
+            get
+            {
+                var first = Blocks.FirstOrDefault();
+                long ticks = first == null ? 0 : HostTicks(first);
+                if (ticks == 0 || _tickFrequency <= 0)
+                    return StartTime;
+
+                return StartTime + TimeSpan.FromSeconds((double)(ticks - _startTicks) / _tickFrequency);
+            }
+        }
+
+        /// <summary>
+        /// Reads every sample of the given channel, in ADC counts.
+        /// </summary>
+        public short[] ReadChannel(int channel)
+        {
+            if (channel < 0 || channel >= Channels.Count)
+                throw new ArgumentOutOfRangeException("channel");
+
+            var samples = new short[Samples];
+            long n = 0;
+            foreach (var b in Blocks)
+            {
+                long p = b.Position + RECORD_BYTES + (long)channel * b.Samples * sizeof(short);
+                _view.ReadArray(p, samples, (int)n, b.Samples);
+                n += b.Samples;
+            }
+
+            return samples;
+        }
+
+        /// <summary>
+        /// Builds an epoch holding a response for each channel, recorded against an external device of
+        /// RecoveredManufacturer named after the channel's stream. Analog inputs are converted to volts;
+        /// other channels are left in counts. The epoch starts at FirstSampleTime, carried by a background
+        /// of each device, and is marked with RecoveredKeyword and RecoveredFromProperty.
+        /// </summary>
+        public Epoch ToEpoch(string protocolID)
+        {
+            var epoch = new Epoch(protocolID);
+            epoch.Keywords.Add(RecoveredKeyword);
+            epoch.Properties[RecoveredFromProperty] = Path;
+
+            var sampleRate = new Measurement((decimal)SampleRate, "Hz");
+            var inputTime = FirstSampleTime;
+
+            for (int c = 0; c < Channels.Count; c++)
+            {
+                var channel = Channels[c];
+                var counts = ReadChannel(c);
+
+                SampleData data;
+                string units;
+                if (channel.ChannelType == ITCMM.D2H)
+                {
+                    var volts = new double[counts.Length];
+                    SampleConverter.CountsToVolts(counts, volts, counts.Length);
+                    data = new SampleData(volts, 0, "V");
+                    units = "V";
+                }
+                else
+                {
+                    data = new SampleData(counts, 0, Measurement.UNITLESS);
+                    units = Measurement.UNITLESS;
+                }
+
+                var device = new UnitConvertingExternalDevice(StreamName(channel), RecoveredManufacturer,
+                                                              new Measurement(0, units));
+
+                var response = new Response();
+                response.AppendData(new InputData(data, sampleRate, inputTime));
+                epoch.Responses[device] = response;
+
+                // An epoch's start time comes from its stimuli and backgrounds
+                epoch.SetBackground(device, new Measurement(0, units), sampleRate);
+                epoch.Backgrounds[device].DidOutputData(inputTime, response.Duration,
+                                                        Enumerable.Empty<IPipelineNodeConfiguration>());
+            }
+
+            return epoch;
+        }
+
+        /// <summary>
+        /// Spill files in directory that were never closed, or were kept by a failed run.
+        /// </summary>
+        public static IList<string> FindOrphans(string directory)
+        {
+            var orphans = new List<string>();
+            foreach (var path in Directory.EnumerateFiles(directory, "*" + Extension))
+            {
+                try
+                {
+                    using (var reader = new SpillFileReader(path))
+                    {
+                        if (!reader.Closed || reader.Kept)
+                            orphans.Add(path);
+                    }
+                }
+                catch (Exception x)
+                {
+                    log.WarnFormat("Skipping unreadable spill file {0}: {1}", path, x.Message);
+                }
+            }
+
+            return orphans;
+        }
+
+        /// <summary>
+        /// Serializes each orphan in directory, oldest first, as an epoch (see ToEpoch) of the persistor's
+        /// current epoch block, then deletes it.
+        /// </summary>
+        /// <returns>Number of epochs recovered</returns>
+        /// <exception cref="InvalidOperationException">If the persistor has no open epoch block</exception>
+        public static int RecoverOrphans(string directory, IEpochPersistor persistor)
+        {
+            if (persistor.CurrentEpochBlock == null)
+                throw new InvalidOperationException("There is no open epoch block");
+
+            string protocolID = persistor.CurrentEpochBlock.ProtocolID;
+
+            int recovered = 0;
+            foreach (var path in FindOrphans(directory).OrderBy(File.GetCreationTimeUtc))
+            {
+                using (var reader = new SpillFileReader(path))
+                {
+                    if (reader.Samples > 0)
+                    {
+                        persistor.Serialize(reader.ToEpoch(protocolID));
+                        recovered++;
+                    }
+                }
+
+                File.Delete(path);
+                log.InfoFormat("Recovered spill file {0}", path);
+            }
+
+            return recovered;
+        }
+
+        /// <summary>
+        /// Marks a closed spill file as kept, so that FindOrphans and RecoverOrphans include it.
+        /// </summary>
+        /// <exception cref="HekaDAQException">If path is not a closed spill file</exception>
+        public static void MarkKept(string path)
+        {
+            using (var reader = new SpillFileReader(path))
+            {
+                if (!reader.Closed)
+                    throw new HekaDAQException("Spill file is still open: " + path);
+            }
+
+            using (var stream = new FileStream(path, FileMode.Open, FileAccess.Write, FileShare.Read))
+            using (var writer = new BinaryWriter(stream))
+            {
+                stream.Position = CLOSED_OFFSET;
+                writer.Write(CLOSED_KEPT);
+            }
+        }
+
+        public void Dispose()
+        {
+            if (_view != null)
+                _view.Dispose();
+
+            if (_file != null)
+                _file.Dispose();
+        }
+
+        // Matches the stream names HekaDAQController gives its channels
+        private static string StreamName(ChannelIdentifier channel)
+        {
+            string prefix = channel.DeviceIndex > 0 ? String.Format("dev{0}_", channel.DeviceIndex) : "";
+
+            switch ((StreamType)channel.ChannelType)
+            {
+                case StreamType.AI:
+                    return String.Format("{0}ai{1}", prefix, channel.ChannelNumber);
+                case StreamType.DI_PORT:
+                    return String.Format("{0}diport{1}", prefix, channel.ChannelNumber);
+                case StreamType.XI:
+                    return String.Format("{0}xi{1}", prefix, channel.ChannelNumber);
+                default:
+                    return String.Format("{0}ch{1}_{2}", prefix, channel.ChannelType, channel.ChannelNumber);
+            }
+        }
+
+        private long HostTicks(Block b)
+        {
+            if (b.ClockTicks == 0 || SampleRate <= 0)
+                return 0;
+
+            return b.ClockTicks - (long)((b.ClockSample - b.FirstSample) * _tickFrequency / SampleRate);
+        }
+
+        private IList<Block> Blocks
+        {
+            get { return _blocks ?? (_blocks = ReadBlocks()); }
+        }
+
+        private IList<Block> ReadBlocks()
+        {
+            var blocks = new List<Block>();
+            long expected = 0;
+            long bytesPerSample = Channels.Count * sizeof(short);
+
+            for (long p = _headerBytes; p + RECORD_BYTES <= _committedBytes;)
+            {
+                var b = new Block
+                            {
+                                Position = p,
+                                Samples = (int)_view.ReadUInt32(p + 4),
+                                FirstSample = _view.ReadInt64(p + 8),
+                                ClockSample = _view.ReadInt64(p + 16),
+                                ClockTicks = _view.ReadInt64(p + 24)
+                            };
+
+                long end = p + ((RECORD_BYTES + b.Samples * bytesPerSample + 7) & ~7L);
+                if (_view.ReadUInt32(p) != RECORD_MARKER || b.FirstSample != expected || end > _committedBytes)
+                {
+                    log.WarnFormat("Spill file {0} is corrupt after sample {1}", Path, expected);
+                    break;
+                }
+
+                blocks.Add(b);
+                expected += b.Samples;
+                p = end;
+            }
+
+            return blocks;
+        }
+
+        private sealed class Block
+        {
+            public long Position;
+            public int Samples;
+            public long FirstSample;
+            public long ClockSample;
+            public long ClockTicks;
+        }
+    }
+}
@@ -0,0 +1,316 @@
+#include "gtest/gtest.h"
+
+#include <windows.h>
+
+#include "SimulatedItc.h"
+#include "0acqerrors.h"
+
+#include <vector>
+
+using namespace std;
+using namespace Heka;
+
+namespace {
+
+	// One loopback pair (AO0 -> AI0) with a stepped clock
+	class SimulatedItcTests : public ::testing::Test
+	{
+	protected:
+		static const uint32_t DEPTH = 1000;
+		static const uint32_t STEP = 100;
+
+		SimulatedItcTests()
+		{
+			SimulatedItcConfig config;
+			config.fifoDepth = DEPTH;
+			config.samplesPerUpdate = STEP;
+			config.pipelineSamples = 3;
+			itc = new SimulatedItc(config);
+
+			ITCChannelInfo info[2];
+			ZeroMemory(info, sizeof(info));
+			info[0].ChannelType = H2D;
+			info[0].ChannelNumber = 0;
+			info[0].HardwareUnderrunValue = 7;
+			info[1].ChannelType = D2H;
+			info[1].ChannelNumber = 0;
+			itc->SetChannels(info, 2);
+
+			driver = SimulatedItc::Driver();
+		}
+
+		~SimulatedItcTests() { delete itc; }
+
+		unsigned long Write(const itcsample_t *samples, unsigned long n, unsigned long command = 0)
+		{
+			ITCChannelDataEx data;
+			ZeroMemory(&data, sizeof(data));
+			data.ChannelType = H2D;
+			data.ChannelNumber = 0;
+			data.Command = command;
+			data.Value = n;
+			data.DataPointer = (void *) samples;
+			return driver->ReadWriteFIFO(itc->Handle(), 1, &data);
+		}
+
+		unsigned long Read(itcsample_t *samples, unsigned long n)
+		{
+			ITCChannelDataEx data;
+			ZeroMemory(&data, sizeof(data));
+			data.ChannelType = D2H;
+			data.ChannelNumber = 0;
+			data.Value = n;
+			data.DataPointer = samples;
+			return driver->ReadWriteFIFO(itc->Handle(), 1, &data);
+		}
+
+		unsigned long Available(unsigned long type)
+		{
+			ITCChannelDataEx data;
+			ZeroMemory(&data, sizeof(data));
+			data.ChannelType = type;
+			data.ChannelNumber = 0;
+			EXPECT_EQ(ACQ_SUCCESS, driver->GetDataAvailable(itc->Handle(), 1, &data));
+			return data.Value;
+		}
+
+		ITCStatus State()
+		{
+			ITCStatus status;
+			ZeroMemory(&status, sizeof(status));
+			EXPECT_EQ(ACQ_SUCCESS, driver->GetState(itc->Handle(), &status));
+			return status;
+		}
+
+		SimulatedItc *itc;
+		const ItcDriver *driver;
+	};
+
+	const uint32_t SimulatedItcTests::DEPTH;
+	const uint32_t SimulatedItcTests::STEP;
+
+	TEST_F(SimulatedItcTests, ShouldLoopOutputBackToInputAfterPipeline)
+	{
+		vector<itcsample_t> out(DEPTH);
+		for(size_t i=0; i < out.size(); i++) {
+			out[i] = (itcsample_t) (i + 1);
+		}
+
+		ASSERT_EQ(ACQ_SUCCESS, Write(out.data(), DEPTH));
+		EXPECT_EQ(0u, Available(H2D));
+
+		itc->Start();
+		driver->UpdateNow(itc->Handle(), NULL);
+		driver->UpdateNow(itc->Handle(), NULL);
+
+		EXPECT_EQ(2 * STEP, Available(H2D));
+		ASSERT_EQ(2 * STEP, Available(D2H));
+
+		vector<itcsample_t> in(2 * STEP);
+		ASSERT_EQ(ACQ_SUCCESS, Read(in.data(), 2 * STEP));
+		EXPECT_EQ(0, in[0]);
+		EXPECT_EQ(0, in[2]);
+		for(size_t i=3; i < in.size(); i++) {
+			EXPECT_EQ(out[i - 3], in[i]);
+		}
+
+		EXPECT_TRUE(itc->IsRunning());
+		EXPECT_EQ(2 * STEP, itc->SamplesClocked());
+	}
+
+	TEST_F(SimulatedItcTests, ShouldStopWithUnderrunWhenOutputRunsOut)
+	{
+		vector<itcsample_t> out(STEP / 2, 1);
+		ASSERT_EQ(ACQ_SUCCESS, Write(out.data(), (unsigned long) out.size()));
+
+		itc->Start();
+		driver->UpdateNow(itc->Handle(), NULL);
+
+		ITCStatus status = State();
+		EXPECT_FALSE((status.RunningMode & RUN_STATE) != 0);
+		EXPECT_TRUE((status.RunningMode & ERROR_STATE) != 0);
+		EXPECT_TRUE((status.Overflow & ITC_WRITE_UNDERRUN_H) != 0);
+		EXPECT_TRUE(itc->Underrun());
+
+		// The rest of the step is filled with HardwareUnderrunValue
+		vector<itcsample_t> in(STEP);
+		ASSERT_EQ(ACQ_SUCCESS, Read(in.data(), STEP));
+		EXPECT_EQ(1, in[3 + STEP / 2 - 1]);
+		EXPECT_EQ(7, in[3 + STEP / 2]);
+	}
+
+	TEST_F(SimulatedItcTests, ShouldStopWithOverflowWhenInputIsNotRead)
+	{
+		vector<itcsample_t> out(DEPTH, 1);
+		ASSERT_EQ(ACQ_SUCCESS, Write(out.data(), DEPTH));
+
+		itc->Start();
+		for(uint32_t n=0; n <= DEPTH / STEP; n++) {
+			ASSERT_EQ(ACQ_SUCCESS, Write(out.data(), Available(H2D)));
+			driver->UpdateNow(itc->Handle(), NULL);
+		}
+
+		ITCStatus status = State();
+		EXPECT_FALSE((status.RunningMode & RUN_STATE) != 0);
+		EXPECT_TRUE((status.Overflow & ITC_READ_OVERFLOW_H) != 0);
+		EXPECT_FALSE(itc->Underrun());
+	}
+
+	TEST_F(SimulatedItcTests, ShouldPlayOutLastBlockAndStopCleanly)
+	{
+		vector<itcsample_t> out(STEP + STEP / 2, 1);
+		ASSERT_EQ(ACQ_SUCCESS, Write(out.data(), (unsigned long) out.size(), LAST_FIFO_COMMAND_EX));
+
+		itc->Start();
+		driver->UpdateNow(itc->Handle(), NULL);
+		EXPECT_TRUE(itc->IsRunning());
+
+		driver->UpdateNow(itc->Handle(), NULL);
+		ITCStatus status = State();
+		EXPECT_EQ(0u, status.RunningMode);
+		EXPECT_EQ(0u, status.Overflow);
+
+		// Nothing more may be written once the last block is in
+		EXPECT_EQ((unsigned long) Error_OutputMode, Write(out.data(), 1));
+	}
+
+	TEST_F(SimulatedItcTests, ShouldRejectTransfersBeyondTheFifo)
+	{
+		vector<itcsample_t> samples(DEPTH + 1, 0);
+		EXPECT_EQ((unsigned long) Error_Parameter, Write(samples.data(), DEPTH + 1));
+		EXPECT_EQ(DEPTH, Available(H2D));
+
+		EXPECT_EQ((unsigned long) Error_Parameter, Read(samples.data(), 1));
+
+		ITCChannelDataEx data;
+		ZeroMemory(&data, sizeof(data));
+		data.ChannelType = D2H;
+		data.ChannelNumber = 5;
+		EXPECT_EQ((unsigned long) Error_ChannelNumber, driver->GetDataAvailable(itc->Handle(), 1, &data));
+	}
+
+	TEST(SimulatedItcSynthesisTests, ShouldSynthesizeInputsWithoutLoopback)
+	{
+		SimulatedItcConfig config;
+		config.fifoDepth = 1000;
+		config.samplesPerUpdate = 400;
+		config.loopback = false;
+		config.syntheticAmplitude = 1000;
+		config.syntheticPeriodSamples = 400;
+		SimulatedItc itc(config);
+
+		ITCChannelInfo info[3];
+		ZeroMemory(info, sizeof(info));
+		info[0].ChannelType = H2D;
+		info[1].ChannelType = D2H;
+		info[2].ChannelType = D2H;
+		info[2].ChannelNumber = 2;
+		itc.SetChannels(info, 3);
+
+		vector<itcsample_t> out(800, 5);
+		ITCChannelDataEx data[2];
+		ZeroMemory(data, sizeof(data));
+		data[0].ChannelType = H2D;
+		data[0].Value = (unsigned long) out.size();
+		data[0].DataPointer = out.data();
+		ASSERT_EQ(ACQ_SUCCESS, SimulatedItc::Driver()->ReadWriteFIFO(itc.Handle(), 1, data));
+
+		itc.Start();
+		SimulatedItc::Driver()->UpdateNow(itc.Handle(), NULL);
+
+		vector<itcsample_t> in0(400), in2(400);
+		data[0].ChannelType = D2H;
+		data[0].ChannelNumber = 0;
+		data[0].Value = 400;
+		data[0].DataPointer = in0.data();
+		data[1].ChannelType = D2H;
+		data[1].ChannelNumber = 2;
+		data[1].Value = 400;
+		data[1].DataPointer = in2.data();
+		ASSERT_EQ(ACQ_SUCCESS, SimulatedItc::Driver()->ReadWriteFIFO(itc.Handle(), 2, data));
+
+		// Sine peaks a quarter period in; channel 2 leads by a quarter period
+		EXPECT_EQ(0, in0[0]);
+		EXPECT_EQ(1000, in0[100]);
+		EXPECT_EQ(-1000, in0[300]);
+		EXPECT_EQ(1000, in2[0]);
+		EXPECT_EQ(in0[150], in2[50]);
+	}
+
+	TEST(SimulatedItcClockTests, ShouldTakeClockRateFromChannels)
+	{
+		SimulatedItcConfig config;
+		config.sampleRate = 1000;
+		SimulatedItc itc(config);
+
+		ITCChannelInfo info;
+		ZeroMemory(&info, sizeof(info));
+		info.ChannelType = D2H;
+		info.SamplingRate = 20000;
+		itc.SetChannels(&info, 1);
+
+		EXPECT_EQ(20000, itc.Config().sampleRate);
+	}
+
+	TEST(SimulatedItcClockTests, ShouldClockFasterThanRealTime)
+	{
+		SimulatedItcConfig config;
+		config.fifoDepth = 1000000;
+		config.sampleRate = 10000;
+		config.speed = 10;
+		SimulatedItc itc(config);
+
+		ITCChannelInfo info;
+		ZeroMemory(&info, sizeof(info));
+		info.ChannelType = D2H;
+		itc.SetChannels(&info, 1);
+
+		itc.Start();
+		Sleep(50);
+		SimulatedItc::Driver()->UpdateNow(itc.Handle(), NULL);
+
+		// 50 ms at ten times 10 kHz
+		EXPECT_GE(itc.SamplesClocked(), 4500);
+		EXPECT_GE(itc.Time(), 0.45);
+	}
+
+	TEST(SimulatedItcClockTests, ShouldClockInRealTime)
+	{
+		SimulatedItcConfig config;
+		config.fifoDepth = 100000;
+		config.sampleRate = 100000;
+		SimulatedItc itc(config);
+
+		ITCChannelInfo info;
+		ZeroMemory(&info, sizeof(info));
+		info.ChannelType = D2H;
+		itc.SetChannels(&info, 1);
+
+		itc.Start();
+		Sleep(50);
+		SimulatedItc::Driver()->UpdateNow(itc.Handle(), NULL);
+
+		// 50 ms at 100 kHz, allowing for a coarse Sleep
+		EXPECT_GE(itc.SamplesClocked(), 4500);
+		EXPECT_LT(itc.SamplesClocked(), 100000);
+		EXPECT_TRUE(itc.IsRunning());
+	}
+
+	TEST(SimulatedItcClockTests, ShouldChargeCallLatency)
+	{
+		SimulatedItcConfig config;
+		config.callLatencyMicroseconds = 200;
+		SimulatedItc itc(config);
+
+		LARGE_INTEGER f, start, end;
+		QueryPerformanceFrequency(&f);
+		QueryPerformanceCounter(&start);
+		for(int i=0; i < 10; i++) {
+			SimulatedItc::Driver()->UpdateNow(itc.Handle(), NULL);
+		}
+		QueryPerformanceCounter(&end);
+
+		EXPECT_EQ(10, itc.DriverCalls());
+		EXPECT_GE((double) (end.QuadPart - start.QuadPart) / f.QuadPart, 10 * 200e-6);
+	}
+}
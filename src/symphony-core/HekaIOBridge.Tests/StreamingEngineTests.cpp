@@ -0,0 +1,352 @@
+#include "gtest/gtest.h"
+
+#include <windows.h>
+
+#include "StreamingEngine.h"
+#include "SpillFile.h"
+#include "SimulatedItc.h"
+#include "0acqerrors.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+using namespace Heka;
+
+namespace {
+
+	// StreamingEngine over a SimulatedItc whose first analog outputs loop back to the matching
+	// analog inputs
+	class StreamingEngineTests : public ::testing::Test
+	{
+	protected:
+		static const uint32_t PIPELINE = 3;
+
+		StreamingEngineTests() : itc(NULL) { InitializeCriticalSection(&driverLock); }
+
+		~StreamingEngineTests()
+		{
+			delete itc;
+			DeleteCriticalSection(&driverLock);
+		}
+
+		void Configure(SimulatedItcConfig config, int channels)
+		{
+			config.pipelineSamples = PIPELINE;
+			itc = new SimulatedItc(config);
+
+			vector<ITCChannelInfo> info(2 * channels);
+			ZeroMemory(info.data(), info.size() * sizeof(ITCChannelInfo));
+			outputs.assign(channels, ITCChannelDataEx());
+			inputs.assign(channels, ITCChannelDataEx());
+			for(int c=0; c < channels; c++) {
+				info[c].ChannelType = H2D;
+				info[c].ChannelNumber = c;
+				info[channels + c].ChannelType = D2H;
+				info[channels + c].ChannelNumber = c;
+
+				ZeroMemory(&outputs[c], sizeof(ITCChannelDataEx));
+				outputs[c].ChannelType = H2D;
+				outputs[c].ChannelNumber = c;
+				ZeroMemory(&inputs[c], sizeof(ITCChannelDataEx));
+				inputs[c].ChannelType = D2H;
+				inputs[c].ChannelNumber = c;
+			}
+			itc->SetChannels(info.data(), (unsigned long) info.size());
+
+			units.assign(channels, 0);
+			backgrounds.assign(channels, 0);
+			monitor.SetFifoDepth(config.fifoDepth);
+			waiter.SetSampleRate(config.sampleRate);
+
+			output.assign(channels, vector<itcsample_t>());
+			input.assign(channels, vector<itcsample_t>());
+		}
+
+		// Distinct ramp per channel, with n samples of background after the first length
+		void Generate(size_t length, size_t tail)
+		{
+			for(size_t c=0; c < output.size(); c++) {
+				output[c].assign(length + tail, 0);
+				for(size_t i=0; i < length; i++) {
+					output[c][i] = (itcsample_t) ((i * (c + 1)) % 30000 + 1);
+				}
+			}
+		}
+
+		void Preload(size_t n)
+		{
+			vector<ITCChannelDataEx> data(outputs);
+			for(size_t c=0; c < data.size(); c++) {
+				data[c].Command = PRELOAD_FIFO_COMMAND_EX;
+				data[c].Value = (unsigned long) n;
+				data[c].DataPointer = output[c].data();
+			}
+
+			ASSERT_EQ(ACQ_SUCCESS, SimulatedItc::Driver()->ReadWriteFIFO(itc->Handle(), (unsigned long) data.size(), data.data()));
+		}
+
+		StreamingEngine *CreateEngine(size_t queueCapacity, unsigned int blockSamples)
+		{
+			void *devices[1] = { itc->Handle() };
+			int n = (int) outputs.size();
+			return new StreamingEngine(devices, 1, SimulatedItc::Driver(), &driverLock, &waiter, &counters, &clock, &monitor, &watchdog,
+				4, outputs.data(), units.data(), backgrounds.data(), n, inputs.data(), units.data(), n,
+				queueCapacity, blockSamples);
+		}
+
+		void Collect(StreamingEngine &engine)
+		{
+			size_t ready = engine.InputAvailable();
+			for(size_t c=0; ready > 0 && c < input.size(); c++) {
+				size_t start = input[c].size();
+				input[c].resize(start + ready);
+				engine.PopInput((int) c, input[c].data() + start, ready);
+			}
+		}
+
+		// Mismatched loopback samples over the first n of every channel
+		int64_t Mismatches(size_t n)
+		{
+			int64_t mismatches = 0;
+			for(size_t c=0; c < input.size(); c++) {
+				for(size_t i=0; i < n; i++) {
+					if(i + PIPELINE >= input[c].size() || input[c][i + PIPELINE] != output[c][i]) {
+						mismatches++;
+					}
+				}
+			}
+			return mismatches;
+		}
+
+		// Channel data and record count of a spill file, read back from disk
+		static bool ReadSpill(const char *path, SpillFileHeader &header, vector<vector<itcsample_t> > &channels, size_t &records)
+		{
+			FILE *f = fopen(path, "rb");
+			if(f == NULL) {
+				return false;
+			}
+
+			vector<uint8_t> bytes;
+			uint8_t buffer[4096];
+			size_t n;
+			while((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+				bytes.insert(bytes.end(), buffer, buffer + n);
+			}
+			fclose(f);
+
+			if(bytes.size() < sizeof(header)) {
+				return false;
+			}
+			memcpy(&header, bytes.data(), sizeof(header));
+
+			channels.assign(header.channelCount, vector<itcsample_t>());
+			records = 0;
+			for(size_t p = header.headerBytes; p < (size_t) header.committedBytes; records++) {
+				SpillRecord record;
+				memcpy(&record, &bytes[p], sizeof(record));
+				if(record.marker != SpillFile::RECORD_MARKER || record.firstSample != (int64_t) channels[0].size()) {
+					return false;
+				}
+				p += sizeof(record);
+
+				for(uint32_t c=0; c < header.channelCount; c++) {
+					const itcsample_t *data = (const itcsample_t *) &bytes[p];
+					channels[c].insert(channels[c].end(), data, data + record.samples);
+					p += record.samples * sizeof(itcsample_t);
+				}
+				p = (p + 7) & ~(size_t) 7;
+			}
+
+			return bytes.size() == (size_t) header.committedBytes;
+		}
+
+		static double Seconds(int64_t ticks)
+		{
+			LARGE_INTEGER f;
+			QueryPerformanceFrequency(&f);
+			return (double) ticks / f.QuadPart;
+		}
+
+		SimulatedItc *itc;
+		CRITICAL_SECTION driverLock;
+		PollWaiter waiter;
+		DriverCounters counters;
+		SampleClock clock;
+		TransferMonitor monitor;
+		FifoWatchdog watchdog;
+
+		vector<ITCChannelDataEx> outputs;
+		vector<ITCChannelDataEx> inputs;
+		vector<int> units;
+		vector<itcsample_t> backgrounds;
+		vector<vector<itcsample_t> > output;
+		vector<vector<itcsample_t> > input;
+	};
+
+	const uint32_t StreamingEngineTests::PIPELINE;
+
+	TEST_F(StreamingEngineTests, ShouldStreamLoopbackWithoutLossAndEndCleanly)
+	{
+		// Stepped clock: the run is the same however fast the host is
+		SimulatedItcConfig config;
+		config.fifoDepth = 2048;
+		config.samplesPerUpdate = 64;
+		Configure(config, 2);
+		waiter.SetMode(POLL_SPIN);
+		watchdog.Configure(0, 512);
+
+		const size_t n = 20000;
+		const size_t preload = 1024;
+		Generate(n, 0);
+		Preload(preload);
+
+		StreamingEngine *engine = CreateEngine(n, 256);
+		for(size_t c=0; c < output.size(); c++) {
+			ASSERT_EQ(n - preload, engine->PushOutput((int) c, output[c].data() + preload, n - preload));
+		}
+
+		itc->Start();
+		engine->Start();
+
+		int64_t deadline = SampleClock::Now() + (int64_t) (10 / Seconds(1));
+		while((engine->IsRunning() || engine->InputAvailable() > 0) && SampleClock::Now() < deadline) {
+			Collect(*engine);
+			SwitchToThread();
+		}
+		Collect(*engine);
+
+		EXPECT_FALSE(engine->IsRunning());
+		EXPECT_FALSE(engine->Failed()) << engine->ErrorMessage();
+		EXPECT_TRUE(engine->OutputEnded());
+		EXPECT_FALSE(itc->Underrun());
+		EXPECT_FALSE(itc->Overflow());
+		EXPECT_GE(input[0].size(), n + PIPELINE);
+		EXPECT_EQ(0, Mismatches(n));
+
+		delete engine;
+	}
+
+	// Throughput and latency of the streaming thread against real-time hardware with a per-call
+	// driver cost; figures are recorded as test properties in the XML report.
+	TEST_F(StreamingEngineTests, ShouldSustainRealTimeStreamingWithDriverLatency)
+	{
+		SimulatedItcConfig config;
+		config.fifoDepth = 16384;
+		config.sampleRate = 50000;
+		config.callLatencyMicroseconds = 30;
+		config.sampleLatencyNanoseconds = 5;
+		Configure(config, 4);
+
+		const unsigned int block = 512;
+		const size_t target = 25000; // 0.5 s
+		Generate(target, 4 * block);
+		Preload(4 * block);
+
+		size_t total = output[0].size();
+		size_t written = 4 * block;
+		StreamingEngine *engine = CreateEngine(config.fifoDepth, block);
+
+		clock.Reset(config.sampleRate);
+		itc->Start();
+		engine->Start();
+
+		vector<double> latencies;
+		int64_t start = SampleClock::Now();
+		int64_t deadline = start + (int64_t) (10 / Seconds(1));
+		while(input[0].size() < target && !engine->Failed() && SampleClock::Now() < deadline) {
+			size_t space = engine->OutputSpace();
+			size_t push = min(space, total - written);
+			for(size_t c=0; push > 0 && c < output.size(); c++) {
+				engine->PushOutput((int) c, output[c].data() + written, push);
+			}
+			written += push;
+
+			size_t before = input[0].size();
+			Collect(*engine);
+			if(input[0].size() > before) {
+				int64_t acquired = clock.HostTicks((int64_t) input[0].size() - 1);
+				if(acquired != 0) {
+					latencies.push_back(Seconds(SampleClock::Now() - acquired));
+				}
+			} else if(push == 0) {
+				Sleep(1);
+			}
+		}
+		double elapsed = Seconds(SampleClock::Now() - start);
+
+		engine->Stop();
+		itc->Stop();
+
+		EXPECT_FALSE(engine->Failed()) << engine->ErrorMessage();
+		EXPECT_FALSE(itc->Underrun());
+		EXPECT_FALSE(itc->Overflow());
+		ASSERT_GE(input[0].size(), target);
+		EXPECT_EQ(0, Mismatches(target - PIPELINE));
+
+		sort(latencies.begin(), latencies.end());
+		double p99 = latencies.empty() ? 0 : latencies[(latencies.size() - 1) * 99 / 100];
+		RecordProperty("SamplesPerSecond", (int) (2.0 * output.size() * target / elapsed));
+		RecordProperty("FifoCalls", (int) counters.ReadWriteFifo());
+		RecordProperty("LatencyP99Microseconds", (int) (p99 * 1e6));
+
+		delete engine;
+	}
+
+	TEST_F(StreamingEngineTests, ShouldSpillInputAsQueued)
+	{
+		SimulatedItcConfig config;
+		config.fifoDepth = 2048;
+		config.samplesPerUpdate = 64;
+		Configure(config, 2);
+		waiter.SetMode(POLL_SPIN);
+		watchdog.Configure(0, 512);
+
+		const size_t n = 20000;
+		const size_t preload = 1024;
+		Generate(n, 0);
+		Preload(preload);
+
+		// Small enough that the writer moves on to later windows
+		SpillFile spill;
+		ASSERT_TRUE(spill.Create(L"ShouldSpillInputAsQueued.itcspill", config.sampleRate, inputs.data(), units.data(), (int) inputs.size(), 4096))
+			<< spill.ErrorMessage();
+
+		StreamingEngine *engine = CreateEngine(n, 256);
+		engine->SetSpill(&spill);
+		for(size_t c=0; c < output.size(); c++) {
+			ASSERT_EQ(n - preload, engine->PushOutput((int) c, output[c].data() + preload, n - preload));
+		}
+
+		itc->Start();
+		engine->Start();
+
+		int64_t deadline = SampleClock::Now() + (int64_t) (10 / Seconds(1));
+		while((engine->IsRunning() || engine->InputAvailable() > 0) && SampleClock::Now() < deadline) {
+			Collect(*engine);
+			SwitchToThread();
+		}
+		Collect(*engine);
+		delete engine;
+		spill.Close();
+
+		EXPECT_FALSE(spill.Failed()) << spill.ErrorMessage();
+		EXPECT_EQ((int64_t) input[0].size(), spill.Samples());
+
+		SpillFileHeader header;
+		vector<vector<itcsample_t> > spilled;
+		size_t records = 0;
+		ASSERT_TRUE(ReadSpill("ShouldSpillInputAsQueued.itcspill", header, spilled, records));
+		remove("ShouldSpillInputAsQueued.itcspill");
+
+		EXPECT_EQ(0, memcmp(header.magic, "SYMSPILL", sizeof(header.magic)));
+		EXPECT_NE(0u, header.closed);
+		EXPECT_EQ(2u, header.channelCount);
+		EXPECT_GT(records, 1u);
+		for(size_t c=0; c < input.size(); c++) {
+			EXPECT_TRUE(spilled[c] == input[c]) << "channel " << c;
+		}
+	}
+}
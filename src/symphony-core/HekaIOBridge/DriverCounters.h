@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Heka {
+
+	// Counts ITCMM calls made by the bridge and its streaming thread. Counters may be incremented
+	// and read from any thread.
+	class DriverCounters
+	{
+	public:
+		DriverCounters() : getState(0), updateNow(0), getDataAvailable(0), readWriteFifo(0) {}
+
+		void CountGetState() { InterlockedIncrement64(&getState); }
+		void CountUpdateNow() { InterlockedIncrement64(&updateNow); }
+		void CountGetDataAvailable() { InterlockedIncrement64(&getDataAvailable); }
+		void CountReadWriteFifo() { InterlockedIncrement64(&readWriteFifo); }
+
+		int64_t GetState() const { return Read(&getState); }
+		int64_t UpdateNow() const { return Read(&updateNow); }
+		int64_t GetDataAvailable() const { return Read(&getDataAvailable); }
+		int64_t ReadWriteFifo() const { return Read(&readWriteFifo); }
+
+		void Reset()
+		{
+			InterlockedExchange64(&getState, 0);
+			InterlockedExchange64(&updateNow, 0);
+			InterlockedExchange64(&getDataAvailable, 0);
+			InterlockedExchange64(&readWriteFifo, 0);
+		}
+
+	private:
+		static int64_t Read(volatile LONGLONG const *value)
+		{
+			return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(value), 0, 0);
+		}
+
+		DriverCounters(const DriverCounters &);
+		DriverCounters &operator=(const DriverCounters &);
+
+		volatile LONGLONG getState;
+		volatile LONGLONG updateNow;
+		volatile LONGLONG getDataAvailable;
+		volatile LONGLONG readWriteFifo;
+	};
+}
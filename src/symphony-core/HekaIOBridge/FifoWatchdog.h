@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Heka {
+
+	// Watches the output margin: the samples queued ahead of the hardware, i.e. those waiting in the
+	// output FIFO plus any the transfer loop has yet to write. Each FIFO pass reports the margin it
+	// saw. Falling below the low watermark counts a low-margin event (once per excursion), so managed
+	// code can be warned before the FIFO underruns. Below the stop watermark, with nothing left to
+	// write, the streaming thread may end the output itself (see StreamingEngine) rather than let
+	// the hardware underrun. Margins are reported by the one thread running a transfer loop;
+	// counters may be read from any thread. Watermarks of zero disable the corresponding check.
+	class FifoWatchdog
+	{
+	public:
+		FifoWatchdog() : lowWatermark(0), stopWatermark(0)
+		{
+			Reset();
+		}
+
+		uint32_t LowWatermark() const { return lowWatermark; }
+		uint32_t StopWatermark() const { return stopWatermark; }
+
+		// Must not be called while a transfer loop is running.
+		void Configure(uint32_t lowSamples, uint32_t stopSamples)
+		{
+			lowWatermark = lowSamples;
+			stopWatermark = stopSamples;
+		}
+
+		// Records the margin seen by one pass, counting a low-margin event if it has just fallen
+		// below the low watermark.
+		void Observe(int64_t margin)
+		{
+			InterlockedExchange64(&lastMargin, margin);
+
+			int64_t lowest = Read(&minMargin);
+			if(lowest < 0 || margin < lowest) {
+				InterlockedExchange64(&minMargin, margin);
+			}
+
+			bool low = lowWatermark > 0 && margin < lowWatermark;
+			if(low && !belowLow) {
+				InterlockedIncrement64(&lowEvents);
+			}
+			belowLow = low;
+		}
+
+		bool BelowStop(int64_t margin) const
+		{
+			return stopWatermark > 0 && margin < stopWatermark;
+		}
+
+		int64_t LowEvents() const { return Read(&lowEvents); }
+		// -1 until a margin has been observed
+		int64_t MinMargin() const { return Read(&minMargin); }
+		int64_t LastMargin() const { return Read(&lastMargin); }
+
+		void Reset()
+		{
+			belowLow = false;
+			InterlockedExchange64(&lowEvents, 0);
+			InterlockedExchange64(&minMargin, -1);
+			InterlockedExchange64(&lastMargin, -1);
+		}
+
+	private:
+		static int64_t Read(volatile LONGLONG const *value)
+		{
+			return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(value), 0, 0);
+		}
+
+		FifoWatchdog(const FifoWatchdog &);
+		FifoWatchdog &operator=(const FifoWatchdog &);
+
+		uint32_t lowWatermark;
+		uint32_t stopWatermark;
+		bool belowLow;
+
+		volatile LONGLONG lowEvents;
+		volatile LONGLONG minMargin;
+		volatile LONGLONG lastMargin;
+	};
+}
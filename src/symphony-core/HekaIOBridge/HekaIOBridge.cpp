@@ -7,18 +7,17 @@
 #include "0acqerrors.h"
 
 #include <cassert>
+#include <climits>
 #include <iostream>
 #include <sstream>
 #include <memory>
 #include <vector>
-
-//Automatcially link importer's project to ITCMM.lib
-#pragma message("Adding automatic link to ITCMM.lib")  
-#pragma comment(lib, "ITCMM.lib")
+#include <vcclr.h>
 
 using namespace std;
 using namespace System::Collections::Generic;
 using namespace System::Linq;
+using namespace System::Runtime::InteropServices;
 using namespace System::Threading;
 
 namespace Heka {
@@ -26,261 +25,1194 @@ namespace Heka {
 
 	void IOBridge::Preload(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output)
 	{
-		WriteOutput(output, true);
+		WriteOutput(output, CommonLength(output), true);
+	}
+
+	void IOBridge::Preload(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output, int32_t nsamples)
+	{
+		WriteOutput(output, nsamples, true);
 	}
 
 	void IOBridge::Write(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output)
 	{
-		WriteOutput(output, false);
+		WriteOutput(output, CommonLength(output), false);
+	}
+
+	int32_t IOBridge::CommonLength(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output)
+	{
+		int32_t nsamples = -1;
+
+		for each(array<itcsample_t>^ samples in output->Values)
+		{
+			if(nsamples < 0) {
+				nsamples = samples->Length;
+			} else if(samples->Length != nsamples) {
+				throw gcnew ArgumentException("Preload sample buffers must be homogenous in length", "output.Values");
+			}
+		}
+
+		return max(nsamples, 0);
+	}
+
+	void IOBridge::ConfigureBuffers(IList<ChannelIdentifier>^ outputs, IList<ChannelIdentifier>^ inputs, int32_t capacity)
+	{
+		CheckStreamCounts(outputs->Count, inputs->Count, capacity);
+
+		fifoDepth = capacity;
+		monitor->SetFifoDepth(capacity);
+
+		outputSlots->Clear();
+		inputSlots->Clear();
+
+		for(int i=0; i < outputs->Count; i++) {
+			OutputRing(outputs[i])->Reserve(capacity);
+		}
+
+		for(int i=0; i < inputs->Count; i++) {
+			InputRing(inputs[i])->Reserve(capacity);
+		}
+	}
+
+	unsigned int IOBridge::TuneTransferBlock(int32_t channelCount)
+	{
+		double rate = waiter->SampleRate();
+		if(rate <= 0) {
+			return TRANSFER_BLOCK_SAMPLES;
+		}
+
+		double callSeconds = waiter->FifoCalls() > 0 ?
+			waiter->AverageFifoCallSeconds() :
+			DEFAULT_FIFO_CALL_SECONDS + channelCount * DEFAULT_FIFO_CHANNEL_SECONDS;
+
+		// One input and one output call per block should cost no more than
+		// 1/AUTO_TUNE_OVERHEAD_RATIO of the time the block spans.
+		double block = 2 * callSeconds * rate * AUTO_TUNE_OVERHEAD_RATIO;
+
+		unsigned int tuned = (unsigned int) min(block, (double) MAX_TRANSFER_BLOCK_SAMPLES);
+		tuned = ((tuned + MIN_TRANSFER_BLOCK_SAMPLES - 1) / MIN_TRANSFER_BLOCK_SAMPLES) * MIN_TRANSFER_BLOCK_SAMPLES;
+
+		return max(tuned, MIN_TRANSFER_BLOCK_SAMPLES);
+	}
+
+	unsigned int IOBridge::ActiveBlockSamples(int32_t channelCount)
+	{
+		unsigned int block = transferBlockSamples > 0 ? transferBlockSamples : TuneTransferBlock(channelCount);
+
+		// Leave the hardware FIFO room for at least FIFO_BLOCK_HEADROOM blocks
+		if(fifoDepth > 0) {
+			unsigned int fifoLimit = max((unsigned) fifoDepth / FIFO_BLOCK_HEADROOM, MIN_TRANSFER_BLOCK_SAMPLES);
+			block = min(block, fifoLimit);
+		}
+
+		activeTransferBlock = block;
+		return block;
+	}
+
+	SampleRing *IOBridge::InputRing(ChannelIdentifier channel)
+	{
+		int32_t slot;
+		if(!inputSlots->TryGetValue(channel, slot)) {
+			slot = inputSlots->Count;
+			if(slot >= InputChannelLimit()) {
+				throw gcnew HekaDAQException("Too many input channels");
+			}
+
+			inputSlots[channel] = slot;
+			inputRings[slot].Clear();
+		}
+
+		return &inputRings[slot];
+	}
+
+	SampleRing *IOBridge::OutputRing(ChannelIdentifier channel)
+	{
+		int32_t slot;
+		if(!outputSlots->TryGetValue(channel, slot)) {
+			slot = outputSlots->Count;
+			if(slot >= OutputChannelLimit()) {
+				throw gcnew HekaDAQException("Too many output channels");
+			}
+
+			outputSlots[channel] = slot;
+			outputRings[slot].Clear();
+		}
+
+		return &outputRings[slot];
 	}
 
-	void IOBridge::WriteOutput(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output, bool preload)
+	void IOBridge::WriteOutput(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output, int32_t nsamples, bool preload)
 	{
 		if(output->Count == 0) {
 			return;
 		}
 
-		ITCChannelDataEx outputData[ITC00_NUMBEROFOUTPUTS];
-		ZeroMemory(outputData, sizeof(outputData));
+		CheckStreamCounts(output->Count, 0, nsamples);
+
+		vector<ITCChannelDataEx> outputData(output->Count);
+		vector<int32_t> outputDevices(output->Count);
+
+		// The driver reads straight from the caller's pinned arrays; GCHandles are kept as native
+		// pointers as in ReadWrite.
+		vector<void *> pins(output->Count);
+		int npins = 0;
+
+		try
+		{
+			for each(KeyValuePair<ChannelIdentifier, array<itcsample_t>^> kvp in output)
+			{
+				CheckDeviceIndex(kvp.Key);
 
+				if(kvp.Value->Length < nsamples) {
+					throw gcnew ArgumentException("Output sample buffers must hold at least nsamples samples", "output.Values");
+				}
 
+				GCHandle pin = GCHandle::Alloc(kvp.Value, GCHandleType::Pinned);
+				pins[npins] = GCHandle::ToIntPtr(pin).ToPointer();
 
-		IList<ChannelIdentifier>^ outputStreams = Enumerable::ToList(output->Keys);
+				ZeroMemory(&outputData[npins], sizeof(ITCChannelDataEx));
+				outputData[npins].ChannelNumber = kvp.Key.ChannelNumber;
+				outputData[npins].ChannelType = kvp.Key.ChannelType;
+				if(preload) {
+					outputData[npins].Command |= PRELOAD_FIFO_COMMAND_EX;
+				}
+				outputData[npins].Value = nsamples;
+				outputData[npins].DataPointer = pin.AddrOfPinnedObject().ToPointer();
+				outputDevices[npins] = kvp.Key.DeviceIndex;
+				npins++;
+			}
+
+			// One call per unit
+			for(int32_t d=0; d < deviceCount; d++) {
+				vector<ITCChannelDataEx> deviceData;
+				for(int i=0; i < npins; i++) {
+					if(outputDevices[i] == d) {
+						deviceData.push_back(outputData[i]);
+					}
+				}
 
-		for(int i=0; i<outputStreams->Count; i++) {
-			outputData[i].ChannelNumber = outputStreams[i].ChannelNumber;
-			outputData[i].ChannelType = outputStreams[i].ChannelType;
-			if(preload) {
-				outputData[i].Command |= PRELOAD_FIFO_COMMAND_EX;
+				if(!deviceData.empty()) {
+					WriteFifo(d, deviceData.data(), (int32_t) deviceData.size());
+				}
+			}
+		}
+		finally
+		{
+			for(int i=0; i < npins; i++) {
+				GCHandle::FromIntPtr(IntPtr(pins[i])).Free();
 			}
 		}
+	}
 
-		long err;
 
-		vector<vector<itcsample_t> > outputSamples(output->Count); 
+	void IOBridge::StartStreaming(IList<ChannelIdentifier>^ outputs, IList<ChannelIdentifier>^ inputs, int32_t queueCapacity)
+	{
+		StartStreaming(outputs, nullptr, inputs, queueCapacity);
+	}
+
+	void IOBridge::StartStreaming(IList<ChannelIdentifier>^ outputs, IList<itcsample_t>^ outputBackgrounds,
+		IList<ChannelIdentifier>^ inputs, int32_t queueCapacity)
+	{
+		CheckStreamCounts(outputs->Count, inputs->Count, queueCapacity);
 
-		int32_t nsamples = output[outputStreams[0]]->Length;
+		if(outputBackgrounds != nullptr && outputBackgrounds->Count != outputs->Count) {
+			throw gcnew HekaDAQException("Output backgrounds do not match the output channels.");
+		}
 
-		for(int i=0; i < output->Count; i++) {
-			if(output[outputStreams[i]]->Length != nsamples) {
-				throw gcnew ArgumentException("Preload sample buffers must be homogenous in length", "output.Values");
+		if(queueCapacity == 0) {
+			throw gcnew HekaDAQException("Streaming queue capacity must be greater than zero.");
+		}
+
+		StopStreaming();
+
+		vector<ITCChannelDataEx> outputData(outputs->Count);
+		vector<int> outputDevices(outputs->Count);
+		vector<itcsample_t> backgrounds(outputs->Count);
+		vector<ITCChannelDataEx> inputData(inputs->Count);
+		vector<int> inputDevices(inputs->Count);
+
+		// Slots are reassigned in list order so that each channel's slot is also its
+		// StreamingEngine channel index.
+		outputSlots->Clear();
+		inputSlots->Clear();
+
+		for(int i=0; i < outputs->Count; i++) {
+			CheckDeviceIndex(outputs[i]);
+			OutputRing(outputs[i]);
+			ZeroMemory(&outputData[i], sizeof(ITCChannelDataEx));
+			outputData[i].ChannelNumber = outputs[i].ChannelNumber;
+			outputData[i].ChannelType = outputs[i].ChannelType;
+			outputDevices[i] = outputs[i].DeviceIndex;
+			backgrounds[i] = outputBackgrounds != nullptr ? outputBackgrounds[i] : 0;
+		}
+
+		for(int i=0; i < inputs->Count; i++) {
+			CheckDeviceIndex(inputs[i]);
+			InputRing(inputs[i]);
+			ZeroMemory(&inputData[i], sizeof(ITCChannelDataEx));
+			inputData[i].ChannelNumber = inputs[i].ChannelNumber;
+			inputData[i].ChannelType = inputs[i].ChannelType;
+			inputDevices[i] = inputs[i].DeviceIndex;
+		}
+
+		delete spill;
+		spill = NULL;
+
+		if(spillPath != nullptr && inputs->Count > 0) {
+			pin_ptr<const wchar_t> path = PtrToStringChars(spillPath);
+			spill = new SpillFile();
+			if(!spill->Create(path, waiter->SampleRate(), inputData.data(), inputDevices.data(), inputs->Count, SpillFile::DEFAULT_WINDOW_BYTES)) {
+				String^ msg = gcnew String(spill->ErrorMessage());
+				delete spill;
+				spill = NULL;
+				throw gcnew HekaDAQException("Unable to create spill file " + spillPath + " (" + msg + ").");
 			}
+		}
+
+		engine = new StreamingEngine(devices, deviceCount, driver, driverLock, waiter, counters, sampleClock, monitor, watchdog, statusCheckInterval,
+			outputData.data(), outputDevices.data(), backgrounds.data(), outputs->Count,
+			inputData.data(), inputDevices.data(), inputs->Count,
+			queueCapacity, ActiveBlockSamples(outputs->Count + inputs->Count));
+		engine->SetSpill(spill);
+
+		engine->Start();
+	}
+
+	void IOBridge::StopStreaming()
+	{
+		if(engine != NULL) {
+			engine->Stop();
+			delete engine;
+			engine = NULL;
+		}
+
+		// Kept, closed, for SpilledSamples and SpillFailed
+		if(spill != NULL) {
+			spill->Close();
+		}
+	}
+
+	void IOBridge::SpillPath::set(String^ path)
+	{
+		if(engine != NULL) {
+			throw gcnew HekaDAQException("The spill file cannot be changed while streaming.");
+		}
+
+		spillPath = path;
+	}
+
+	TransferStatistics IOBridge::Statistics::get()
+	{
+		TransferStatistics result;
+		result.Passes = monitor->Passes();
+		result.OutputSamples = monitor->OutputSamples();
+		result.InputSamples = monitor->InputSamples();
+		result.MaxPollTime = HostTicksToTimeSpan(monitor->MaxPollTicks());
+		result.MaxFifoCallTime = HostTicksToTimeSpan(monitor->MaxFifoTicks());
+		result.MaxPassInterval = HostTicksToTimeSpan(monitor->MaxPassGapTicks());
+
+		int64_t space = monitor->MaxOutputSpace();
+		result.MinOutputFifoFill = space >= 0 && monitor->FifoDepth() > 0 ? max((int64_t) monitor->FifoDepth() - space, (int64_t) 0) : -1;
+		result.MaxInputFifoFill = monitor->MaxInputFill();
+
+		double rate = waiter->SampleRate();
+		result.MinTimeToUnderrun = result.MinOutputFifoFill >= 0 && rate > 0 ?
+			TimeSpan::FromSeconds(result.MinOutputFifoFill / rate) :
+			TimeSpan::MaxValue;
 
-			outputSamples[i] = vector<itcsample_t>(nsamples); //new itcsample_t[nsamples];
-			array<itcsample_t>^ out = output[outputStreams[i]];
-			for(int j=0; j<out->Length; j++) {
-				outputSamples[i][j] = out[j];
+		return result;
+	}
+
+	void IOBridge::TraceTransfers::set(bool enable)
+	{
+		if(engine != NULL) {
+			throw gcnew HekaDAQException("Transfer tracing cannot be changed while streaming.");
+		}
+
+		monitor->EnableTrace(enable);
+	}
+
+	void IOBridge::ConfigureFifoWatchdog(uint32_t lowSamples, uint32_t stopSamples)
+	{
+		if(engine != NULL) {
+			throw gcnew HekaDAQException("The FIFO watchdog cannot be configured while streaming.");
+		}
+
+		watchdog->Configure(lowSamples, stopSamples);
+	}
+
+	void IOBridge::Driver::set(IntPtr table)
+	{
+		if(engine != NULL) {
+			throw gcnew HekaDAQException("The driver cannot be changed while streaming.");
+		}
+
+		driver = table == IntPtr::Zero ? ItcmmDriver() : (const ItcDriver *) table.ToPointer();
+	}
+
+	void SimulatedDevice::FifoDepth::set(uint32_t value)
+	{
+		if(value == 0) {
+			throw gcnew ArgumentOutOfRangeException("value", "FIFO depth must be positive");
+		}
+
+		SimulatedItcConfig config = itc->Config();
+		config.fifoDepth = value;
+		Configure(config);
+	}
+
+	void SimulatedDevice::SampleRate::set(double value)
+	{
+		if(!(value > 0)) {
+			throw gcnew ArgumentOutOfRangeException("value", "Sample rate must be positive");
+		}
+
+		SimulatedItcConfig config = itc->Config();
+		config.sampleRate = value;
+		Configure(config);
+	}
+
+	void SimulatedDevice::Speed::set(double value)
+	{
+		if(!(value > 0)) {
+			throw gcnew ArgumentOutOfRangeException("value", "Speed must be positive");
+		}
+
+		SimulatedItcConfig config = itc->Config();
+		config.speed = value;
+		Configure(config);
+	}
+
+	void SimulatedDevice::CallLatencyMicroseconds::set(double value)
+	{
+		SimulatedItcConfig config = itc->Config();
+		config.callLatencyMicroseconds = value;
+		Configure(config);
+	}
+
+	void SimulatedDevice::SampleLatencyNanoseconds::set(double value)
+	{
+		SimulatedItcConfig config = itc->Config();
+		config.sampleLatencyNanoseconds = value;
+		Configure(config);
+	}
+
+	void SimulatedDevice::Loopback::set(bool value)
+	{
+		SimulatedItcConfig config = itc->Config();
+		config.loopback = value;
+		Configure(config);
+	}
+
+	void SimulatedDevice::SyntheticAmplitude::set(double value)
+	{
+		SimulatedItcConfig config = itc->Config();
+		config.syntheticAmplitude = value;
+		Configure(config);
+	}
+
+	void SimulatedDevice::SyntheticPeriodSamples::set(double value)
+	{
+		if(!(value > 0)) {
+			throw gcnew ArgumentOutOfRangeException("value", "Synthetic period must be positive");
+		}
+
+		SimulatedItcConfig config = itc->Config();
+		config.syntheticPeriodSamples = value;
+		Configure(config);
+	}
+
+	void SimulatedDevice::Configure(const SimulatedItcConfig &config)
+	{
+		if(itc->IsRunning()) {
+			throw gcnew HekaDAQException("The simulated device cannot be configured while running.");
+		}
+
+		itc->SetConfig(config);
+	}
+
+	void SimulatedDevice::SetChannels(array<ITCMM::ITCChannelInfo>^ channels)
+	{
+		if(channels == nullptr) {
+			throw gcnew ArgumentNullException("channels");
+		}
+
+		vector<ITCChannelInfo> info(channels->Length);
+		for(int i=0; i < channels->Length; i++) {
+			info[i].ChannelType = channels[i].ChannelType;
+			info[i].ChannelNumber = channels[i].ChannelNumber;
+			info[i].HardwareUnderrunValue = channels[i].HardwareUnderrunValue;
+			info[i].SamplingRate = channels[i].SamplingRate;
+		}
+
+		itc->SetChannels(info.empty() ? NULL : &info[0], (unsigned long) info.size());
+	}
+
+	FifoMarginStatus IOBridge::FifoMargin::get()
+	{
+		FifoMarginStatus result;
+		result.LowMarginEvents = watchdog->LowEvents();
+		result.MinMargin = watchdog->MinMargin();
+		result.LastMargin = watchdog->LastMargin();
+		result.OutputEnded = engine != NULL && engine->OutputEnded();
+		return result;
+	}
+
+	array<TransferTraceEntry>^ IOBridge::DumpTransferTrace()
+	{
+		vector<TransferRecord> records(TransferMonitor::TRACE_CAPACITY);
+		uint32_t n = monitor->DumpTrace(records.data(), TransferMonitor::TRACE_CAPACITY);
+
+		array<TransferTraceEntry>^ result = gcnew array<TransferTraceEntry>(n);
+		for(uint32_t i=0; i < n; i++) {
+			TransferTraceEntry entry;
+			entry.StartTicks = records[i].start;
+			entry.PollTime = HostTicksToTimeSpan(records[i].pollTicks);
+			entry.FifoCallTime = HostTicksToTimeSpan(records[i].fifoTicks);
+			entry.OutputFifoSpace = records[i].outputSpace;
+			entry.InputFifoFill = records[i].inputFill;
+			entry.OutputSamples = records[i].outputSamples;
+			entry.InputSamples = records[i].inputSamples;
+			result[i] = entry;
+		}
+
+		return result;
+	}
+
+	void IOBridge::CheckStreaming()
+	{
+		if(engine == NULL) {
+			throw gcnew HekaDAQException("Streaming has not been started.");
+		}
+
+		if(engine->Failed()) {
+			throw gcnew HekaDAQException(gcnew String(engine->ErrorMessage()), (uint32_t) engine->ErrorCode());
+		}
+	}
+
+	int32_t IOBridge::StreamReadWrite(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
+		IDictionary<ChannelIdentifier, array<itcsample_t>^>^ input,
+		int32_t nsamples,
+		CancellationToken^ token)
+	{
+		CheckStreamCounts(output->Count, input->Count, nsamples);
+
+		int32_t noutput = -1;
+		for each(array<itcsample_t>^ a in output->Values) {
+			if(noutput < 0) {
+				noutput = a->Length;
+			} else if(a->Length != noutput) {
+				throw gcnew HekaDAQException("Output buffers are not equal length.");
 			}
 		}
+		if(noutput < 0) {
+			noutput = 0;
+		}
 
-		for(int i=0; i < outputStreams->Count; i++) {
-			outputData[i].Value = nsamples;
+		for each(array<itcsample_t>^ a in input->Values) {
+			if(a->Length < nsamples) {
+				throw gcnew HekaDAQException("Input buffer too small");
+			}
 		}
 
+		int32_t nOut = 0;
+		int32_t nIn = 0;
+
+		while((nOut < noutput) || (nIn < nsamples && input->Count > 0)) {
+
+			if(token->IsCancellationRequested)
+			{
+				break;
+			}
+
+			CheckStreaming();
+
+			// Once the streaming thread has stopped by itself (after ending the output), whatever
+			// input it queued is all there will be
+			bool finished = !engine->IsRunning();
+
+			bool progressed = false;
+
+			// Queue levels are read once; the streaming thread may change them at any time
+			size_t outputSpace = engine->OutputSpace();
+			int32_t outBlock = (int32_t) min((size_t) (noutput - nOut), outputSpace);
+			if(outBlock > 0) {
+				for each(KeyValuePair<ChannelIdentifier, array<itcsample_t>^> kvp in output)
+				{
+					int32_t slot;
+					if(!outputSlots->TryGetValue(kvp.Key, slot)) {
+						throw gcnew HekaDAQException("Output channel is not streaming.");
+					}
 
-		for(int i=0; i < outputStreams->Count; i++) {
-			outputData[i].DataPointer = outputSamples[i].data();
+					pin_ptr<itcsample_t> samples = &kvp.Value[nOut];
+					engine->PushOutput(slot, samples, outBlock);
+				}
+
+				nOut += outBlock;
+				progressed = true;
+			}
+
+			size_t inputAvailable = engine->InputAvailable();
+			int32_t inBlock = (int32_t) min((size_t) (nsamples - nIn), inputAvailable);
+			if(inBlock > 0) {
+				for each(KeyValuePair<ChannelIdentifier, array<itcsample_t>^> kvp in input)
+				{
+					int32_t slot;
+					if(!inputSlots->TryGetValue(kvp.Key, slot)) {
+						throw gcnew HekaDAQException("Input channel is not streaming.");
+					}
+
+					pin_ptr<itcsample_t> samples = &kvp.Value[nIn];
+					engine->PopInput(slot, samples, inBlock);
+				}
+
+				nIn += inBlock;
+				progressed = true;
+			}
+
+			if(!progressed) {
+				if(finished) {
+					break;
+				}
+
+				Thread::Sleep(1);
+			}
 		}
 
-		err = ITC_ReadWriteFIFO(GetDevice(), outputStreams->Count, outputData);
-		if(err != ACQ_SUCCESS) {
-			throw gcnew HekaDAQException("ITC_ReadWriteFIFO error", err);
+		if(input->Count > 0) {
+			EndInputBlock(nIn);
 		}
+
+		return nIn;
 	}
 
 
-	void CheckStatus(void *device, ITCStatus status)
+	void CheckStatus(const ItcDriver *driver, void *device, ITCStatus *status)
 	{
-		long err = ITC_GetState(device, &status);
+		long err = driver->GetState(device, status);
 		if(err != ACQ_SUCCESS) {
 			throw gcnew HekaDAQException("ITC_GetState error", err);
 		}
 
-		if( !(status.RunningMode & RUN_STATE) ||
-			((status.RunningMode & ERROR_STATE) && (status.Overflow & (ITC_WRITE_UNDERRUN_H | ITC_WRITE_UNDERRUN_S))) ||
-			((status.RunningMode & ERROR_STATE) && (status.Overflow & (ITC_READ_OVERFLOW_H | ITC_READ_OVERFLOW_S)))
+		if( !(status->RunningMode & RUN_STATE) ||
+			((status->RunningMode & ERROR_STATE) && (status->Overflow & (ITC_WRITE_UNDERRUN_H | ITC_WRITE_UNDERRUN_S))) ||
+			((status->RunningMode & ERROR_STATE) && (status->Overflow & (ITC_READ_OVERFLOW_H | ITC_READ_OVERFLOW_S)))
 			)
 		{
 
 			String ^msg;
 
-			if(status.RunningMode == DEAD_STATE)
+			if(status->RunningMode == DEAD_STATE)
 				msg = String::Format("ITC not running. State: DEAD (likely due to hardware underrun)");
 			else
-				msg = String::Format("ITC not running. State: 0x{0:X}, error code: 0x{1:X}", status.RunningMode, status.Overflow);
+				msg = String::Format("ITC not running. State: 0x{0:X}, error code: 0x{1:X}", status->RunningMode, status->Overflow);
 
 			throw gcnew HekaDAQException(msg);
 		}
 	}
 
 
-	IDictionary<ChannelIdentifier, array<itcsample_t>^>^ 
-		IOBridge::ReadWrite(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
-		IList<ChannelIdentifier>^ input,
-		int32_t nsamples,
-		CancellationToken^ token)
+	void IOBridge::CheckStreamCounts(int32_t outputCount, int32_t inputCount, int32_t nsamples)
 	{
-
 		if(nsamples < 0) {
 			throw gcnew HekaDAQException("nsamples may not be less than zero.");
 		}
 
-		if(output->Keys->Count >= ITC00_NUMBEROFOUTPUTS) {
+		if(outputCount >= OutputChannelLimit()) {
 			throw gcnew HekaDAQException("Too many output channels");
 		}
 
-		if(input->Count >= ITC00_NUMBEROFINPUTS) {
+		if(inputCount >= InputChannelLimit()) {
 			throw gcnew HekaDAQException("Too many input channels");
 		}
 
-
-		long err;
-
-		if((unsigned) output->Values->Count > maxOutputs) {
+		if((unsigned) outputCount > maxOutputs) {
 			throw gcnew HekaDAQException("Output stream number exceeds output stream availability.");
 		}
 
-		if((unsigned) input->Count > maxInputs) {
+		if((unsigned) inputCount > maxInputs) {
 			throw gcnew HekaDAQException("Input stream count exceeds input stream availability.");
 		}
+	}
+
+	void IOBridge::CheckSingleDevice()
+	{
+		if(deviceCount > 1) {
+			throw gcnew HekaDAQException("Multi-device acquisition requires native streaming.");
+		}
+	}
+
+	void IOBridge::CheckDeviceIndex(ChannelIdentifier channel)
+	{
+		if(channel.DeviceIndex >= deviceCount) {
+			throw gcnew HekaDAQException("Channel device index exceeds the number of devices.");
+		}
+	}
+
+
+	int32_t IOBridge::Transfer(ITCChannelDataEx *outputData,
+		SampleRing **outputs,
+		int32_t outputCount,
+		ITCChannelDataEx *inputData,
+		SampleRing **inputs,
+		int32_t inputCount,
+		int32_t nsamples,
+		CancellationToken^ token)
+	{
+		long err;
 
 		ITCStatus status;
 		ZeroMemory(&status, sizeof(status));
 		status.CommandStatus = READ_ERRORS | READ_OVERFLOW | READ_RUNNINGMODE;
 
+		// All channels are queried in one ITC_GetDataAvailable call (outputs first, then inputs), and
+		// those with samples to move are batched into a single ITC_ReadWriteFIFO call.
+		ITCChannelDataEx availableData[ITC00_NUMBEROFOUTPUTS + ITC00_NUMBEROFINPUTS];
+		ITCChannelDataEx transferData[ITC00_NUMBEROFOUTPUTS + ITC00_NUMBEROFINPUTS];
+
+		for(int i=0; i < outputCount; i++) {
+			availableData[i] = outputData[i];
+		}
+		for(int i=0; i < inputCount; i++) {
+			availableData[outputCount + i] = inputData[i];
+		}
+		ITCChannelDataEx *availableOutputs = availableData;
+		ITCChannelDataEx *availableInputs = availableData + outputCount;
+
+		// Run state is checked on the first pass, every statusCheckInterval passes, and after any
+		// pass that moved nothing, so a stalled (underrun/overflowed) device is still caught at once.
+		unsigned int passesSinceStatus = UINT_MAX;
+
+		int32_t nIn = 0;
+		int32_t nOut = 0;
+
+		unsigned int transferBlock = min((unsigned) nsamples, ActiveBlockSamples(outputCount + inputCount));
+
+		while((nOut < nsamples && outputCount > 0) || (nIn < nsamples && inputCount > 0)) {
+
+			if(token->IsCancellationRequested)
+			{
+				break;
+			}
+
+			int64_t serviceStart = waiter->BeginTransfer();
+
+			if(passesSinceStatus >= statusCheckInterval) {
+				CheckStatus(driver, GetDevice(), &status);
+				counters->CountGetState();
+				passesSinceStatus = 0;
+			}
+			passesSinceStatus++;
+
+			// The FIFO pointers are latched somewhere within the UpdateNow call
+			int64_t updateStart = SampleClock::Now();
+			driver->UpdateNow(GetDevice(), NULL);
+			int64_t latched = updateStart + (SampleClock::Now() - updateStart) / 2;
+			counters->CountUpdateNow();
+
+			err = driver->GetDataAvailable(GetDevice(), outputCount + inputCount, availableData);
+			counters->CountGetDataAvailable();
+
+			TransferRecord pass;
+			pass.start = serviceStart;
+			pass.pollTicks = (uint32_t) (SampleClock::Now() - updateStart);
+			pass.fifoTicks = 0;
+			pass.outputSpace = TransferMonitor::MaxAvailable(availableOutputs, outputCount);
+			pass.inputFill = TransferMonitor::MaxAvailable(availableInputs, inputCount);
+			pass.outputChannels = (uint16_t) outputCount;
+			pass.inputChannels = (uint16_t) inputCount;
+
+			if(inputCount > 0) {
+				sampleClock->Record(inputSamples + nIn + availableInputs[0].Value, latched);
+			}
+
+			// Only the output of this call is queued ahead of the FIFO, so blocking transfers watch
+			// for a low margin but cannot end the output themselves
+			int64_t depth = monitor->FifoDepth();
+			if(outputCount > 0 && depth > 0) {
+				int64_t fill = max(depth - (int64_t) pass.outputSpace, (int64_t) 0);
+				watchdog->Observe(fill + (nsamples - nOut));
+			}
+
+			bool inPending = inputCount > 0 && nIn < nsamples;
+			bool outPending = outputCount > 0 && nOut < nsamples;
+
+			// Each direction moves whatever every channel has available, capped at one block and at
+			// the contiguous room in each ring so the driver reads and writes ring storage directly.
+			unsigned int inCap = inPending ? min(transferBlock, (unsigned) (nsamples - nIn)) : 0;
+			for(int i=0; i < inputCount; i++) {
+				inCap = min(inCap, (unsigned) inputs[i]->ContiguousSpace());
+			}
+
+			if(inPending && inCap == 0) {
+				throw gcnew HekaDAQException("Input buffer overflow");
+			}
+
+			unsigned int outCap = outPending ? min(transferBlock, (unsigned) (nsamples - nOut)) : 0;
+			for(int i=0; i < outputCount; i++) {
+				outCap = min(outCap, (unsigned) outputs[i]->ContiguousCount());
+			}
+
+			if(outPending && outCap == 0) {
+				throw gcnew HekaDAQException("Output buffer underrun");
+			}
+
+			unsigned int inBlock = inCap;
+			for(int i=0; i < inputCount; i++) {
+				inBlock = min(inBlock, (unsigned) availableInputs[i].Value);
+			}
+
+			unsigned int outBlock = outCap;
+			for(int i=0; i < outputCount; i++) {
+				outBlock = min(outBlock, (unsigned) availableOutputs[i].Value);
+			}
+
+			int n = 0;
+			if(outBlock > 0) {
+				for(int i=0; i < outputCount; i++, n++) {
+					transferData[n] = outputData[i];
+					transferData[n].Value = outBlock;
+					transferData[n].DataPointer = outputs[i]->ReadPointer();
+				}
+			}
+
+			if(inBlock > 0) {
+				for(int i=0; i < inputCount; i++, n++) {
+					transferData[n] = inputData[i];
+					transferData[n].Value = inBlock;
+					transferData[n].DataPointer = inputs[i]->WritePointer();
+				}
+			}
+
+			if(n > 0) {
+				int64_t callStart = waiter->BeginTransfer();
+				err = driver->ReadWriteFIFO(GetDevice(), n, transferData);
+				waiter->RecordFifoCall(callStart);
+				pass.fifoTicks = (uint32_t) (SampleClock::Now() - callStart);
+				counters->CountReadWriteFifo();
+				if(err != ACQ_SUCCESS) {
+					throw gcnew HekaDAQException("ITC_ReadWriteFIFO error", err);
+				}
+
+				for(int i=0; outBlock > 0 && i < outputCount; i++) {
+					outputs[i]->Consume(outBlock);
+				}
+				nOut += outBlock;
+
+				for(int i=0; inBlock > 0 && i < inputCount; i++) {
+					inputs[i]->Commit(inBlock);
+				}
+				nIn += inBlock;
+			} else {
+				passesSinceStatus = statusCheckInterval;
+			}
+
+			pass.outputSamples = n > 0 ? outBlock : 0;
+			pass.inputSamples = n > 0 ? inBlock : 0;
+			monitor->Record(pass);
+
+			waiter->EndTransfer(serviceStart);
+
+			// Wait only once the FIFO has been drained below a full block in every pending direction,
+			// for roughly as long as the closest direction needs to fill one.
+			bool full = (inPending && inBlock == inCap) || (outPending && outBlock == outCap);
+			if(!full) {
+				unsigned int missing = UINT_MAX;
+				if(inPending) {
+					missing = min(missing, inCap - inBlock);
+				}
+				if(outPending) {
+					missing = min(missing, outCap - outBlock);
+				}
+
+				waiter->Wait(missing == UINT_MAX ? 0 : missing);
+			}
+		}
+
+		if(inputCount > 0) {
+			EndInputBlock(nIn);
+		}
+
+		return nIn;
+	}
+
+
+	IDictionary<ChannelIdentifier, array<itcsample_t>^>^ 
+		IOBridge::ReadWrite(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
+		IList<ChannelIdentifier>^ input,
+		int32_t nsamples,
+		CancellationToken^ token)
+	{
+		CheckSingleDevice();
+		CheckStreamCounts(output->Count, input->Count, nsamples);
+
 		ITCChannelDataEx outputData[ITC00_NUMBEROFOUTPUTS];
 		ZeroMemory(outputData, sizeof(outputData));
 		ITCChannelDataEx inputData[ITC00_NUMBEROFINPUTS];
 		ZeroMemory(inputData, sizeof(inputData));
 
+		SampleRing *outputs[ITC00_NUMBEROFOUTPUTS];
+		SampleRing *inputs[ITC00_NUMBEROFINPUTS];
+
+		int nOutputs = 0;
+		for each(KeyValuePair<ChannelIdentifier, array<itcsample_t>^> kvp in output)
+		{
+			//check all outputs are correct length
+			if(kvp.Value->Length != nsamples) {
+				throw gcnew HekaDAQException("Output not correct length");
+			}
 
-		IList<ChannelIdentifier>^ outputStreams = Enumerable::ToList(output->Keys);
+			SampleRing *ring = OutputRing(kvp.Key);
+			ring->Clear();
+			ring->Reserve(nsamples);
 
+			if(nsamples > 0) {
+				pin_ptr<itcsample_t> samples = &kvp.Value[0];
+				ring->Write(samples, nsamples);
+			}
 
-		for(int i=0; i<outputStreams->Count; i++) {
-			outputData[i].ChannelNumber = outputStreams[i].ChannelNumber;
-			outputData[i].ChannelType = outputStreams[i].ChannelType;
+			outputData[nOutputs].ChannelNumber = kvp.Key.ChannelNumber;
+			outputData[nOutputs].ChannelType = kvp.Key.ChannelType;
+			outputs[nOutputs] = ring;
+			nOutputs++;
 		}
 
 		for(int i=0; i<input->Count; i++) {
 			inputData[i].ChannelNumber = input[i].ChannelNumber;
 			inputData[i].ChannelType = input[i].ChannelType;
-		}
 
-		//check all outputs are correct length
-		for each(array<itcsample_t>^ a in output->Values) {
-			if(a->Length != nsamples) {
-				throw gcnew HekaDAQException("Output not correct length");
-			}
+			inputs[i] = InputRing(input[i]);
+			inputs[i]->Reserve(inputs[i]->Count() + nsamples);
 		}
 
-		int32_t nIn = 0;
-		int32_t nOut = 0;
+		int32_t nIn = Transfer(outputData, outputs, nOutputs,
+			inputData, inputs, input->Count,
+			nsamples, token);
 
-		vector<vector<itcsample_t> > inputSamples(input->Count); 
-		vector<vector<itcsample_t> > outputSamples(output->Count);
-
-		unsigned int transferBlock = min(nsamples, TRANSFER_BLOCK_SAMPLES);
+		IDictionary<ChannelIdentifier, array<itcsample_t>^>^ result = gcnew Dictionary<ChannelIdentifier, array<itcsample_t>^>();
 
 		for(int i=0; i < input->Count; i++) {
-			inputSamples[i] = vector<itcsample_t>(2*nsamples);
+			ChannelIdentifier c = input[i];
+			c.Samples = c.Samples + nIn;
+			input[i] = c;
+
+			array<itcsample_t>^ inData = gcnew array<itcsample_t>((int32_t) inputs[i]->Count());
+			if(inData->Length > 0) {
+				pin_ptr<itcsample_t> samples = &inData[0];
+				inputs[i]->Read(samples, inData->Length);
+			}
+
+			result[input[i]] = inData;
 		}
 
-		for(int i=0; i < output->Count; i++) {
-			outputSamples[i] = vector<itcsample_t>(nsamples);
+		return result;
+	}
 
-			array<itcsample_t>^ out = output[outputStreams[i]];
 
-			for(int j=0; j<out->Length; j++) {
-				outputSamples[i][j] = out[j];
-			}
+	int32_t IOBridge::ReadWrite(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
+		IDictionary<ChannelIdentifier, array<itcsample_t>^>^ input,
+		int32_t nsamples,
+		CancellationToken^ token)
+	{
+		return ReadWrite(output, 0, input, nsamples, token);
+	}
+
+	int32_t IOBridge::ReadWrite(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
+		int32_t deficitSamples,
+		IDictionary<ChannelIdentifier, array<itcsample_t>^>^ input,
+		int32_t nsamples,
+		CancellationToken^ token)
+	{
+		CheckSingleDevice();
+		CheckStreamCounts(output->Count, input->Count, nsamples);
+
+		if(deficitSamples < 0) {
+			throw gcnew HekaDAQException("deficitSamples may not be less than zero.");
 		}
 
-		while((nOut < nsamples && output->Count > 0) || (nIn < nsamples && input->Count > 0)) {
+		ITCChannelDataEx deficitData[ITC00_NUMBEROFOUTPUTS];
+		ZeroMemory(deficitData, sizeof(deficitData));
+		ITCChannelDataEx outputData[ITC00_NUMBEROFOUTPUTS];
+		ZeroMemory(outputData, sizeof(outputData));
+		ITCChannelDataEx inputData[ITC00_NUMBEROFINPUTS];
+		ZeroMemory(inputData, sizeof(inputData));
 
-			if(token->IsCancellationRequested)
+		// Rings here are views onto the caller's pinned arrays rather than IOBridge-owned storage.
+		SampleRing outputViews[ITC00_NUMBEROFOUTPUTS];
+		SampleRing inputViews[ITC00_NUMBEROFINPUTS];
+		SampleRing *outputs[ITC00_NUMBEROFOUTPUTS];
+		SampleRing *inputs[ITC00_NUMBEROFINPUTS];
+
+		// GCHandles are kept as native pointers so that pinning the caller's arrays does not
+		// itself allocate on the managed heap.
+		void *outputPins[ITC00_NUMBEROFOUTPUTS];
+		void *inputPins[ITC00_NUMBEROFINPUTS];
+		int nOutputPins = 0;
+		int nInputPins = 0;
+
+		try
+		{
+			for each(KeyValuePair<ChannelIdentifier, array<itcsample_t>^> kvp in output)
 			{
-				break;
-			}
+				if(kvp.Value->Length != deficitSamples + nsamples) {
+					throw gcnew HekaDAQException("Output not correct length");
+				}
 
-			CheckStatus(GetDevice(), status);
+				GCHandle pin = GCHandle::Alloc(kvp.Value, GCHandleType::Pinned);
+				outputPins[nOutputPins] = GCHandle::ToIntPtr(pin).ToPointer();
+				itcsample_t *samples = static_cast<itcsample_t *>(pin.AddrOfPinnedObject().ToPointer());
 
-			ITC_UpdateNow(GetDevice(), NULL);
+				deficitData[nOutputPins].ChannelNumber = kvp.Key.ChannelNumber;
+				deficitData[nOutputPins].ChannelType = kvp.Key.ChannelType;
+				deficitData[nOutputPins].Value = deficitSamples;
+				deficitData[nOutputPins].DataPointer = samples;
 
-			err = ITC_GetDataAvailable(GetDevice(), input->Count, inputData);
+				outputData[nOutputPins].ChannelNumber = kvp.Key.ChannelNumber;
+				outputData[nOutputPins].ChannelType = kvp.Key.ChannelType;
+				outputViews[nOutputPins].Attach(samples + deficitSamples, nsamples, nsamples);
+				outputs[nOutputPins] = &outputViews[nOutputPins];
+				nOutputPins++;
+			}
 
-			bool inBlockAvailable = false;
-			for(int i=0; i < input->Count; i++) {
-				if(inputData[i].Value >= transferBlock) {
-					inputData[i].Value = transferBlock;
-					inBlockAvailable = true;
-				} else {
-					inputData[i].Value = 0;
+			for each(KeyValuePair<ChannelIdentifier, array<itcsample_t>^> kvp in input)
+			{
+				if(kvp.Value->Length < nsamples) {
+					throw gcnew HekaDAQException("Input buffer too small");
 				}
+
+				GCHandle pin = GCHandle::Alloc(kvp.Value, GCHandleType::Pinned);
+				inputPins[nInputPins] = GCHandle::ToIntPtr(pin).ToPointer();
+
+				inputData[nInputPins].ChannelNumber = kvp.Key.ChannelNumber;
+				inputData[nInputPins].ChannelType = kvp.Key.ChannelType;
+				inputViews[nInputPins].Attach(static_cast<itcsample_t *>(pin.AddrOfPinnedObject().ToPointer()), nsamples, 0);
+				inputs[nInputPins] = &inputViews[nInputPins];
+				nInputPins++;
 			}
 
-			if (inBlockAvailable) {
-				for(int i=0; i < input->Count; i++) {
-					inputData[i].DataPointer = inputSamples[i].data() + nIn;
-				}
+			// The samples the process loop fell behind on go straight to the FIFO to catch up
+			if(deficitSamples > 0 && nOutputPins > 0) {
+				WriteFifo(0, deficitData, nOutputPins);
+			}
 
-				err = ITC_ReadWriteFIFO(GetDevice(), input->Count, inputData);
-				if(err != ACQ_SUCCESS) {
-					throw gcnew HekaDAQException("ITC_ReadWriteFIFO error", err);
-				}
+			return Transfer(outputData, outputs, nOutputPins,
+				inputData, inputs, nInputPins,
+				nsamples, token);
+		}
+		finally
+		{
+			for(int i=0; i < nOutputPins; i++) {
+				GCHandle::FromIntPtr(IntPtr(outputPins[i])).Free();
+			}
 
-				nIn += transferBlock;
-				for(int i=0; i < input->Count; i++) {
-					ChannelIdentifier c = input[i];
-					c.Samples = c.Samples + inputData[i].Value;
-					input[i] = c;
-				}
+			for(int i=0; i < nInputPins; i++) {
+				GCHandle::FromIntPtr(IntPtr(inputPins[i])).Free();
 			}
+		}
+	}
 
-			err = ITC_GetDataAvailable(GetDevice(), output->Count, outputData);
+	void IOBridge::WriteFifo(int32_t deviceIndex, ITCChannelDataEx *outputData, int32_t outputCount)
+	{
+		long err;
 
-			bool outBlockAvailable = false;
-			for(int i=0; i < output->Count; i++) {
-				if(outputData[i].Value >= transferBlock) {
-					outputData[i].Value = transferBlock;
-					if((int)(nOut + outputData[i].Value) >= output[outputStreams[i]]->Length) {
-						outputData[i].Value = output[outputStreams[i]]->Length - nOut;
-					}
-					outBlockAvailable = true;
-				} else {
-					outputData[i].Value = 0;
-				}
+		err = driver->ReadWriteFIFO(GetDevice(deviceIndex), outputCount, outputData);
+		counters->CountReadWriteFifo();
+		if(err != ACQ_SUCCESS) {
+			throw gcnew HekaDAQException("ITC_ReadWriteFIFO error", err);
+		}
+	}
+
+	String^ SampleConverter::InstructionSet::get()
+	{
+		return ConversionSimdLevel() == SIMD_AVX2 ? "AVX2" : "SSE2";
+	}
+
+	void SampleConverter::CountsToVolts(array<itcsample_t>^ counts, array<double>^ volts, int32_t n)
+	{
+		CountsToValues(counts, 0, volts, 0, n, 1.0 / COUNTS_PER_VOLT, 0);
+	}
+
+	void SampleConverter::CountsToVolts(array<itcsample_t>^ counts, array<float>^ volts, int32_t n)
+	{
+		CountsToValues(counts, 0, volts, 0, n, (float) (1.0 / COUNTS_PER_VOLT), 0);
+	}
+
+	void SampleConverter::VoltsToCounts(array<double>^ volts, array<itcsample_t>^ counts, int32_t n)
+	{
+		ValuesToCounts(volts, 0, counts, 0, n, COUNTS_PER_VOLT, 0);
+	}
+
+	void SampleConverter::VoltsToCounts(array<float>^ volts, array<itcsample_t>^ counts, int32_t n)
+	{
+		ValuesToCounts(volts, 0, counts, 0, n, (float) COUNTS_PER_VOLT, 0);
+	}
+
+	void SampleConverter::CountsToValues(array<itcsample_t>^ counts, int32_t countsIndex,
+		array<double>^ values, int32_t valuesIndex,
+		int32_t n, double scale, double offset)
+	{
+		CheckRange(counts, countsIndex, n, "counts");
+		CheckRange(values, valuesIndex, n, "values");
+		if(n == 0) {
+			return;
+		}
+
+		pin_ptr<itcsample_t> src = &counts[countsIndex];
+		pin_ptr<double> dst = &values[valuesIndex];
+		Heka::CountsToValues(src, dst, n, scale, offset);
+	}
+
+	void SampleConverter::CountsToValues(array<itcsample_t>^ counts, int32_t countsIndex,
+		array<float>^ values, int32_t valuesIndex,
+		int32_t n, float scale, float offset)
+	{
+		CheckRange(counts, countsIndex, n, "counts");
+		CheckRange(values, valuesIndex, n, "values");
+		if(n == 0) {
+			return;
+		}
+
+		pin_ptr<itcsample_t> src = &counts[countsIndex];
+		pin_ptr<float> dst = &values[valuesIndex];
+		Heka::CountsToValues(src, dst, n, scale, offset);
+	}
+
+	void SampleConverter::ValuesToCounts(array<double>^ values, int32_t valuesIndex,
+		array<itcsample_t>^ counts, int32_t countsIndex,
+		int32_t n, double scale, double offset)
+	{
+		CheckRange(values, valuesIndex, n, "values");
+		CheckRange(counts, countsIndex, n, "counts");
+		if(n == 0) {
+			return;
+		}
+
+		pin_ptr<double> src = &values[valuesIndex];
+		pin_ptr<itcsample_t> dst = &counts[countsIndex];
+		Heka::ValuesToCounts(src, dst, n, scale, offset);
+	}
+
+	void SampleConverter::ValuesToCounts(array<float>^ values, int32_t valuesIndex,
+		array<itcsample_t>^ counts, int32_t countsIndex,
+		int32_t n, float scale, float offset)
+	{
+		CheckRange(values, valuesIndex, n, "values");
+		CheckRange(counts, countsIndex, n, "counts");
+		if(n == 0) {
+			return;
+		}
+
+		pin_ptr<float> src = &values[valuesIndex];
+		pin_ptr<itcsample_t> dst = &counts[countsIndex];
+		Heka::ValuesToCounts(src, dst, n, scale, offset);
+	}
+
+	void SampleConverter::UnpackBits(array<itcsample_t>^ port, int32_t n,
+		array<uint16_t>^ bitPositions,
+		array<array<itcsample_t>^>^ lines)
+	{
+		unsigned int bits[Heka::MAX_PORT_LINES];
+		CheckRange(port, 0, n, "port");
+		CheckLines(lines, bitPositions, n, bits);
+		if(n == 0) {
+			return;
+		}
+
+		int lineCount = lines->Length;
+		itcsample_t *linePointers[Heka::MAX_PORT_LINES];
+		void *pins[Heka::MAX_PORT_LINES];
+		int npins = 0;
+
+		try
+		{
+			for(; npins < lineCount; npins++) {
+				GCHandle pin = GCHandle::Alloc(lines[npins], GCHandleType::Pinned);
+				pins[npins] = GCHandle::ToIntPtr(pin).ToPointer();
+				linePointers[npins] = static_cast<itcsample_t *>(pin.AddrOfPinnedObject().ToPointer());
 			}
 
-			if (outBlockAvailable) {
-				for(int i=0; i < outputStreams->Count; i++) {
-					outputData[i].DataPointer = outputSamples[i].data() + nOut;
-				}
+			pin_ptr<itcsample_t> src = &port[0];
+			Heka::UnpackBits(src, n, bits, linePointers, lineCount);
+		}
+		finally
+		{
+			for(int i = 0; i < npins; i++) {
+				GCHandle::FromIntPtr(IntPtr(pins[i])).Free();
+			}
+		}
+	}
 
-				if(nOut < nsamples) {
-					err = ITC_ReadWriteFIFO(GetDevice(), outputStreams->Count, outputData);
-					if(err != ACQ_SUCCESS) {
-						throw gcnew HekaDAQException("ITC_ReadWriteFIFO error", err);
-					}
+	int32_t SampleConverter::PackBits(array<array<itcsample_t>^>^ lines,
+		array<uint16_t>^ bitPositions,
+		array<itcsample_t>^ port, int32_t n)
+	{
+		unsigned int bits[Heka::MAX_PORT_LINES];
+		CheckRange(port, 0, n, "port");
+		CheckLines(lines, bitPositions, n, bits);
+		if(n == 0) {
+			return -1;
+		}
 
-					nOut += transferBlock;
-				}
+		int lineCount = lines->Length;
+		const itcsample_t *linePointers[Heka::MAX_PORT_LINES];
+		void *pins[Heka::MAX_PORT_LINES];
+		int npins = 0;
+
+		try
+		{
+			for(; npins < lineCount; npins++) {
+				GCHandle pin = GCHandle::Alloc(lines[npins], GCHandleType::Pinned);
+				pins[npins] = GCHandle::ToIntPtr(pin).ToPointer();
+				linePointers[npins] = static_cast<const itcsample_t *>(pin.AddrOfPinnedObject().ToPointer());
+			}
+
+			pin_ptr<itcsample_t> dst = &port[0];
+			return Heka::PackBits(linePointers, bits, lineCount, dst, n);
+		}
+		finally
+		{
+			for(int i = 0; i < npins; i++) {
+				GCHandle::FromIntPtr(IntPtr(pins[i])).Free();
 			}
 		}
+	}
 
-		IDictionary<ChannelIdentifier, array<itcsample_t>^>^ result = gcnew Dictionary<ChannelIdentifier, array<itcsample_t>^>();
+	void SampleConverter::CheckLines(array<array<itcsample_t>^>^ lines, array<uint16_t>^ bitPositions, int32_t n,
+		unsigned int *bits)
+	{
+		if(lines == nullptr) {
+			throw gcnew ArgumentNullException("lines");
+		}
 
+		if(bitPositions == nullptr) {
+			throw gcnew ArgumentNullException("bitPositions");
+		}
 
-		for(int i=0; i < input->Count; i++) {
-			array<itcsample_t>^ inData = gcnew array<itcsample_t>(input[i].Samples);
-			for(unsigned int j=0; j < (unsigned) input[i].Samples; j++) {
-				itcsample_t s = inputSamples[i][j];  
-				inData[j] = s;
+		if(lines->Length != bitPositions->Length) {
+			throw gcnew ArgumentException("Each line requires a bit position", "bitPositions");
+		}
+
+		if(lines->Length > Heka::MAX_PORT_LINES) {
+			throw gcnew ArgumentException("Too many port lines", "lines");
+		}
+
+		for(int l = 0; l < lines->Length; l++) {
+			if(bitPositions[l] >= Heka::MAX_PORT_LINES) {
+				throw gcnew ArgumentOutOfRangeException("bitPositions", "Bit position must be less than 16");
 			}
 
-			result[input[i]] = inData;
+			CheckRange(lines[l], 0, n, "lines");
+			bits[l] = bitPositions[l];
 		}
+	}
 
-		return result;
+	void SampleConverter::CheckRange(Array^ buffer, int32_t index, int32_t n, String^ name)
+	{
+		if(buffer == nullptr) {
+			throw gcnew ArgumentNullException(name);
+		}
+
+		if(index < 0 || n < 0 || index > buffer->Length - n) {
+			throw gcnew ArgumentOutOfRangeException(name, "Sample range exceeds buffer length");
+		}
 	}
-}
\ No newline at end of file
+}
@@ -11,16 +11,27 @@
 //#endif
 
 #pragma warning (default : 4412)
+
+#include <cstdint>
+#include "itcmm.h"
+#include "ItcDriver.h"
+#include "SampleRing.h"
+#include "PollWaiter.h"
+#include "DriverCounters.h"
+#include "SampleClock.h"
+#include "TransferMonitor.h"
+#include "FifoWatchdog.h"
+#include "StreamingEngine.h"
+#include "SpillFile.h"
+#include "SampleConversion.h"
+#include "SimulatedItc.h"
+
 using namespace System;
 using namespace System::Collections::Generic;
 using namespace System::Threading;
 using namespace Heka::NativeInterop;
 
-#include <cstdint>
-
 namespace Heka {
-	typedef int16_t itcsample_t;
-
 
 	public value struct ChannelIdentifier
 	{
@@ -28,6 +39,7 @@ namespace Heka {
 		property uint16_t ChannelNumber;
 		property uint16_t ChannelType;
 		property int32_t Samples; //Number of input/output samples
+		property uint16_t DeviceIndex; //ITC unit within a multi-device IOBridge; 0 is the primary unit
 
 
 		virtual bool Equals(Object ^obj) override
@@ -36,7 +48,8 @@ namespace Heka {
 			{
 				ChannelIdentifier ^other = dynamic_cast<ChannelIdentifier^>(obj);
 				return (other->ChannelNumber == ChannelNumber &&
-					other->ChannelType == ChannelType);
+					other->ChannelType == ChannelType &&
+					other->DeviceIndex == DeviceIndex);
 
 			} else {
 				return false;
@@ -45,19 +58,161 @@ namespace Heka {
 
 		virtual int GetHashCode() override
 		{
-			return ChannelNumber.GetHashCode() ^ ChannelType.GetHashCode();
+			return ChannelNumber.GetHashCode() ^ ChannelType.GetHashCode() ^ (DeviceIndex.GetHashCode() << 16);
 		}
 
 	};
 
+	// Wait strategy used while the FIFO is short of a full transfer block (see PollWaiter).
+	public enum class PollingMode
+	{
+		Spin = POLL_SPIN,
+		Hybrid = POLL_HYBRID,
+		Sleep = POLL_SLEEP
+	};
+
+	// Number of ITCMM calls of each kind made by an IOBridge (including its streaming thread).
+	public value struct DriverCallCounts
+	{
+	public:
+		property int64_t GetState;
+		property int64_t UpdateNow;
+		property int64_t GetDataAvailable;
+		property int64_t ReadWriteFIFO;
+	};
+
+	// FIFO transfer loop timing and FIFO levels since the last ResetPollingStatistics, over the
+	// blocking transfers and the streaming thread alike. FIFO fills are -1 (and MinTimeToUnderrun
+	// TimeSpan::MaxValue) until known.
+	public value struct TransferStatistics
+	{
+	public:
+		property int64_t Passes;
+		property int64_t OutputSamples; //Per channel
+		property int64_t InputSamples; //Per channel
+		property TimeSpan MaxPollTime; //Longest ITC_UpdateNow + ITC_GetDataAvailable in one pass
+		property TimeSpan MaxFifoCallTime; //Longest ITC_ReadWriteFIFO time in one pass
+		property TimeSpan MaxPassInterval; //Longest time between the starts of successive passes
+		property int64_t MinOutputFifoFill; //Fewest samples left queued in an output FIFO at a poll
+		property int64_t MaxInputFifoFill; //Most samples waiting in an input FIFO at a poll
+		property TimeSpan MinTimeToUnderrun; //MinOutputFifoFill at SampleRate
+	};
+
+	// One FIFO pass from the transfer trace (see IOBridge::TraceTransfers).
+	public value struct TransferTraceEntry
+	{
+	public:
+		property int64_t StartTicks; //Stopwatch ticks
+		property TimeSpan PollTime;
+		property TimeSpan FifoCallTime;
+		property int32_t OutputFifoSpace;
+		property int32_t InputFifoFill;
+		property int32_t OutputSamples;
+		property int32_t InputSamples;
+	};
+
+	// Output margin seen by the FIFO watchdog (see IOBridge::ConfigureFifoWatchdog) since the last
+	// ResetPollingStatistics. Margins are samples per channel queued ahead of the hardware; -1 until
+	// known.
+	public value struct FifoMarginStatus
+	{
+	public:
+		property int64_t LowMarginEvents; //Times the margin fell below the low watermark
+		property int64_t MinMargin;
+		property int64_t LastMargin;
+		property bool OutputEnded; //The streaming thread ended the output on a low margin
+	};
+
+	// Hardware timing of the input block most recently returned by an IOBridge.
+	public value struct InputBlockTime
+	{
+	public:
+		property int64_t FirstSample; //Index of the block's first sample since ResetSampleClock
+		property int64_t HostTicks; //Estimated host time that sample was acquired (Stopwatch ticks); 0 if unknown
+	};
+
 	public ref class IOBridge
 	{
 	public:
 		static const unsigned int TRANSFER_BLOCK_SAMPLES = 512;
+		static const unsigned int MIN_TRANSFER_BLOCK_SAMPLES = 64;
+		static const unsigned int MAX_TRANSFER_BLOCK_SAMPLES = 16384;
+		static const unsigned int STATUS_CHECK_INTERVAL = 8;
 
 		IOBridge(IntPtr^ dev, unsigned int maxInputStreams, unsigned int maxOutputStreams) 
-			: device(dev->ToPointer()), maxInputs(maxInputStreams), maxOutputs(maxOutputStreams) 
-		{}
+			: devices(new void*[1]), deviceCount(1), driver(ItcmmDriver()), maxInputs(maxInputStreams), maxOutputs(maxOutputStreams),
+			inputRings(new SampleRing[ITC00_NUMBEROFINPUTS]), outputRings(new SampleRing[ITC00_NUMBEROFOUTPUTS]),
+			inputSlots(gcnew Dictionary<ChannelIdentifier, int32_t>()), outputSlots(gcnew Dictionary<ChannelIdentifier, int32_t>()),
+			driverLock(new CRITICAL_SECTION), waiter(new PollWaiter()), counters(new DriverCounters()), sampleClock(new SampleClock()), monitor(new TransferMonitor()), watchdog(new FifoWatchdog()), engine(NULL), spill(NULL),
+			statusCheckInterval(STATUS_CHECK_INTERVAL),
+			transferBlockSamples(TRANSFER_BLOCK_SAMPLES), activeTransferBlock(TRANSFER_BLOCK_SAMPLES), fifoDepth(0),
+			inputSamples(0), lastInputBlock(0)
+		{
+			devices[0] = dev->ToPointer();
+			InitializeCriticalSection(driverLock);
+		}
+
+		// Bridge over several ITC units, opened by the caller, that are started together (e.g. from a
+		// shared external trigger). Channels select their unit with ChannelIdentifier::DeviceIndex, an
+		// index into devs. All units are serviced by the one streaming thread, which keeps their
+		// channels sample-aligned; the blocking ReadWrite transfers support only single-unit bridges.
+		// maxInputStreams and maxOutputStreams are totals over all units.
+		IOBridge(array<IntPtr>^ devs, unsigned int maxInputStreams, unsigned int maxOutputStreams)
+			: devices(new void*[devs->Length]), deviceCount(devs->Length), driver(ItcmmDriver()), maxInputs(maxInputStreams), maxOutputs(maxOutputStreams),
+			inputRings(new SampleRing[ITC00_NUMBEROFINPUTS * devs->Length]), outputRings(new SampleRing[ITC00_NUMBEROFOUTPUTS * devs->Length]),
+			inputSlots(gcnew Dictionary<ChannelIdentifier, int32_t>()), outputSlots(gcnew Dictionary<ChannelIdentifier, int32_t>()),
+			driverLock(new CRITICAL_SECTION), waiter(new PollWaiter()), counters(new DriverCounters()), sampleClock(new SampleClock()), monitor(new TransferMonitor()), watchdog(new FifoWatchdog()), engine(NULL), spill(NULL),
+			statusCheckInterval(STATUS_CHECK_INTERVAL),
+			transferBlockSamples(TRANSFER_BLOCK_SAMPLES), activeTransferBlock(TRANSFER_BLOCK_SAMPLES), fifoDepth(0),
+			inputSamples(0), lastInputBlock(0)
+		{
+			if(devs->Length == 0) {
+				throw gcnew ArgumentException("At least one device is required", "devs");
+			}
+
+			for(int i=0; i < devs->Length; i++) {
+				devices[i] = devs[i].ToPointer();
+			}
+
+			InitializeCriticalSection(driverLock);
+		}
+
+		~IOBridge() { this->!IOBridge(); }
+		!IOBridge()
+		{
+			delete engine;
+			engine = NULL;
+			delete spill;
+			spill = NULL;
+			delete waiter;
+			waiter = NULL;
+			delete counters;
+			counters = NULL;
+			delete sampleClock;
+			sampleClock = NULL;
+			delete monitor;
+			monitor = NULL;
+			delete watchdog;
+			watchdog = NULL;
+			if(driverLock != NULL) {
+				DeleteCriticalSection(driverLock);
+				delete driverLock;
+				driverLock = NULL;
+			}
+			delete[] inputRings;
+			inputRings = NULL;
+			delete[] outputRings;
+			outputRings = NULL;
+			delete[] devices;
+			devices = NULL;
+		}
+
+		property int32_t DeviceCount { int32_t get() { return deviceCount; } }
+
+		// Assigns a persistent native ring buffer of the given capacity (in samples) to each
+		// channel. Rings are reused by ReadWrite for the rest of the
+		// acquisition and only grow if a later transfer needs more room.
+		void ConfigureBuffers(IList<ChannelIdentifier>^ outputs, IList<ChannelIdentifier>^ inputs, int32_t capacity);
 
 		array<itcsample_t>^ RunTestMain(array<itcsample_t>^ managedOut, int nsamples);
 
@@ -67,18 +222,381 @@ namespace Heka {
 			int32_t nsamples,
 			CancellationToken^ token);
 
+		// Zero-copy variant of ReadWrite. The caller's output and input arrays are pinned for the
+		// duration of the call and handed directly to the ITC driver; input arrays must hold at
+		// least nsamples samples and are filled in place. Returns the number of samples read into
+		// each input array.
+		int32_t ReadWrite(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
+			IDictionary<ChannelIdentifier, array<itcsample_t>^>^ input,
+			int32_t nsamples,
+			CancellationToken^ token);
+
+		// Zero-copy ReadWrite of a whole process-loop block. Each output array holds deficitSamples
+		// followed by nsamples samples: the first deficitSamples are written to the FIFO at once to
+		// catch up after the caller fell behind, then the rest is transferred while nsamples of input
+		// are read. Both parts come straight from the same pinned arrays.
+		int32_t ReadWrite(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
+			int32_t deficitSamples,
+			IDictionary<ChannelIdentifier, array<itcsample_t>^>^ input,
+			int32_t nsamples,
+			CancellationToken^ token);
+
+		// Preload and Write hand the output arrays directly to the ITC driver in a single
+		// ITC_ReadWriteFIFO call. Preload with nsamples sends only the first nsamples of each
+		// array, so callers may keep reusing larger preallocated buffers.
 		void Preload(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output);
+		void Preload(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output, int32_t nsamples);
 		void Write(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output);
 
+		// Starts a native thread that services the FIFOs of the given channels continuously (see
+		// StreamingEngine). The hardware must already be running. While streaming, exchange data
+		// with StreamReadWrite rather than ReadWrite/Write.
+		// outputBackgrounds, if given, holds each output's background level in ADC counts, used if the
+		// FIFO watchdog ends the output; otherwise outputs end at zero.
+		void StartStreaming(IList<ChannelIdentifier>^ outputs, IList<ChannelIdentifier>^ inputs, int32_t queueCapacity);
+		void StartStreaming(IList<ChannelIdentifier>^ outputs, IList<itcsample_t>^ outputBackgrounds,
+			IList<ChannelIdentifier>^ inputs, int32_t queueCapacity);
+		void StopStreaming();
+
+		property bool Streaming { bool get() { return engine != NULL && engine->IsRunning(); } }
+
+		// If set, each streaming run also appends its input, as read from the FIFO, to a
+		// memory-mapped spill file at this path (see SpillFile), replacing any file there. The file
+		// is closed, and flagged as such, by StopStreaming; one left unclosed by a dying process can
+		// be recovered with SpillFileReader. May only be changed while not streaming. Defaults to
+		// nullptr (no spill file).
+		property String^ SpillPath
+		{
+			String^ get() { return spillPath; }
+			void set(String^ path);
+		}
+
+		// Samples per input spilled by the current or most recent streaming run, and whether
+		// spilling failed (e.g. the disk filled). A failed spill does not stop the run.
+		property int64_t SpilledSamples { int64_t get() { return spill != NULL ? spill->Samples() : 0; } }
+		property bool SpillFailed { bool get() { return spill != NULL && spill->Failed(); } }
+
+		// Queues output samples on the streaming thread and collects nsamples of input into the
+		// caller's arrays. Output arrays may be of any (common) length. Blocks only while the
+		// output queues are full or the input queues are empty. Returns the number of samples
+		// read into each input array.
+		int32_t StreamReadWrite(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
+			IDictionary<ChannelIdentifier, array<itcsample_t>^>^ input,
+			int32_t nsamples,
+			CancellationToken^ token);
+
+		// Samples moved per ITC_ReadWriteFIFO call. Zero selects auto-tuning from the sampling rate,
+		// channel count and measured driver call cost (see TuneTransferBlock). Either way the block
+		// is capped to a fraction of the FIFO depth given to ConfigureBuffers.
+		property unsigned int TransferBlockSamples
+		{
+			unsigned int get() { return transferBlockSamples; }
+			void set(unsigned int samples) { transferBlockSamples = samples; }
+		}
+
+		// Block size used by the most recent transfer (the tuned size when auto-tuning).
+		property unsigned int ActiveTransferBlockSamples { unsigned int get() { return activeTransferBlock; } }
+
+		unsigned int TuneTransferBlock(int32_t channelCount);
+
+		property PollingMode Polling
+		{
+			PollingMode get() { return (PollingMode) waiter->Mode(); }
+			void set(PollingMode mode) { waiter->SetMode((PollMode) mode); }
+		}
+
+		// Per-channel sampling rate (Hz), used to estimate how long until the next block is ready.
+		property double SampleRate
+		{
+			double get() { return waiter->SampleRate(); }
+			void set(double hz) { waiter->SetSampleRate(hz); }
+		}
+
+		// Time spent waiting on, and servicing, the FIFO since the last ResetPollingStatistics.
+		property TimeSpan PollWaitTime { TimeSpan get() { return TimeSpan::FromSeconds(waiter->WaitSeconds()); } }
+		property TimeSpan TransferTime { TimeSpan get() { return TimeSpan::FromSeconds(waiter->TransferSeconds()); } }
+		void ResetPollingStatistics() { waiter->ResetStatistics(); monitor->Reset(); watchdog->Reset(); }
+
+		property TransferStatistics Statistics { TransferStatistics get(); }
+
+		// If true, the most recent TransferMonitor::TRACE_CAPACITY FIFO passes are kept in a native
+		// ring, without allocation, for DumpTransferTrace after a failure. May only be changed while
+		// not streaming. Defaults to false.
+		property bool TraceTransfers
+		{
+			bool get() { return monitor->TraceEnabled(); }
+			void set(bool enable);
+		}
+
+		// Traced passes (oldest first) since the last ResetPollingStatistics; empty if not tracing.
+		array<TransferTraceEntry>^ DumpTransferTrace();
+
+		// Watches the output margin (samples per channel waiting in the output FIFO plus those not
+		// yet written to it) on every FIFO pass, given the FIFO depth from ConfigureBuffers. Each
+		// fall below lowSamples is counted in FifoMargin. While streaming, a margin below
+		// stopSamples with no output left to write ends the output cleanly: the streaming thread
+		// writes one block of background marked as the last FIFO data and stops once the remaining
+		// input has been read, instead of letting the hardware underrun. Zero disables either check.
+		// May only be changed while not streaming.
+		void ConfigureFifoWatchdog(uint32_t lowSamples, uint32_t stopSamples);
+
+		property FifoMarginStatus FifoMargin { FifoMarginStatus get(); }
+
+		// Transfer passes between ITC_GetState run-state checks. A pass that moves no samples always
+		// triggers a check on the next pass, so underrun/overflow is still detected promptly.
+		// 1 checks every pass.
+		property unsigned int StatusCheckInterval
+		{
+			unsigned int get() { return statusCheckInterval; }
+			void set(unsigned int passes) { statusCheckInterval = passes; }
+		}
+
+		property DriverCallCounts DriverCalls
+		{
+			DriverCallCounts get()
+			{
+				DriverCallCounts result;
+				result.GetState = counters->GetState();
+				result.UpdateNow = counters->UpdateNow();
+				result.GetDataAvailable = counters->GetDataAvailable();
+				result.ReadWriteFIFO = counters->ReadWriteFifo();
+				return result;
+			}
+		}
+
+		void ResetDriverCalls() { counters->Reset(); }
+
+		// Every FIFO pass (blocking or streaming) pairs the hardware's input sample count with the
+		// host performance counter, and the pairs are fitted to timestamp input blocks without extra
+		// driver calls (see SampleClock). Call ResetSampleClock as the hardware starts with reset
+		// FIFOs, after setting SampleRate.
+		void ResetSampleClock()
+		{
+			sampleClock->Reset(waiter->SampleRate());
+			inputSamples = 0;
+			lastInputBlock = 0;
+		}
+
+		property InputBlockTime LastInputBlock
+		{
+			InputBlockTime get()
+			{
+				InputBlockTime result;
+				result.FirstSample = lastInputBlock;
+				result.HostTicks = sampleClock->HostTicks(lastInputBlock);
+				return result;
+			}
+		}
+
+		// Drift of the hardware sample clock from SampleRate, in parts per million of the host
+		// clock; positive when the hardware runs slow. Zero until enough samples have been observed.
+		property double SampleClockDriftPpm { double get() { return sampleClock->DriftPpm(); } }
+		property int64_t SampleClockObservations { int64_t get() { return sampleClock->Observations(); } }
+
+		// Serializes ITCMM access with the streaming thread. Callers making their own driver
+		// calls must hold the driver while streaming.
+		void AcquireDriver() { EnterCriticalSection(driverLock); }
+		void ReleaseDriver() { LeaveCriticalSection(driverLock); }
+
+		// The native ItcDriver table (see ItcDriver.h) that the bridge's driver calls go through:
+		// ITCMM by default, or e.g. SimulatedItc::Driver() for a bridge whose devices are
+		// SimulatedItc handles. IntPtr::Zero restores ITCMM. May only be changed while not streaming.
+		property IntPtr Driver
+		{
+			IntPtr get() { return IntPtr((void *) driver); }
+			void set(IntPtr table);
+		}
+
 	private:
-		void *GetDevice() { return device; }
+		void *GetDevice() { return devices[0]; }
+		void *GetDevice(int32_t index) { return devices[index]; }
+
+		// Channel slots (and stack transfer arrays) available over all units
+		int32_t OutputChannelLimit() { return ITC00_NUMBEROFOUTPUTS * deviceCount; }
+		int32_t InputChannelLimit() { return ITC00_NUMBEROFINPUTS * deviceCount; }
+
+		void CheckSingleDevice();
+		void CheckDeviceIndex(ChannelIdentifier channel);
 
 		void WriteOutput(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output,
+			int32_t nsamples,
 			bool preload);
 
-		void *device;
+		void WriteFifo(int32_t deviceIndex, ITCChannelDataEx *outputData, int32_t outputCount);
+
+		static int32_t CommonLength(IDictionary<ChannelIdentifier, array<itcsample_t>^>^ output);
+
+		void CheckStreamCounts(int32_t outputCount, int32_t inputCount, int32_t nsamples);
+
+		int32_t Transfer(ITCChannelDataEx *outputData,
+			SampleRing **outputs,
+			int32_t outputCount,
+			ITCChannelDataEx *inputData,
+			SampleRing **inputs,
+			int32_t inputCount,
+			int32_t nsamples,
+			CancellationToken^ token);
+
+		SampleRing *InputRing(ChannelIdentifier channel);
+		SampleRing *OutputRing(ChannelIdentifier channel);
+
+		void CheckStreaming();
+
+		TimeSpan HostTicksToTimeSpan(int64_t ticks)
+		{
+			return TimeSpan::FromSeconds((double) ticks / sampleClock->Frequency());
+		}
+
+		// Advances the input sample count past a returned block of n samples
+		void EndInputBlock(int32_t n)
+		{
+			lastInputBlock = inputSamples;
+			inputSamples += n;
+		}
+
+		unsigned int ActiveBlockSamples(int32_t channelCount);
+
+		// Auto-tuning parameters. Call cost defaults apply until a driver call has been timed.
+		literal double DEFAULT_FIFO_CALL_SECONDS = 50e-6;
+		literal double DEFAULT_FIFO_CHANNEL_SECONDS = 10e-6;
+		literal double AUTO_TUNE_OVERHEAD_RATIO = 20;
+		literal unsigned int FIFO_BLOCK_HEADROOM = 4;
+
+		void **devices;
+		const int32_t deviceCount;
+		const ItcDriver *driver;
 
 		unsigned const int maxInputs;
 		unsigned const int maxOutputs;
+
+		SampleRing *inputRings;
+		SampleRing *outputRings;
+		Dictionary<ChannelIdentifier, int32_t>^ inputSlots;
+		Dictionary<ChannelIdentifier, int32_t>^ outputSlots;
+
+		CRITICAL_SECTION *driverLock;
+		PollWaiter *waiter;
+		DriverCounters *counters;
+		SampleClock *sampleClock;
+		TransferMonitor *monitor;
+		FifoWatchdog *watchdog;
+		StreamingEngine *engine;
+		SpillFile *spill;
+		String^ spillPath;
+
+		unsigned int statusCheckInterval;
+
+		unsigned int transferBlockSamples;
+		unsigned int activeTransferBlock;
+		int32_t fifoDepth;
+
+		int64_t inputSamples; //Input samples returned since ResetSampleClock
+		int64_t lastInputBlock;
+	};
+
+	// Managed owner of a SimulatedItc (see SimulatedItc.h), so that managed hosts can run an
+	// IOBridge without hardware: give Handle to the IOBridge constructor and Driver to
+	// IOBridge::Driver. The configuration properties may only be set while the unit is stopped.
+	public ref class SimulatedDevice
+	{
+	public:
+		SimulatedDevice() : itc(new SimulatedItc(SimulatedItcConfig())) {}
+
+		~SimulatedDevice() { this->!SimulatedDevice(); }
+		!SimulatedDevice()
+		{
+			delete itc;
+			itc = NULL;
+		}
+
+		property IntPtr Handle { IntPtr get() { return IntPtr(itc->Handle()); } }
+		static property IntPtr Driver { IntPtr get() { return IntPtr((void *) SimulatedItc::Driver()); } }
+
+		property uint32_t FifoDepth { uint32_t get() { return itc->Config().fifoDepth; } void set(uint32_t value); }
+		property double SampleRate { double get() { return itc->Config().sampleRate; } void set(double value); }
+
+		// Sample clock rate as a multiple of SampleRate; above 1 for faster than real-time runs
+		property double Speed { double get() { return itc->Config().speed; } void set(double value); }
+
+		property double CallLatencyMicroseconds { double get() { return itc->Config().callLatencyMicroseconds; } void set(double value); }
+		property double SampleLatencyNanoseconds { double get() { return itc->Config().sampleLatencyNanoseconds; } void set(double value); }
+
+		// If true, each input acquires the output of the same number; other inputs acquire a sine
+		// of SyntheticAmplitude counts every SyntheticPeriodSamples samples
+		property bool Loopback { bool get() { return itc->Config().loopback; } void set(bool value); }
+		property double SyntheticAmplitude { double get() { return itc->Config().syntheticAmplitude; } void set(double value); }
+		property double SyntheticPeriodSamples { double get() { return itc->Config().syntheticPeriodSamples; } void set(double value); }
+
+		// As ITC_SetChannels; a channel's SamplingRate sets SampleRate
+		void SetChannels(array<ITCMM::ITCChannelInfo>^ channels);
+
+		void Start() { itc->Start(); }
+		void Stop() { itc->Stop(); }
+
+		property bool Running { bool get() { return itc->IsRunning(); } }
+		property bool Underrun { bool get() { return itc->Underrun(); } }
+		property bool Overflow { bool get() { return itc->Overflow(); } }
+		property int64_t SamplesClocked { int64_t get() { return itc->SamplesClocked(); } }
+		property int64_t DriverCalls { int64_t get() { return itc->DriverCalls(); } }
+
+		// As ITC_GetTime
+		property double Time { double get() { return itc->Time(); } }
+
+	private:
+		void Configure(const SimulatedItcConfig &config);
+
+		SimulatedItc *itc;
+	};
+
+	// Bulk conversions between ITC int16 counts and floating point samples, using the SIMD
+	// kernels in SampleConversion.cpp. The general forms compute
+	//   values = counts * scale + offset
+	//   counts = round(values * scale + offset), saturated to the int16 range
+	// on n samples starting at the given array indexes. The volts forms use COUNTS_PER_VOLT.
+	public ref class SampleConverter abstract sealed
+	{
+	public:
+		literal double COUNTS_PER_VOLT = ANALOGVOLT;
+
+		// "AVX2" or "SSE2"
+		static property String^ InstructionSet { String^ get(); }
+
+		static void CountsToVolts(array<itcsample_t>^ counts, array<double>^ volts, int32_t n);
+		static void CountsToVolts(array<itcsample_t>^ counts, array<float>^ volts, int32_t n);
+		static void VoltsToCounts(array<double>^ volts, array<itcsample_t>^ counts, int32_t n);
+		static void VoltsToCounts(array<float>^ volts, array<itcsample_t>^ counts, int32_t n);
+
+		static void CountsToValues(array<itcsample_t>^ counts, int32_t countsIndex,
+			array<double>^ values, int32_t valuesIndex,
+			int32_t n, double scale, double offset);
+		static void CountsToValues(array<itcsample_t>^ counts, int32_t countsIndex,
+			array<float>^ values, int32_t valuesIndex,
+			int32_t n, float scale, float offset);
+		static void ValuesToCounts(array<double>^ values, int32_t valuesIndex,
+			array<itcsample_t>^ counts, int32_t countsIndex,
+			int32_t n, double scale, double offset);
+		static void ValuesToCounts(array<float>^ values, int32_t valuesIndex,
+			array<itcsample_t>^ counts, int32_t countsIndex,
+			int32_t n, float scale, float offset);
+
+		literal int32_t MAX_PORT_LINES = Heka::MAX_PORT_LINES;
+
+		// Splits the first n samples of a digital port into per-line 0/1 samples in one pass;
+		// lines[l] receives bit bitPositions[l].
+		static void UnpackBits(array<itcsample_t>^ port, int32_t n,
+			array<uint16_t>^ bitPositions,
+			array<array<itcsample_t>^>^ lines);
+
+		// Merges the first n per-line 0/1 samples into port samples in one pass; line l is
+		// shifted to bit bitPositions[l]. Returns the index of the first line holding a value
+		// other than 0 or 1, or -1.
+		static int32_t PackBits(array<array<itcsample_t>^>^ lines,
+			array<uint16_t>^ bitPositions,
+			array<itcsample_t>^ port, int32_t n);
+
+	private:
+		static void CheckRange(Array^ buffer, int32_t index, int32_t n, String^ name);
+		static void CheckLines(array<array<itcsample_t>^>^ lines, array<uint16_t>^ bitPositions, int32_t n,
+			unsigned int *bits);
 	};
 }
\ No newline at end of file
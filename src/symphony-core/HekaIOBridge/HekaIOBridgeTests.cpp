@@ -172,7 +172,7 @@ namespace Heka {
 				err = ITC_Start(dev, NULL);
 
 
-				this->device = dev;
+				this->devices[0] = dev;
 				int nPreload = nOut; //TODO for skipping in input
 				array<int16_t>^ remainingOut = gcnew array<int16_t>(managedOut->Length - nOut);
 				Array::Copy(managedOut, nOut, remainingOut, 0, remainingOut->Length);
@@ -0,0 +1,25 @@
+// ItcDriver.cpp : ITCMM.lib driver table. Kept apart from the bridge sources so that builds
+// running against SimulatedItc need not link ITCMM.lib.
+//
+
+#include "stdafx.h"
+#include "ItcDriver.h"
+
+//Automatcially link importer's project to ITCMM.lib
+#pragma message("Adding automatic link to ITCMM.lib")
+#pragma comment(lib, "ITCMM.lib")
+
+namespace Heka {
+
+	const ItcDriver *ItcmmDriver()
+	{
+		static const ItcDriver driver = {
+			ITC_GetState,
+			ITC_UpdateNow,
+			ITC_GetDataAvailable,
+			ITC_ReadWriteFIFO
+		};
+
+		return &driver;
+	}
+}
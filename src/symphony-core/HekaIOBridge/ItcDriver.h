@@ -0,0 +1,21 @@
+#pragma once
+
+#include "itcmm.h"
+
+namespace Heka {
+
+	// The ITCMM calls made on the bridge's transfer paths, as a table that IOBridge and
+	// StreamingEngine call through. ItcmmDriver() calls ITCMM.lib; SimulatedItc::Driver() runs
+	// the same paths against a simulated device, without hardware. Entries have the ITCMM
+	// signatures and return codes.
+	struct ItcDriver
+	{
+		unsigned long (*GetState)(HANDLE device, ITCStatus *status);
+		unsigned long (*UpdateNow)(HANDLE device, void *param);
+		unsigned long (*GetDataAvailable)(HANDLE device, unsigned long channelCount, ITCChannelDataEx *channels);
+		unsigned long (*ReadWriteFIFO)(HANDLE device, unsigned long channelCount, ITCChannelDataEx *channels);
+	};
+
+	// Table of the ITCMM.lib functions (ItcDriver.cpp).
+	const ItcDriver *ItcmmDriver();
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+namespace Heka {
+
+	enum PollMode
+	{
+		POLL_SPIN,   // Re-poll immediately (lowest latency, one core at 100%)
+		POLL_HYBRID, // Timer-wait for most of the expected gap, then yield-poll the remainder
+		POLL_SLEEP   // Timer-wait for the whole expected gap
+	};
+
+	// Paces FIFO polling loops. Given the number of samples still missing before the next block
+	// can be transferred and the per-channel sampling rate, waits roughly until that block should
+	// be ready, using a high-resolution waitable timer where the OS provides one. Time spent
+	// waiting and transferring is accumulated for reporting; counters may be read from any thread.
+	class PollWaiter
+	{
+	public:
+		// Below this expected gap, hybrid mode yields instead of arming the timer.
+		static const int64_t HYBRID_SPIN_MICROSECONDS = 1000;
+
+		PollWaiter() : mode(POLL_HYBRID), sampleRate(0), waitTicks(0), transferTicks(0), waits(0), fifoCallTicks(0), fifoCalls(0)
+		{
+			LARGE_INTEGER f;
+			QueryPerformanceFrequency(&f);
+			frequency = f.QuadPart;
+
+			timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+			if(timer == NULL) {
+				timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+			}
+		}
+
+		~PollWaiter()
+		{
+			if(timer != NULL) {
+				CloseHandle(timer);
+			}
+		}
+
+		PollMode Mode() const { return mode; }
+		void SetMode(PollMode m) { mode = m; }
+
+		double SampleRate() const { return sampleRate; }
+		void SetSampleRate(double hz) { sampleRate = hz; }
+
+		// Waits until about missingSamples more samples should have been acquired/played.
+		void Wait(size_t missingSamples)
+		{
+			if(mode == POLL_SPIN) {
+				return;
+			}
+
+			int64_t start = Now();
+
+			int64_t expected = sampleRate > 0 ? (int64_t) (missingSamples * 1e6 / sampleRate) : -1;
+
+			if(expected < 0) {
+				// No rate to estimate from
+				if(mode == POLL_SLEEP) {
+					Sleep(1);
+				} else {
+					SwitchToThread();
+				}
+			} else if(mode == POLL_HYBRID) {
+				if(expected > HYBRID_SPIN_MICROSECONDS) {
+					TimerWait(expected - HYBRID_SPIN_MICROSECONDS / 2);
+				} else {
+					SwitchToThread();
+				}
+			} else {
+				TimerWait(expected);
+			}
+
+			InterlockedExchangeAdd64(&waitTicks, Now() - start);
+			InterlockedIncrement64(&waits);
+		}
+
+		int64_t BeginTransfer() const { return Now(); }
+		void EndTransfer(int64_t start) { InterlockedExchangeAdd64(&transferTicks, Now() - start); }
+
+		// Records the duration of a single ITC_ReadWriteFIFO call started at BeginTransfer().
+		void RecordFifoCall(int64_t start)
+		{
+			InterlockedExchangeAdd64(&fifoCallTicks, Now() - start);
+			InterlockedIncrement64(&fifoCalls);
+		}
+
+		int64_t FifoCalls() const { return Read(&fifoCalls); }
+		double AverageFifoCallSeconds() const
+		{
+			int64_t calls = FifoCalls();
+			return calls > 0 ? (double) Read(&fifoCallTicks) / frequency / calls : 0;
+		}
+
+		double WaitSeconds() const { return (double) Read(&waitTicks) / frequency; }
+		double TransferSeconds() const { return (double) Read(&transferTicks) / frequency; }
+		int64_t Waits() const { return Read(&waits); }
+
+		void ResetStatistics()
+		{
+			InterlockedExchange64(&waitTicks, 0);
+			InterlockedExchange64(&transferTicks, 0);
+			InterlockedExchange64(&waits, 0);
+			InterlockedExchange64(&fifoCallTicks, 0);
+			InterlockedExchange64(&fifoCalls, 0);
+		}
+
+	private:
+		int64_t Now() const
+		{
+			LARGE_INTEGER t;
+			QueryPerformanceCounter(&t);
+			return t.QuadPart;
+		}
+
+		static int64_t Read(volatile LONGLONG const *value)
+		{
+			return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(value), 0, 0);
+		}
+
+		void TimerWait(int64_t microseconds)
+		{
+			if(microseconds <= 0) {
+				return;
+			}
+
+			if(timer == NULL) {
+				Sleep((DWORD) ((microseconds + 999) / 1000));
+				return;
+			}
+
+			LARGE_INTEGER due;
+			due.QuadPart = -microseconds * 10; // relative, 100ns units
+			if(SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE)) {
+				WaitForSingleObject(timer, INFINITE);
+			}
+		}
+
+		PollWaiter(const PollWaiter &);
+		PollWaiter &operator=(const PollWaiter &);
+
+		HANDLE timer;
+		int64_t frequency;
+		volatile PollMode mode;
+		volatile double sampleRate;
+		volatile LONGLONG waitTicks;
+		volatile LONGLONG transferTicks;
+		volatile LONGLONG waits;
+		volatile LONGLONG fifoCallTicks;
+		volatile LONGLONG fifoCalls;
+	};
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Heka {
+
+	// Relates the ITC sample counter to the host performance counter. Each FIFO pass records an
+	// observation: the number of input samples the hardware had acquired (samples already read plus
+	// those waiting in the FIFO) and the host time at which that count was latched by ITC_UpdateNow.
+	// A running least-squares fit of host time against sample index gives the host time of any
+	// sample and the drift of the hardware sample clock from its nominal rate, as measured by the
+	// host clock. Observations may be recorded and estimates read from any thread.
+	class SampleClock
+	{
+	public:
+		SampleClock() : nominalRate(0)
+		{
+			LARGE_INTEGER f;
+			QueryPerformanceFrequency(&f);
+			frequency = f.QuadPart;
+
+			InitializeCriticalSection(&lock);
+			Clear();
+		}
+
+		~SampleClock()
+		{
+			DeleteCriticalSection(&lock);
+		}
+
+		// Host performance counter, in the same ticks as System::Diagnostics::Stopwatch.
+		static int64_t Now()
+		{
+			LARGE_INTEGER t;
+			QueryPerformanceCounter(&t);
+			return t.QuadPart;
+		}
+
+		int64_t Frequency() const { return frequency; }
+
+		// Discards all observations. Call as the hardware (re)starts so that sample 0 is the first
+		// sample acquired. rate is the nominal per-channel sampling rate (Hz), used until there are
+		// enough observations to fit the sample period.
+		void Reset(double rate)
+		{
+			EnterCriticalSection(&lock);
+			nominalRate = rate;
+			Clear();
+			LeaveCriticalSection(&lock);
+		}
+
+		// Records that acquiredSamples samples had been acquired at host time hostTicks.
+		void Record(int64_t acquiredSamples, int64_t hostTicks)
+		{
+			if(acquiredSamples <= 0) {
+				return;
+			}
+
+			EnterCriticalSection(&lock);
+
+			if(observations == 0) {
+				originSample = acquiredSamples - 1;
+				originTicks = hostTicks;
+			}
+
+			// Welford-style update, relative to the first observation to keep precision
+			double x = (double) (acquiredSamples - 1 - originSample);
+			double y = (double) (hostTicks - originTicks) / frequency;
+
+			observations++;
+			lastX = x;
+			double dx = x - meanX;
+			meanX += dx / observations;
+			meanY += (y - meanY) / observations;
+			sxx += dx * (x - meanX);
+			sxy += dx * (y - meanY);
+
+			LeaveCriticalSection(&lock);
+		}
+
+		int64_t Observations() const
+		{
+			EnterCriticalSection(&lock);
+			int64_t n = observations;
+			LeaveCriticalSection(&lock);
+			return n;
+		}
+
+		// Estimated host time (performance counter ticks) at which the sample with the given index
+		// was acquired, or 0 if nothing has been observed yet.
+		int64_t HostTicks(int64_t sampleIndex) const
+		{
+			EnterCriticalSection(&lock);
+
+			int64_t ticks = 0;
+			if(observations > 0) {
+				double period = Period();
+				double seconds = meanY + period * ((double) (sampleIndex - originSample) - meanX);
+				ticks = originTicks + (int64_t) (seconds * frequency);
+			}
+
+			LeaveCriticalSection(&lock);
+			return ticks;
+		}
+
+		// Fitted sample period relative to the nominal period, in parts per million; positive when
+		// the hardware clock runs slow against the host. Zero until the period can be fitted.
+		double DriftPpm() const
+		{
+			EnterCriticalSection(&lock);
+
+			double ppm = 0;
+			if(Fitted() && nominalRate > 0) {
+				ppm = (sxy / sxx * nominalRate - 1) * 1e6;
+			}
+
+			LeaveCriticalSection(&lock);
+			return ppm;
+		}
+
+	private:
+		// Observations must span this many samples before the fitted period replaces the nominal one
+		static const int64_t MIN_FIT_SAMPLES = 64;
+
+		void Clear()
+		{
+			observations = 0;
+			originSample = 0;
+			originTicks = 0;
+			meanX = meanY = lastX = sxx = sxy = 0;
+		}
+
+		bool Fitted() const
+		{
+			return sxx > 0 && lastX >= MIN_FIT_SAMPLES;
+		}
+
+		double Period() const
+		{
+			if(Fitted()) {
+				return sxy / sxx;
+			}
+
+			return nominalRate > 0 ? 1.0 / nominalRate : 0;
+		}
+
+		SampleClock(const SampleClock &);
+		SampleClock &operator=(const SampleClock &);
+
+		mutable CRITICAL_SECTION lock;
+		int64_t frequency;
+		double nominalRate;
+
+		int64_t observations;
+		int64_t originSample;
+		int64_t originTicks;
+		double meanX;
+		double meanY;
+		double lastX;
+		double sxx;
+		double sxy;
+	};
+}
@@ -0,0 +1,411 @@
+// SampleConversion.cpp : SIMD int16 <-> floating point sample conversion and digital port
+// bit pack/unpack kernels.
+//
+// Compiled without /clr (see HekaIOBridge.vcxproj). Each kernel has an SSE2 and an AVX2 body;
+// the AVX2 body is chosen at run time when both the CPU and the OS support it. Both bodies and
+// the scalar tail use the same round-to-nearest conversion, so results do not depend on the
+// path taken.
+
+#include "stdafx.h"
+#include "SampleConversion.h"
+
+#include <intrin.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+namespace Heka {
+
+	namespace {
+
+		const double MIN_COUNT = -32768.0;
+		const double MAX_COUNT = 32767.0;
+
+		bool DetectAvx2()
+		{
+			int info[4];
+			__cpuid(info, 0);
+			if(info[0] < 7) {
+				return false;
+			}
+
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx = (info[2] & (1 << 28)) != 0;
+			if(!osxsave || !avx) {
+				return false;
+			}
+
+			// XMM and YMM state must both be enabled by the OS
+			if((_xgetbv(0) & 0x6) != 0x6) {
+				return false;
+			}
+
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+		}
+
+		bool UseAvx2()
+		{
+			static const bool avx2 = DetectAvx2();
+			return avx2;
+		}
+
+		// Scalar conversions matching the vector ones: clamp (max first, so NaN becomes the
+		// minimum), then round with the current (round-to-nearest) mode.
+		inline itcsample_t ToCount(double v)
+		{
+			__m128d x = _mm_set_sd(v);
+			x = _mm_min_sd(_mm_max_sd(x, _mm_set_sd(MIN_COUNT)), _mm_set_sd(MAX_COUNT));
+			return (itcsample_t) _mm_cvtsd_si32(x);
+		}
+
+		inline itcsample_t ToCount(float v)
+		{
+			__m128 x = _mm_set_ss(v);
+			x = _mm_min_ss(_mm_max_ss(x, _mm_set_ss((float) MIN_COUNT)), _mm_set_ss((float) MAX_COUNT));
+			return (itcsample_t) _mm_cvtss_si32(x);
+		}
+
+		// Sign-extends eight int16 counts to two vectors of four int32.
+		inline void Widen(__m128i c, __m128i &lo, __m128i &hi)
+		{
+			lo = _mm_srai_epi32(_mm_unpacklo_epi16(c, c), 16);
+			hi = _mm_srai_epi32(_mm_unpackhi_epi16(c, c), 16);
+		}
+
+		size_t CountsToDoubleSse2(const itcsample_t *counts, double *values, size_t n, double scale, double offset)
+		{
+			const __m128d s = _mm_set1_pd(scale);
+			const __m128d o = _mm_set1_pd(offset);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m128i lo, hi;
+				Widen(_mm_loadu_si128((const __m128i *) (counts + i)), lo, hi);
+
+				_mm_storeu_pd(values + i, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(lo), s), o));
+				_mm_storeu_pd(values + i + 2, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(lo, lo)), s), o));
+				_mm_storeu_pd(values + i + 4, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(hi), s), o));
+				_mm_storeu_pd(values + i + 6, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(hi, hi)), s), o));
+			}
+
+			return i;
+		}
+
+		size_t CountsToDoubleAvx2(const itcsample_t *counts, double *values, size_t n, double scale, double offset)
+		{
+			const __m256d s = _mm256_set1_pd(scale);
+			const __m256d o = _mm256_set1_pd(offset);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m256i c = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (counts + i)));
+
+				__m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(c));
+				__m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(c, 1));
+
+				_mm256_storeu_pd(values + i, _mm256_add_pd(_mm256_mul_pd(lo, s), o));
+				_mm256_storeu_pd(values + i + 4, _mm256_add_pd(_mm256_mul_pd(hi, s), o));
+			}
+
+			_mm256_zeroupper();
+			return i;
+		}
+
+		size_t CountsToFloatSse2(const itcsample_t *counts, float *values, size_t n, float scale, float offset)
+		{
+			const __m128 s = _mm_set1_ps(scale);
+			const __m128 o = _mm_set1_ps(offset);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m128i lo, hi;
+				Widen(_mm_loadu_si128((const __m128i *) (counts + i)), lo, hi);
+
+				_mm_storeu_ps(values + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), s), o));
+				_mm_storeu_ps(values + i + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), s), o));
+			}
+
+			return i;
+		}
+
+		size_t CountsToFloatAvx2(const itcsample_t *counts, float *values, size_t n, float scale, float offset)
+		{
+			const __m256 s = _mm256_set1_ps(scale);
+			const __m256 o = _mm256_set1_ps(offset);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m256i c = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (counts + i)));
+				_mm256_storeu_ps(values + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(c), s), o));
+			}
+
+			_mm256_zeroupper();
+			return i;
+		}
+
+		inline __m128i DoubleToInt32Sse2(const double *values, __m128d s, __m128d o, __m128d lo, __m128d hi)
+		{
+			__m128d a = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(values), s), o);
+			__m128d b = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(values + 2), s), o);
+			a = _mm_min_pd(_mm_max_pd(a, lo), hi);
+			b = _mm_min_pd(_mm_max_pd(b, lo), hi);
+			return _mm_unpacklo_epi64(_mm_cvtpd_epi32(a), _mm_cvtpd_epi32(b));
+		}
+
+		size_t DoubleToCountsSse2(const double *values, itcsample_t *counts, size_t n, double scale, double offset)
+		{
+			const __m128d s = _mm_set1_pd(scale);
+			const __m128d o = _mm_set1_pd(offset);
+			const __m128d lo = _mm_set1_pd(MIN_COUNT);
+			const __m128d hi = _mm_set1_pd(MAX_COUNT);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m128i first = DoubleToInt32Sse2(values + i, s, o, lo, hi);
+				__m128i second = DoubleToInt32Sse2(values + i + 4, s, o, lo, hi);
+				_mm_storeu_si128((__m128i *) (counts + i), _mm_packs_epi32(first, second));
+			}
+
+			return i;
+		}
+
+		inline __m128i DoubleToInt32Avx2(const double *values, __m256d s, __m256d o, __m256d lo, __m256d hi)
+		{
+			__m256d v = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(values), s), o);
+			v = _mm256_min_pd(_mm256_max_pd(v, lo), hi);
+			return _mm256_cvtpd_epi32(v);
+		}
+
+		size_t DoubleToCountsAvx2(const double *values, itcsample_t *counts, size_t n, double scale, double offset)
+		{
+			const __m256d s = _mm256_set1_pd(scale);
+			const __m256d o = _mm256_set1_pd(offset);
+			const __m256d lo = _mm256_set1_pd(MIN_COUNT);
+			const __m256d hi = _mm256_set1_pd(MAX_COUNT);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m128i first = DoubleToInt32Avx2(values + i, s, o, lo, hi);
+				__m128i second = DoubleToInt32Avx2(values + i + 4, s, o, lo, hi);
+				_mm_storeu_si128((__m128i *) (counts + i), _mm_packs_epi32(first, second));
+			}
+
+			_mm256_zeroupper();
+			return i;
+		}
+
+		size_t FloatToCountsSse2(const float *values, itcsample_t *counts, size_t n, float scale, float offset)
+		{
+			const __m128 s = _mm_set1_ps(scale);
+			const __m128 o = _mm_set1_ps(offset);
+			const __m128 lo = _mm_set1_ps((float) MIN_COUNT);
+			const __m128 hi = _mm_set1_ps((float) MAX_COUNT);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m128 a = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(values + i), s), o);
+				__m128 b = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(values + i + 4), s), o);
+				a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+				b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+				_mm_storeu_si128((__m128i *) (counts + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+			}
+
+			return i;
+		}
+
+		size_t FloatToCountsAvx2(const float *values, itcsample_t *counts, size_t n, float scale, float offset)
+		{
+			const __m256 s = _mm256_set1_ps(scale);
+			const __m256 o = _mm256_set1_ps(offset);
+			const __m256 lo = _mm256_set1_ps((float) MIN_COUNT);
+			const __m256 hi = _mm256_set1_ps((float) MAX_COUNT);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(values + i), s), o);
+				v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+
+				__m256i c = _mm256_cvtps_epi32(v);
+				_mm_storeu_si128((__m128i *) (counts + i),
+					_mm_packs_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1)));
+			}
+
+			_mm256_zeroupper();
+			return i;
+		}
+	}
+
+	namespace {
+
+		size_t UnpackBitsSse2(const itcsample_t *port, size_t n, const unsigned int *bits, itcsample_t *const *lines, int lineCount)
+		{
+			const __m128i one = _mm_set1_epi16(1);
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m128i v = _mm_loadu_si128((const __m128i *) (port + i));
+				for(int l = 0; l < lineCount; l++) {
+					__m128i bit = _mm_and_si128(_mm_srl_epi16(v, _mm_cvtsi32_si128((int) bits[l])), one);
+					_mm_storeu_si128((__m128i *) (lines[l] + i), bit);
+				}
+			}
+
+			return i;
+		}
+
+		size_t UnpackBitsAvx2(const itcsample_t *port, size_t n, const unsigned int *bits, itcsample_t *const *lines, int lineCount)
+		{
+			const __m256i one = _mm256_set1_epi16(1);
+
+			size_t i = 0;
+			for(; i + 16 <= n; i += 16) {
+				__m256i v = _mm256_loadu_si256((const __m256i *) (port + i));
+				for(int l = 0; l < lineCount; l++) {
+					__m256i bit = _mm256_and_si256(_mm256_srl_epi16(v, _mm_cvtsi32_si128((int) bits[l])), one);
+					_mm256_storeu_si256((__m256i *) (lines[l] + i), bit);
+				}
+			}
+
+			_mm256_zeroupper();
+			return i;
+		}
+
+		size_t PackBitsSse2(const itcsample_t *const *lines, const unsigned int *bits, int lineCount, itcsample_t *port, size_t n, bool &invalid)
+		{
+			const __m128i one = _mm_set1_epi16(1);
+			__m128i bad = _mm_setzero_si128();
+
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m128i v = _mm_setzero_si128();
+				for(int l = 0; l < lineCount; l++) {
+					__m128i x = _mm_loadu_si128((const __m128i *) (lines[l] + i));
+					bad = _mm_or_si128(bad, _mm_andnot_si128(one, x));
+					v = _mm_or_si128(v, _mm_sll_epi16(x, _mm_cvtsi32_si128((int) bits[l])));
+				}
+				_mm_storeu_si128((__m128i *) (port + i), v);
+			}
+
+			invalid = _mm_movemask_epi8(_mm_cmpeq_epi16(bad, _mm_setzero_si128())) != 0xFFFF;
+			return i;
+		}
+
+		size_t PackBitsAvx2(const itcsample_t *const *lines, const unsigned int *bits, int lineCount, itcsample_t *port, size_t n, bool &invalid)
+		{
+			const __m256i one = _mm256_set1_epi16(1);
+			__m256i bad = _mm256_setzero_si256();
+
+			size_t i = 0;
+			for(; i + 16 <= n; i += 16) {
+				__m256i v = _mm256_setzero_si256();
+				for(int l = 0; l < lineCount; l++) {
+					__m256i x = _mm256_loadu_si256((const __m256i *) (lines[l] + i));
+					bad = _mm256_or_si256(bad, _mm256_andnot_si256(one, x));
+					v = _mm256_or_si256(v, _mm256_sll_epi16(x, _mm_cvtsi32_si128((int) bits[l])));
+				}
+				_mm256_storeu_si256((__m256i *) (port + i), v);
+			}
+
+			invalid = !_mm256_testz_si256(bad, bad);
+			_mm256_zeroupper();
+			return i;
+		}
+	}
+
+	SimdLevel ConversionSimdLevel()
+	{
+		return UseAvx2() ? SIMD_AVX2 : SIMD_SSE2;
+	}
+
+	void CountsToValues(const itcsample_t *counts, double *values, size_t n, double scale, double offset)
+	{
+		size_t i = UseAvx2()
+			? CountsToDoubleAvx2(counts, values, n, scale, offset)
+			: CountsToDoubleSse2(counts, values, n, scale, offset);
+
+		for(; i < n; i++) {
+			values[i] = counts[i] * scale + offset;
+		}
+	}
+
+	void CountsToValues(const itcsample_t *counts, float *values, size_t n, float scale, float offset)
+	{
+		size_t i = UseAvx2()
+			? CountsToFloatAvx2(counts, values, n, scale, offset)
+			: CountsToFloatSse2(counts, values, n, scale, offset);
+
+		for(; i < n; i++) {
+			values[i] = counts[i] * scale + offset;
+		}
+	}
+
+	void ValuesToCounts(const double *values, itcsample_t *counts, size_t n, double scale, double offset)
+	{
+		size_t i = UseAvx2()
+			? DoubleToCountsAvx2(values, counts, n, scale, offset)
+			: DoubleToCountsSse2(values, counts, n, scale, offset);
+
+		for(; i < n; i++) {
+			counts[i] = ToCount(values[i] * scale + offset);
+		}
+	}
+
+	void ValuesToCounts(const float *values, itcsample_t *counts, size_t n, float scale, float offset)
+	{
+		size_t i = UseAvx2()
+			? FloatToCountsAvx2(values, counts, n, scale, offset)
+			: FloatToCountsSse2(values, counts, n, scale, offset);
+
+		for(; i < n; i++) {
+			counts[i] = ToCount(values[i] * scale + offset);
+		}
+	}
+
+	void UnpackBits(const itcsample_t *port, size_t n, const unsigned int *bits, itcsample_t *const *lines, int lineCount)
+	{
+		size_t i = UseAvx2()
+			? UnpackBitsAvx2(port, n, bits, lines, lineCount)
+			: UnpackBitsSse2(port, n, bits, lines, lineCount);
+
+		for(; i < n; i++) {
+			unsigned int v = (uint16_t) port[i];
+			for(int l = 0; l < lineCount; l++) {
+				lines[l][i] = (itcsample_t) ((v >> bits[l]) & 1);
+			}
+		}
+	}
+
+	int PackBits(const itcsample_t *const *lines, const unsigned int *bits, int lineCount, itcsample_t *port, size_t n)
+	{
+		bool invalid = false;
+		size_t vectorized = UseAvx2()
+			? PackBitsAvx2(lines, bits, lineCount, port, n, invalid)
+			: PackBitsSse2(lines, bits, lineCount, port, n, invalid);
+
+		for(size_t i = vectorized; i < n; i++) {
+			unsigned int v = 0;
+			for(int l = 0; l < lineCount; l++) {
+				unsigned int x = (uint16_t) lines[l][i];
+				invalid |= (x & ~1u) != 0;
+				v |= x << bits[l];
+			}
+			port[i] = (itcsample_t) v;
+		}
+
+		if(!invalid) {
+			return -1;
+		}
+
+		// Rare: find the offending line
+		for(int l = 0; l < lineCount; l++) {
+			for(size_t i = 0; i < n; i++) {
+				if((lines[l][i] & ~1) != 0) {
+					return l;
+				}
+			}
+		}
+
+		return -1;
+	}
+}
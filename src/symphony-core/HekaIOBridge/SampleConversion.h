@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include "SampleRing.h"
+
+namespace Heka {
+
+	enum SimdLevel
+	{
+		SIMD_SSE2,
+		SIMD_AVX2
+	};
+
+	// Widest instruction set the conversion kernels use on this CPU. Detected once.
+	SimdLevel ConversionSimdLevel();
+
+	// Bulk int16 sample conversions, vectorized with SSE2 or AVX2 (compiled native in
+	// SampleConversion.cpp, since intrinsics are not available under /clr).
+	//
+	// Counts to values computes counts * scale + offset. Values to counts computes
+	// values * scale + offset, rounded to nearest (ties to even, as Math.Round) and saturated to
+	// the int16 range; NaN converts to the most negative count. Buffers may not overlap.
+	void CountsToValues(const itcsample_t *counts, double *values, size_t n, double scale, double offset);
+	void CountsToValues(const itcsample_t *counts, float *values, size_t n, float scale, float offset);
+	void ValuesToCounts(const double *values, itcsample_t *counts, size_t n, double scale, double offset);
+	void ValuesToCounts(const float *values, itcsample_t *counts, size_t n, float scale, float offset);
+
+	// Most lines a digital port can be split into.
+	const int MAX_PORT_LINES = 16;
+
+	// Splits n digital port samples into per-line 0/1 samples in one pass over the port:
+	// lines[l][i] = (port[i] >> bits[l]) & 1. Bit positions must be below MAX_PORT_LINES.
+	void UnpackBits(const itcsample_t *port, size_t n, const unsigned int *bits, itcsample_t *const *lines, int lineCount);
+
+	// Merges per-line 0/1 samples into n digital port samples in one pass:
+	// port[i] = OR over l of lines[l][i] << bits[l]. Returns the index of the first line that
+	// holds a value other than 0 or 1 (its samples are merged unmasked), or -1.
+	int PackBits(const itcsample_t *const *lines, const unsigned int *bits, int lineCount, itcsample_t *port, size_t n);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Heka {
+	typedef int16_t itcsample_t;
+
+	// Fixed-capacity single-channel sample ring. A ring either owns its storage (Reserve) or is a
+	// view onto caller-owned storage (Attach). WritePointer/ContiguousSpace and
+	// ReadPointer/ContiguousCount expose the contiguous regions that can be handed directly to
+	// ITC_ReadWriteFIFO without an intermediate copy.
+	class SampleRing
+	{
+	public:
+		SampleRing() : storage(NULL), capacity(0), head(0), tail(0), count(0) {}
+
+		// Ensures capacity for at least n samples. Buffered samples are preserved; owned storage
+		// is only reallocated when it grows.
+		void Reserve(size_t n)
+		{
+			if(n <= capacity && storage == owned.data()) {
+				return;
+			}
+
+			std::vector<itcsample_t> grown(n > capacity ? n : capacity);
+			size_t buffered = Peek(grown.data(), count);
+
+			owned.swap(grown);
+			storage = owned.data();
+			capacity = owned.size();
+			head = capacity > 0 ? buffered % capacity : 0;
+			tail = 0;
+			count = buffered;
+		}
+
+		// Makes this ring a view onto an external buffer of the given capacity, of which the
+		// first 'filled' samples are already valid.
+		void Attach(itcsample_t *buffer, size_t bufferCapacity, size_t filled)
+		{
+			storage = buffer;
+			capacity = bufferCapacity;
+			tail = 0;
+			count = filled;
+			head = capacity > 0 ? filled % capacity : 0;
+		}
+
+		void Clear()
+		{
+			head = tail = count = 0;
+		}
+
+		size_t Capacity() const { return capacity; }
+		size_t Count() const { return count; }
+		size_t Space() const { return capacity - count; }
+
+		itcsample_t *WritePointer() { return storage + head; }
+
+		size_t ContiguousSpace() const
+		{
+			size_t toEnd = capacity - head;
+			return toEnd < Space() ? toEnd : Space();
+		}
+
+		void Commit(size_t n)
+		{
+			if(capacity == 0) {
+				return;
+			}
+
+			head = (head + n) % capacity;
+			count += n;
+		}
+
+		itcsample_t *ReadPointer() { return storage + tail; }
+
+		size_t ContiguousCount() const
+		{
+			size_t toEnd = capacity - tail;
+			return toEnd < count ? toEnd : count;
+		}
+
+		void Consume(size_t n)
+		{
+			if(capacity == 0) {
+				return;
+			}
+
+			tail = (tail + n) % capacity;
+			count -= n;
+		}
+
+		// Copies up to n samples into the ring; returns the number copied.
+		size_t Write(const itcsample_t *src, size_t n)
+		{
+			size_t written = 0;
+			while(written < n && Space() > 0) {
+				size_t block = ContiguousSpace();
+				if(block > n - written) {
+					block = n - written;
+				}
+
+				memcpy(WritePointer(), src + written, block * sizeof(itcsample_t));
+				Commit(block);
+				written += block;
+			}
+
+			return written;
+		}
+
+		// Copies and consumes up to n samples from the ring; returns the number copied.
+		size_t Read(itcsample_t *dst, size_t n)
+		{
+			size_t read = Peek(dst, n);
+			Consume(read);
+			return read;
+		}
+
+	private:
+		size_t Peek(itcsample_t *dst, size_t n) const
+		{
+			if(n > count) {
+				n = count;
+			}
+
+			size_t first = capacity - tail;
+			if(first > n) {
+				first = n;
+			}
+
+			if(n > 0) {
+				memcpy(dst, storage + tail, first * sizeof(itcsample_t));
+				memcpy(dst + first, storage, (n - first) * sizeof(itcsample_t));
+			}
+
+			return n;
+		}
+
+		std::vector<itcsample_t> owned;
+		itcsample_t *storage;
+		size_t capacity;
+		size_t head;
+		size_t tail;
+		size_t count;
+	};
+}
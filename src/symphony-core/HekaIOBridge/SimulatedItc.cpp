@@ -0,0 +1,411 @@
+// SimulatedItc.cpp : Simulated ITC unit behind the ItcDriver table.
+//
+
+#include "stdafx.h"
+#include "SimulatedItc.h"
+#include "SampleClock.h"
+#include "0acqerrors.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+using namespace std;
+
+namespace Heka {
+
+	SimulatedItc::SimulatedItc(const SimulatedItcConfig &c)
+		: config(c), createdTicks(0), startTicks(0), clocked(0), calls(0), running(false), underrun(false), overflow(false)
+	{
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		frequency = f.QuadPart;
+		createdTicks = SampleClock::Now();
+
+		InitializeCriticalSection(&lock);
+	}
+
+	SimulatedItc::~SimulatedItc()
+	{
+		Clear();
+		DeleteCriticalSection(&lock);
+	}
+
+	const ItcDriver *SimulatedItc::Driver()
+	{
+		static const ItcDriver driver = {
+			DriverGetState,
+			DriverUpdateNow,
+			DriverGetDataAvailable,
+			DriverReadWriteFIFO
+		};
+
+		return &driver;
+	}
+
+	void SimulatedItc::SetConfig(const SimulatedItcConfig &c)
+	{
+		EnterCriticalSection(&lock);
+		config = c;
+		LeaveCriticalSection(&lock);
+	}
+
+	void SimulatedItc::SetChannels(const ITCChannelInfo *info, unsigned long channelCount)
+	{
+		EnterCriticalSection(&lock);
+
+		Clear();
+		for(unsigned long i=0; i < channelCount; i++) {
+			if(info[i].SamplingRate > 0) {
+				config.sampleRate = info[i].SamplingRate;
+			}
+
+
+			Channel *c = new Channel();
+			c->type = info[i].ChannelType;
+			c->output = (c->type & 1) != 0;
+			c->number = info[i].ChannelNumber;
+			c->underrunValue = (itcsample_t) info[i].HardwareUnderrunValue;
+			c->fifo.Reserve(config.fifoDepth);
+			c->source = NULL;
+			c->last = false;
+			channels.push_back(c);
+		}
+
+		for(size_t i=0; i < channels.size(); i++) {
+			if(!channels[i]->output && config.loopback) {
+				channels[i]->source = Find(channels[i]->type + 1, channels[i]->number);
+			}
+		}
+
+		LeaveCriticalSection(&lock);
+	}
+
+	void SimulatedItc::Start()
+	{
+		EnterCriticalSection(&lock);
+
+		for(size_t i=0; i < channels.size(); i++) {
+			Channel *c = channels[i];
+			c->loopback.Clear();
+			if(c->output) {
+				c->loopback.Reserve(config.pipelineSamples + config.fifoDepth);
+				scratch.assign(config.pipelineSamples, 0);
+				c->loopback.Write(scratch.data(), scratch.size());
+			}
+		}
+
+		startTicks = SampleClock::Now();
+		clocked = 0;
+		underrun = false;
+		overflow = false;
+		running = true;
+
+		LeaveCriticalSection(&lock);
+	}
+
+	void SimulatedItc::Stop()
+	{
+		EnterCriticalSection(&lock);
+		running = false;
+		LeaveCriticalSection(&lock);
+	}
+
+	void SimulatedItc::Advance(uint32_t samples)
+	{
+		EnterCriticalSection(&lock);
+		Clock(samples);
+		LeaveCriticalSection(&lock);
+	}
+
+	bool SimulatedItc::IsRunning() const
+	{
+		EnterCriticalSection(&lock);
+		bool r = running;
+		LeaveCriticalSection(&lock);
+		return r;
+	}
+
+	bool SimulatedItc::Underrun() const
+	{
+		EnterCriticalSection(&lock);
+		bool u = underrun;
+		LeaveCriticalSection(&lock);
+		return u;
+	}
+
+	bool SimulatedItc::Overflow() const
+	{
+		EnterCriticalSection(&lock);
+		bool o = overflow;
+		LeaveCriticalSection(&lock);
+		return o;
+	}
+
+	int64_t SimulatedItc::SamplesClocked() const
+	{
+		EnterCriticalSection(&lock);
+		int64_t n = clocked;
+		LeaveCriticalSection(&lock);
+		return n;
+	}
+
+	int64_t SimulatedItc::DriverCalls() const
+	{
+		EnterCriticalSection(&lock);
+		int64_t n = calls;
+		LeaveCriticalSection(&lock);
+		return n;
+	}
+
+	double SimulatedItc::Time() const
+	{
+		return (double) (SampleClock::Now() - createdTicks) / frequency * config.speed;
+	}
+
+	unsigned long SimulatedItc::GetState(ITCStatus *status)
+	{
+		EnterCriticalSection(&lock);
+		BeginCall();
+
+		status->RunningMode = running ? RUN_STATE : 0;
+		status->Overflow = 0;
+		if(underrun) {
+			status->RunningMode |= ERROR_STATE;
+			status->Overflow |= ITC_WRITE_UNDERRUN_H;
+		}
+		if(overflow) {
+			status->RunningMode |= ERROR_STATE;
+			status->Overflow |= ITC_READ_OVERFLOW_H;
+		}
+
+		LeaveCriticalSection(&lock);
+		return ACQ_SUCCESS;
+	}
+
+	unsigned long SimulatedItc::UpdateNow()
+	{
+		EnterCriticalSection(&lock);
+		BeginCall();
+
+		if(config.samplesPerUpdate > 0) {
+			Clock(config.samplesPerUpdate);
+		}
+
+		LeaveCriticalSection(&lock);
+		return ACQ_SUCCESS;
+	}
+
+	unsigned long SimulatedItc::GetDataAvailable(unsigned long channelCount, ITCChannelDataEx *data)
+	{
+		EnterCriticalSection(&lock);
+		BeginCall();
+
+		unsigned long err = ACQ_SUCCESS;
+		for(unsigned long i=0; i < channelCount; i++) {
+			Channel *c = Find(data[i].ChannelType, data[i].ChannelNumber);
+			if(c == NULL) {
+				err = Error_ChannelNumber;
+				break;
+			}
+
+			data[i].Value = (unsigned long) (c->output ? c->fifo.Space() : c->fifo.Count());
+		}
+
+		LeaveCriticalSection(&lock);
+		return err;
+	}
+
+	unsigned long SimulatedItc::ReadWriteFIFO(unsigned long channelCount, ITCChannelDataEx *data)
+	{
+		EnterCriticalSection(&lock);
+		BeginCall();
+
+		// Nothing is moved unless every channel can be
+		unsigned long err = ACQ_SUCCESS;
+		for(unsigned long i=0; i < channelCount && err == ACQ_SUCCESS; i++) {
+			Channel *c = Find(data[i].ChannelType, data[i].ChannelNumber);
+			if(c == NULL) {
+				err = Error_ChannelNumber;
+			} else if(data[i].Value > (c->output ? c->fifo.Space() : c->fifo.Count())) {
+				err = Error_Parameter;
+			} else if(c->output && c->last && data[i].Value > 0) {
+				err = Error_OutputMode;
+			}
+		}
+
+		if(err == ACQ_SUCCESS) {
+			int64_t moved = 0;
+			for(unsigned long i=0; i < channelCount; i++) {
+				Channel *c = Find(data[i].ChannelType, data[i].ChannelNumber);
+				itcsample_t *samples = (itcsample_t *) data[i].DataPointer;
+
+				if(c->output) {
+					c->fifo.Write(samples, data[i].Value);
+					if(data[i].Command & LAST_FIFO_COMMAND_EX) {
+						c->last = true;
+					}
+				} else {
+					c->fifo.Read(samples, data[i].Value);
+				}
+				moved += data[i].Value;
+			}
+
+			Spin(moved * config.sampleLatencyNanoseconds * 1e-3);
+		}
+
+		LeaveCriticalSection(&lock);
+		return err;
+	}
+
+	unsigned long SimulatedItc::DriverGetState(HANDLE device, ITCStatus *status)
+	{
+		return static_cast<SimulatedItc *>(device)->GetState(status);
+	}
+
+	unsigned long SimulatedItc::DriverUpdateNow(HANDLE device, void *)
+	{
+		return static_cast<SimulatedItc *>(device)->UpdateNow();
+	}
+
+	unsigned long SimulatedItc::DriverGetDataAvailable(HANDLE device, unsigned long channelCount, ITCChannelDataEx *channels)
+	{
+		return static_cast<SimulatedItc *>(device)->GetDataAvailable(channelCount, channels);
+	}
+
+	unsigned long SimulatedItc::DriverReadWriteFIFO(HANDLE device, unsigned long channelCount, ITCChannelDataEx *channels)
+	{
+		return static_cast<SimulatedItc *>(device)->ReadWriteFIFO(channelCount, channels);
+	}
+
+	SimulatedItc::Channel *SimulatedItc::Find(unsigned long type, unsigned long number)
+	{
+		for(size_t i=0; i < channels.size(); i++) {
+			if(channels[i]->type == type && channels[i]->number == number) {
+				return channels[i];
+			}
+		}
+
+		return NULL;
+	}
+
+	void SimulatedItc::BeginCall()
+	{
+		calls++;
+		Spin(config.callLatencyMicroseconds);
+		Sync();
+	}
+
+	void SimulatedItc::Spin(double microseconds)
+	{
+		if(microseconds <= 0) {
+			return;
+		}
+
+		int64_t until = SampleClock::Now() + (int64_t) (microseconds * 1e-6 * frequency);
+		while(SampleClock::Now() < until) {
+		}
+	}
+
+	void SimulatedItc::Sync()
+	{
+		if(!running || config.samplesPerUpdate > 0) {
+			return;
+		}
+
+		int64_t due = (int64_t) ((double) (SampleClock::Now() - startTicks) / frequency * config.sampleRate * config.speed);
+		if(due > clocked) {
+			Clock(due - clocked);
+		}
+	}
+
+	void SimulatedItc::Clock(int64_t samples)
+	{
+		// Beyond a FIFO's worth the unit has underrun or overflowed anyway, so long gaps are
+		// clocked in FIFO-sized steps that keep the loopback rings bounded
+		while(samples > 0 && running) {
+			size_t n = (size_t) min(samples, (int64_t) config.fifoDepth);
+			samples -= n;
+
+			bool outputs = false;
+			bool playing = false;
+			for(size_t i=0; i < channels.size(); i++) {
+				Channel *c = channels[i];
+				if(!c->output) {
+					continue;
+				}
+
+				size_t k = c->fifo.Count();
+				if(k > n) {
+					k = n;
+				}
+
+				scratch.resize(n);
+				c->fifo.Read(scratch.data(), k);
+				fill(scratch.begin() + k, scratch.begin() + n, c->underrunValue);
+				c->loopback.Reserve(config.pipelineSamples + n);
+				c->loopback.Write(scratch.data(), n);
+
+				if(k < n && !c->last) {
+					underrun = true;
+				}
+
+				outputs = true;
+				playing = playing || !c->last || c->fifo.Count() > 0;
+			}
+
+			for(size_t i=0; i < channels.size(); i++) {
+				Channel *c = channels[i];
+				if(c->output) {
+					continue;
+				}
+
+				scratch.assign(n, 0);
+				if(c->source != NULL) {
+					c->source->loopback.Read(scratch.data(), n);
+				} else if(c->type == D2H && config.syntheticAmplitude != 0) {
+					Synthesize(c, scratch.data(), n);
+				}
+
+				if(c->fifo.Write(scratch.data(), n) < n) {
+					overflow = true;
+				}
+			}
+
+			// Played output nobody acquires is dropped
+			for(size_t i=0; i < channels.size(); i++) {
+				Channel *c = channels[i];
+				if(c->output && c->loopback.Count() > config.pipelineSamples) {
+					c->loopback.Consume(c->loopback.Count() - config.pipelineSamples);
+				}
+			}
+
+			clocked += n;
+
+			if((underrun && config.stopOnUnderrun) || (overflow && config.stopOnOverflow) || (outputs && !playing)) {
+				running = false;
+			}
+		}
+	}
+
+	void SimulatedItc::Synthesize(const Channel *c, itcsample_t *samples, size_t n)
+	{
+		const double twoPi = 6.283185307179586;
+		double period = config.syntheticPeriodSamples > 0 ? config.syntheticPeriodSamples : 1;
+		double phase = c->number * period / 8;
+		double amplitude = config.syntheticAmplitude > SHRT_MAX ? SHRT_MAX : config.syntheticAmplitude;
+
+		for(size_t i=0; i < n; i++) {
+			double x = fmod((double) (clocked + i) + phase, period) / period;
+			samples[i] = (itcsample_t) floor(amplitude * sin(twoPi * x) + 0.5);
+		}
+	}
+
+	void SimulatedItc::Clear()
+	{
+		for(size_t i=0; i < channels.size(); i++) {
+			delete channels[i];
+		}
+		channels.clear();
+	}
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "itcmm.h"
+#include "SampleRing.h"
+#include "ItcDriver.h"
+
+namespace Heka {
+
+	struct SimulatedItcConfig
+	{
+		SimulatedItcConfig()
+			: fifoDepth(16384), sampleRate(10000), speed(1), samplesPerUpdate(0), callLatencyMicroseconds(0),
+			sampleLatencyNanoseconds(0), pipelineSamples(3), loopback(true), syntheticAmplitude(0),
+			syntheticPeriodSamples(1000), stopOnUnderrun(true), stopOnOverflow(true)
+		{
+		}
+
+		uint32_t fifoDepth;              // Samples per channel FIFO, each direction
+		double sampleRate;               // Per-channel rate (Hz) of the real-time sample clock
+		double speed;                    // Real-time clock rate as a multiple of sampleRate
+
+		// If nonzero the sample clock is stepped rather than real-time: each UpdateNow (or Advance)
+		// plays and acquires this many samples, so runs are independent of host timing
+		uint32_t samplesPerUpdate;
+
+		double callLatencyMicroseconds;  // Busy-waited in every driver call
+		double sampleLatencyNanoseconds; // Busy-waited per sample moved by ReadWriteFIFO
+
+		// Each input channel acquires the output channel of the same kind and number (AD from DA,
+		// digital input from digital output), this many samples late, as a loopback-wired ITC-18 does
+		uint32_t pipelineSamples;
+
+		// If false, or for an input with no such output, AD inputs acquire a synthetic sine of the
+		// given amplitude (counts) and period, phase-shifted by channel number, and other inputs zero
+		bool loopback;
+		double syntheticAmplitude;
+		double syntheticPeriodSamples;
+
+		bool stopOnUnderrun;             // As ITCStartInfo::StopOnUnderrun/StopOnOverflow
+		bool stopOnOverflow;
+	};
+
+	// Simulated ITC unit for running the bridge without hardware. Driver() is an ItcDriver whose
+	// device handles are SimulatedItc objects (see Handle), so it can be given to IOBridge or
+	// StreamingEngine in place of ItcmmDriver().
+	//
+	// Channels are configured with SetChannels, and the FIFOs preloaded, before Start. Once
+	// started, the sample clock plays every output FIFO into its loopback input FIFO, stopping
+	// with an underrun or overflow as the hardware would; an output whose last block was written
+	// with LAST_FIFO_COMMAND_EX instead plays out, and the unit stops cleanly once every output
+	// has. Writing more than the free FIFO space, or reading more than is available, fails with
+	// Error_Parameter.
+	//
+	// The unit is locked per call, so it may be driven from one thread and inspected from another.
+	class SimulatedItc
+	{
+	public:
+		explicit SimulatedItc(const SimulatedItcConfig &config);
+		~SimulatedItc();
+
+		static const ItcDriver *Driver();
+
+		HANDLE Handle() { return this; }
+		const SimulatedItcConfig &Config() const { return config; }
+
+		// Replaces the configuration while stopped. FIFO depth and loopback changes take effect at
+		// the next SetChannels, the pipeline delay at the next Start.
+		void SetConfig(const SimulatedItcConfig &config);
+
+		// As ITC_SetChannels: replaces the channel set and empties the FIFOs. Only ChannelType,
+		// ChannelNumber, HardwareUnderrunValue and SamplingRate are used; a nonzero SamplingRate
+		// sets the sample clock rate, which the ITC-18 shares over all channels.
+		void SetChannels(const ITCChannelInfo *channels, unsigned long channelCount);
+
+		// As ITC_Start/ITC_Stop. Start clears any previous error and restarts the clock at sample 0.
+		void Start();
+		void Stop();
+
+		// Plays and acquires the given number of samples now, whatever the clock mode.
+		void Advance(uint32_t samples);
+
+		bool IsRunning() const;
+		bool Underrun() const;
+		bool Overflow() const;
+
+		int64_t SamplesClocked() const; // Since Start
+		int64_t DriverCalls() const;
+
+		// As ITC_GetTime: seconds since construction, at the clock speed
+		double Time() const;
+
+	private:
+		struct Channel
+		{
+			unsigned long type;
+			unsigned long number;
+			bool output;         // Output types are odd (H2D, DIGITAL_OUTPUT, AUX_OUTPUT)
+			itcsample_t underrunValue;
+			SampleRing fifo;
+			SampleRing loopback; // Output played but not yet acquired by the paired input
+			Channel *source;     // Input: the output it acquires, or NULL
+			bool last;           // Output: LAST_FIFO_COMMAND_EX written
+		};
+
+		unsigned long GetState(ITCStatus *status);
+		unsigned long UpdateNow();
+		unsigned long GetDataAvailable(unsigned long channelCount, ITCChannelDataEx *channels);
+		unsigned long ReadWriteFIFO(unsigned long channelCount, ITCChannelDataEx *channels);
+
+		static unsigned long DriverGetState(HANDLE device, ITCStatus *status);
+		static unsigned long DriverUpdateNow(HANDLE device, void *param);
+		static unsigned long DriverGetDataAvailable(HANDLE device, unsigned long channelCount, ITCChannelDataEx *channels);
+		static unsigned long DriverReadWriteFIFO(HANDLE device, unsigned long channelCount, ITCChannelDataEx *channels);
+
+		Channel *Find(unsigned long type, unsigned long number);
+		void BeginCall();
+		void Spin(double microseconds);
+		void Sync();  // Brings a real-time clock up to now
+		void Clock(int64_t samples);
+		void Synthesize(const Channel *c, itcsample_t *samples, size_t n);
+		void Clear();
+
+		SimulatedItcConfig config;
+		std::vector<Channel *> channels;
+		std::vector<itcsample_t> scratch;
+
+		mutable CRITICAL_SECTION lock;
+		int64_t frequency;
+		int64_t createdTicks;
+		int64_t startTicks;
+		int64_t clocked;
+		int64_t calls;
+		bool running;
+		bool underrun;
+		bool overflow;
+
+		SimulatedItc(const SimulatedItc &);
+		SimulatedItc &operator=(const SimulatedItc &);
+	};
+}
@@ -0,0 +1,351 @@
+// SpillFile.cpp : Memory-mapped input spill file. Compiled without /clr, as it is written from
+// the native streaming thread.
+//
+
+#include "stdafx.h"
+#include "SpillFile.h"
+#include "SampleClock.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace Heka {
+
+	namespace {
+
+		uint64_t Align8(uint64_t n) { return (n + 7) & ~(uint64_t) 7; }
+	}
+
+
+	// A view of bytes [index * stride, (index + 2) * stride) of the file
+	struct SpillFile::Window
+	{
+		uint64_t index;
+		HANDLE mapping;
+		uint8_t *view;
+	};
+
+	// Shared by the writer and the mapper thread. The writer only swaps pointers under lock;
+	// mapping and unmapping happen outside it.
+	struct SpillFile::Mapper
+	{
+		mutex lock;
+		condition_variable wake;
+		Window *ready; // Mapped ahead of the writer, or NULL
+		uint64_t wanted; // Index of the window the writer needs next
+		uint64_t attempted; // Index of the window last mapped (or tried)
+		vector<Window *> retired; // Left by the writer, to unmap
+		bool stopping;
+		thread worker;
+
+		Mapper() : ready(NULL), wanted(0), attempted(0), stopping(false)
+		{
+			retired.reserve(8);
+		}
+	};
+
+
+	SpillFile::SpillFile() : file(INVALID_HANDLE_VALUE), headerMapping(NULL), header(NULL), current(NULL), mapper(NULL), stride(0),
+		committed(0), channelCount(0), samples(0), failed(false)
+	{
+	}
+
+	SpillFile::~SpillFile()
+	{
+		Close();
+	}
+
+	bool SpillFile::Create(const wchar_t *path,
+		double sampleRate,
+		const ITCChannelDataEx *inputs,
+		const int *inputDevices,
+		int inputCount,
+		uint64_t windowBytes)
+	{
+		Close();
+		failed = false;
+		error.clear();
+		samples = 0;
+
+		file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(file == INVALID_HANDLE_VALUE) {
+			return Fail("CreateFile");
+		}
+
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		uint64_t granularity = info.dwAllocationGranularity;
+		stride = max((windowBytes / 2 + granularity - 1) / granularity, (uint64_t) 1) * granularity;
+
+		channelCount = (uint32_t) inputCount;
+		uint64_t headerBytes = Align8(sizeof(SpillFileHeader) + inputCount * sizeof(SpillChannel));
+		if(headerBytes > stride) {
+			return Fail("Spill window", "too small for the header");
+		}
+
+		current = Map(0);
+		if(current == NULL) {
+			return Fail("MapViewOfFile");
+		}
+
+		headerMapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, 0, (DWORD) headerBytes, NULL);
+		if(headerMapping == NULL) {
+			return Fail("CreateFileMapping");
+		}
+
+		header = (SpillFileHeader *) MapViewOfFile(headerMapping, FILE_MAP_WRITE, 0, 0, (SIZE_T) headerBytes);
+		if(header == NULL) {
+			return Fail("MapViewOfFile");
+		}
+
+		ZeroMemory(header, (size_t) headerBytes);
+		memcpy(header->magic, "SYMSPILL", sizeof(header->magic));
+		header->version = VERSION;
+		header->channelCount = channelCount;
+		header->headerBytes = (uint32_t) headerBytes;
+		header->sampleRate = sampleRate;
+
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		header->tickFrequency = f.QuadPart;
+		header->startTicks = SampleClock::Now();
+
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		header->startFileTime = ((int64_t) now.dwHighDateTime << 32) | now.dwLowDateTime;
+
+		SpillChannel *channels = (SpillChannel *) ((uint8_t *) header + sizeof(SpillFileHeader));
+		for(int i=0; i < inputCount; i++) {
+			channels[i].channelType = inputs[i].ChannelType;
+			channels[i].channelNumber = inputs[i].ChannelNumber;
+			channels[i].deviceIndex = (uint16_t) inputDevices[i];
+		}
+
+		committed = headerBytes;
+		InterlockedExchange64(&header->committedBytes, (LONGLONG) committed);
+
+		mapper = new Mapper();
+		mapper->wanted = 1;
+		mapper->worker = thread(&SpillFile::MapAhead, this);
+
+		return true;
+	}
+
+	bool SpillFile::Append(int64_t firstSample, int64_t clockSample, int64_t clockTicks,
+		const itcsample_t *const *channels, uint32_t n)
+	{
+		if(failed || header == NULL) {
+			return false;
+		}
+
+		uint64_t channelBytes = (uint64_t) n * sizeof(itcsample_t);
+		uint64_t bytes = Align8(sizeof(SpillRecord) + channelCount * channelBytes);
+		if(bytes > stride) {
+			return Fail("Spill record", "larger than half a window");
+		}
+
+		uint64_t index = committed / stride;
+		if(index != current->index && !Advance(index)) {
+			return false;
+		}
+
+		uint8_t *p = current->view + (committed - index * stride);
+
+		SpillRecord record;
+		record.marker = RECORD_MARKER;
+		record.samples = n;
+		record.firstSample = firstSample;
+		record.clockSample = clockSample;
+		record.clockTicks = clockTicks;
+		memcpy(p, &record, sizeof(record));
+		p += sizeof(record);
+
+		for(uint32_t c=0; c < channelCount; c++, p += channelBytes) {
+			memcpy(p, channels[c], (size_t) channelBytes);
+		}
+
+		// The record is complete before it is counted
+		committed += bytes;
+		InterlockedExchange64(&header->committedBytes, (LONGLONG) committed);
+		samples += n;
+
+		return true;
+	}
+
+	void SpillFile::Close()
+	{
+		if(mapper != NULL) {
+			{
+				lock_guard<mutex> hold(mapper->lock);
+				mapper->stopping = true;
+			}
+			mapper->wake.notify_one();
+			mapper->worker.join();
+
+			Unmap(mapper->ready);
+			for(size_t i=0; i < mapper->retired.size(); i++) {
+				Unmap(mapper->retired[i]);
+			}
+
+			delete mapper;
+			mapper = NULL;
+		}
+
+		if(header != NULL && !failed) {
+			header->closed = 1;
+			FlushViewOfFile(header, 0);
+			if(current != NULL) {
+				FlushViewOfFile(current->view, 0);
+			}
+		}
+
+		Unmap(current);
+		current = NULL;
+
+		if(header != NULL) {
+			UnmapViewOfFile(header);
+			header = NULL;
+		}
+
+		if(headerMapping != NULL) {
+			CloseHandle(headerMapping);
+			headerMapping = NULL;
+		}
+
+		if(file != INVALID_HANDLE_VALUE) {
+			if(!failed) {
+				LARGE_INTEGER size;
+				size.QuadPart = (LONGLONG) committed;
+				SetFilePointerEx(file, size, NULL, FILE_BEGIN);
+				SetEndOfFile(file);
+				FlushFileBuffers(file);
+			}
+
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	SpillFile::Window *SpillFile::Map(uint64_t index) const
+	{
+		uint64_t offset = index * stride;
+		uint64_t end = offset + 2 * stride;
+
+		// Creating the mapping extends the file to the end of the window
+		HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, (DWORD) (end >> 32), (DWORD) end, NULL);
+		if(mapping == NULL) {
+			return NULL;
+		}
+
+		uint8_t *view = (uint8_t *) MapViewOfFile(mapping, FILE_MAP_WRITE, (DWORD) (offset >> 32), (DWORD) offset, (SIZE_T) (2 * stride));
+		if(view == NULL) {
+			DWORD err = GetLastError();
+			CloseHandle(mapping);
+			SetLastError(err);
+			return NULL;
+		}
+
+		Window *window = new Window();
+		window->index = index;
+		window->mapping = mapping;
+		window->view = view;
+		return window;
+	}
+
+	void SpillFile::Unmap(Window *window)
+	{
+		if(window != NULL) {
+			UnmapViewOfFile(window->view);
+			CloseHandle(window->mapping);
+			delete window;
+		}
+	}
+
+	bool SpillFile::Advance(uint64_t index)
+	{
+		Window *next = NULL;
+		{
+			lock_guard<mutex> hold(mapper->lock);
+			if(mapper->ready != NULL && mapper->ready->index == index) {
+				next = mapper->ready;
+				mapper->ready = NULL;
+			}
+			mapper->retired.push_back(current);
+			mapper->wanted = index + 1;
+		}
+		mapper->wake.notify_one();
+		current = NULL;
+
+		if(next == NULL) {
+			// The mapper fell behind; map here rather than lose the record
+			next = Map(index);
+			if(next == NULL) {
+				return Fail("MapViewOfFile");
+			}
+		}
+
+		current = next;
+		return true;
+	}
+
+	void SpillFile::MapAhead()
+	{
+		unique_lock<mutex> hold(mapper->lock);
+		while(!mapper->stopping) {
+			if(!mapper->retired.empty()) {
+				Window *window = mapper->retired.back();
+				mapper->retired.pop_back();
+				hold.unlock();
+				Unmap(window);
+				hold.lock();
+				continue;
+			}
+
+			if(mapper->attempted != mapper->wanted) {
+				uint64_t index = mapper->wanted;
+				mapper->attempted = index;
+				Window *stale = mapper->ready;
+				mapper->ready = NULL;
+				hold.unlock();
+				Unmap(stale);
+				Window *window = Map(index);
+				hold.lock();
+
+				// The writer may have moved past it, mapping what it needed itself
+				if(mapper->wanted == index) {
+					mapper->ready = window;
+				} else if(window != NULL) {
+					mapper->retired.push_back(window);
+				}
+				continue;
+			}
+
+			mapper->wake.wait(hold);
+		}
+	}
+
+	bool SpillFile::Fail(const char *what)
+	{
+		char msg[128];
+		sprintf_s(msg, sizeof(msg), "%s error: %lu", what, (unsigned long) GetLastError());
+		error = msg;
+		failed = true;
+
+		// Whatever was committed stays readable from the file; Close unmaps it
+		return false;
+	}
+
+	bool SpillFile::Fail(const char *what, const char *reason)
+	{
+		error = string(what) + " " + reason;
+		failed = true;
+		return false;
+	}
+}
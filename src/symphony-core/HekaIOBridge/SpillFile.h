@@ -0,0 +1,126 @@
+#pragma once
+
+#include "itcmm.h"
+#include "SampleRing.h"
+
+#include <cstdint>
+#include <string>
+
+namespace Heka {
+
+	// On-disk layout of a spill file (little-endian). The header and its channel table are followed,
+	// from headerBytes, by records: a SpillRecord, then samples itcsample_t of each channel in turn,
+	// padded to 8 bytes. committedBytes is the end of the last complete record; it only moves once
+	// a record has been written, so a reader never sees a partial record.
+	struct SpillChannel
+	{
+		uint16_t channelType;
+		uint16_t channelNumber;
+		uint16_t deviceIndex;
+		uint16_t reserved;
+	};
+
+	struct SpillFileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t channelCount;
+		uint32_t headerBytes;
+		uint32_t closed; // 1 once the file was closed cleanly; 2 once kept by a failed run (SpillFileReader.MarkKept)
+		double sampleRate; // Per channel, Hz
+		int64_t tickFrequency; // Host performance counter ticks per second
+		int64_t startTicks; // Host ticks when the file was created
+		int64_t startFileTime; // UTC FILETIME when the file was created
+		volatile int64_t committedBytes;
+	};
+
+	// One transferred FIFO block. firstSample counts input samples from the start of the run;
+	// the hardware had acquired clockSample samples when its FIFO pointers were latched at host
+	// time clockTicks (see SampleClock).
+	struct SpillRecord
+	{
+		uint32_t marker;
+		uint32_t samples;
+		int64_t firstSample;
+		int64_t clockSample;
+		int64_t clockTicks;
+	};
+
+	// Append-only, memory-mapped record of the input acquired by a streaming run. Each block is
+	// copied once, from the streaming queue it was just read into, into a mapped view; nothing is
+	// flushed on the streaming thread. Pages written to a view belong to the system file cache,
+	// so the data survives the process dying, and a file left without its closed flag is an orphan
+	// to recover (see SpillFileReader).
+	//
+	// Records are written through a fixed-size window of the file rather than a view of all of it,
+	// so long runs fit a 32-bit address space. Windows overlap by half: window k maps
+	// [k * stride, (k + 2) * stride), and a record starting in its first half always fits. A mapper
+	// thread extends the file and maps the next window ahead of the writer, and unmaps the windows
+	// it has left, so an append only copies; if the mapper falls behind, the writer maps the window
+	// itself rather than lose the record.
+	//
+	// A file is written by one thread at a time. Once an append fails (e.g. the disk is full) the
+	// file stays failed and later appends are ignored; the acquisition itself is unaffected.
+	class SpillFile
+	{
+	public:
+		static const uint32_t VERSION = 1;
+		static const uint32_t RECORD_MARKER = 0x314B4C42; // "BLK1"
+		static const uint64_t DEFAULT_WINDOW_BYTES = 32 << 20;
+
+		SpillFile();
+		~SpillFile();
+
+		// Creates (or replaces) the file at path with a channel table of the given inputs, written
+		// through windows of windowBytes (rounded up to twice the allocation granularity). A record
+		// may be at most half a window. Returns false, with ErrorMessage set, if the file cannot be
+		// created.
+		bool Create(const wchar_t *path,
+			double sampleRate,
+			const ITCChannelDataEx *inputs,
+			const int *inputDevices,
+			int inputCount,
+			uint64_t windowBytes);
+
+		// Appends samples of every channel, channels[c] pointing at channel c's samples.
+		bool Append(int64_t firstSample, int64_t clockSample, int64_t clockTicks,
+			const itcsample_t *const *channels, uint32_t samples);
+
+		// Stops the mapper, marks the file closed, flushes it and trims it to its records.
+		void Close();
+
+		bool IsOpen() const { return header != NULL; }
+		bool Failed() const { return failed; }
+		const char *ErrorMessage() const { return error.c_str(); }
+
+		// Samples per channel appended so far.
+		int64_t Samples() const { return samples; }
+		uint64_t CommittedBytes() const { return committed; }
+
+	private:
+		struct Window;
+		struct Mapper;
+
+		Window *Map(uint64_t index) const;
+		static void Unmap(Window *window);
+		bool Advance(uint64_t index);
+		void MapAhead();
+		bool Fail(const char *what);
+		bool Fail(const char *what, const char *reason);
+
+		HANDLE file;
+		HANDLE headerMapping;
+		SpillFileHeader *header;
+		Window *current; // Window records are written through
+		Mapper *mapper;
+		uint64_t stride; // Half a window
+		uint64_t committed;
+		uint32_t channelCount;
+		int64_t samples;
+		bool failed;
+		std::string error;
+
+		SpillFile(const SpillFile &);
+		SpillFile &operator=(const SpillFile &);
+	};
+}
@@ -0,0 +1,654 @@
+// StreamingEngine.cpp : Native FIFO streaming thread. Compiled without /clr so that it may use
+// <thread> and <atomic>.
+//
+
+#include "stdafx.h"
+#include "StreamingEngine.h"
+#include "0acqerrors.h"
+
+#include <algorithm>
+#include <climits>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace Heka {
+
+	namespace {
+
+		// Lock-free single-producer/single-consumer sample queue. The producer only advances
+		// head and the consumer only advances tail; both are monotonic sample counts. Space and
+		// Count are read once per decision, as the other side may move them at any time.
+		class SpscQueue
+		{
+		public:
+			explicit SpscQueue(size_t capacity) : buffer(capacity), head(0), tail(0) {}
+
+			size_t Count() const { return head.load(memory_order_acquire) - tail.load(memory_order_acquire); }
+			size_t Space() const { return buffer.size() - Count(); }
+
+			// Producer side: contiguous writable region and commit.
+			itcsample_t *WritePointer() { return &buffer[0] + head.load(memory_order_relaxed) % buffer.size(); }
+			size_t ContiguousSpace() const
+			{
+				size_t toEnd = buffer.size() - head.load(memory_order_relaxed) % buffer.size();
+				size_t space = Space();
+				return min(toEnd, space);
+			}
+			void Commit(size_t n) { head.store(head.load(memory_order_relaxed) + n, memory_order_release); }
+
+			// Consumer side: contiguous readable region and consume.
+			itcsample_t *ReadPointer() { return &buffer[0] + tail.load(memory_order_relaxed) % buffer.size(); }
+			size_t ContiguousCount() const
+			{
+				size_t toEnd = buffer.size() - tail.load(memory_order_relaxed) % buffer.size();
+				size_t count = Count();
+				return min(toEnd, count);
+			}
+			void Consume(size_t n) { tail.store(tail.load(memory_order_relaxed) + n, memory_order_release); }
+
+			size_t Push(const itcsample_t *src, size_t n)
+			{
+				size_t written = 0;
+				size_t block;
+				while(written < n && (block = ContiguousSpace()) > 0) {
+					block = min(block, n - written);
+					memcpy(WritePointer(), src + written, block * sizeof(itcsample_t));
+					Commit(block);
+					written += block;
+				}
+
+				return written;
+			}
+
+			size_t Pop(itcsample_t *dst, size_t n)
+			{
+				size_t read = 0;
+				size_t block;
+				while(read < n && (block = ContiguousCount()) > 0) {
+					block = min(block, n - read);
+					memcpy(dst + read, ReadPointer(), block * sizeof(itcsample_t));
+					Consume(block);
+					read += block;
+				}
+
+				return read;
+			}
+
+		private:
+			vector<itcsample_t> buffer;
+			atomic<size_t> head;
+			atomic<size_t> tail;
+		};
+
+		class DriverLockGuard
+		{
+		public:
+			explicit DriverLockGuard(CRITICAL_SECTION *cs) : lock(cs) { EnterCriticalSection(lock); }
+			~DriverLockGuard() { LeaveCriticalSection(lock); }
+
+		private:
+			CRITICAL_SECTION *lock;
+		};
+	}
+
+
+	struct StreamingEngine::State
+	{
+		// One ITC unit and the engine channels (indexes into outputData/inputData) on it
+		struct Unit
+		{
+			void *device;
+			vector<size_t> outputs;
+			vector<size_t> inputs;
+			vector<ITCChannelDataEx> availableData; // outputs, then inputs
+			vector<ITCChannelDataEx> transferData;
+		};
+
+		vector<Unit> units;
+		const ItcDriver *driver;
+		CRITICAL_SECTION *driverLock;
+		PollWaiter *waiter;
+		DriverCounters *counters;
+		SampleClock *clock;
+		TransferMonitor *monitor;
+		FifoWatchdog *watchdog;
+		SpillFile *spill;
+		vector<const itcsample_t *> spillChannels; // Each input's block as it was read
+		int64_t spillFirst; // Block read by the last pass, appended once the driver lock is released
+		int64_t spillClockSample;
+		int64_t spillClockTicks;
+		uint32_t spillSamples;
+		int clockUnit; // unit whose input FIFO is observed by clock, or -1 with no inputs
+		int64_t inputCommitted;
+		int64_t clockSample; // Latest observation recorded in clock
+		int64_t clockTicks;
+		unsigned int statusCheckInterval;
+		unsigned int passesSinceStatus;
+		unsigned int blockSamples;
+
+		vector<ITCChannelDataEx> outputData;
+		vector<ITCChannelDataEx> inputData;
+		vector<SpscQueue *> outputQueues;
+		vector<SpscQueue *> inputQueues;
+		vector<vector<itcsample_t> > padding; // One block of background per output channel
+
+		// Once the output has been ended, input is read until the hardware stops or endInput samples
+		// (covering everything written) have been queued
+		atomic<bool> outputEnded;
+		bool hardwareStopped;
+		int64_t endInput;
+
+		thread worker;
+		atomic<bool> stopRequested;
+		atomic<bool> running;
+		atomic<bool> failed;
+		long errorCode;
+		string errorMessage;
+
+		State() : spill(NULL), spillFirst(0), spillClockSample(0), spillClockTicks(0), spillSamples(0), clockUnit(-1), inputCommitted(0), clockSample(0), clockTicks(0), passesSinceStatus(UINT_MAX), outputEnded(false), hardwareStopped(false), endInput(0),
+			stopRequested(false), running(false), failed(false), errorCode(0) {}
+
+		~State()
+		{
+			for(size_t i=0; i < outputQueues.size(); i++) {
+				delete outputQueues[i];
+			}
+
+			for(size_t i=0; i < inputQueues.size(); i++) {
+				delete inputQueues[i];
+			}
+		}
+
+		void Fail(long code, const string &msg)
+		{
+			errorCode = code;
+			errorMessage = msg;
+			failed.store(true, memory_order_release);
+		}
+
+		// Mirrors CheckStatus in HekaIOBridge.cpp, reporting instead of throwing.
+		bool CheckStatus(void *device)
+		{
+			ITCStatus status;
+			ZeroMemory(&status, sizeof(status));
+			status.CommandStatus = READ_ERRORS | READ_OVERFLOW | READ_RUNNINGMODE;
+
+			long err = driver->GetState(device, &status);
+			counters->CountGetState();
+			if(err != ACQ_SUCCESS) {
+				Fail(err, "ITC_GetState error");
+				return false;
+			}
+
+			if( !(status.RunningMode & RUN_STATE) ||
+				((status.RunningMode & ERROR_STATE) && (status.Overflow & (ITC_WRITE_UNDERRUN_H | ITC_WRITE_UNDERRUN_S))) ||
+				((status.RunningMode & ERROR_STATE) && (status.Overflow & (ITC_READ_OVERFLOW_H | ITC_READ_OVERFLOW_S)))
+				)
+			{
+				char msg[128];
+				if(status.RunningMode == DEAD_STATE)
+					sprintf_s(msg, sizeof(msg), "ITC not running. State: DEAD (likely due to hardware underrun)");
+				else
+					sprintf_s(msg, sizeof(msg), "ITC not running. State: 0x%lX, error code: 0x%lX", status.RunningMode, status.Overflow);
+
+				Fail(0, msg);
+				return false;
+			}
+
+			return true;
+		}
+
+		// Run-state check after the output has been ended, when the hardware is expected to stop (or
+		// report an underrun) as it plays out. Only an input overflow is a failure.
+		bool CheckEndedStatus(void *device)
+		{
+			ITCStatus status;
+			ZeroMemory(&status, sizeof(status));
+			status.CommandStatus = READ_ERRORS | READ_OVERFLOW | READ_RUNNINGMODE;
+
+			long err = driver->GetState(device, &status);
+			counters->CountGetState();
+			if(err != ACQ_SUCCESS) {
+				Fail(err, "ITC_GetState error");
+				return false;
+			}
+
+			if((status.RunningMode & ERROR_STATE) && (status.Overflow & (ITC_READ_OVERFLOW_H | ITC_READ_OVERFLOW_S))) {
+				char msg[128];
+				sprintf_s(msg, sizeof(msg), "ITC input overflow after output ended. State: 0x%lX, error code: 0x%lX", status.RunningMode, status.Overflow);
+				Fail(0, msg);
+				return false;
+			}
+
+			if( !(status.RunningMode & RUN_STATE) ||
+				((status.RunningMode & ERROR_STATE) && (status.Overflow & (ITC_WRITE_UNDERRUN_H | ITC_WRITE_UNDERRUN_S)))
+				)
+			{
+				hardwareStopped = true;
+			}
+
+			return true;
+		}
+
+		// Smallest number of samples queued on any output channel
+		size_t OutputQueued() const
+		{
+			size_t queued = SIZE_MAX;
+			for(size_t i=0; i < outputQueues.size(); i++) {
+				size_t count = outputQueues[i]->Count();
+				queued = min(queued, count);
+			}
+
+			return queued;
+		}
+
+		// One pass over the FIFOs, moving whatever is available (up to a block) with a single
+		// ITC_ReadWriteFIFO call per unit. Every channel of every unit moves the same number of
+		// samples. Returns false if the thread should exit. full is set if either direction moved a
+		// whole block; otherwise missing is how many samples short of a block the closest direction is.
+		bool Service(bool &full, size_t &missing)
+		{
+			DriverLockGuard guard(driverLock);
+
+			TransferRecord pass;
+			ZeroMemory(&pass, sizeof(pass));
+			pass.start = SampleClock::Now();
+			pass.outputChannels = (uint16_t) outputData.size();
+			pass.inputChannels = (uint16_t) inputData.size();
+
+			bool ended = outputEnded.load(memory_order_relaxed);
+
+			if(passesSinceStatus >= statusCheckInterval) {
+				for(size_t u=0; u < units.size(); u++) {
+					if(!(ended ? CheckEndedStatus(units[u].device) : CheckStatus(units[u].device))) {
+						return false;
+					}
+				}
+				passesSinceStatus = 0;
+			}
+			passesSinceStatus++;
+
+			// Output queued after the output was ended is discarded
+			for(size_t i=0; ended && i < outputData.size(); i++) {
+				outputQueues[i]->Consume(outputQueues[i]->Count());
+			}
+
+			size_t inCap = inputData.empty() ? 0 : blockSamples;
+			for(size_t i=0; i < inputData.size(); i++) {
+				size_t space = inputQueues[i]->ContiguousSpace();
+				inCap = min(inCap, space);
+			}
+
+			size_t outCap = outputData.empty() || ended ? 0 : blockSamples;
+			for(size_t i=0; i < outputData.size(); i++) {
+				size_t count = outputQueues[i]->ContiguousCount();
+				outCap = min(outCap, count);
+			}
+
+			size_t inBlock = inCap;
+			size_t outBlock = outCap;
+			size_t fifoSpace = outputData.empty() ? 0 : SIZE_MAX; // Least output FIFO space on any channel
+			size_t fifoInput = inputData.empty() ? 0 : SIZE_MAX; // Least input waiting on any channel
+
+			for(size_t u=0; u < units.size(); u++) {
+				Unit &unit = units[u];
+
+				// The FIFO pointers are latched somewhere within the UpdateNow call
+				int64_t updateStart = SampleClock::Now();
+				driver->UpdateNow(unit.device, NULL);
+				int64_t latched = updateStart + (SampleClock::Now() - updateStart) / 2;
+				counters->CountUpdateNow();
+
+				if(unit.availableData.empty()) {
+					continue;
+				}
+
+				driver->GetDataAvailable(unit.device, (unsigned long) unit.availableData.size(), &unit.availableData[0]);
+				counters->CountGetDataAvailable();
+				pass.pollTicks += (uint32_t) (SampleClock::Now() - updateStart);
+				uint32_t outputSpace = TransferMonitor::MaxAvailable(unit.availableData.data(), unit.outputs.size());
+				uint32_t inputFill = TransferMonitor::MaxAvailable(unit.availableData.data() + unit.outputs.size(), unit.inputs.size());
+				pass.outputSpace = max(pass.outputSpace, outputSpace);
+				pass.inputFill = max(pass.inputFill, inputFill);
+
+				if((int) u == clockUnit) {
+					clockSample = inputCommitted + unit.availableData[unit.outputs.size()].Value;
+					clockTicks = latched;
+					clock->Record(clockSample, latched);
+				}
+
+				for(size_t i=0; i < unit.outputs.size(); i++) {
+					fifoSpace = min(fifoSpace, (size_t) unit.availableData[i].Value);
+				}
+
+				for(size_t i=0; i < unit.inputs.size(); i++) {
+					fifoInput = min(fifoInput, (size_t) unit.availableData[unit.outputs.size() + i].Value);
+				}
+			}
+
+			inBlock = min(inBlock, fifoInput);
+			outBlock = min(outBlock, fifoSpace);
+
+			// The margin is what the hardware has left to play: its output FIFO plus our queues
+			bool ending = false;
+			uint32_t depth = monitor->FifoDepth();
+			if(!ended && !outputData.empty() && depth > 0) {
+				size_t queued = OutputQueued();
+				int64_t fill = max((int64_t) depth - (int64_t) pass.outputSpace, (int64_t) 0);
+				int64_t margin = fill + (int64_t) queued;
+				watchdog->Observe(margin);
+
+				if(queued == 0 && watchdog->BelowStop(margin)) {
+					outBlock = min((size_t) blockSamples, fifoSpace);
+					ending = outBlock > 0;
+					if(ending) {
+						// Input is acquired in step with the output still to be played
+						endInput = inputCommitted + (int64_t) fifoInput + fill + (int64_t) outBlock;
+					}
+				}
+			}
+
+			bool moved = false;
+			for(size_t u=0; u < units.size(); u++) {
+				Unit &unit = units[u];
+
+				size_t n = 0;
+				if(outBlock > 0) {
+					for(size_t i=0; i < unit.outputs.size(); i++, n++) {
+						size_t c = unit.outputs[i];
+						unit.transferData[n] = outputData[c];
+						unit.transferData[n].Value = (unsigned long) outBlock;
+						if(ending) {
+							unit.transferData[n].Command |= LAST_FIFO_COMMAND_EX;
+							unit.transferData[n].DataPointer = &padding[c][0];
+						} else {
+							unit.transferData[n].DataPointer = outputQueues[c]->ReadPointer();
+						}
+					}
+				}
+
+				if(inBlock > 0) {
+					for(size_t i=0; i < unit.inputs.size(); i++, n++) {
+						size_t c = unit.inputs[i];
+						unit.transferData[n] = inputData[c];
+						unit.transferData[n].Value = (unsigned long) inBlock;
+						unit.transferData[n].DataPointer = inputQueues[c]->WritePointer();
+						spillChannels[c] = (const itcsample_t *) unit.transferData[n].DataPointer;
+					}
+				}
+
+				if(n > 0) {
+					int64_t callStart = waiter->BeginTransfer();
+					long err = driver->ReadWriteFIFO(unit.device, (unsigned long) n, &unit.transferData[0]);
+					waiter->RecordFifoCall(callStart);
+					pass.fifoTicks += (uint32_t) (SampleClock::Now() - callStart);
+					counters->CountReadWriteFifo();
+					if(err != ACQ_SUCCESS) {
+						Fail(err, "ITC_ReadWriteFIFO error");
+						return false;
+					}
+
+					moved = true;
+				}
+			}
+
+			if(moved) {
+				for(size_t i=0; outBlock > 0 && !ending && i < outputData.size(); i++) {
+					outputQueues[i]->Consume(outBlock);
+				}
+
+				if(spill != NULL && inBlock > 0 && !spill->Failed()) {
+					spillFirst = inputCommitted;
+					spillClockSample = clockSample;
+					spillClockTicks = clockTicks;
+					spillSamples = (uint32_t) inBlock;
+				}
+
+				for(size_t i=0; inBlock > 0 && i < inputData.size(); i++) {
+					inputQueues[i]->Commit(inBlock);
+				}
+				inputCommitted += inputData.empty() ? 0 : inBlock;
+
+				pass.outputSamples = (uint32_t) outBlock;
+				pass.inputSamples = (uint32_t) inBlock;
+			} else {
+				passesSinceStatus = statusCheckInterval;
+			}
+			monitor->Record(pass);
+
+			if(ending && moved) {
+				outputEnded.store(true, memory_order_release);
+				passesSinceStatus = statusCheckInterval;
+			}
+
+			// Once ended, stop when everything written has come back as input, or when the hardware
+			// has stopped and nothing is left to read (a full input queue only delays the read)
+			if(ended) {
+				if(!inputData.empty() && inputCommitted >= endInput) {
+					return false;
+				}
+				if(hardwareStopped && !moved && fifoInput == 0) {
+					return false;
+				}
+			}
+
+			full = (inCap > 0 && inBlock == inCap) || (outCap > 0 && outBlock == outCap);
+			if(inCap > 0) {
+				missing = min(missing, inCap - inBlock);
+			}
+			if(outCap > 0) {
+				missing = min(missing, outCap - outBlock);
+			}
+
+			return true;
+		}
+
+		// Appends the block read by the last pass to the spill file. Runs without the driver lock: the
+		// block stays where it was read in the input queues until this thread next writes them.
+		void Spill()
+		{
+			if(spillSamples > 0) {
+				spill->Append(spillFirst, spillClockSample, spillClockTicks, spillChannels.data(), spillSamples);
+				spillSamples = 0;
+			}
+		}
+
+		void Run()
+		{
+			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+
+			while(!stopRequested.load(memory_order_acquire)) {
+				bool full = false;
+				size_t missing = blockSamples;
+
+				int64_t start = waiter->BeginTransfer();
+				bool ok = Service(full, missing);
+				waiter->EndTransfer(start);
+				Spill();
+
+				if(!ok) {
+					break;
+				}
+
+				if(!full) {
+					waiter->Wait(missing);
+				}
+			}
+
+			running.store(false, memory_order_release);
+		}
+	};
+
+
+	StreamingEngine::StreamingEngine(void *const *devices,
+		int deviceCount,
+		const ItcDriver *driver,
+		CRITICAL_SECTION *driverLock,
+		PollWaiter *waiter,
+		DriverCounters *counters,
+		SampleClock *clock,
+		TransferMonitor *monitor,
+		FifoWatchdog *watchdog,
+		unsigned int statusCheckInterval,
+		const ITCChannelDataEx *outputs,
+		const int *outputDevices,
+		const itcsample_t *outputBackgrounds,
+		int outputCount,
+		const ITCChannelDataEx *inputs,
+		const int *inputDevices,
+		int inputCount,
+		size_t queueCapacity,
+		unsigned int blockSamples)
+		: state(new State())
+	{
+		state->units.resize(deviceCount);
+		for(int u=0; u < deviceCount; u++) {
+			state->units[u].device = devices[u];
+		}
+
+		state->driver = driver;
+		state->driverLock = driverLock;
+		state->waiter = waiter;
+		state->counters = counters;
+		state->clock = clock;
+		state->monitor = monitor;
+		state->watchdog = watchdog;
+		state->clockUnit = inputCount > 0 ? inputDevices[0] : -1;
+		state->statusCheckInterval = statusCheckInterval;
+		state->blockSamples = blockSamples;
+
+		for(int i=0; i < outputCount; i++) {
+			ITCChannelDataEx c;
+			ZeroMemory(&c, sizeof(c));
+			c.ChannelType = outputs[i].ChannelType;
+			c.ChannelNumber = outputs[i].ChannelNumber;
+			state->units[outputDevices[i]].outputs.push_back(state->outputData.size());
+			state->units[outputDevices[i]].availableData.push_back(c);
+			state->outputData.push_back(c);
+			state->outputQueues.push_back(new SpscQueue(queueCapacity));
+			state->padding.push_back(vector<itcsample_t>(blockSamples, outputBackgrounds[i]));
+		}
+
+		for(int i=0; i < inputCount; i++) {
+			ITCChannelDataEx c;
+			ZeroMemory(&c, sizeof(c));
+			c.ChannelType = inputs[i].ChannelType;
+			c.ChannelNumber = inputs[i].ChannelNumber;
+			state->inputData.push_back(c);
+			state->inputQueues.push_back(new SpscQueue(queueCapacity));
+		}
+		state->spillChannels.assign(inputCount, NULL);
+
+		// Each unit's availability query lists its outputs, then its inputs
+		for(int i=0; i < inputCount; i++) {
+			State::Unit &unit = state->units[inputDevices[i]];
+			unit.inputs.push_back(i);
+			unit.availableData.push_back(state->inputData[i]);
+		}
+
+		for(int u=0; u < deviceCount; u++) {
+			state->units[u].transferData.resize(state->units[u].availableData.size());
+		}
+	}
+
+	StreamingEngine::~StreamingEngine()
+	{
+		Stop();
+		delete state;
+	}
+
+	void StreamingEngine::SetSpill(SpillFile *spill)
+	{
+		state->spill = spill;
+	}
+
+	void StreamingEngine::Start()
+	{
+		if(state->worker.joinable()) {
+			return;
+		}
+
+		state->stopRequested.store(false);
+		state->running.store(true);
+		state->worker = thread(&State::Run, state);
+	}
+
+	void StreamingEngine::Stop()
+	{
+		state->stopRequested.store(true, memory_order_release);
+		if(state->worker.joinable()) {
+			state->worker.join();
+		}
+	}
+
+	bool StreamingEngine::IsRunning() const
+	{
+		return state->running.load(memory_order_acquire);
+	}
+
+	bool StreamingEngine::Failed() const
+	{
+		return state->failed.load(memory_order_acquire);
+	}
+
+	long StreamingEngine::ErrorCode() const
+	{
+		return Failed() ? state->errorCode : 0;
+	}
+
+	const char *StreamingEngine::ErrorMessage() const
+	{
+		return Failed() ? state->errorMessage.c_str() : "";
+	}
+
+	bool StreamingEngine::OutputEnded() const
+	{
+		return state->outputEnded.load(memory_order_acquire);
+	}
+
+	size_t StreamingEngine::OutputSpace() const
+	{
+		if(state->outputQueues.empty()) {
+			return 0;
+		}
+
+		size_t space = state->outputQueues[0]->Space();
+		for(size_t i=1; i < state->outputQueues.size(); i++) {
+			size_t queueSpace = state->outputQueues[i]->Space();
+			space = min(space, queueSpace);
+		}
+
+		return space;
+	}
+
+	size_t StreamingEngine::InputAvailable() const
+	{
+		if(state->inputQueues.empty()) {
+			return 0;
+		}
+
+		size_t available = state->inputQueues[0]->Count();
+		for(size_t i=1; i < state->inputQueues.size(); i++) {
+			size_t queueCount = state->inputQueues[i]->Count();
+			available = min(available, queueCount);
+		}
+
+		return available;
+	}
+
+	size_t StreamingEngine::PushOutput(int channel, const itcsample_t *samples, size_t n)
+	{
+		return state->outputQueues[channel]->Push(samples, n);
+	}
+
+	size_t StreamingEngine::PopInput(int channel, itcsample_t *samples, size_t n)
+	{
+		return state->inputQueues[channel]->Pop(samples, n);
+	}
+}
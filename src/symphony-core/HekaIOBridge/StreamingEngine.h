@@ -0,0 +1,97 @@
+#pragma once
+
+#include "itcmm.h"
+#include "ItcDriver.h"
+#include "SampleRing.h"
+#include "PollWaiter.h"
+#include "DriverCounters.h"
+#include "SampleClock.h"
+#include "TransferMonitor.h"
+#include "FifoWatchdog.h"
+#include "SpillFile.h"
+
+namespace Heka {
+
+	// Services the ITC FIFOs continuously from a dedicated high-priority native thread. Output
+	// samples are queued with PushOutput and input samples collected with PopInput; each channel
+	// has its own lock-free single-producer/single-consumer queue, so managed code can produce and
+	// consume at its own pace while the FIFO keeps being serviced.
+	//
+	// The engine may service several ITC units started together. Each pass moves the same number
+	// of samples on every channel of every unit, so the queues stay sample-aligned across units.
+	//
+	// This header is shared with /clr translation units, so the thread and atomics live behind
+	// an opaque State defined in StreamingEngine.cpp (compiled native).
+	class StreamingEngine
+	{
+	public:
+		// Channel order in outputs/inputs defines the channel index used by PushOutput/PopInput;
+		// outputDevices/inputDevices give the index into devices of each channel's unit.
+		// All driver calls made by the streaming thread go through driver, hold driverLock and are
+		// tallied in counters; waiter paces the thread while the FIFO is short of a block. Every
+		// pass records the input sample count of the first input channel's unit in clock, counting
+		// from zero when the engine starts, its timing and FIFO levels in monitor, and its output
+		// margin in watchdog (given monitor's FIFO depth). Run state is checked every
+		// statusCheckInterval passes and after any pass that moved nothing.
+		//
+		// If the output margin falls below the watchdog's stop watermark with every output queue
+		// empty, the engine ends the output rather than let the hardware underrun: it writes one
+		// block of each channel's outputBackgrounds value marked LAST_FIFO_COMMAND_EX, stops
+		// writing output, and keeps reading input until the hardware has played out, then exits
+		// without failing (see OutputEnded).
+		StreamingEngine(void *const *devices,
+			int deviceCount,
+			const ItcDriver *driver,
+			CRITICAL_SECTION *driverLock,
+			PollWaiter *waiter,
+			DriverCounters *counters,
+			SampleClock *clock,
+			TransferMonitor *monitor,
+			FifoWatchdog *watchdog,
+			unsigned int statusCheckInterval,
+			const ITCChannelDataEx *outputs,
+			const int *outputDevices,
+			const itcsample_t *outputBackgrounds,
+			int outputCount,
+			const ITCChannelDataEx *inputs,
+			const int *inputDevices,
+			int inputCount,
+			size_t queueCapacity,
+			unsigned int blockSamples);
+		~StreamingEngine();
+
+		// Each input block is also appended to spill, if given, once it is queued and the driver
+		// lock released (see SpillFile). Set before Start; the engine does not own spill.
+		void SetSpill(SpillFile *spill);
+
+		void Start();
+		void Stop();
+		bool IsRunning() const;
+
+		// Failed() becomes true once the streaming thread has stopped on a driver error or a
+		// hardware overflow/underrun. ErrorCode is the ITCMM error, or zero for hardware state errors.
+		bool Failed() const;
+		long ErrorCode() const;
+		const char *ErrorMessage() const;
+
+		// True once the engine has ended the output on a low margin. Output pushed afterwards is
+		// discarded; the thread stops by itself once the remaining input has been queued.
+		bool OutputEnded() const;
+
+		// Samples that can currently be queued on every output channel.
+		size_t OutputSpace() const;
+
+		// Samples currently ready on every input channel.
+		size_t InputAvailable() const;
+
+		size_t PushOutput(int channel, const itcsample_t *samples, size_t n);
+		size_t PopInput(int channel, itcsample_t *samples, size_t n);
+
+	private:
+		struct State;
+		State *state;
+
+		StreamingEngine(const StreamingEngine &);
+		StreamingEngine &operator=(const StreamingEngine &);
+	};
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>
+#include "itcmm.h"
+
+namespace Heka {
+
+	// One FIFO pass of a transfer loop. Durations are host performance counter ticks; FIFO levels
+	// are those reported by ITC_GetDataAvailable at the start of the pass.
+	struct TransferRecord
+	{
+		int64_t start;          // Pass start
+		uint32_t pollTicks;     // ITC_UpdateNow + ITC_GetDataAvailable
+		uint32_t fifoTicks;     // ITC_ReadWriteFIFO, zero if nothing moved
+		uint32_t outputSpace;   // Free output FIFO space on the fullest-drained output channel
+		uint32_t inputFill;     // Samples waiting on the fullest input channel
+		uint32_t outputSamples; // Samples moved per output channel
+		uint32_t inputSamples;  // Samples moved per input channel
+		uint16_t outputChannels;
+		uint16_t inputChannels;
+	};
+
+	// Timing and FIFO-level counters for the FIFO transfer loops, plus an optional trace ring of the
+	// most recent passes that can be dumped after a failure. Records are written by the one thread
+	// running a transfer loop, without allocating or locking; counters may be read from any thread.
+	// The trace must be enabled or disabled while no transfer is running.
+	class TransferMonitor
+	{
+	public:
+		static const uint32_t TRACE_CAPACITY = 4096;
+
+		TransferMonitor() : trace(NULL), fifoDepth(0)
+		{
+			Reset();
+		}
+
+		~TransferMonitor()
+		{
+			delete[] trace;
+		}
+
+		// Hardware FIFO depth, used to turn free output space into output FIFO fill.
+		uint32_t FifoDepth() const { return fifoDepth; }
+		void SetFifoDepth(uint32_t samples) { fifoDepth = samples; }
+
+		bool TraceEnabled() const { return trace != NULL; }
+		void EnableTrace(bool enable)
+		{
+			if(enable && trace == NULL) {
+				trace = new TransferRecord[TRACE_CAPACITY];
+			} else if(!enable) {
+				delete[] trace;
+				trace = NULL;
+			}
+
+			InterlockedExchange64(&traceCount, 0);
+		}
+
+		void Record(const TransferRecord &pass)
+		{
+			if(lastStart != 0) {
+				Max(&maxPassGap, pass.start - lastStart);
+			}
+			lastStart = pass.start;
+
+			InterlockedIncrement64(&passes);
+			InterlockedExchangeAdd64(&outputSamples, pass.outputSamples);
+			InterlockedExchangeAdd64(&inputSamples, pass.inputSamples);
+			Max(&maxPollTicks, pass.pollTicks);
+			Max(&maxFifoTicks, pass.fifoTicks);
+			if(pass.outputChannels > 0) {
+				Max(&maxOutputSpace, pass.outputSpace);
+			}
+			if(pass.inputChannels > 0) {
+				Max(&maxInputFill, pass.inputFill);
+			}
+
+			if(trace != NULL) {
+				trace[Read(&traceCount) % TRACE_CAPACITY] = pass;
+				InterlockedIncrement64(&traceCount);
+			}
+		}
+
+		// Largest Value over n channels of an ITC_GetDataAvailable result
+		static uint32_t MaxAvailable(const ITCChannelDataEx *channels, size_t n)
+		{
+			uint32_t result = 0;
+			for(size_t i=0; i < n; i++) {
+				if(channels[i].Value > result) {
+					result = (uint32_t) channels[i].Value;
+				}
+			}
+
+			return result;
+		}
+
+		int64_t Passes() const { return Read(&passes); }
+		int64_t OutputSamples() const { return Read(&outputSamples); }
+		int64_t InputSamples() const { return Read(&inputSamples); }
+		int64_t MaxPollTicks() const { return Read(&maxPollTicks); }
+		int64_t MaxFifoTicks() const { return Read(&maxFifoTicks); }
+		int64_t MaxPassGapTicks() const { return Read(&maxPassGap); }
+		// -1 until a pass with output (input) channels has been recorded
+		int64_t MaxOutputSpace() const { return Read(&maxOutputSpace); }
+		int64_t MaxInputFill() const { return Read(&maxInputFill); }
+
+		// Copies up to maxRecords of the most recent passes into dst, oldest first; returns the number
+		// copied. Passes recorded during the copy may overwrite the oldest entries.
+		uint32_t DumpTrace(TransferRecord *dst, uint32_t maxRecords) const
+		{
+			if(trace == NULL) {
+				return 0;
+			}
+
+			int64_t count = Read(&traceCount);
+			int64_t n = count < TRACE_CAPACITY ? count : TRACE_CAPACITY;
+			if(n > maxRecords) {
+				n = maxRecords;
+			}
+
+			for(int64_t i=0; i < n; i++) {
+				dst[i] = trace[(count - n + i) % TRACE_CAPACITY];
+			}
+
+			return (uint32_t) n;
+		}
+
+		void Reset()
+		{
+			lastStart = 0;
+			InterlockedExchange64(&passes, 0);
+			InterlockedExchange64(&outputSamples, 0);
+			InterlockedExchange64(&inputSamples, 0);
+			InterlockedExchange64(&maxPollTicks, 0);
+			InterlockedExchange64(&maxFifoTicks, 0);
+			InterlockedExchange64(&maxPassGap, 0);
+			InterlockedExchange64(&maxOutputSpace, -1);
+			InterlockedExchange64(&maxInputFill, -1);
+			InterlockedExchange64(&traceCount, 0);
+		}
+
+	private:
+		static int64_t Read(volatile LONGLONG const *value)
+		{
+			return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(value), 0, 0);
+		}
+
+		// Single writer, so a plain compare suffices
+		static void Max(volatile LONGLONG *value, int64_t candidate)
+		{
+			if(candidate > Read(value)) {
+				InterlockedExchange64(value, candidate);
+			}
+		}
+
+		TransferMonitor(const TransferMonitor &);
+		TransferMonitor &operator=(const TransferMonitor &);
+
+		TransferRecord *trace;
+		uint32_t fifoDepth;
+		int64_t lastStart;
+
+		volatile LONGLONG passes;
+		volatile LONGLONG outputSamples;
+		volatile LONGLONG inputSamples;
+		volatile LONGLONG maxPollTicks;
+		volatile LONGLONG maxFifoTicks;
+		volatile LONGLONG maxPassGap;
+		volatile LONGLONG maxOutputSpace;
+		volatile LONGLONG maxInputFill;
+		volatile LONGLONG traceCount;
+	};
+}
@@ -0,0 +1,472 @@
+// Benchmark.cpp : Loopback throughput and latency trials against ITC hardware.
+//
+
+#include "stdafx.h"
+#include "Windows.h"
+
+#include "Benchmark.h"
+#include "StreamingEngine.h"
+#include "0acqerrors.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+namespace Heka {
+
+	namespace {
+
+		int64_t ProcessCpuTicks()
+		{
+			FILETIME created, exited, kernel, user;
+			GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+
+			ULARGE_INTEGER k, u;
+			k.LowPart = kernel.dwLowDateTime;
+			k.HighPart = kernel.dwHighDateTime;
+			u.LowPart = user.dwLowDateTime;
+			u.HighPart = user.dwHighDateTime;
+
+			return (int64_t) (k.QuadPart + u.QuadPart); // 100 ns units
+		}
+
+		// Distinct sawtooth per channel, within +/-5 V
+		itcsample_t Waveform(int channel, int64_t i)
+		{
+			return (itcsample_t) (((i * (channel + 1)) % 1000 - 500) * 32);
+		}
+	}
+
+	const char *TransferModeName(TransferMode mode)
+	{
+		return mode == TRANSFER_STREAMING ? "streaming" : "blocking";
+	}
+
+
+	LoopbackBenchmark::LoopbackBenchmark(HANDLE dev)
+		: device(dev), target(0), preloaded(0), fifoDepth(0), clock(NULL)
+	{
+	}
+
+	TrialResult LoopbackBenchmark::Run(const TrialConfig &trial)
+	{
+		config = trial;
+
+		TrialResult result;
+		result.config = trial;
+		result.stable = false;
+		result.samples = 0;
+		result.elapsedSeconds = 0;
+		result.throughput = 0;
+		result.meanLatencyMs = result.p99LatencyMs = result.maxLatencyMs = 0;
+		result.cpuPercent = 0;
+		result.fifoCalls = 0;
+		result.mismatches = 0;
+
+		// The output runs on past the input target by enough to cover the pipeline and a last block,
+		// so the hardware is stopped before it can underrun
+		target = (int64_t) (trial.seconds * trial.sampleRate);
+		int64_t tail = 2 * (int64_t) trial.blockSamples + MAX_PIPELINE_SAMPLES;
+
+		output.assign(trial.channels, vector<itcsample_t>((size_t) (target + tail), 0));
+		input.assign(trial.channels, vector<itcsample_t>((size_t) target, 0));
+		for(int c=0; c < trial.channels; c++) {
+			for(int64_t i=0; i < target; i++) {
+				output[c][(size_t) i] = Waveform(c, i);
+			}
+		}
+
+		latencies.clear();
+		latencies.reserve((size_t) (target / max(trial.blockSamples, 1u) + 1));
+
+		SampleClock sampleClock;
+		sampleClock.Reset(trial.sampleRate);
+		clock = &sampleClock;
+
+		if(!Configure(trial, result) || !Preload(result)) {
+			clock = NULL;
+			return result;
+		}
+
+		ITCStartInfo start;
+		ZeroMemory(&start, sizeof(start));
+		start.OutputEnable = 1;
+		start.StopOnOverflow = 1;
+		start.StopOnUnderrun = 1;
+		start.ResetFIFOs = 1;
+
+		int64_t cpuStart = ProcessCpuTicks();
+		int64_t wallStart = SampleClock::Now();
+
+		long err = ITC_Start(device, &start);
+		if(err != ACQ_SUCCESS) {
+			Fail(result, "ITC_Start", err);
+			clock = NULL;
+			return result;
+		}
+
+		if(trial.mode == TRANSFER_STREAMING) {
+			RunStreaming(result);
+		} else {
+			RunBlocking(result);
+		}
+
+		err = ITC_Stop(device, NULL);
+		if(err != ACQ_SUCCESS && result.error.empty()) {
+			Fail(result, "ITC_Stop", err);
+		}
+
+		result.elapsedSeconds = (double) (SampleClock::Now() - wallStart) / sampleClock.Frequency();
+		double cpuSeconds = (ProcessCpuTicks() - cpuStart) * 1e-7;
+		result.cpuPercent = result.elapsedSeconds > 0 ? 100 * cpuSeconds / result.elapsedSeconds : 0;
+		result.throughput = result.elapsedSeconds > 0 ?
+			2.0 * trial.channels * result.samples / result.elapsedSeconds : 0;
+
+		if(!latencies.empty()) {
+			sort(latencies.begin(), latencies.end());
+			double sum = 0;
+			for(size_t i=0; i < latencies.size(); i++) {
+				sum += latencies[i];
+			}
+			result.meanLatencyMs = sum / latencies.size();
+			result.p99LatencyMs = latencies[(latencies.size() - 1) * 99 / 100];
+			result.maxLatencyMs = latencies.back();
+		}
+
+		if(result.error.empty()) {
+			Verify(result);
+		}
+
+		result.stable = result.error.empty() && result.samples == target && result.mismatches == 0;
+
+		clock = NULL;
+		return result;
+	}
+
+	bool LoopbackBenchmark::Configure(const TrialConfig &trial, TrialResult &result)
+	{
+		long err = ITC_ResetChannels(device);
+		if(err != ACQ_SUCCESS) {
+			Fail(result, "ITC_ResetChannels", err);
+			return false;
+		}
+
+		vector<ITCChannelInfo> info(2 * trial.channels);
+		ZeroMemory(info.data(), info.size() * sizeof(ITCChannelInfo));
+		for(int c=0; c < trial.channels; c++) {
+			info[c].ChannelType = H2D;
+			info[c].ChannelNumber = c;
+			info[c].SamplingRate = trial.sampleRate;
+			info[c].HardwareUnderrunValue = 1;
+
+			info[trial.channels + c].ChannelType = D2H;
+			info[trial.channels + c].ChannelNumber = c;
+			info[trial.channels + c].SamplingRate = trial.sampleRate;
+		}
+
+		err = ITC_SetChannels(device, (unsigned long) info.size(), info.data());
+		if(err != ACQ_SUCCESS) {
+			Fail(result, "ITC_SetChannels", err);
+			return false;
+		}
+
+		err = ITC_UpdateChannels(device);
+		if(err != ACQ_SUCCESS) {
+			Fail(result, "ITC_UpdateChannels", err);
+			return false;
+		}
+
+		// With freshly reset channels the free output space is the FIFO depth
+		ITCChannelDataEx available;
+		ZeroMemory(&available, sizeof(available));
+		available.ChannelType = H2D;
+		err = ITC_GetDataAvailable(device, 1, &available);
+		if(err != ACQ_SUCCESS) {
+			Fail(result, "ITC_GetDataAvailable", err);
+			return false;
+		}
+		fifoDepth = (uint32_t) available.Value;
+
+		return true;
+	}
+
+	bool LoopbackBenchmark::Preload(TrialResult &result)
+	{
+		int64_t total = (int64_t) output[0].size();
+		int64_t preload = min((int64_t) PRELOAD_BLOCKS * config.blockSamples, (int64_t) fifoDepth / 2);
+		preloaded = min(preload, total);
+
+		vector<ITCChannelDataEx> channelData(config.channels);
+		ZeroMemory(channelData.data(), channelData.size() * sizeof(ITCChannelDataEx));
+		for(int c=0; c < config.channels; c++) {
+			channelData[c].ChannelType = H2D;
+			channelData[c].ChannelNumber = c;
+			channelData[c].Command = PRELOAD_FIFO_COMMAND_EX;
+			channelData[c].Value = (unsigned long) preloaded;
+			channelData[c].DataPointer = output[c].data();
+		}
+
+		long err = ITC_ReadWriteFIFO(device, (unsigned long) channelData.size(), channelData.data());
+		if(err != ACQ_SUCCESS) {
+			Fail(result, "ITC_ReadWriteFIFO (preload)", err);
+			return false;
+		}
+
+		return true;
+	}
+
+	// FIFO passes as made by IOBridge::Transfer: one ITC_GetDataAvailable over every channel, one
+	// ITC_ReadWriteFIFO moving up to a block each way, run state checked every few passes and after
+	// any pass that moved nothing.
+	void LoopbackBenchmark::RunBlocking(TrialResult &result)
+	{
+		const int n = config.channels;
+		int64_t total = (int64_t) output[0].size();
+
+		vector<ITCChannelDataEx> available(2 * n);
+		vector<ITCChannelDataEx> transfer(2 * n);
+		ZeroMemory(available.data(), available.size() * sizeof(ITCChannelDataEx));
+		for(int c=0; c < n; c++) {
+			available[c].ChannelType = H2D;
+			available[c].ChannelNumber = c;
+			available[n + c].ChannelType = D2H;
+			available[n + c].ChannelNumber = c;
+		}
+
+		PollWaiter waiter;
+		waiter.SetSampleRate(config.sampleRate);
+
+		ITCStatus status;
+		int64_t nOut = preloaded;
+		int64_t nIn = 0;
+		unsigned int passesSinceStatus = UINT_MAX;
+
+		while(nIn < target) {
+			if(passesSinceStatus >= STATUS_CHECK_INTERVAL) {
+				ZeroMemory(&status, sizeof(status));
+				status.CommandStatus = READ_ERRORS | READ_OVERFLOW | READ_RUNNINGMODE;
+				long err = ITC_GetState(device, &status);
+				if(err != ACQ_SUCCESS) {
+					Fail(result, "ITC_GetState", err);
+					break;
+				}
+
+				if( !(status.RunningMode & RUN_STATE) ||
+					((status.RunningMode & ERROR_STATE) && (status.Overflow & (ITC_WRITE_UNDERRUN_H | ITC_WRITE_UNDERRUN_S))) ||
+					((status.RunningMode & ERROR_STATE) && (status.Overflow & (ITC_READ_OVERFLOW_H | ITC_READ_OVERFLOW_S)))
+					)
+				{
+					char msg[128];
+					sprintf_s(msg, sizeof(msg), "ITC not running. State: 0x%lX, error code: 0x%lX", status.RunningMode, status.Overflow);
+					result.error = msg;
+					break;
+				}
+				passesSinceStatus = 0;
+			}
+			passesSinceStatus++;
+
+			int64_t updateStart = SampleClock::Now();
+			ITC_UpdateNow(device, NULL);
+			int64_t latched = updateStart + (SampleClock::Now() - updateStart) / 2;
+
+			long err = ITC_GetDataAvailable(device, (unsigned long) available.size(), available.data());
+			if(err != ACQ_SUCCESS) {
+				Fail(result, "ITC_GetDataAvailable", err);
+				break;
+			}
+
+			int64_t outBlock = min((int64_t) config.blockSamples, total - nOut);
+			int64_t inBlock = min((int64_t) config.blockSamples, target - nIn);
+			int64_t inFifo = LLONG_MAX;
+			for(int c=0; c < n; c++) {
+				outBlock = min(outBlock, (int64_t) available[c].Value);
+				inFifo = min(inFifo, (int64_t) available[n + c].Value);
+			}
+			inBlock = min(inBlock, inFifo);
+
+			clock->Record(nIn + inFifo, latched);
+
+			int k = 0;
+			for(int c=0; outBlock > 0 && c < n; c++, k++) {
+				transfer[k] = available[c];
+				transfer[k].Value = (unsigned long) outBlock;
+				transfer[k].DataPointer = output[c].data() + nOut;
+			}
+			for(int c=0; inBlock > 0 && c < n; c++, k++) {
+				transfer[k] = available[n + c];
+				transfer[k].Value = (unsigned long) inBlock;
+				transfer[k].DataPointer = input[c].data() + nIn;
+			}
+
+			if(k == 0) {
+				passesSinceStatus = STATUS_CHECK_INTERVAL;
+				waiter.Wait(config.blockSamples);
+				continue;
+			}
+
+			err = ITC_ReadWriteFIFO(device, k, transfer.data());
+			result.fifoCalls++;
+			if(err != ACQ_SUCCESS) {
+				Fail(result, "ITC_ReadWriteFIFO", err);
+				break;
+			}
+
+			nOut += outBlock;
+			if(inBlock > 0) {
+				nIn += inBlock;
+				RecordLatency(nIn);
+			}
+
+			if(inBlock < config.blockSamples && outBlock < config.blockSamples) {
+				waiter.Wait((size_t) (config.blockSamples - max(inBlock, outBlock)));
+			}
+		}
+
+		result.samples = nIn;
+	}
+
+	// The IOBridge streaming thread services the FIFO; this thread only queues output and collects
+	// input, sleeping when neither can progress, as IOBridge::StreamReadWrite does.
+	void LoopbackBenchmark::RunStreaming(TrialResult &result)
+	{
+		const int n = config.channels;
+		int64_t total = (int64_t) output[0].size();
+
+		vector<ITCChannelDataEx> outputs(n), inputs(n);
+		ZeroMemory(outputs.data(), outputs.size() * sizeof(ITCChannelDataEx));
+		ZeroMemory(inputs.data(), inputs.size() * sizeof(ITCChannelDataEx));
+		for(int c=0; c < n; c++) {
+			outputs[c].ChannelType = H2D;
+			outputs[c].ChannelNumber = c;
+			inputs[c].ChannelType = D2H;
+			inputs[c].ChannelNumber = c;
+		}
+		vector<int> units(n, 0);
+		vector<itcsample_t> backgrounds(n, 0);
+
+		CRITICAL_SECTION driverLock;
+		InitializeCriticalSection(&driverLock);
+
+		PollWaiter waiter;
+		waiter.SetSampleRate(config.sampleRate);
+		DriverCounters counters;
+		TransferMonitor monitor;
+		monitor.SetFifoDepth(fifoDepth);
+		FifoWatchdog watchdog;
+
+		void *devices[1] = { device };
+		size_t capacity = max((size_t) fifoDepth, (size_t) PRELOAD_BLOCKS * config.blockSamples);
+
+		{
+			StreamingEngine engine(devices, 1, ItcmmDriver(), &driverLock, &waiter, &counters, clock, &monitor, &watchdog,
+				STATUS_CHECK_INTERVAL,
+				outputs.data(), units.data(), backgrounds.data(), n,
+				inputs.data(), units.data(), n,
+				capacity, config.blockSamples);
+
+			int64_t nOut = preloaded;
+			int64_t nIn = 0;
+
+			engine.Start();
+
+			while(nIn < target) {
+				if(engine.Failed()) {
+					char msg[256];
+					sprintf_s(msg, sizeof(msg), "%s (0x%lX)", engine.ErrorMessage(), engine.ErrorCode());
+					result.error = msg;
+					break;
+				}
+
+				bool progressed = false;
+
+				size_t space = engine.OutputSpace();
+				int64_t outBlock = min((int64_t) space, total - nOut);
+				if(outBlock > 0) {
+					for(int c=0; c < n; c++) {
+						engine.PushOutput(c, output[c].data() + nOut, (size_t) outBlock);
+					}
+					nOut += outBlock;
+					progressed = true;
+				}
+
+				size_t ready = engine.InputAvailable();
+				int64_t inBlock = min((int64_t) ready, target - nIn);
+				if(inBlock > 0) {
+					for(int c=0; c < n; c++) {
+						engine.PopInput(c, input[c].data() + nIn, (size_t) inBlock);
+					}
+					nIn += inBlock;
+					RecordLatency(nIn);
+					progressed = true;
+				}
+
+				if(!progressed) {
+					Sleep(1);
+				}
+			}
+
+			engine.Stop();
+			result.samples = nIn;
+		}
+
+		result.fifoCalls = counters.ReadWriteFifo();
+		DeleteCriticalSection(&driverLock);
+	}
+
+	// Each channel's input lags its output by the hardware pipeline, found as the lag (up to
+	// MAX_PIPELINE_SAMPLES) with the fewest mismatches over the start of the trial.
+	void LoopbackBenchmark::Verify(TrialResult &result)
+	{
+		const int64_t probe = min(result.samples - MAX_PIPELINE_SAMPLES, (int64_t) 1000);
+		if(probe <= 0) {
+			return;
+		}
+
+		for(int c=0; c < config.channels; c++) {
+			int bestLag = 0;
+			int64_t bestMismatches = LLONG_MAX;
+			for(int lag=0; lag <= MAX_PIPELINE_SAMPLES; lag++) {
+				int64_t mismatches = 0;
+				for(int64_t i=0; i < probe; i++) {
+					if(abs(input[c][(size_t) (i + lag)] - output[c][(size_t) i]) > MAX_LOOPBACK_DIFF) {
+						mismatches++;
+					}
+				}
+				if(mismatches < bestMismatches) {
+					bestMismatches = mismatches;
+					bestLag = lag;
+				}
+			}
+
+			for(int64_t i=0; i + bestLag < result.samples; i++) {
+				if(abs(input[c][(size_t) (i + bestLag)] - output[c][(size_t) i]) > MAX_LOOPBACK_DIFF) {
+					result.mismatches++;
+				}
+			}
+		}
+
+		if(result.mismatches > 0 && result.error.empty()) {
+			char msg[64];
+			sprintf_s(msg, sizeof(msg), "%lld loopback samples differ from the output", (long long) result.mismatches);
+			result.error = msg;
+		}
+	}
+
+	void LoopbackBenchmark::Fail(TrialResult &result, const char *call, long err)
+	{
+		char msg[128];
+		sprintf_s(msg, sizeof(msg), "%s error: 0x%lX", call, err);
+		result.error = msg;
+	}
+
+	void LoopbackBenchmark::RecordLatency(int64_t end)
+	{
+		int64_t acquired = clock->HostTicks(end - 1);
+		if(acquired != 0) {
+			latencies.push_back(1e3 * (SampleClock::Now() - acquired) / clock->Frequency());
+		}
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "itcmm.h"
+#include "SampleRing.h"
+
+namespace Heka {
+
+	class SampleClock;
+
+	enum TransferMode
+	{
+		TRANSFER_BLOCKING, // FIFO passes made by the calling thread, as IOBridge::ReadWrite does
+		TRANSFER_STREAMING // FIFO serviced by the IOBridge StreamingEngine thread
+	};
+
+	const char *TransferModeName(TransferMode mode);
+
+	struct TrialConfig
+	{
+		double sampleRate;         // Per channel (Hz)
+		int channels;              // Loopback pairs: analog output n wired to analog input n
+		unsigned int blockSamples; // Samples moved per ITC_ReadWriteFIFO call
+		TransferMode mode;
+		double seconds;            // Acquisition length
+	};
+
+	struct TrialResult
+	{
+		TrialConfig config;
+
+		// True if the trial ran to completion without a driver error, FIFO overflow/underrun or
+		// loopback mismatch
+		bool stable;
+		std::string error;
+
+		int64_t samples;       // Input samples acquired per channel
+		double elapsedSeconds;
+		double throughput;     // Samples per second over all input and output channels
+
+		// Time from the acquisition of the last sample of each input block (from the hardware sample
+		// counter, see SampleClock) until the block reached the host
+		double meanLatencyMs;
+		double p99LatencyMs;
+		double maxLatencyMs;
+
+		double cpuPercent;     // Process CPU time over wall time; 100 is one core
+		int64_t fifoCalls;
+		int64_t mismatches;    // Loopback input samples differing from the output
+	};
+
+	// Loopback trials on an opened, initialized ITC-18/USB-18 whose first analog outputs are wired
+	// to the matching analog inputs. Each trial configures the channels, preloads the output FIFO,
+	// starts the hardware and moves a distinct waveform per channel through it, then checks the
+	// input against the output.
+	class LoopbackBenchmark
+	{
+	public:
+		explicit LoopbackBenchmark(HANDLE device);
+
+		TrialResult Run(const TrialConfig &config);
+
+	private:
+		static const int STATUS_CHECK_INTERVAL = 8;
+		static const int PRELOAD_BLOCKS = 4;
+		static const int MAX_PIPELINE_SAMPLES = 16; // Largest input-to-output lag searched for
+		static const int MAX_LOOPBACK_DIFF = 80;    // 25 mV in ADC counts
+
+		bool Configure(const TrialConfig &config, TrialResult &result);
+		bool Preload(TrialResult &result);
+		void RunBlocking(TrialResult &result);
+		void RunStreaming(TrialResult &result);
+		void Verify(TrialResult &result);
+		void Fail(TrialResult &result, const char *call, long err);
+
+		// Records the latency of an input block ending before sample index end, delivered now
+		void RecordLatency(int64_t end);
+
+		HANDLE device;
+		TrialConfig config;
+
+		std::vector<std::vector<itcsample_t> > output; // Per channel, including a tail of background
+		std::vector<std::vector<itcsample_t> > input;
+		int64_t target;        // Input samples per channel to acquire
+		int64_t preloaded;
+		uint32_t fifoDepth;
+
+		SampleClock *clock;
+		std::vector<double> latencies;
+	};
+}
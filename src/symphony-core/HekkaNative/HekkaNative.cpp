@@ -1,4 +1,8 @@
-// HekkaNative.cpp : Defines the entry point for the console application.
+// HekkaNative.cpp : Loopback benchmark for ITC-18/USB-18 hardware.
+//
+// Sweeps sampling rate, channel count, transfer block size and transfer mode over the first
+// analog outputs wired to the matching analog inputs, writing one CSV row per trial and the
+// highest stable rate of each (mode, channels, block) to a summary CSV. See ReadMe.txt.
 //
 
 #include "stdafx.h"
@@ -6,258 +10,298 @@
 
 #include "itcmm.h"
 #include "0acqerrors.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
-#include <cassert>
+#include <string>
+#include <vector>
 
 //Automatcially link importer's project to ITCMM.lib
-#pragma message("Adding automatic link to ITCMM.lib")  
+#pragma message("Adding automatic link to ITCMM.lib")
 #pragma comment(lib, "ITCMM.lib")
 
-const int ITC18_PIPELINE_SAMPLES = 3;
 using namespace std;
+using namespace Heka;
+
+namespace {
+
+	struct Options
+	{
+		unsigned long deviceType;
+		unsigned long deviceNumber;
+		vector<double> rates;
+		vector<int> channels;
+		vector<unsigned int> blocks;
+		vector<TransferMode> modes;
+		double seconds;
+		bool allRates;
+		wstring output;
+		wstring summary;
+	};
+
+	void Usage()
+	{
+		cout << "Usage: HekkaNative [options]" << endl
+			<< "  --type=itc18|usb18      Device type (default itc18)" << endl
+			<< "  --device=N              Device number (default 0)" << endl
+			<< "  --rates=R,R,...         Per-channel sampling rates, Hz" << endl
+			<< "  --channels=N,N,...      Loopback channel pairs" << endl
+			<< "  --blocks=N,N,...        Transfer block sizes, samples" << endl
+			<< "  --modes=M,M,...         blocking and/or streaming" << endl
+			<< "  --seconds=S             Length of each trial (default 10)" << endl
+			<< "  --all-rates             Keep sweeping rates past the first unstable one" << endl
+			<< "  --output=FILE           Per-trial CSV (default hekka-benchmark.csv)" << endl
+			<< "  --summary=FILE          Max stable rate CSV (default hekka-benchmark-summary.csv)" << endl;
+	}
 
-using namespace System;
-
-int _tmain(int argc, _TCHAR* argv[])
-{
-	HANDLE dev = NULL;
-	unsigned long num;
-	//unsigned long devices[2] = {ITC00_ID, ITC18_ID};
-	unsigned long devices[1] = {ITC18_ID};
-	int ndevices = 1;
-
-	for(int d=0; d < ndevices; d++) {
-		unsigned long deviceID = devices[d];
-		cout << "Device ID: " << devices[d] << endl;
-
-		long err = ITC_Devices(deviceID, &num);
-		if(err != ACQ_SUCCESS)
-		{
-			cout << "ITC_Devices Error: 0x" << hex << err << dec << "(" << err << ")" << endl;
-			cout << endl << "Press any key to terminate this program. " ; cin.ignore();
-			exit(1);
-		}
-		else
-		{
-			cout << num << " devices." << endl;
-		}
-
-
-		num = 1;
-
-		for(unsigned c=0; c<num; c++) 
-		{
-			cout << "Device " << c << "..." << endl;
-
-			err = ITC_OpenDevice(deviceID, c, SMART_MODE, &dev);
-			if(err != ACQ_SUCCESS)
-			{
-				cout << "ITC_OpenDevice Error: 0x" << hex << err << dec << " (" << err << ")" << endl;
-				cout << endl << "Press any key to terminate this program. " ; cin.ignore();
-				exit(1);
-			}
-
-			assert(dev != NULL);
-
-			err = ITC_InitDevice(dev, NULL);
-			if(err != ACQ_SUCCESS)
-			{
-				cout << "ITC_InitDevice Error: 0x" << hex << err << endl;
-				cout << endl << "Press any key to terminate this program. " ; cin.ignore();
-				exit(1);
-			}
-			/*
-			ITCPublicConfig config;
-			ZeroMemory(&config, sizeof(config));
-			config.OutputEnable = 1;
-			err = ITC_ConfigDevice(dev, &config);
-			if(err != ACQ_SUCCESS) {
-			cout << "ITC_ConfigDevice : " << hex << err << endl;
-			}
-			*/
-			err = ITC_ResetChannels(dev);
-			if(err != ACQ_SUCCESS) {
-				cout << "ITC_ResetChannels Error: " << hex << err << endl;
-			}
-
-
-			ITCChannelInfo info[2];
-			ZeroMemory(info, sizeof(info));
-
-			info[0].ChannelNumber = 0;
-			info[0].ChannelType = OUTPUT_GROUP;
-
-			info[1].ChannelNumber = 0;
-			info[1].ChannelType = INPUT_GROUP;
-
-			info[0].HardwareUnderrunValue = 1;
-
-			double srate = 10000.0;
-			info[0].SamplingRate = srate;
-			info[1].SamplingRate = srate;
-
-			err = ITC_SetChannels(dev, 2, info);
-			if(err != ACQ_SUCCESS) {
-				cout << "ITC_SetChannels Error: " << hex << err << endl;
-			}
-
-			err = ITC_UpdateChannels(dev);
-			if(err != ACQ_SUCCESS) {
-				cout << "ITC_UpdateChannels Error: " << hex << err << endl;
-			}
-
-			const int nsamples = 100000;
-			short in[2*nsamples+ITC18_PIPELINE_SAMPLES];
-			short out[nsamples];
-			array<short>^ managedOut = gcnew array<short>(nsamples);
-			array<short>^ managedIn = gcnew array<short>(2*nsamples+ITC18_PIPELINE_SAMPLES);
-
-			ZeroMemory(out, sizeof(out));
-			ZeroMemory(in, sizeof(in));
-			for(int i=0; i< nsamples; i++) {
-				managedOut[i] = (i % 1000 * 100);
-				out[i] = managedOut[i];
-			}
-
-			ITCChannelDataEx channelData[2];
-			ZeroMemory(channelData, sizeof(channelData));
-
-			channelData[0].ChannelNumber = 0;
-			channelData[0].ChannelType = OUTPUT_GROUP; //output
-			channelData[0].Command = 0;//ITC_STOP_ALL_ON_UNDERRUN;
-
-			channelData[1].ChannelNumber = 0;
-			channelData[1].ChannelType = INPUT_GROUP; //input
-			channelData[1].Command = 0;//ITC_STOP_ALL_ON_OVERFLOW;
-
-			int nOut = 0;
-			int nIn = 0;
-			channelData[0].Value = 2048;
-			channelData[0].DataPointer = out;
-			channelData[0].Command = PRELOAD_FIFO_COMMAND_EX;
-
-			channelData[1].DataPointer = in;
-
-			nOut += channelData[0].Value;
-
-			err = ITC_ReadWriteFIFO(dev, 1, &channelData[0]);
-			if(err != ACQ_SUCCESS) {
-				cout << "ITC_ReadWriteFIFO preload error: " << hex << err << endl;
+	vector<wstring> SplitList(const wstring &list)
+	{
+		vector<wstring> items;
+		size_t start = 0;
+		while(start <= list.size()) {
+			size_t end = list.find(L',', start);
+			if(end == wstring::npos) {
+				end = list.size();
 			}
-
-			/*
-			ITCStartInfo sParam;
-			ZeroMemory(&sParam, sizeof(sParam));
-			sParam.OutputEnable = 1;
-			sParam.StopOnOverflow = 1;
-			sParam.StopOnUnderrun = 1;
-
-			err = ITC_Start(dev, &sParam);
-			if(err != ACQ_SUCCESS) {
-			cout << "ITC_Start Error: " << hex << err << endl;
+			if(end > start) {
+				items.push_back(list.substr(start, end - start));
 			}
-			*/
-			ITCStatus status;
-			ZeroMemory(&status, sizeof(status));
-			status.CommandStatus = READ_ERRORS | READ_OVERFLOW | READ_RUNNINGMODE;
-
-			err = ITC_GetState(dev, &status);
-
-			channelData[0].Command = 0;
-
-			err = ITC_Start(dev, NULL);
+			start = end + 1;
+		}
+		return items;
+	}
 
-			while(nIn < nsamples) {
+	bool ParsePositive(const wstring &text, double &value)
+	{
+		wchar_t *end = NULL;
+		value = wcstod(text.c_str(), &end);
+		return end != text.c_str() && *end == L'\0' && value > 0;
+	}
 
-				err = ITC_GetDataAvailable(dev, 2, channelData);
-				if(err != ACQ_SUCCESS) {
-					cout << "ITC_GetDataAvailableError: " << hex << err << endl;
+	bool ParseOptions(int argc, _TCHAR* argv[], Options &options)
+	{
+		options.deviceType = ITC18_ID;
+		options.deviceNumber = 0;
+		options.seconds = 10;
+		options.allRates = false;
+		options.output = L"hekka-benchmark.csv";
+		options.summary = L"hekka-benchmark-summary.csv";
+
+		for(int a=1; a < argc; a++) {
+			wstring arg = argv[a];
+			size_t eq = arg.find(L'=');
+			wstring name = arg.substr(0, eq);
+			wstring value = eq == wstring::npos ? wstring() : arg.substr(eq + 1);
+			vector<wstring> items = SplitList(value);
+			double v;
+
+			if(name == L"--help") {
+				return false;
+			} else if(name == L"--all-rates") {
+				options.allRates = true;
+			} else if(name == L"--type" && (value == L"itc18" || value == L"usb18")) {
+				options.deviceType = value == L"usb18" ? USB18_ID : ITC18_ID;
+			} else if(name == L"--device" && (ParsePositive(value, v) || value == L"0")) {
+				options.deviceNumber = value == L"0" ? 0 : (unsigned long) v;
+			} else if(name == L"--seconds" && ParsePositive(value, v)) {
+				options.seconds = v;
+			} else if(name == L"--output" && !value.empty()) {
+				options.output = value;
+			} else if(name == L"--summary" && !value.empty()) {
+				options.summary = value;
+			} else if(name == L"--rates" || name == L"--channels" || name == L"--blocks") {
+				for(size_t i=0; i < items.size(); i++) {
+					if(!ParsePositive(items[i], v)) {
+						wcout << L"Invalid " << name << L" value: " << items[i] << endl;
+						return false;
+					}
+					if(name == L"--rates") {
+						options.rates.push_back(v);
+					} else if(name == L"--channels") {
+						options.channels.push_back((int) v);
+					} else {
+						options.blocks.push_back((unsigned int) v);
+					}
 				}
-
-				if(channelData[1].Value >= 512)
-				{
-					//Add 512 points read 512 points
-					channelData[0].Value = channelData[1].Value = 512;
+			} else if(name == L"--modes") {
+				for(size_t i=0; i < items.size(); i++) {
+					if(items[i] == L"blocking") {
+						options.modes.push_back(TRANSFER_BLOCKING);
+					} else if(items[i] == L"streaming") {
+						options.modes.push_back(TRANSFER_STREAMING);
+					} else {
+						wcout << L"Invalid transfer mode: " << items[i] << endl;
+						return false;
+					}
 				}
-				else
-					continue;
-
+			} else {
+				wcout << L"Unrecognized option: " << arg << endl;
+				return false;
+			}
+		}
 
-				channelData[0].DataPointer = out + nOut;
+		if(options.rates.empty()) {
+			const double rates[] = { 10000, 20000, 50000, 100000, 200000 };
+			options.rates.assign(rates, rates + sizeof(rates) / sizeof(rates[0]));
+		}
+		if(options.channels.empty()) {
+			const int channels[] = { 1, 2, 4 };
+			options.channels.assign(channels, channels + sizeof(channels) / sizeof(channels[0]));
+		}
+		if(options.blocks.empty()) {
+			const unsigned int blocks[] = { 128, 512, 2048 };
+			options.blocks.assign(blocks, blocks + sizeof(blocks) / sizeof(blocks[0]));
+		}
+		if(options.modes.empty()) {
+			options.modes.push_back(TRANSFER_BLOCKING);
+			options.modes.push_back(TRANSFER_STREAMING);
+		}
 
-				nOut += channelData[0].Value;
-				if(nOut == nsamples) {
-					channelData[0].Command |= LAST_FIFO_COMMAND_EX;
-				}
+		// The rate sweep stops at the first unstable rate, so rates run low to high
+		sort(options.rates.begin(), options.rates.end());
 
-				//cout << "  Sending " << channelData[0].Value << " samples..." << endl;
+		return true;
+	}
 
-				channelData[1].DataPointer = in + nIn;
-				
-				err = ITC_ReadWriteFIFO(dev, 2, channelData);
-				if(err != ACQ_SUCCESS) {
-					cout << "ITC_ReadWriteFIFO : " << hex << err << endl;
-				}
+	string CsvQuoted(const string &text)
+	{
+		string quoted = "\"";
+		for(size_t i=0; i < text.size(); i++) {
+			if(text[i] == '"') {
+				quoted += '"';
+			}
+			quoted += text[i];
+		}
+		return quoted + "\"";
+	}
 
-				for(int i = nIn; i < nIn + channelData[1].Value; i++) {
-					managedIn[i] = in[i];
-				}
-				nIn += channelData[1].Value;
+	void Fatal(const char *call, long err)
+	{
+		cout << call << " Error: 0x" << hex << err << dec << " (" << err << ")" << endl;
+		exit(1);
+	}
+}
 
-				err = ITC_GetState(dev, &status);
-				if(err != ACQ_SUCCESS) {
-					cout << "ITC_GetStatus : " << hex << err << endl;
-				}
-				if(
-					!(status.RunningMode & RUN_STATE) ||
-					((status.RunningMode & ERROR_STATE) && (status.RunningMode & ITC_WRITE_UNDERRUN_H))
-					) 
-				{
-					cout << "ITC not running. State: 0x" << hex << status.RunningMode << ", error code: 0x" << hex << status.Overflow << endl;
-					break;
-				}
+int _tmain(int argc, _TCHAR* argv[])
+{
+	Options options;
+	if(!ParseOptions(argc, argv, options)) {
+		Usage();
+		return 2;
+	}
 
-				ITC_UpdateNow(dev, NULL);
+	unsigned long num = 0;
+	long err = ITC_Devices(options.deviceType, &num);
+	if(err != ACQ_SUCCESS) {
+		Fatal("ITC_Devices", err);
+	}
+	cout << num << " devices." << endl;
+	if(options.deviceNumber >= num) {
+		cout << "No device " << options.deviceNumber << endl;
+		return 1;
+	}
 
+	HANDLE dev = NULL;
+	err = ITC_OpenDevice(options.deviceType, options.deviceNumber, SMART_MODE, &dev);
+	if(err != ACQ_SUCCESS) {
+		Fatal("ITC_OpenDevice", err);
+	}
 
-			}
+	err = ITC_InitDevice(dev, NULL);
+	if(err != ACQ_SUCCESS) {
+		Fatal("ITC_InitDevice", err);
+	}
 
-			err = ITC_Stop(dev, NULL);
-			if(err != ACQ_SUCCESS) {
-				cout << "ITC_Stop : " << hex << err << endl;
-			}
+	VersionInfo driver, kernel, hardware;
+	ZeroMemory(&driver, sizeof(driver));
+	ZeroMemory(&kernel, sizeof(kernel));
+	ZeroMemory(&hardware, sizeof(hardware));
+	ITC_GetVersions(dev, &driver, &kernel, &hardware);
+
+	char driverVersion[32], hardwareVersion[32];
+	sprintf_s(driverVersion, sizeof(driverVersion), "%ld.%ld", driver.Major, driver.Minor);
+	sprintf_s(hardwareVersion, sizeof(hardwareVersion), "%ld.%ld", hardware.Major, hardware.Minor);
+	cout << "Driver " << driverVersion << ", hardware " << hardwareVersion << endl;
+
+	FILE *trials = NULL;
+	FILE *summary = NULL;
+	if(_wfopen_s(&trials, options.output.c_str(), L"w") != 0 || _wfopen_s(&summary, options.summary.c_str(), L"w") != 0) {
+		cout << "Unable to open the output files" << endl;
+		return 1;
+	}
 
-			int failures = 0;
-			int dif;
-			const double MAX_VOLTAGE_DIFF = 0.025;
-			for(int i=0; i<nsamples-ITC18_PIPELINE_SAMPLES; i++) {
-				dif = managedIn[i+ITC18_PIPELINE_SAMPLES] - managedOut[i];
-				
-				if(abs(dif) > MAX_VOLTAGE_DIFF*ANALOGVOLT) {
-					cout << "Sample " << i+3 << " differs from output by " << ((double)dif)/ANALOGVOLT << "V" << endl;
-					failures++;
+	fprintf(trials, "device_type,device_number,driver_version,hardware_version,mode,channels,block_samples,"
+		"sample_rate,seconds,stable,samples,elapsed_s,throughput_sps,latency_mean_ms,latency_p99_ms,"
+		"latency_max_ms,cpu_percent,fifo_calls,mismatches,error\n");
+	fprintf(summary, "device_type,device_number,mode,channels,block_samples,max_stable_rate\n");
+
+	const char *deviceType = options.deviceType == USB18_ID ? "usb18" : "itc18";
+	LoopbackBenchmark benchmark(dev);
+
+	for(size_t m=0; m < options.modes.size(); m++) {
+		for(size_t c=0; c < options.channels.size(); c++) {
+			for(size_t b=0; b < options.blocks.size(); b++) {
+				double maxStableRate = 0;
+
+				for(size_t r=0; r < options.rates.size(); r++) {
+					TrialConfig config;
+					config.sampleRate = options.rates[r];
+					config.channels = options.channels[c];
+					config.blockSamples = options.blocks[b];
+					config.mode = options.modes[m];
+					config.seconds = options.seconds;
+
+					cout << TransferModeName(config.mode) << ", " << config.channels << " ch, "
+						<< config.blockSamples << " samples/block, " << config.sampleRate << " Hz: " << flush;
+
+					TrialResult result = benchmark.Run(config);
+
+					if(result.stable) {
+						maxStableRate = max(maxStableRate, config.sampleRate);
+						cout << "stable, " << result.throughput << " samples/s, latency " << result.meanLatencyMs
+							<< " ms mean/" << result.p99LatencyMs << " ms p99, CPU " << result.cpuPercent << "%" << endl;
+					} else {
+						cout << "UNSTABLE: " << result.error << endl;
+					}
+
+					fprintf(trials, "%s,%lu,%s,%s,%s,%d,%u,%.0f,%.3f,%d,%lld,%.6f,%.1f,%.4f,%.4f,%.4f,%.2f,%lld,%lld,%s\n",
+						deviceType, options.deviceNumber, driverVersion, hardwareVersion,
+						TransferModeName(config.mode), config.channels, config.blockSamples,
+						config.sampleRate, config.seconds, result.stable ? 1 : 0, (long long) result.samples,
+						result.elapsedSeconds, result.throughput, result.meanLatencyMs, result.p99LatencyMs,
+						result.maxLatencyMs, result.cpuPercent, (long long) result.fifoCalls,
+						(long long) result.mismatches, CsvQuoted(result.error).c_str());
+					fflush(trials);
+
+					if(!result.stable) {
+						// Clear any overflow/underrun state before the next trial
+						err = ITC_InitDevice(dev, NULL);
+						if(err != ACQ_SUCCESS) {
+							Fatal("ITC_InitDevice", err);
+						}
+
+						if(!options.allRates) {
+							break;
+						}
+					}
 				}
 
-			}
-
-			if(failures == 0) {
-				cout << "  PASS: Loopback input matches output!" << endl;
-			} else {
-				cout << "  FAIL: " << failures << " samples do not match output!" << endl;
-			}
-
-
-
-			err = ITC_CloseDevice(dev);
-			if(err != ACQ_SUCCESS) {
-				cout << "ITC_CloseDevice : " << hex << err << endl;
+				fprintf(summary, "%s,%lu,%s,%d,%u,%.0f\n", deviceType, options.deviceNumber,
+					TransferModeName(options.modes[m]), options.channels[c], options.blocks[b], maxStableRate);
+				fflush(summary);
 			}
 		}
 	}
 
+	fclose(trials);
+	fclose(summary);
 
-	cout << endl << "Press any key to terminate this program. " ; cin.ignore();
+	err = ITC_CloseDevice(dev);
+	if(err != ACQ_SUCCESS) {
+		cout << "ITC_CloseDevice : " << hex << err << endl;
+	}
 
 	return 0;
-
 }
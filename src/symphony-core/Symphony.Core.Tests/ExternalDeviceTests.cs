@@ -189,4 +189,94 @@ namespace Symphony.Core
         }
     }
 
-}
+    [TestFixture]
+    class CoalescingDeviceTests
+    {
+        private static readonly IMeasurement SRATE = new Measurement(1000, "Hz");
+
+        private class CapturingController : Controller
+        {
+            public readonly List<IInputData> Pushed = new List<IInputData>();
+
+            public override void PushInputData(ExternalDeviceBase device, IInputData inData)
+            {
+                Pushed.Add(inData);
+            }
+        }
+
+        private static IInputData Block(params short[] samples)
+        {
+            return new InputData(new SampleData(samples, 0, "V"), SRATE, DateTimeOffset.Now);
+        }
+
+        private static CoalescingDevice Device(CapturingController controller, out DAQInputStream in0, out DAQInputStream in1)
+        {
+            var device = new CoalescingDevice("amp", null, controller, new Measurement(0, "V"));
+            in0 = new DAQInputStream("in0");
+            in1 = new DAQInputStream("in1");
+            device.BindStream(in0).BindStream(in1);
+            device.Connect(in0, in1);
+
+            return device;
+        }
+
+        [Test]
+        public void ShouldCoalesceOncePerStreamBlocksInOrder()
+        {
+            var controller = new CapturingController();
+            DAQInputStream in0, in1;
+            var device = Device(controller, out in0, out in1);
+            device.Coalesce = data => data[1];
+
+            var a1 = Block(1);
+            var a2 = Block(2);
+            var b1 = Block(3);
+            var b2 = Block(4);
+
+            device.PushInputData(in0, a1);
+            device.PushInputData(in0, a2);
+            Assert.That(controller.Pushed, Is.Empty);
+
+            device.PushInputData(in1, b1);
+            device.PushInputData(in1, b2);
+
+            CollectionAssert.AreEqual(new[] {b1, b2}, controller.Pushed);
+        }
+
+        [Test]
+        public void ShouldCoalesceSampleBuffers()
+        {
+            var controller = new CapturingController();
+            DAQInputStream in0, in1;
+            var device = Device(controller, out in0, out in1);
+            device.Coalesce = data => { throw new InvalidOperationException(); };
+            device.SampleCoalesce = samples => new SampleData(
+                samples[0].Int16Samples.Zip(samples[1].Int16Samples, (a, b) => (short)(a + b)).ToArray(), 0, "V");
+
+            var first = Block(1, 2);
+            device.PushInputData(in0, first);
+            device.PushInputData(in1, Block(10, 20));
+
+            Assert.AreEqual(1, controller.Pushed.Count);
+            Assert.AreEqual(new[] {new Measurement(11, "V"), new Measurement(22, "V")}, controller.Pushed[0].Data);
+            Assert.AreEqual(first.InputTime, controller.Pushed[0].InputTime);
+        }
+
+        [Test]
+        public void ShouldThrowWhenAStreamStalls()
+        {
+            var controller = new CapturingController();
+            DAQInputStream in0, in1;
+            var device = Device(controller, out in0, out in1);
+            device.Coalesce = CoalescingDevice.OneItemCoalesce;
+
+            for (int i = 0; i < CoalescingDevice.QueueCapacity; i++)
+            {
+                device.PushInputData(in0, Block(1));
+            }
+
+            Assert.Throws<ExternalDeviceException>(() => device.PushInputData(in0, Block(1)));
+        }
+    }
+
+}
\ No newline at end of file
@@ -646,6 +646,113 @@ namespace Symphony.Core
             Assert.AreEqual(blk, persistedEpoch.EpochBlock);
         }
 
+        [Test]
+        public void ShouldSerializeEpochAsynchronously()
+        {
+            ExternalDeviceBase dev1;
+            ExternalDeviceBase dev2;
+            var epoch = CreateTestEpoch(out dev1, out dev2);
+
+            var src = persistor.AddSource("label", null);
+            var grp = persistor.BeginEpochGroup("group", src);
+            var blk = persistor.BeginEpochBlock(epoch.ProtocolID, epoch.ProtocolParameters, epoch.StartTime);
+
+            var persistedEpoch = persistor.SerializeAsync(epoch).Result;
+
+            PersistentEpochAssert.AssertEpochsEqual(epoch, persistedEpoch);
+            Assert.AreEqual(blk, persistedEpoch.EpochBlock);
+        }
+
+        [Test]
+        public void ShouldSerializeEpochWithResponsesWrittenAsRecorded()
+        {
+            ExternalDeviceBase dev1;
+            ExternalDeviceBase dev2;
+            var epoch = CreateTestEpoch(out dev1, out dev2);
+
+            var src = persistor.AddSource("label", null);
+            var grp = persistor.BeginEpochGroup("group", src);
+            var blk = persistor.BeginEpochBlock(epoch.ProtocolID, epoch.ProtocolParameters, epoch.StartTime);
+
+            // Replay the recorded responses after Prepare, as the input pipeline would
+            var recorded = epoch.Responses.ToDictionary(kv => kv.Key, kv => kv.Value.DataSegments);
+            foreach (var dev in recorded.Keys)
+            {
+                epoch.Responses[dev] = new Response();
+            }
+
+            persistor.ResponseChunkSamples = 1000;
+            persistor.Prepare(epoch);
+
+            foreach (var kv in recorded)
+            {
+                foreach (var segment in kv.Value)
+                {
+                    epoch.Responses[kv.Key].AppendData(segment);
+                }
+            }
+
+            var persistedEpoch = persistor.Serialize(epoch);
+
+            PersistentEpochAssert.AssertEpochsEqual(epoch, persistedEpoch);
+            Assert.AreEqual(blk, persistedEpoch.EpochBlock);
+        }
+
+        [Test]
+        public void ShouldSerializeResponsesAsSamples()
+        {
+            AssertSamplesRoundTrip(false);
+        }
+
+        [Test]
+        public void ShouldSerializeResponsesWrittenAsRecordedAsSamples()
+        {
+            AssertSamplesRoundTrip(true);
+        }
+
+        private void AssertSamplesRoundTrip(bool prepare)
+        {
+            persistor.Close();
+            System.IO.File.Delete(TEST_FILE);
+            persistor = H5EpochPersistor.Create(TEST_FILE, startTime, 9, ResponseDataLayout.Samples);
+            // Not a divisor of the response lengths, either written as recorded or at Serialize
+            persistor.ResponseChunkSamples = 777;
+
+            ExternalDeviceBase dev1;
+            ExternalDeviceBase dev2;
+            var epoch = CreateTestEpoch(out dev1, out dev2);
+
+            var src = persistor.AddSource("label", null);
+            var grp = persistor.BeginEpochGroup("group", src);
+            var blk = persistor.BeginEpochBlock(epoch.ProtocolID, epoch.ProtocolParameters, epoch.StartTime);
+
+            // int16 samples in mV, as delivered from the DAQ, for one device and doubles for the other
+            var counts = Enumerable.Range(0, 10000).Select(i => (short) (i % 2000 - 1000)).ToArray();
+            var volts = counts.Select(c => c / 8.0).ToArray();
+            var recorded = epoch.Responses.ToDictionary(kv => kv.Key, kv => kv.Value.DataSegments);
+            epoch.Responses[dev1] = new Response();
+            epoch.Responses[dev2] = new Response();
+
+            if (prepare)
+            {
+                persistor.Prepare(epoch);
+            }
+
+            foreach (var segment in recorded[dev1])
+            {
+                epoch.Responses[dev1].AppendData(new InputData(segment, new SampleData(counts, -3, "V")));
+            }
+            foreach (var segment in recorded[dev2])
+            {
+                epoch.Responses[dev2].AppendData(new InputData(segment, new SampleData(volts, 0, "V")));
+            }
+
+            var persistedEpoch = persistor.Serialize(epoch);
+
+            Assert.AreEqual(ResponseDataLayout.Samples, persistor.ResponseLayout);
+            PersistentEpochAssert.AssertEpochsEqual(epoch, persistedEpoch);
+        }
+
         [Test]
         public void ShouldNotAllowSerializingEpochToBlockWithDifferentProtocolId()
         {
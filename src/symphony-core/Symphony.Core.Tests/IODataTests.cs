@@ -510,6 +510,22 @@ namespace Symphony.Core
 
         }
 
+        [Test]
+        public void OutputDataForRangeSlicesSampleData()
+        {
+            var samples = Enumerable.Range(0, 1000).Select(i => (short)i).ToArray();
+            var srate = new Measurement(1000, "Hz");
+
+            var outData = new OutputData(new SampleData(samples, 0, "V"), srate, false);
+
+            var result = outData.OutputDataForRange(100, 250);
+
+            Assert.That(result.Data, Is.InstanceOf<SampleData>());
+            Assert.AreEqual(outData.Data.Skip(100).Take(250).ToList(), result.Data);
+            Assert.AreEqual(srate, result.SampleRate);
+            Assert.IsFalse(result.IsLast);
+        }
+
         [Test]
         public void InputDataSplitsDataAtDuration(
             [Values(0.01, 0.5, 0.751)] double splitDuration
@@ -0,0 +1,122 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading;
+
+namespace Symphony.Core
+{
+    using NUnit.Framework;
+
+    [TestFixture]
+    class InputPipelineTests
+    {
+        private static readonly IMeasurement SRATE = new Measurement(1000, "Hz");
+
+        // Converts for a fixed delay, then delivers in its turn
+        private class DelayingStream : DAQInputStream
+        {
+            private readonly int _delayMs;
+            private readonly ConcurrentQueue<string> _deliveries;
+
+            public DelayingStream(string name, int delayMs, ConcurrentQueue<string> deliveries)
+                : base(name)
+            {
+                _delayMs = delayMs;
+                _deliveries = deliveries;
+            }
+
+            public int MaxConcurrent;
+            public static int Running;
+
+            public override void PushInputData(IInputData inData)
+            {
+                int running = Interlocked.Increment(ref Running);
+                MaxConcurrent = Math.Max(MaxConcurrent, running);
+                Thread.Sleep(_delayMs);
+                Interlocked.Decrement(ref Running);
+
+                using (InputPipeline.BeginDelivery())
+                {
+                    _deliveries.Enqueue(Name + ":" + inData.InputTime.Ticks);
+                }
+            }
+        }
+
+        private class ThrowingStream : DAQInputStream
+        {
+            public ThrowingStream() : base("throwing")
+            {
+            }
+
+            public override void PushInputData(IInputData inData)
+            {
+                throw new DAQException("Failed");
+            }
+        }
+
+        private static IInputData Block(long iteration)
+        {
+            return new InputData(new List<IMeasurement> {new Measurement(0, "V")}, SRATE, new DateTimeOffset(iteration, TimeSpan.Zero));
+        }
+
+        [Test]
+        public void ShouldDeliverInIterationOrder()
+        {
+            var deliveries = new ConcurrentQueue<string>();
+            var slow = new DelayingStream("slow", 20, deliveries);
+            var fast = new DelayingStream("fast", 0, deliveries);
+
+            var pipeline = new InputPipeline();
+            for (long i = 1; i <= 5; i++)
+            {
+                pipeline.Push(new Dictionary<IDAQInputStream, IInputData> {{slow, Block(i)}, {fast, Block(i)}});
+            }
+
+            pipeline.WaitForIdle();
+            pipeline.Close();
+
+            var iterations = deliveries.Select(d => long.Parse(d.Split(':')[1])).ToList();
+            Assert.AreEqual(10, iterations.Count);
+            CollectionAssert.AreEqual(iterations.OrderBy(i => i), iterations);
+            Assert.AreEqual(0, pipeline.Pending);
+        }
+
+        [Test]
+        public void ShouldConvertStreamsInParallel()
+        {
+            var deliveries = new ConcurrentQueue<string>();
+            var streams = Enumerable.Range(0, 3).Select(i => new DelayingStream("s" + i, 50, deliveries)).ToList();
+
+            var pipeline = new InputPipeline();
+            pipeline.Push(streams.ToDictionary(s => (IDAQInputStream)s, s => Block(1)));
+            pipeline.WaitForIdle();
+            pipeline.Close();
+
+            Assert.AreEqual(3, deliveries.Count);
+            Assert.Greater(streams.Max(s => s.MaxConcurrent), 1);
+        }
+
+        [Test]
+        public void ShouldRethrowPushFailures()
+        {
+            var deliveries = new ConcurrentQueue<string>();
+            var ok = new DelayingStream("ok", 0, deliveries);
+
+            var pipeline = new InputPipeline();
+            pipeline.Push(new Dictionary<IDAQInputStream, IInputData> {{new ThrowingStream(), Block(1)}, {ok, Block(1)}});
+
+            Assert.Throws<AggregateException>(pipeline.WaitForIdle);
+            Assert.AreEqual(1, deliveries.Count);
+
+            pipeline.WaitForIdle();
+            pipeline.Close();
+        }
+
+        [Test]
+        public void ShouldNotOrderDeliveriesOutsidePipeline()
+        {
+            Assert.IsNull(InputPipeline.BeginDelivery());
+        }
+    }
+}
@@ -423,5 +423,52 @@ namespace Symphony.Core
                 Assert.IsTrue(ReferenceEquals(expected, actual));
             }
         }
+
+        [Test]
+        public void ShouldPoolInt16CountsDirectly()
+        {
+            var expected = MeasurementPool.GetMeasurement((short)-1234, 0, "counts");
+
+            Assert.AreEqual(-1234m, expected.Quantity);
+            Assert.AreEqual("counts", expected.BaseUnits);
+            Assert.IsTrue(ReferenceEquals(expected, MeasurementPool.GetMeasurement(-1234m, 0, "counts")));
+            Assert.IsTrue(ReferenceEquals(expected, MeasurementPool.Units(0, "counts").Get((short)-1234)));
+            Assert.IsFalse(ReferenceEquals(expected, MeasurementPool.GetMeasurement((short)-1234, -3, "counts")));
+        }
+
+        [Test]
+        public void ShouldFindPoolByIdForEqualUnitStrings()
+        {
+            var pool = MeasurementPool.Units(-3, "V");
+            var copy = new string("V".ToCharArray());
+
+            Assert.AreSame(pool, MeasurementPool.Units(pool.Id));
+            Assert.AreSame(pool, MeasurementPool.Units(-3, copy));
+            Assert.AreNotEqual(pool.Id, MeasurementPool.Units(-6, "V").Id);
+            Assert.IsTrue(ReferenceEquals(pool.Get(2.5m), MeasurementPool.GetMeasurement(2.5m, -3, copy)));
+        }
+
+        [Test]
+        public void ShouldReturnOneMeasurementAcrossThreads()
+        {
+            var results = new IMeasurement[64];
+            System.Threading.Tasks.Parallel.For(0, results.Length,
+                                                i => results[i] = MeasurementPool.GetMeasurement(7.25m, 0, "A"));
+
+            Assert.IsTrue(results.All(m => ReferenceEquals(results[0], m)));
+        }
+
+        [Test]
+        public void ShouldCountHitsAndMisses()
+        {
+            long hits = MeasurementPool.Hits;
+            long misses = MeasurementPool.Misses;
+
+            MeasurementPool.GetMeasurement(12345.678m, 0, "ShouldCountHitsAndMisses");
+            MeasurementPool.GetMeasurement(12345.678m, 0, "ShouldCountHitsAndMisses");
+
+            Assert.AreEqual(misses + 1, MeasurementPool.Misses);
+            Assert.AreEqual(hits + 1, MeasurementPool.Hits);
+        }
     }
 }
@@ -0,0 +1,116 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading;
+
+namespace Symphony.Core
+{
+    using NUnit.Framework;
+
+    [TestFixture]
+    class PersistenceQueueTests
+    {
+        [Test]
+        public void ShouldCommitInQueueOrder()
+        {
+            var committed = new List<int>();
+            using (var queue = new PersistenceQueue(100, 4))
+            {
+                var random = new Random(1);
+                for (int i = 0; i < 100; i++)
+                {
+                    int n = i;
+                    int delay = random.Next(3);
+                    queue.Enqueue(() =>
+                                      {
+                                          Thread.Sleep(delay);
+                                          return n;
+                                      },
+                                  committed.Add);
+                }
+            }
+
+            CollectionAssert.AreEqual(Enumerable.Range(0, 100), committed);
+        }
+
+        [Test]
+        public void ShouldRejectWithoutBlockingWhenFull()
+        {
+            var release = new ManualResetEventSlim(false);
+            using (var queue = new PersistenceQueue(2, 1))
+            {
+                queue.Enqueue<object>(null, o => release.Wait());
+                while (queue.Status.Depth != 0)
+                {
+                    Thread.Sleep(1);
+                }
+
+                Assert.IsTrue(queue.TryEnqueue<object>(null, o => { }));
+                Assert.IsTrue(queue.TryEnqueue<object>(null, o => { }));
+                Assert.IsFalse(queue.TryEnqueue<object>(null, o => { }));
+
+                var status = queue.Status;
+                Assert.AreEqual(2, status.Capacity);
+                Assert.AreEqual(2, status.Depth);
+                Assert.AreEqual(1, status.Rejected);
+
+                release.Set();
+            }
+        }
+
+        [Test]
+        public void ShouldInvokeAfterQueuedItems()
+        {
+            var committed = new List<int>();
+            using (var queue = new PersistenceQueue(10, 2))
+            {
+                queue.Enqueue(() => 1, committed.Add);
+                queue.Enqueue(() => 2, committed.Add);
+
+                Assert.AreEqual(2, queue.Invoke(() => committed.Count));
+
+                var status = queue.Status;
+                Assert.AreEqual(3, status.Committed);
+                Assert.AreEqual(0, status.Rejected);
+            }
+        }
+
+        [Test]
+        public void ShouldInvokeAsyncWithoutWaitingForWriter()
+        {
+            var release = new ManualResetEventSlim(false);
+            using (var queue = new PersistenceQueue(10, 1))
+            {
+                queue.Enqueue<object>(null, o => release.Wait());
+
+                var invoked = queue.InvokeAsync(() => 1);
+                Assert.IsFalse(invoked.IsCompleted);
+
+                release.Set();
+                Assert.IsTrue(invoked.Wait(5000));
+                Assert.AreEqual(1, invoked.Result);
+            }
+        }
+
+        [Test]
+        public void ShouldRethrowInvokeExceptions()
+        {
+            using (var queue = new PersistenceQueue(10, 1))
+            {
+                Assert.Throws<ArgumentException>(() => queue.Invoke<int>(() => { throw new ArgumentException(); }));
+
+                // The writer survives
+                Assert.AreEqual(1, queue.Invoke(() => 1));
+            }
+        }
+
+        [Test]
+        public void ShouldNotQueueOnceDisposed()
+        {
+            var queue = new PersistenceQueue(10, 1);
+            queue.Dispose();
+
+            Assert.IsFalse(queue.TryEnqueue<object>(null, o => { }));
+        }
+    }
+}
@@ -0,0 +1,66 @@
+﻿using System;
+using System.Diagnostics;
+
+namespace Symphony.Core
+{
+    using NUnit.Framework;
+
+    [TestFixture]
+    class ProcessLoopMonitorTests
+    {
+        private static long Ticks(double seconds)
+        {
+            return (long)(seconds * Stopwatch.Frequency);
+        }
+
+        [Test]
+        public void ShouldTrackIterationTimes()
+        {
+            var monitor = new ProcessLoopMonitor();
+            monitor.Reset(TimeSpan.FromMilliseconds(100));
+
+            monitor.BeginIteration(Ticks(1.0));
+            monitor.EndIteration(Ticks(1.010));
+            monitor.BeginIteration(Ticks(1.1));
+            monitor.EndIteration(Ticks(1.130));
+
+            var stats = monitor.Statistics;
+            Assert.AreEqual(2, stats.Iterations);
+            Assert.AreEqual(20, stats.MeanIterationTime.TotalMilliseconds, 0.01);
+            Assert.AreEqual(30, stats.MaxIterationTime.TotalMilliseconds, 0.01);
+        }
+
+        [Test]
+        public void ShouldIgnoreFirstPeriodForJitter()
+        {
+            var monitor = new ProcessLoopMonitor();
+            monitor.Reset(TimeSpan.FromMilliseconds(100));
+
+            // The first iteration waited for a trigger
+            monitor.BeginIteration(Ticks(1.0));
+            monitor.BeginIteration(Ticks(5.0));
+            Assert.AreEqual(TimeSpan.Zero, monitor.Statistics.MaxPeriodJitter);
+
+            monitor.BeginIteration(Ticks(5.104));
+            monitor.BeginIteration(Ticks(5.201));
+            Assert.AreEqual(4, monitor.Statistics.MaxPeriodJitter.TotalMilliseconds, 0.01);
+        }
+
+        [Test]
+        public void ShouldTrackDeficit()
+        {
+            var monitor = new ProcessLoopMonitor();
+            monitor.Reset(TimeSpan.FromMilliseconds(100));
+
+            monitor.RecordDeficit(TimeSpan.FromMilliseconds(7));
+            monitor.RecordDeficit(TimeSpan.FromMilliseconds(2));
+
+            var stats = monitor.Statistics;
+            Assert.AreEqual(7, stats.MaxDeficit.TotalMilliseconds, 0.01);
+            Assert.AreEqual(2, stats.LastDeficit.TotalMilliseconds, 0.01);
+
+            monitor.Reset(TimeSpan.FromMilliseconds(100));
+            Assert.AreEqual(TimeSpan.Zero, monitor.Statistics.MaxDeficit);
+        }
+    }
+}
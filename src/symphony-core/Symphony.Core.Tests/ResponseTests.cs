@@ -47,6 +47,25 @@ namespace Symphony.Core
                 .DataWithStreamConfiguration(stream, config);
         }
 
+        [Test]
+        public void ShouldRaiseDataAppendedOncePerSegment()
+        {
+            Response r = new Response();
+
+            IInputData d1;
+            IInputData d2;
+            OrderedFakeInputData(out d1, out d2);
+
+            var appended = new List<IInputData>();
+            r.DataAppended += (sender, args) => appended.Add(args.Data);
+
+            r.AppendData(d1);
+            r.AppendData(d2);
+            r.AppendData(d1);
+
+            CollectionAssert.AreEqual(new[] {d1, d2}, appended);
+        }
+
         [Test]
         public void OrdersInput()
         {
@@ -123,5 +142,56 @@ namespace Symphony.Core
             TimeSpan expected = new TimeSpan(0, 0, 0, 0, 200);
             Assert.AreEqual(new TimeSpan(r.DataSegments.Select(d => d.Duration.Ticks).Sum()), r.Duration);
         }
+
+        private static IInputData Segment(int first, int count, DateTimeOffset start)
+        {
+            var srate = new Measurement(1000, "Hz");
+            var data = Enumerable.Range(first, count).Select(v => new Measurement(v, "V") as IMeasurement).ToList();
+            return new InputData(data, srate, start.AddSeconds(first / 1000.0));
+        }
+
+        [Test]
+        public void ShouldIndexDataAcrossSegments()
+        {
+            Response r = new Response();
+            var start = DateTimeOffset.Now;
+
+            r.AppendData(Segment(0, 100, start));
+            r.AppendData(Segment(250, 50, start));
+            r.AppendData(Segment(100, 150, start)); // Out of order
+
+            Assert.AreEqual(300, r.SampleCount);
+
+            var data = (IList<IMeasurement>) r.Data;
+            Assert.AreEqual(300, data.Count);
+            foreach (var i in new[] {0, 99, 100, 249, 250, 299})
+            {
+                Assert.AreEqual(new Measurement(i, "V"), data[i]);
+            }
+
+            CollectionAssert.AreEqual(Enumerable.Range(0, 300).Select(v => new Measurement(v, "V")), data);
+        }
+
+        [Test]
+        public void ShouldReadDataRanges()
+        {
+            Response r = new Response();
+            var start = DateTimeOffset.Now;
+
+            r.AppendData(Segment(0, 100, start));
+            r.AppendData(Segment(100, 100, start));
+
+            CollectionAssert.AreEqual(Enumerable.Range(90, 20).Select(v => new Measurement(v, "V")),
+                                      r.ReadData(90, 20));
+            Assert.AreEqual(10, r.ReadData(190, 50).Count);
+            Assert.That(r.ReadData(300, 10), Is.Empty);
+
+            Assert.AreEqual(150, r.SampleIndexAt(start.AddMilliseconds(150)));
+            Assert.AreEqual(0, r.SampleIndexAt(start.AddSeconds(-1)));
+            Assert.AreEqual(200, r.SampleIndexAt(start.AddSeconds(1)));
+
+            CollectionAssert.AreEqual(Enumerable.Range(50, 100).Select(v => new Measurement(v, "V")),
+                                      r.ReadData(start.AddMilliseconds(50), TimeSpan.FromMilliseconds(100)));
+        }
     }
 }
@@ -0,0 +1,160 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+
+namespace Symphony.Core
+{
+    using NUnit.Framework;
+
+    [TestFixture]
+    class SampleDataTests
+    {
+        private static readonly IMeasurement SRATE = new Measurement(1000, "Hz");
+
+        [Test]
+        public void ShouldCreateMeasurementsOnDemand()
+        {
+            var samples = new SampleData(new short[] { -2, 0, 3 }, -3, "V");
+
+            Assert.AreEqual(3, samples.Count);
+            Assert.AreEqual(new Measurement(-2, -3, "V"), samples[0]);
+            Assert.AreEqual(new IMeasurement[] { new Measurement(-2, -3, "V"), new Measurement(0, -3, "V"), new Measurement(3, -3, "V") },
+                samples.ToList());
+        }
+
+        [Test]
+        public void ShouldBeReadOnly()
+        {
+            var samples = new SampleData(new[] { 1.0, 2.0 }, 0, "V");
+
+            Assert.That(samples.IsReadOnly);
+            Assert.Throws<NotSupportedException>(() => samples.Add(new Measurement(1, "V")));
+            Assert.Throws<NotSupportedException>(() => samples[0] = new Measurement(1, "V"));
+        }
+
+        [Test]
+        public void SliceShouldShareArray()
+        {
+            var array = Enumerable.Range(0, 10).Select(i => (double)i).ToArray();
+            var slice = new SampleData(array, 0, "V").Slice(2, 5).Slice(1, 3);
+
+            var segment = slice.DoubleSamples;
+            Assert.AreSame(array, segment.Array);
+            Assert.AreEqual(3, segment.Offset);
+            Assert.AreEqual(new[] { 3.0, 4.0, 5.0 }, slice.ToDoubleArray());
+        }
+
+        [Test]
+        public void ShouldSplitOutputDataIntoViews()
+        {
+            var array = Enumerable.Range(0, 1000).Select(i => (short)i).ToArray();
+            var data = new OutputData(new SampleData(array, 0, "V"), SRATE, false);
+
+            var split = data.SplitData(TimeSpan.FromMilliseconds(300));
+
+            var head = (SampleData)split.Head.Data;
+            var rest = (SampleData)split.Rest.Data;
+            Assert.AreSame(array, head.Int16Samples.Array);
+            Assert.AreSame(array, rest.Int16Samples.Array);
+            Assert.AreEqual(300, head.Count);
+            Assert.AreEqual(700, rest.Count);
+            Assert.AreEqual(new Measurement(300, "V"), rest[0]);
+        }
+
+        [Test]
+        public void ShouldSplitInputDataIntoViews()
+        {
+            var data = new InputData(new SampleData(new double[100], 0, "V"), SRATE, DateTimeOffset.Now);
+
+            var split = data.SplitData(TimeSpan.FromMilliseconds(40));
+
+            Assert.That(split.Head.Data, Is.InstanceOf<SampleData>());
+            Assert.AreEqual(40, split.Head.Data.Count);
+            Assert.AreEqual(60, split.Rest.Data.Count);
+        }
+
+        [Test]
+        public void ShouldClampSplitOfSampleData()
+        {
+            var data = new OutputData(new SampleData(new short[10], 0, "V"), SRATE, false);
+
+            var negative = data.SplitData(TimeSpan.FromMilliseconds(-5));
+            Assert.AreEqual(0, negative.Head.Data.Count);
+            Assert.AreEqual(10, negative.Rest.Data.Count);
+
+            var beyond = new InputData(new SampleData(new short[10], 0, "V"), SRATE, DateTimeOffset.Now)
+                .SplitData(TimeSpan.FromMilliseconds(50));
+            Assert.AreEqual(10, beyond.Head.Data.Count);
+            Assert.AreEqual(0, beyond.Rest.Data.Count);
+        }
+
+        [Test]
+        public void ShouldConcatCompatibleSamplesInBulk()
+        {
+            var d1 = new OutputData(new SampleData(new[] { 1.0, 2.0 }, 0, "V"), SRATE, false);
+            var d2 = new OutputData(new SampleData(new[] { 3.0 }, 0, "V"), SRATE, true);
+
+            var result = d1.Concat(d2);
+
+            Assert.That(result.Data, Is.InstanceOf<SampleData>());
+            Assert.AreEqual(new[] { 1.0, 2.0, 3.0 }, ((SampleData)result.Data).ToDoubleArray());
+            Assert.That(result.IsLast);
+        }
+
+        [Test]
+        public void ShouldConcatIncompatibleSamplesAsMeasurements()
+        {
+            var d1 = new OutputData(new SampleData(new short[] { 1 }, 0, "V"), SRATE, false);
+            var d2 = new OutputData(new SampleData(new[] { 2.0 }, -3, "V"), SRATE, false);
+
+            var result = d1.Concat(d2);
+
+            Assert.AreEqual(new[] { new Measurement(1, "V"), new Measurement(2, -3, "V") }, result.Data);
+        }
+
+        [Test]
+        public void ShouldHandleExponentInBulk()
+        {
+            var data = new InputData(new SampleData(new short[] { 1, 2, 3 }, 0, "V"), SRATE, DateTimeOffset.Now);
+
+            var result = data.DataWithUnits("mV");
+
+            var samples = (SampleData)result.Data;
+            Assert.AreEqual(-3, samples.Exponent);
+            Assert.AreEqual(new[] { 1000.0, 2000.0, 3000.0 }, samples.ToDoubleArray());
+        }
+
+        [Test]
+        public void ShouldUseBulkConverter()
+        {
+            Converters.Clear();
+            Converters.Register("V", "foo", m => new Measurement(m.QuantityInBaseUnits * 2, 0, "foo"));
+            Converters.RegisterBulk("V", "foo", s => s.Scale(2, 0, 0, "foo"));
+
+            var data = new OutputData(new SampleData(new[] { 1.0, 2.0 }, 0, "V"), SRATE, false);
+
+            var result = data.DataWithUnits("foo");
+
+            Assert.That(result.Data, Is.InstanceOf<SampleData>());
+            Assert.AreEqual(new[] { new Measurement(2, 0, "foo"), new Measurement(4, 0, "foo") }, result.Data);
+        }
+
+        [Test]
+        public void ShouldFallBackToConvertProcWithoutBulkConverter()
+        {
+            Converters.Clear();
+            Converters.Register("V", "foo", m => new Measurement(m.QuantityInBaseUnits * 2, 0, "foo"));
+            Converters.RegisterBulk("V", "foo", s => s.Scale(3, 0, 0, "foo"));
+
+            // Re-registering the ConvertProc discards the (now stale) bulk converter
+            Converters.Register("V", "foo", m => new Measurement(m.QuantityInBaseUnits * 2, 0, "foo"));
+
+            var data = new InputData(new SampleData(new[] { 1.0, 2.0 }, 0, "V"), SRATE, DateTimeOffset.Now);
+
+            var result = data.DataWithUnits("foo");
+
+            Assert.IsFalse(result.Data is SampleData);
+            Assert.AreEqual(new[] { new Measurement(2, 0, "foo"), new Measurement(4, 0, "foo") }, result.Data);
+        }
+    }
+}
@@ -0,0 +1,236 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+
+namespace Symphony.Core
+{
+    using NUnit.Framework;
+
+    [TestFixture]
+    class StimulusCacheTests
+    {
+        private static readonly IMeasurement SRATE = new Measurement(1000, "Hz");
+        private static readonly TimeSpan BlockDuration = TimeSpan.FromMilliseconds(100);
+        private const int SAMPLES = 250;
+
+        private int _rendered;
+        private Dictionary<IDictionary<string, object>, int> _produced; // By stimulus Parameters
+
+        [SetUp]
+        public void SetUp()
+        {
+            _rendered = 0;
+            _produced = new Dictionary<IDictionary<string, object>, int>();
+        }
+
+        // Ramp of samples samples in volts, counting the blocks rendered. Every ramp shares one
+        // renderer, as the cache keys a DelegatedStimulus on it.
+        private IStimulus Ramp(double slope, int samples = SAMPLES)
+        {
+            var parameters = new Dictionary<string, object> {{"slope", slope}, {"samples", samples}, {"points", new[] {1, 2, 3}}};
+
+            return new DelegatedStimulus("test.Ramp", "V", SRATE, parameters, RenderRamp,
+                                         p => Option<TimeSpan>.Some(TimeSpan.FromSeconds(samples / 1000.0)));
+        }
+
+        private IOutputData RenderRamp(IDictionary<string, object> parameters, TimeSpan blockDuration)
+        {
+            int samples = (int)parameters["samples"];
+            int produced;
+            _produced.TryGetValue(parameters, out produced);
+            if (produced >= samples)
+                return null;
+
+            int n = Math.Min((int)Math.Ceiling(blockDuration.TotalSeconds * 1000), samples - produced);
+            var block = Enumerable.Range(produced, n).Select(i => i * (double)parameters["slope"]).ToArray();
+            _produced[parameters] = produced + n;
+            _rendered++;
+
+            return new OutputData(new SampleData(block, 0, "V"), SRATE, produced + n >= samples);
+        }
+
+        private static IList<IOutputData> Stream(IStimulus stimulus, StimulusCache cache)
+        {
+            var stream = new StimulusOutputDataStream(stimulus, BlockDuration, cache);
+
+            var blocks = new List<IOutputData>();
+            while (!stream.IsAtEnd)
+            {
+                blocks.Add(stream.PullOutputData(BlockDuration));
+            }
+
+            return blocks;
+        }
+
+        [Test]
+        public void ShouldGenerateRepeatedStimulusOnce()
+        {
+            var cache = new StimulusCache();
+
+            var first = Stream(Ramp(0.5), cache);
+            int rendered = _rendered;
+            var second = Stream(Ramp(0.5), cache);
+
+            Assert.AreEqual(rendered, _rendered);
+            Assert.AreEqual(1, cache.Hits);
+            Assert.AreEqual(1, cache.Misses);
+            Assert.AreEqual(1, cache.Count);
+
+            Assert.AreEqual(first.Count, second.Count);
+            CollectionAssert.AreEqual(first.SelectMany(b => b.Data), second.SelectMany(b => b.Data));
+            CollectionAssert.AreEqual(first.Select(b => b.IsLast), second.Select(b => b.IsLast));
+            Assert.IsTrue(second.Take(second.Count - 1).All(b => b.Duration == BlockDuration));
+        }
+
+        [Test]
+        public void ShouldCacheStimulusOfWholeBlocks()
+        {
+            var cache = new StimulusCache();
+
+            var first = Stream(Ramp(0.5, 300), cache);
+            int rendered = _rendered;
+            var second = Stream(Ramp(0.5, 300), cache);
+
+            Assert.AreEqual(3, first.Count);
+            Assert.AreEqual(rendered, _rendered);
+            Assert.AreEqual(1, cache.Hits);
+            Assert.AreEqual(1, cache.Count);
+            CollectionAssert.AreEqual(first.SelectMany(b => b.Data), second.SelectMany(b => b.Data));
+            Assert.IsTrue(second.Last().IsLast);
+        }
+
+        [Test]
+        public void ShouldGenerateStimulusWithOtherParameters()
+        {
+            var cache = new StimulusCache();
+
+            Stream(Ramp(0.5), cache);
+            int rendered = _rendered;
+            var other = Stream(Ramp(2), cache);
+
+            Assert.AreEqual(2 * rendered, _rendered);
+            Assert.AreEqual(2, cache.Misses);
+            Assert.AreEqual(new Measurement(2, "V"), other[0].Data[1]);
+        }
+
+        [Test]
+        public void ShouldMemoizeConversionsOfCachedStimulus()
+        {
+            var cache = new StimulusCache();
+            Stream(Ramp(0.5), cache);
+
+            var blocks = Stream(Ramp(0.5), cache);
+            var mv1 = (SampleData)blocks[0].DataWithUnits("mV").Data;
+            var mv2 = (SampleData)blocks[1].DataWithUnits("mV").Data;
+
+            Assert.AreSame(mv1.DoubleSamples.Array, mv2.DoubleSamples.Array);
+            Assert.AreEqual(new Measurement(50000, -3, "V"), mv2[0]);
+            Assert.Greater(cache.Bytes, (long)SAMPLES * sizeof(double));
+        }
+
+        [Test]
+        public void ShouldNotCacheUnreproducibleStimuli()
+        {
+            var parameters = new Dictionary<string, object> {{"generator", new object()}};
+            var stimulus = new DelegatedStimulus("test.Other", "V", SRATE, parameters,
+                                                 (p, b) => null,
+                                                 p => Option<TimeSpan>.Some(TimeSpan.FromSeconds(1)));
+            var indefinite = new DelegatedStimulus("test.Other", "V", SRATE, new Dictionary<string, object>(),
+                                                   (p, b) => null,
+                                                   p => Option<TimeSpan>.None());
+
+            Assert.IsNull(StimulusCache.KeyFor(stimulus));
+            Assert.IsNull(StimulusCache.KeyFor(indefinite));
+            Assert.IsNotNull(StimulusCache.KeyFor(Ramp(1)));
+        }
+
+        [Test]
+        public void ShouldKeyDelegatedStimulusOnItsRenderer()
+        {
+            var cache = new StimulusCache();
+            var parameters = new Dictionary<string, object> {{"amplitude", 1.0}};
+            DelegatedStimulus.DurationCalculator duration = p => Option<TimeSpan>.Some(TimeSpan.FromMilliseconds(100));
+
+            var ones = new DelegatedStimulus("test.Same", "V", SRATE, parameters, Constant(1), duration);
+            var twos = new DelegatedStimulus("test.Same", "V", SRATE, parameters, Constant(2), duration);
+
+            Assert.AreNotEqual(StimulusCache.KeyFor(ones), StimulusCache.KeyFor(twos));
+
+            Stream(ones, cache);
+            var blocks = Stream(twos, cache);
+
+            Assert.AreEqual(0, cache.Hits);
+            Assert.IsTrue(blocks.SelectMany(b => b.Data).All(m => m.Equals(new Measurement(2, "V"))));
+        }
+
+        // Renderer of a single 100 ms block of value
+        private static DelegatedStimulus.BlockRenderer Constant(double value)
+        {
+            bool rendered = false;
+            return (p, b) =>
+                {
+                    if (rendered)
+                        return null;
+
+                    rendered = true;
+                    return new OutputData(new SampleData(Enumerable.Repeat(value, 100).ToArray(), 0, "V"), SRATE, true);
+                };
+        }
+
+        [Test]
+        public void ShouldNotCacheCombinedStimulus()
+        {
+            var cache = new StimulusCache();
+            var parameters = new Dictionary<string, object>();
+
+            var sum = new CombinedStimulus("test.Combined", parameters, new[] {Ramp(1), Ramp(0.5)}, CombinedStimulus.Add);
+            var difference = new CombinedStimulus("test.Combined", parameters, new[] {Ramp(1), Ramp(0.5)}, CombinedStimulus.Subtract);
+
+            Assert.IsNull(StimulusCache.KeyFor(sum));
+
+            var added = Stream(sum, cache);
+            var subtracted = Stream(difference, cache);
+
+            Assert.AreEqual(0, cache.Count);
+            Assert.AreEqual(new Measurement(1.5, "V"), added[0].Data[1]);
+            Assert.AreEqual(new Measurement(0.5, "V"), subtracted[0].Data[1]);
+        }
+
+        [Test]
+        public void ShouldNotCacheRenderedStimulus()
+        {
+            var cache = new StimulusCache();
+            var parameters = new Dictionary<string, object> {{"amplitude", 1.0}};
+
+            var ones = new RenderedStimulus("test.Rendered", parameters,
+                                            new OutputData(new SampleData(Enumerable.Repeat(1.0, SAMPLES).ToArray(), 0, "V"), SRATE, true));
+            var twos = new RenderedStimulus("test.Rendered", parameters,
+                                            new OutputData(new SampleData(Enumerable.Repeat(2.0, SAMPLES).ToArray(), 0, "V"), SRATE, true));
+
+            Assert.IsNull(StimulusCache.KeyFor(ones));
+
+            Stream(ones, cache);
+            var blocks = Stream(twos, cache);
+
+            Assert.AreEqual(0, cache.Count);
+            Assert.IsTrue(blocks.SelectMany(b => b.Data).All(m => m.Equals(new Measurement(2, "V"))));
+        }
+
+        [Test]
+        public void ShouldDropLeastRecentlyUsed()
+        {
+            var cache = new StimulusCache(2 * SAMPLES * sizeof(double));
+
+            Stream(Ramp(1), cache);
+            Stream(Ramp(2), cache);
+            Stream(Ramp(1), cache);
+            Stream(Ramp(3), cache);
+
+            Assert.AreEqual(2, cache.Count);
+            Assert.AreEqual(1, cache.Hits);
+
+            Stream(Ramp(1), cache);
+            Assert.AreEqual(2, cache.Hits);
+        }
+    }
+}
@@ -3,6 +3,7 @@ using System.Collections;
 using System.Collections.Generic;
 using System.Linq;
 using System.Threading;
+using System.Threading.Tasks;
 
 namespace Symphony.Core
 {
@@ -15,12 +16,30 @@ namespace Symphony.Core
             PersistedEpochs = new LinkedList<Epoch>();
         }
 
+        public void Prepare(Epoch e)
+        {
+        }
+
         public virtual IPersistentEpoch Serialize(Epoch e)
         {
             ((LinkedList<Epoch>)PersistedEpochs).AddLast(e);
             return null;
         }
 
+        public Task<IPersistentEpoch> SerializeAsync(Epoch e)
+        {
+            var done = new TaskCompletionSource<IPersistentEpoch>();
+            try
+            {
+                done.SetResult(Serialize(e));
+            }
+            catch (Exception x)
+            {
+                done.SetException(x);
+            }
+            return done.Task;
+        }
+
         public void Close()
         {
         }
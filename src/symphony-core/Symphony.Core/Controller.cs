@@ -1,6 +1,7 @@
 ﻿using System;
 using System.Collections.Generic;
 using System.Linq;
+using System.Runtime.ExceptionServices;
 using System.Threading.Tasks;
 using System.Threading;
 using System.Collections.Concurrent;
@@ -115,6 +116,12 @@ namespace Symphony.Core
         /// </summary>
         public IDAQController DAQController { get; set; }
 
+        /// <summary>
+        /// Cache through which epoch stimuli are streamed, so a stimulus repeated across epochs is
+        /// generated and converted once. Null (the default) streams every stimulus from its generator.
+        /// </summary>
+        public StimulusCache StimulusCache { get; set; }
+
         /// <summary>
         /// Enumerable collection of available IHardwareControllers in this Controller's
         /// input/ouput piplines. IHardwareControllers may be DAQ Controllers, video output
@@ -389,29 +396,33 @@ namespace Symphony.Core
         /// <param name="inData">Input data instance</param>
         public virtual void PushInputData(ExternalDeviceBase device, IInputData inData)
         {
-            var inStream = InputDataStreams[device];
-
-            var unpushedInData = inData;
-
-            while (unpushedInData.Duration > TimeSpan.Zero)
+            // Input pushed from a DAQ's input pipeline waits here for its turn (see InputPipeline)
+            using (InputPipeline.BeginDelivery())
             {
-                OnWillPushPullData(device, inStream);
+                var inStream = InputDataStreams[device];
 
-                if (inStream.IsAtEnd)
+                var unpushedInData = inData;
+
+                while (unpushedInData.Duration > TimeSpan.Zero)
                 {
-                    var msg = "Input stream exhausted for " + device.Name;
-                    log.Error(msg);
-                    throw new SymphonyControllerException(msg);
-                }
+                    OnWillPushPullData(device, inStream);
 
-                var dur = (bool)inStream.Duration
-                    ? inStream.Duration - inStream.Position
-                    : unpushedInData.Duration;
+                    if (inStream.IsAtEnd)
+                    {
+                        var msg = "Input stream exhausted for " + device.Name;
+                        log.Error(msg);
+                        throw new SymphonyControllerException(msg);
+                    }
+
+                    var dur = (bool)inStream.Duration
+                        ? inStream.Duration - inStream.Position
+                        : unpushedInData.Duration;
 
-                var cons = unpushedInData.SplitData(dur);
+                    var cons = unpushedInData.SplitData(dur);
 
-                inStream.PushInputData(cons.Head);
-                unpushedInData = cons.Rest;
+                    inStream.PushInputData(cons.Head);
+                    unpushedInData = cons.Rest;
+                }
             }
         }
 
@@ -696,7 +707,7 @@ namespace Symphony.Core
 
                             if (shouldBufferEpoch && epochQueue.TryDequeue(out nextEpoch))
                             {
-                                BufferEpoch(nextEpoch);
+                                BufferEpoch(nextEpoch, persistor);
                                 incompleteEpochs.Enqueue(nextEpoch);
                                 didBufferEpoch = true;
                             }
@@ -731,6 +742,8 @@ namespace Symphony.Core
                         if (!incompleteEpochs.TryDequeue(out completedEpoch) || completedEpoch != currentEpoch)
                             throw new SymphonyControllerException("Failed to dequeue completed epoch");
 
+                        // The task completes once the epoch is saved, but the completion scheduler
+                        // does not wait for the persistor to write it
                         var completeTask = Task.Factory.StartNew(() =>
                             {
                                 OnCompletedEpoch(completedEpoch);
@@ -738,12 +751,14 @@ namespace Symphony.Core
                                 if (persistor != null && completedEpoch.ShouldBePersisted)
                                 {
                                     log.DebugFormat("Saving completed Epoch ({0})...", completedEpoch.StartTime);
-                                    SaveEpoch(persistor, completedEpoch);
+                                    return SaveEpoch(persistor, completedEpoch);
                                 }
+
+                                return Task.FromResult(0);
                             },
                                 CancellationToken.None,
                                 TaskCreationOptions.PreferFairness,
-                                CompletedEpochTaskScheduler);
+                                CompletedEpochTaskScheduler).Unwrap();
 
                         CompletedEpochTasks = CompletedEpochTasks.Where(t => !t.IsCompleted).ToList();
                         CompletedEpochTasks.Add(completeTask);
@@ -820,7 +835,7 @@ namespace Symphony.Core
                             }
                         }
 
-                        BufferEpoch(epoch);
+                        BufferEpoch(epoch, persistor);
                         incompleteEpochs.Enqueue(epoch);
 
                         DAQController.Start(epoch.ShouldWaitForTrigger);
@@ -869,8 +884,13 @@ namespace Symphony.Core
         /// </summary>
         private ConcurrentDictionary<IExternalDevice, SequenceInputDataStream> InputDataStreams { get; set; }
 
-        private void BufferEpoch(Epoch epoch)
+        private void BufferEpoch(Epoch epoch, IEpochPersistor persistor)
         {
+            if (persistor != null && epoch.ShouldBePersisted)
+            {
+                persistor.Prepare(epoch);
+            }
+
             foreach (var kv in OutputDataStreams)
             {
                 var device = kv.Key;
@@ -879,7 +899,7 @@ namespace Symphony.Core
                 IOutputDataStream outStream;
                 if (epoch.Stimuli.ContainsKey(device))
                 {
-                    outStream = new StimulusOutputDataStream(epoch.Stimuli[device], DAQController.ProcessInterval);
+                    outStream = new StimulusOutputDataStream(epoch.Stimuli[device], DAQController.ProcessInterval, StimulusCache);
                 }
                 else if (epoch.Backgrounds.ContainsKey(device))
                 {
@@ -924,10 +944,15 @@ namespace Symphony.Core
 
         private static readonly ILog log = LogManager.GetLogger(typeof(Controller));
 
-        private void SaveEpoch(IEpochPersistor persistor, Epoch e)
+        private Task SaveEpoch(IEpochPersistor persistor, Epoch e)
         {
-            persistor.Serialize(e);
-            OnSavedEpoch(e);
+            return persistor.SerializeAsync(e).ContinueWith(t =>
+                {
+                    if (t.IsFaulted)
+                        ExceptionDispatchInfo.Capture(t.Exception.InnerException).Throw();
+
+                    OnSavedEpoch(e);
+                }, CancellationToken.None, TaskContinuationOptions.None, CompletedEpochTaskScheduler);
         }
 
         /// <summary>
@@ -176,12 +176,22 @@ namespace Symphony.Core
         /// </summary>
         public TimeSpan ProcessInterval { get; protected set; }
 
+        private readonly ProcessLoopMonitor _loopMonitor = new ProcessLoopMonitor();
+
+        /// <summary>
+        /// Timing of the process loop since it last started. May be read while running.
+        /// </summary>
+        public ProcessLoopStatistics LoopStatistics
+        {
+            get { return _loopMonitor.Statistics; }
+        }
+
 
         protected DAQControllerBase()
         {
             this.DAQStreams = new HashSet<IDAQStream>();
             this.Configuration = new Dictionary<string, object>();
-            this.InputTasks = new List<Task>();
+            this.InputPipeline = new InputPipeline();
             this.OutputTasks = new List<Task>();
         }
 
@@ -273,7 +283,7 @@ namespace Symphony.Core
                 OnStarted();
 
                 OutputTasks.Clear();
-                InputTasks.Clear();
+                InputPipeline.ClearFaults();
 
                 WillBeginProcessLoop();
                 ProcessLoop(waitForTrigger);
@@ -291,6 +301,7 @@ namespace Symphony.Core
                 }
 
                 DidEndProcessLoop();
+                InputPipeline.Close();
             }
         }
 
@@ -325,6 +336,7 @@ namespace Symphony.Core
             {
                 RequestedStop += stopRequested;
                 GCSettings.LatencyMode = GCLatencyMode.SustainedLowLatency;
+                _loopMonitor.Reset(ProcessInterval);
 
                 while (IsRunning && !ShouldStop())
                 {
@@ -367,7 +379,9 @@ namespace Symphony.Core
                     }
 
                     // Run iteration
+                    _loopMonitor.BeginIteration();
                     var incomingData = ProcessLoopIteration(outgoingData, deficit, cts.Token);
+                    _loopMonitor.EndIteration();
 
                     // Push Output events
                     outputTime = outputTime.HasValue ? outputTime.Value.Add(ProcessInterval) : Clock.Now - ProcessInterval;
@@ -388,6 +402,7 @@ namespace Symphony.Core
 
                     //Wait for rest of the process interval
                     deficit = SleepForRestOfIteration(iterationStart.Value, ProcessInterval);
+                    _loopMonitor.RecordDeficit(deficit);
 
                     iterationStart += ProcessInterval;
                 }
@@ -414,40 +429,20 @@ namespace Symphony.Core
             return DateTimeOffset.Now - (iterationStart + iterationDuration);
         }
 
-        private IList<Task> InputTasks { get; set; }
+        /// <summary>
+        /// Pushes incoming data up the input pipeline off the process loop thread, one worker per stream.
+        /// </summary>
+        private InputPipeline InputPipeline { get; set; }
 
         private void PushIncomingData(IEnumerable<KeyValuePair<IDAQInputStream, IInputData>> incomingData)
         {
-            // Throw if any previous tasks faulted
-            if (InputTasks.Any(t => t.IsFaulted))
-            {
-                throw new AggregateException(InputTasks.Where(t => t.IsFaulted).Select(t => t.Exception));
-            }
-
-            var newTask = InputTasks.Any()
-                              ? Task.Factory.ContinueWhenAll(InputTasks.ToArray(),
-                                                             (tasks) =>
-                                                                 {
-                                                                     foreach (var kvp in incomingData)
-                                                                     {
-                                                                         kvp.Key.PushInputData(kvp.Value);
-                                                                     }
-                                                                 })
-                              : Task.Factory.StartNew(() =>
-                                      {
-                                          foreach (var kvp in incomingData)
-                                          {
-                                              kvp.Key.PushInputData(kvp.Value);
-                                          }
-                                      });
-
-            InputTasks = InputTasks.Where(t => !t.IsCompleted).ToList();
-            InputTasks.Add(newTask);
+            // Throws if pushing an earlier iteration failed
+            InputPipeline.Push(incomingData);
         }
 
         public void WaitForInputTasks()
         {
-            Task.WaitAll(InputTasks.ToArray());
+            InputPipeline.WaitForIdle();
         }
 
         public IInputData ReadStream(IDAQInputStream s)
@@ -452,36 +452,150 @@ namespace Symphony.Core
     }
 
 
+    /// <summary>
+    /// .Net event EventArgs subclass that describes a data segment appended to a Response.
+    /// </summary>
+    public class ResponseDataEventArgs : EventArgs
+    {
+        public ResponseDataEventArgs(IInputData data)
+        {
+            Data = data;
+        }
+
+        public IInputData Data { get; private set; }
+    }
+
     /// <summary>
     /// The Response class represents data recorded from a single ExternalDevice for a single Epoch.
+    ///
+    /// <para>Segments are kept in an input-time ordered index with the sample offset of each, so Data is
+    /// a flat view over all segments and SampleRate, InputTime, Duration and range reads do not
+    /// re-sort or re-enumerate the segments. A Response may be read while the input pipeline appends
+    /// to it.</para>
     /// </summary>
     public class Response
     {
         /// <summary>
-        /// List of IInputData appended to this Response by the Symphony input pipeline. The durations of thse
-        /// segments may not be homogenous.
+        /// Raised on the input pipeline each time a new data segment is appended to this Response.
+        /// </summary>
+        public event EventHandler<ResponseDataEventArgs> DataAppended;
+
+        private readonly object _segmentsLock = new object();
+
+        // Ordered by InputTime; _offsets[i] is the index of segment i's first sample in Data
+        private readonly List<IInputData> _segments = new List<IInputData>();
+        private readonly List<long> _offsets = new List<long>();
+        private long _sampleCount;
+        private long _durationTicks;
+        private IMeasurement _sampleRate;
+        private bool _mixedSampleRates;
+
+        // Read-only copy of _segments, taken on first access after an append
+        private IList<IInputData> _snapshot;
+
+        /// <summary>
+        /// List of IInputData appended to this Response by the Symphony input pipeline, in InputTime order.
+        /// The durations of these segments may not be homogenous.
         /// </summary>
         public IList<IInputData> DataSegments
         {
             get
             {
-                var result = RawData.ToList();
-                
-                result.Sort((IInputData d1, IInputData d2) => d1.InputTime.CompareTo(d2.InputTime));
-
-                return result;
+                lock (_segmentsLock)
+                {
+                    return _snapshot ?? (_snapshot = _segments.ToList().AsReadOnly());
+                }
             }
         }
 
         /// <summary>
-        /// A single enumerable of Measurement that is the concatenation of the DataSegments' data of this Response.
+        /// A single list of Measurement that is the concatenation of the DataSegments' data of this Response.
+        /// The view is fixed at the segments appended when it was taken.
         /// </summary>
         public IEnumerable<IMeasurement> Data
         {
             get
             {
-                return DataSegments.Select(d => d.Data)
-                    .Aggregate<IEnumerable<IMeasurement>, IEnumerable<IMeasurement>>(new List<IMeasurement>(), (curr, next) => curr.Concat(next));
+                lock (_segmentsLock)
+                {
+                    return new SegmentedData(DataSegments, _offsets.ToArray(), _sampleCount);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Number of samples in Data.
+        /// </summary>
+        public long SampleCount
+        {
+            get { lock (_segmentsLock) return _sampleCount; }
+        }
+
+        /// <summary>
+        /// Reads count samples of Data starting at sample index start; fewer if Data ends first.
+        /// </summary>
+        public IList<IMeasurement> ReadData(long start, long count)
+        {
+            if (start < 0)
+                throw new ArgumentOutOfRangeException("start");
+            if (count < 0)
+                throw new ArgumentOutOfRangeException("count");
+
+            var data = (SegmentedData)Data;
+            long end = Math.Min(start + count, data.Count);
+
+            var result = new List<IMeasurement>((int)Math.Max(end - start, 0));
+            for (int s = data.SegmentOf(start); s < data.Segments.Count && data.Offsets[s] < end; s++)
+            {
+                var segment = data.Segments[s].Data;
+                int first = (int)Math.Max(start - data.Offsets[s], 0);
+                int last = (int)Math.Min(end - data.Offsets[s], segment.Count);
+                for (int i = first; i < last; i++)
+                {
+                    result.Add(segment[i]);
+                }
+            }
+
+            return result;
+        }
+
+        /// <summary>
+        /// Reads the samples of Data acquired from time start for the given duration.
+        /// </summary>
+        public IList<IMeasurement> ReadData(DateTimeOffset start, TimeSpan duration)
+        {
+            long first = SampleIndexAt(start);
+            return ReadData(first, SampleIndexAt(start + duration) - first);
+        }
+
+        /// <summary>
+        /// Index in Data of the first sample acquired at or after the given time, or SampleCount if
+        /// there is none.
+        /// </summary>
+        public long SampleIndexAt(DateTimeOffset time)
+        {
+            lock (_segmentsLock)
+            {
+                // Last segment starting at or before time
+                int lo = 0;
+                int hi = _segments.Count;
+                while (lo < hi)
+                {
+                    int mid = (lo + hi) / 2;
+                    if (_segments[mid].InputTime <= time)
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+
+                if (lo == 0)
+                    return 0;
+
+                var segment = _segments[lo - 1];
+                double rate = (double)segment.SampleRate.QuantityInBaseUnits;
+                long within = (long)Math.Ceiling((time - segment.InputTime).Ticks * rate / TimeSpan.TicksPerSecond);
+
+                return _offsets[lo - 1] + Math.Min(within, segment.Data.Count);
             }
         }
 
@@ -497,18 +611,19 @@ namespace Symphony.Core
         {
             get //TODO test (Response)
             {
-                var sampleRates = DataSegments.Select(s => s.SampleRate).Distinct();
-
-                if (sampleRates.Count() > 1)
-                    throw new ResponseException("Response data segments have multiple sample rates");
+                lock (_segmentsLock)
+                {
+                    if (_mixedSampleRates)
+                        throw new ResponseException("Response data segments have multiple sample rates");
 
-                return sampleRates.FirstOrDefault();
+                    return _sampleRate;
+                }
             }
         }
 
         public DateTimeOffset InputTime
         {
-            get { return DataSegments.Select(s => s.InputTime).FirstOrDefault(); } //TODO test (Resposne)
+            get { lock (_segmentsLock) return _segments.Count > 0 ? _segments[0].InputTime : default(DateTimeOffset); } //TODO test (Resposne)
         }
 
         ISet<IInputData> RawData { get; set; }
@@ -527,7 +642,47 @@ namespace Symphony.Core
         /// <param name="data">Data to append</param>
         virtual public void AppendData(IInputData data)
         {
-            RawData.Add(data);
+            lock (_segmentsLock)
+            {
+                if (!RawData.Add(data))
+                    return;
+
+                Index(data);
+            }
+
+            var handler = DataAppended;
+            if (handler != null)
+            {
+                handler(this, new ResponseDataEventArgs(data));
+            }
+        }
+
+        private void Index(IInputData data)
+        {
+            // Segments normally arrive in order; an earlier one is inserted and the offsets after it moved
+            int i = _segments.Count;
+            while (i > 0 && _segments[i - 1].InputTime > data.InputTime)
+            {
+                i--;
+            }
+
+            long offset = i == _segments.Count ? _sampleCount : _offsets[i];
+            _segments.Insert(i, data);
+            _offsets.Insert(i, offset);
+            for (int k = i + 1; k < _offsets.Count; k++)
+            {
+                _offsets[k] += data.Data.Count;
+            }
+
+            _sampleCount += data.Data.Count;
+            _durationTicks += data.Duration.Ticks;
+
+            if (_segments.Count == 1)
+                _sampleRate = data.SampleRate;
+            else if (!_sampleRate.Equals(data.SampleRate))
+                _mixedSampleRates = true;
+
+            _snapshot = null;
         }
 
         /// <summary>
@@ -535,10 +690,112 @@ namespace Symphony.Core
         /// </summary>
         public TimeSpan Duration
         {
-            get
+            get { lock (_segmentsLock) return new TimeSpan(_durationTicks); }
+        }
+
+        /// <summary>
+        /// Read-only flat list over a fixed set of segments.
+        /// </summary>
+        private sealed class SegmentedData : IList<IMeasurement>
+        {
+            public readonly IList<IInputData> Segments;
+            public readonly long[] Offsets;
+            private readonly int _count;
+
+            public SegmentedData(IList<IInputData> segments, long[] offsets, long count)
             {
-                return new TimeSpan(this.DataSegments.Select(x => x.Duration.Ticks).Sum());
+                Segments = segments;
+                Offsets = offsets;
+                _count = (int)count;
             }
+
+            // Segment holding sample index (the last if index is past the end)
+            public int SegmentOf(long index)
+            {
+                int s = Array.BinarySearch(Offsets, index);
+                if (s < 0)
+                    s = ~s - 1;
+
+                // Skip empty segments sharing the offset
+                while (s + 1 < Offsets.Length && Offsets[s + 1] == Offsets[s] && Offsets[s] <= index)
+                {
+                    s++;
+                }
+
+                return Math.Max(s, 0);
+            }
+
+            public int Count
+            {
+                get { return _count; }
+            }
+
+            public bool IsReadOnly
+            {
+                get { return true; }
+            }
+
+            public IMeasurement this[int index]
+            {
+                get
+                {
+                    if (index < 0 || index >= _count)
+                        throw new ArgumentOutOfRangeException("index");
+
+                    int s = SegmentOf(index);
+                    return Segments[s].Data[(int)(index - Offsets[s])];
+                }
+                set { throw new NotSupportedException(); }
+            }
+
+            public IEnumerator<IMeasurement> GetEnumerator()
+            {
+                foreach (var segment in Segments)
+                {
+                    foreach (var m in segment.Data)
+                    {
+                        yield return m;
+                    }
+                }
+            }
+
+            System.Collections.IEnumerator System.Collections.IEnumerable.GetEnumerator()
+            {
+                return GetEnumerator();
+            }
+
+            public void CopyTo(IMeasurement[] array, int arrayIndex)
+            {
+                foreach (var segment in Segments)
+                {
+                    segment.Data.CopyTo(array, arrayIndex);
+                    arrayIndex += segment.Data.Count;
+                }
+            }
+
+            public int IndexOf(IMeasurement item)
+            {
+                int i = 0;
+                foreach (var m in this)
+                {
+                    if (Equals(m, item))
+                        return i;
+                    i++;
+                }
+
+                return -1;
+            }
+
+            public bool Contains(IMeasurement item)
+            {
+                return IndexOf(item) >= 0;
+            }
+
+            public void Add(IMeasurement item) { throw new NotSupportedException(); }
+            public void Clear() { throw new NotSupportedException(); }
+            public void Insert(int index, IMeasurement item) { throw new NotSupportedException(); }
+            public bool Remove(IMeasurement item) { throw new NotSupportedException(); }
+            public void RemoveAt(int index) { throw new NotSupportedException(); }
         }
     }
 
@@ -600,6 +857,14 @@ namespace Symphony.Core
         private DurationCalculator DurationDelegate { get; set; }
         private BlockRenderer BlockDelegate { get; set; }
 
+        /// <summary>
+        /// Renderer of this stimulus' blocks (see StimulusCache.KeyFor).
+        /// </summary>
+        internal BlockRenderer Renderer
+        {
+            get { return BlockDelegate; }
+        }
+
         public override IEnumerable<IOutputData> DataBlocks(TimeSpan blockDuration)
         {
             IOutputData current = BlockDelegate(Parameters, blockDuration);
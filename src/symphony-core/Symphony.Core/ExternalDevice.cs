@@ -807,18 +807,46 @@ namespace Symphony.Core
     /// The CoalescingDevice is a special kind of ExternalDevice that needs
     /// to coalesce (combine) multiple InputData instances into a single
     /// InputData for processing further up the pipeline.
+    ///
+    /// <para>Input waiting for the other streams is held in a fixed-capacity ring per stream, with a
+    /// count of the streams holding input, so matching a push needs no scan or allocation. The
+    /// list passed to Coalesce (or the SampleData list passed to SampleCoalesce) is reused for
+    /// every match and must not be kept.</para>
     /// </summary>
     public class CoalescingDevice : UnitConvertingExternalDevice
     {
         public delegate IInputData CoalesceProc(IList<IInputData> inputs); //IDictionary<string, IInputData> inputs);
 
+        /// <summary>
+        /// Combines the sample buffers of one input block from each stream into a single buffer.
+        /// </summary>
+        public delegate SampleData SampleCoalesceProc(IList<SampleData> inputs);
+
         /// <summary>
         /// This is a simple CoalescingProc for a CoalescingDevice, for configuration purposes
         /// </summary>
         public static CoalesceProc OneItemCoalesce = data => data[0];
 
-        private IDictionary<IDAQInputStream, IList<IInputData>> queues =
-            new Dictionary<IDAQInputStream, IList<IInputData>>();
+        /// <summary>
+        /// Input blocks held per stream before a stream is considered stalled.
+        /// </summary>
+        public const int QueueCapacity = 64;
+
+        private sealed class InputRing
+        {
+            public readonly IInputData[] Items = new IInputData[QueueCapacity];
+            public int Head;
+            public int Count;
+        }
+
+        private readonly object queuesLock = new object();
+        private Dictionary<IDAQInputStream, int> streamIndices = new Dictionary<IDAQInputStream, int>();
+        private InputRing[] rings = new InputRing[0];
+        private int readyStreams; // Rings holding at least one block
+
+        // Reused for each match
+        private IInputData[] heads = new IInputData[0];
+        private SampleData[] headSamples = new SampleData[0];
 
         public CoalescingDevice(string name, string manufacturer, Measurement background)
             : base(name, manufacturer, background)
@@ -832,6 +860,12 @@ namespace Symphony.Core
 
         public CoalesceProc Coalesce { get; set; }
 
+        /// <summary>
+        /// If set, used instead of Coalesce when every matched block holds SampleData. The coalesced
+        /// block takes its time, sample rate and configuration from the first stream's block.
+        /// </summary>
+        public SampleCoalesceProc SampleCoalesce { get; set; }
+
         /// <summary>
         /// These streams must all produce an IInputData before the
         /// CoalescingDevice will push the resulting IInputData onwards
@@ -839,10 +873,17 @@ namespace Symphony.Core
         /// <param name="streams">The instances that are connected</param>
         public void Connect(params IDAQInputStream[] streams)
         {
-            queues.Clear();
-
-            foreach (var inStream in streams)
-                queues.Add(inStream, new List<IInputData>());
+            lock (queuesLock)
+            {
+                streamIndices = new Dictionary<IDAQInputStream, int>();
+                foreach (var inStream in streams)
+                    streamIndices.Add(inStream, streamIndices.Count);
+
+                rings = streams.Select(st => new InputRing()).ToArray();
+                heads = new IInputData[streams.Length];
+                headSamples = new SampleData[streams.Length];
+                readyStreams = 0;
+            }
         }
 
         /// <summary>
@@ -949,32 +990,51 @@ namespace Symphony.Core
         // needs a shot at processing the InputData on its way back from the board
         public override void PushInputData(IDAQInputStream stream, IInputData inData)
         {
-            // Do these conversions need to be on a per-stream basis?
-            // Or is per-device enough?
+            // Streams may push concurrently (see InputPipeline). The coalesced data is pushed on
+            // outside the lock; the controller receives it in input order regardless.
+            IInputData coalesced;
+            lock (queuesLock)
+            {
+                var ring = rings[streamIndices[stream]];
+                if (ring.Count == ring.Items.Length)
+                    throw new ExternalDeviceException("Input queue for " + stream.Name + " is full; another coalesced stream has stalled");
 
-            // This is the easy part
-            queues[stream].Add(inData);
+                ring.Items[(ring.Head + ring.Count) % ring.Items.Length] = inData;
+                if (ring.Count++ == 0)
+                    readyStreams++;
 
-            // Now figure out if we have all the data we need
-            bool haveOneOfEverything = true;
-            foreach (var dataList in queues.Values)
-            {
-                if (dataList.Count == 0)
+                // Now figure out if we have all the data we need
+                if (readyStreams < rings.Length)
+                    return;
+
+                bool allSamples = SampleCoalesce != null;
+                for (int i = 0; i < rings.Length; i++)
                 {
-                    haveOneOfEverything = false;
+                    var r = rings[i];
+                    heads[i] = r.Items[r.Head];
+                    r.Items[r.Head] = null;
+                    r.Head = (r.Head + 1) % r.Items.Length;
+                    if (--r.Count == 0)
+                        readyStreams--;
+
+                    headSamples[i] = heads[i].Data as SampleData;
+                    allSamples &= headSamples[i] != null;
                 }
-            }
 
-            if (haveOneOfEverything)
-            {
-                IList<IInputData> data = new List<IInputData>();
-                foreach (var dataList in queues.Values)
+                try
                 {
-                    data.Add(dataList[0]); data.RemoveAt(0);
+                    coalesced = allSamples
+                        ? new InputData(heads[0], SampleCoalesce(headSamples))
+                        : Coalesce(heads);
+                }
+                finally
+                {
+                    Array.Clear(heads, 0, heads.Length);
+                    Array.Clear(headSamples, 0, headSamples.Length);
                 }
-
-                Controller.PushInputData(this, Coalesce(data));
             }
+
+            Controller.PushInputData(this, coalesced);
         }
     }
 }
\ No newline at end of file
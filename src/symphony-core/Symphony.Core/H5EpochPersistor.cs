@@ -1,18 +1,38 @@
 ﻿using System;
 using System.CodeDom;
 using System.Collections;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.IO;
 using System.Linq;
 using System.Runtime.InteropServices;
 using System.Security.Cryptography;
+using System.Runtime.ExceptionServices;
 using System.Text;
+using System.Threading.Tasks;
 using HDF5;
 using HDF5DotNet;
 using log4net;
 
 namespace Symphony.Core
 {
+    /// <summary>
+    /// How an H5EpochPersistor stores Response data.
+    /// </summary>
+    public enum ResponseDataLayout
+    {
+        /// <summary>
+        /// A compound (quantity, units) struct per sample. Persistence version 2.
+        /// </summary>
+        Measurements,
+
+        /// <summary>
+        /// A plain int16 (for int16 samples) or float32 dataset, with "scale", "offset" and "units"
+        /// attributes such that each sample is value * scale + offset in units. Persistence version 3.
+        /// </summary>
+        Samples
+    }
+
     /// <summary>
     /// IEpochPersistor implementation for persisting Epochs to an HDF5 data file. HDF5 does not currently
     /// offer atomic operations so, while this implementation does it's best to maintain data integrity it's
@@ -25,9 +45,24 @@ namespace Symphony.Core
         private const string SymphonyVersionKey = "symphonyVersion";
         private const string CompressionKey = "compression";
         private const uint PersistenceVersion = 2;
+        private const uint SamplesPersistenceVersion = 3;
+
+        /// <summary>
+        /// Default number of samples per chunk of a Response dataset written as it is recorded.
+        /// </summary>
+        public const long DefaultResponseChunkSamples = 4096;
+
+        /// <summary>
+        /// Default most Response segments and Epochs waiting to be written at once.
+        /// </summary>
+        public const int DefaultQueueCapacity = 1024;
 
         private readonly H5File _file;
 
+        // Response data and Epochs are written on the queue's writer thread, in the order they arrive
+        private readonly PersistenceQueue _queue;
+        private readonly ConcurrentDictionary<Response, H5ResponseWriter> _responseWriters = new ConcurrentDictionary<Response, H5ResponseWriter>();
+
         private readonly H5PersistentExperiment _experiment;
         private readonly Stack<H5PersistentEpochGroup> _openEpochGroups;
 
@@ -42,15 +77,19 @@ namespace Symphony.Core
         /// <param name="filename">Desired HDF5 path</param>
         /// <param name="startTime">Start time for the root Experiment entity</param>
         /// <param name="compression">Automatically numeric data compression (0 = none, 9 = maximum)</param>
+        /// <param name="layout">How Response data is stored</param>
         /// <returns>The new Epoch Persistor</returns>
-        public static H5EpochPersistor Create(string filename, DateTimeOffset startTime, uint compression = 9)
+        public static H5EpochPersistor Create(string filename, DateTimeOffset startTime, uint compression = 9,
+            ResponseDataLayout layout = ResponseDataLayout.Measurements)
         {
             if (File.Exists(filename))
                 throw new IOException("File already exists");
 
             using (var file = new H5File(filename))
             {
-                file.Attributes[VersionKey] = PersistenceVersion;
+                file.Attributes[VersionKey] = layout == ResponseDataLayout.Samples
+                    ? SamplesPersistenceVersion
+                    : PersistenceVersion;
                 file.Attributes[SymphonyVersionKey] = SymphonyFramework.VersionString;
                 file.Attributes[CompressionKey] = compression;
 
@@ -66,6 +105,17 @@ namespace Symphony.Core
         /// </summary>
         /// <param name="filename">Existing HDF5 file path</param>
         public H5EpochPersistor(string filename)
+            : this(filename, DefaultQueueCapacity, Math.Max(1, Environment.ProcessorCount / 2))
+        {
+        }
+
+        /// <summary>
+        /// Constructs a new H5EpochPersistor with an existing HDF5 file at the given path.
+        /// </summary>
+        /// <param name="filename">Existing HDF5 file path</param>
+        /// <param name="queueCapacity">Most Response segments and Epochs waiting to be written at once</param>
+        /// <param name="workers">Most Response segments converted for writing at once</param>
+        public H5EpochPersistor(string filename, int queueCapacity, int workers)
         {
             if (!File.Exists(filename))
                 throw new IOException("File does not exist");
@@ -76,10 +126,16 @@ namespace Symphony.Core
                     "File does not have a version attribute. Are you sure this is a Symphony file?");
 
             Version = _file.Attributes[VersionKey];
-            if (Version != PersistenceVersion)
+            if (Version != PersistenceVersion && Version != SamplesPersistenceVersion)
                 throw new FileLoadException("Version mismatch. This file may have been produced by an older version.");
 
+            ResponseLayout = Version == SamplesPersistenceVersion
+                ? ResponseDataLayout.Samples
+                : ResponseDataLayout.Measurements;
+
             NumericDataCompression = _file.Attributes[CompressionKey];
+            ResponseCompression = NumericDataCompression;
+            ResponseChunkSamples = DefaultResponseChunkSamples;
 
             if (_file.Groups.Count() != 1)
                 throw new FileLoadException("Expected a single top-level group. Are you sure this is a Symphony file?");
@@ -88,6 +144,8 @@ namespace Symphony.Core
 
             _openEpochGroups = new Stack<H5PersistentEpochGroup>();
 
+            _queue = new PersistenceQueue(queueCapacity, workers);
+
             IsClosed = false;
         }
 
@@ -143,6 +201,16 @@ namespace Symphony.Core
 
         public void CloseDocument()
         {
+            // Writes everything already queued
+            _queue.Dispose();
+
+            // Responses of Epochs that were never serialized
+            foreach (var writer in _responseWriters.Values)
+            {
+                writer.Close();
+            }
+            _responseWriters.Clear();
+
             _file.Close();
         }
 
@@ -154,6 +222,33 @@ namespace Symphony.Core
 
         public uint NumericDataCompression { get; private set; }
 
+        /// <summary>
+        /// How Response data is stored, fixed by the file's persistence version. Responses of either layout
+        /// are read regardless.
+        /// </summary>
+        public ResponseDataLayout ResponseLayout { get; private set; }
+
+        /// <summary>
+        /// Compression (0 = none, 9 = maximum) of Response datasets written as they are recorded. Defaults to
+        /// NumericDataCompression. Lower levels cost the input pipeline less time per block.
+        /// </summary>
+        public uint ResponseCompression { get; set; }
+
+        /// <summary>
+        /// Samples per chunk of Response datasets written as they are recorded.
+        /// </summary>
+        public long ResponseChunkSamples { get; set; }
+
+        /// <summary>
+        /// Depth and backpressure of the queue of Response segments and Epochs waiting to be written. Segments
+        /// the queue rejects when full are written when their Epoch is serialized instead; SerializeAsync waits
+        /// only while the queue is full.
+        /// </summary>
+        public PersistenceQueueStatus QueueStatus
+        {
+            get { return _queue.Status; }
+        }
+
         public IPersistentExperiment Experiment
         {
             get { return _experiment; }
@@ -293,12 +388,85 @@ namespace Symphony.Core
 
         public IPersistentEpochBlock CurrentEpochBlock { get; set; }
 
+        /// <summary>
+        /// Creates an extensible, chunked dataset in the current Epoch Block for each of the Epoch's Responses
+        /// and appends each data segment to it as the segment is appended to the Response. Serialize then links
+        /// the dataset into the persisted Response rather than converting and writing the data all at once.
+        /// 
+        /// Segments are queued for writing without blocking, so Prepare and the input pipeline never wait on
+        /// the file.
+        /// </summary>
+        public void Prepare(Epoch epoch)
+        {
+            if (CurrentEpochBlock == null)
+                throw new InvalidOperationException("There is no open epoch block");
+            if (ResponseChunkSamples <= 0)
+                throw new InvalidOperationException("Response chunk size must be positive");
+
+            var block = (H5PersistentEpochBlock) CurrentEpochBlock;
+
+            foreach (var response in epoch.Responses.Values.ToList())
+            {
+                if (_responseWriters.ContainsKey(response))
+                    continue;
+
+                _responseWriters[response] = new H5ResponseWriter(block.Group, response, ResponseLayout,
+                    ResponseChunkSamples, ResponseCompression, _queue);
+            }
+        }
+
+        /// <summary>
+        /// Serializes the Epoch on the writer thread, once all of its queued Response data is written, and
+        /// waits for it to be written.
+        /// </summary>
         public IPersistentEpoch Serialize(Epoch epoch)
+        {
+            try
+            {
+                return SerializeAsync(epoch).Result;
+            }
+            catch (AggregateException x)
+            {
+                ExceptionDispatchInfo.Capture(x.InnerException).Throw();
+                throw;
+            }
+        }
+
+        /// <summary>
+        /// Queues the Epoch to be serialized on the writer thread, once all of its queued Response data is
+        /// written. Returns without waiting for the writer unless the queue is full (see QueueStatus).
+        /// </summary>
+        public Task<IPersistentEpoch> SerializeAsync(Epoch epoch)
         {
             if (CurrentEpochBlock == null)
                 throw new InvalidOperationException("There is no open epoch block");
 
-            return ((H5PersistentEpochBlock) CurrentEpochBlock).InsertEpoch(epoch, NumericDataCompression);
+            var block = (H5PersistentEpochBlock) CurrentEpochBlock;
+
+            return _queue.InvokeAsync<IPersistentEpoch>(() =>
+                {
+                    var writers = new Dictionary<Response, H5ResponseWriter>();
+                    foreach (var response in epoch.Responses.Values.ToList())
+                    {
+                        H5ResponseWriter writer;
+                        if (_responseWriters.TryRemove(response, out writer))
+                        {
+                            writers[response] = writer;
+                        }
+                    }
+
+                    try
+                    {
+                        return block.InsertEpoch(epoch, NumericDataCompression, ResponseLayout, ResponseChunkSamples, writers);
+                    }
+                    finally
+                    {
+                        foreach (var writer in writers.Values)
+                        {
+                            writer.Close();
+                        }
+                    }
+                });
         }
 
         public void Delete(IPersistentEntity entity)
@@ -1497,12 +1665,14 @@ namespace Symphony.Core
             return EntityFactory.Create<H5PersistentEpoch>(group);
         }
 
-        public H5PersistentEpoch InsertEpoch(Epoch epoch, uint compression)
+        public H5PersistentEpoch InsertEpoch(Epoch epoch, uint compression, ResponseDataLayout layout,
+            long responseChunkSamples, IDictionary<Response, H5ResponseWriter> responseWriters)
         {
             if (epoch.ProtocolID != ProtocolID)
                 throw new ArgumentException("Epoch protocol id does not match epoch block protocol id");
 
-            var pEpoch = H5PersistentEpoch.InsertEpoch(_epochsGroup, EntityFactory, this, epoch, compression);
+            var pEpoch = H5PersistentEpoch.InsertEpoch(_epochsGroup, EntityFactory, this, epoch, compression,
+                layout, responseChunkSamples, responseWriters);
             TryFlush();
 
             return pEpoch;
@@ -1580,7 +1750,8 @@ namespace Symphony.Core
         private H5Group _epochBlockGroup;
 
         public static H5PersistentEpoch InsertEpoch(H5Group container, H5PersistentEntityFactory factory,
-            H5PersistentEpochBlock block, Epoch epoch, uint compression)
+            H5PersistentEpochBlock block, Epoch epoch, uint compression, ResponseDataLayout layout,
+            long responseChunkSamples, IDictionary<Response, H5ResponseWriter> responseWriters)
         {
             var group = InsertTimelineEntityGroup(container, "epoch", epoch.StartTime,
                 (DateTimeOffset) epoch.StartTime + epoch.Duration);
@@ -1619,8 +1790,10 @@ namespace Symphony.Core
                 foreach (var kv in epoch.Responses.ToList())
                 {
                     var device = experiment.Device(kv.Key.Name, kv.Key.Manufacturer);
+                    H5ResponseWriter writer;
+                    responseWriters.TryGetValue(kv.Value, out writer);
                     H5PersistentResponse.InsertResponse(responsesGroup, factory, persistentEpoch, device, kv.Value,
-                        compression);
+                        compression, layout, writer, responseChunkSamples);
                 }
 
                 foreach (var kv in epoch.Stimuli.ToList())
@@ -1966,7 +2139,9 @@ namespace Symphony.Core
         private H5Dataset _dataDataset;
 
         public static H5PersistentResponse InsertResponse(H5Group container, H5PersistentEntityFactory factory,
-            H5PersistentEpoch epoch, H5PersistentDevice device, Response response, uint compression)
+            H5PersistentEpoch epoch, H5PersistentDevice device, Response response, uint compression,
+            ResponseDataLayout layout = ResponseDataLayout.Measurements, H5ResponseWriter writer = null,
+            long chunkSamples = H5EpochPersistor.DefaultResponseChunkSamples)
         {
             var group = InsertIOBaseGroup(container, epoch, device, response.DataConfigurationSpans.ToList());
             try
@@ -1976,8 +2151,18 @@ namespace Symphony.Core
                 group.Attributes[InputTimeTicksKey] = response.InputTime.Ticks;
                 group.Attributes[InputTimeOffsetHoursKey] = response.InputTime.Offset.TotalHours;
 
-                group.AddDataset(DataDatasetName, H5Map.GetMeasurementType(container.File),
-                    response.Data.ToList().Select(H5Map.Convert).ToArray(), compression);
+                if (writer != null && writer.Covers(response))
+                {
+                    group.AddHardLink(DataDatasetName, writer.Dataset);
+                }
+                else if (layout != ResponseDataLayout.Samples ||
+                         H5Map.InsertSamples(group, DataDatasetName, response.DataSegments.Select(d => d.Data).ToList(),
+                             chunkSamples, compression) == null)
+                {
+                    // Measurements, or data without common units
+                    group.AddDataset(DataDatasetName, H5Map.GetMeasurementType(container.File),
+                        response.Data.ToList().Select(H5Map.Convert).ToArray(), compression);
+                }
 
                 return factory.Create<H5PersistentResponse>(group);
             }
@@ -2013,7 +2198,12 @@ namespace Symphony.Core
 
         public IEnumerable<IMeasurement> Data
         {
-            get { return _dataDataset.GetData<H5Map.MeasurementT>().Select(H5Map.Convert); }
+            get
+            {
+                return _dataDataset.DatatypeClass == H5T.H5TClass.COMPOUND
+                    ? _dataDataset.GetData<H5Map.MeasurementT>().Select(H5Map.Convert)
+                    : H5Map.ReadSamples(_dataDataset);
+            }
         }
 
         public override void SetEpoch(H5PersistentEpoch epoch)
@@ -2043,6 +2233,182 @@ namespace Symphony.Core
         }
     }
 
+    /// <summary>
+    /// Writes a Response's data to an extensible, chunked dataset as each data segment is appended to the
+    /// Response, so that a long recording is never held for conversion and written all at once. Segments are
+    /// converted on the persistence queue's workers and written on its writer thread.
+    /// 
+    /// <para>In the Samples layout the dataset is created with the first segment, whose storage type, exponent
+    /// and units every later segment must share.</para>
+    /// </summary>
+    class H5ResponseWriter
+    {
+        private const string DatasetPrefix = "pendingResponse_";
+
+        private readonly H5Group _container;
+        private readonly Response _response;
+        private readonly ResponseDataLayout _layout;
+        private readonly long _chunkSamples;
+        private readonly uint _compression;
+        private readonly PersistenceQueue _queue;
+        private DateTimeOffset _lastInputTime = DateTimeOffset.MinValue; //Input pipeline only
+        private H5Map.Samples _first;
+        private long _samples;
+        private volatile bool _failed;
+        private bool _closed;
+
+        public H5ResponseWriter(H5Group container, Response response, ResponseDataLayout layout, long chunkSamples,
+            uint compression, PersistenceQueue queue)
+        {
+            _container = container;
+            _response = response;
+            _layout = layout;
+            _chunkSamples = chunkSamples;
+            _compression = compression;
+            _queue = queue;
+
+            if (_layout == ResponseDataLayout.Samples ||
+                _queue.TryEnqueue<object>(null, o => CreateMeasurements()))
+            {
+                _response.DataAppended += Append;
+            }
+            else
+            {
+                _failed = true;
+            }
+        }
+
+        public H5Dataset Dataset { get; private set; }
+
+        /// <summary>
+        /// Set if a segment could not be queued or written, or arrived out of order. The Response data is then
+        /// written whole when the Response is persisted.
+        /// </summary>
+        public bool Failed
+        {
+            get { return _failed; }
+        }
+
+        /// <summary>
+        /// Indicates if the dataset holds all of the given Response's data, in order.
+        /// </summary>
+        public bool Covers(Response response)
+        {
+            return !_failed && Dataset != null && _samples == response.SampleCount;
+        }
+
+        private void CreateMeasurements()
+        {
+            try
+            {
+                Dataset = _container.AddDataset(DatasetPrefix + Guid.NewGuid(),
+                    H5Map.GetMeasurementType(_container.File), new[] {0L}, new[] {-1L}, new[] {_chunkSamples},
+                    _compression);
+            }
+            catch (Exception x)
+            {
+                H5EpochPersistor.Log.WarnFormat("Unable to create response dataset: {0}", x);
+                _failed = true;
+            }
+        }
+
+        private void Append(object sender, ResponseDataEventArgs args)
+        {
+            if (_failed)
+                return;
+
+            var segment = args.Data;
+            if (segment.InputTime < _lastInputTime)
+            {
+                _failed = true;
+                return;
+            }
+            _lastInputTime = segment.InputTime;
+
+            // Never block the input pipeline on persistence
+            bool queued = _layout == ResponseDataLayout.Samples
+                ? _queue.TryEnqueue(() => H5Map.ToSamples(segment.Data), WriteSamples)
+                : _queue.TryEnqueue(() => segment.Data.Select(H5Map.Convert).ToArray(), WriteMeasurements);
+
+            if (!queued)
+            {
+                H5EpochPersistor.Log.Warn("Persistence queue is full. Response will be written when its epoch is serialized.");
+                _failed = true;
+            }
+        }
+
+        private void WriteMeasurements(H5Map.MeasurementT[] data)
+        {
+            if (_closed || _failed || data.Length == 0)
+                return;
+
+            try
+            {
+                Dataset.Extend(new[] {_samples + data.Length});
+                Dataset.SetData(data, new[] {_samples}, new[] {(long) data.Length});
+                _samples += data.Length;
+            }
+            catch (Exception x)
+            {
+                H5EpochPersistor.Log.WarnFormat("Unable to write response data as it was recorded: {0}", x);
+                _failed = true;
+            }
+        }
+
+        private void WriteSamples(H5Map.Samples data)
+        {
+            if (_closed || _failed || data == null || data.Count == 0)
+            {
+                // No common units
+                if (data == null)
+                    _failed = true;
+                return;
+            }
+
+            try
+            {
+                if (Dataset == null)
+                {
+                    Dataset = H5Map.CreateSamplesDataset(_container, DatasetPrefix + Guid.NewGuid(), data, 0,
+                        _chunkSamples, _compression);
+                    _first = data;
+                }
+                else if (!data.IsCompatible(_first))
+                {
+                    _failed = true;
+                    return;
+                }
+
+                Dataset.Extend(new[] {_samples + data.Count});
+                data.Write(Dataset, _samples);
+                _samples += data.Count;
+            }
+            catch (Exception x)
+            {
+                H5EpochPersistor.Log.WarnFormat("Unable to write response data as it was recorded: {0}", x);
+                _failed = true;
+            }
+        }
+
+        /// <summary>
+        /// Stops writing and unlinks the pending dataset. Data linked into a persisted Response is kept.
+        /// Called on the writer thread, or once the queue is stopped.
+        /// </summary>
+        public void Close()
+        {
+            if (_closed)
+                return;
+
+            _response.DataAppended -= Append;
+            _closed = true;
+
+            if (Dataset != null)
+            {
+                Dataset.Delete();
+            }
+        }
+    }
+
     class H5PersistentStimulus : H5PersistentIOBase, IPersistentStimulus
     {
         private const string StimulusIDKey = "stimulusID";
@@ -2546,6 +2912,174 @@ namespace Symphony.Core
             }
             return new Measurement(mt.quantity, units);
         }
+
+        private const string ScaleKey = "scale";
+        private const string OffsetKey = "offset";
+        private const string SamplesUnitsKey = "units";
+
+        /// <summary>
+        /// A block of Response data in the Samples layout: int16 samples as the pipeline delivered them, or
+        /// float32 values, each with a common exponent and base units.
+        /// </summary>
+        public sealed class Samples
+        {
+            public short[] Int16 { get; set; }
+            public float[] Single { get; set; }
+            public int Count { get; set; }
+            public int Exponent { get; set; }
+            public string BaseUnits { get; set; }
+
+            public bool IsInt16
+            {
+                get { return Int16 != null; }
+            }
+
+            public bool IsCompatible(Samples other)
+            {
+                return IsInt16 == other.IsInt16 && Exponent == other.Exponent && BaseUnits == other.BaseUnits;
+            }
+
+            /// <summary>
+            /// Writes these samples into dataset starting at start. The dataset must already be large enough.
+            /// </summary>
+            public void Write(H5Dataset dataset, long start)
+            {
+                if (IsInt16)
+                {
+                    dataset.SetData(Int16, new[] {start}, new[] {(long) Count});
+                }
+                else
+                {
+                    dataset.SetData(Single, new[] {start}, new[] {(long) Count});
+                }
+            }
+        }
+
+        /// <summary>
+        /// Takes the samples of data for the Samples layout. Int16 SampleData starting at the beginning of its
+        /// array is used as is; other data is converted in one pass, without a Measurement per sample if it is
+        /// SampleData. Returns null if data has samples in different base units.
+        /// </summary>
+        public static Samples ToSamples(IList<IMeasurement> data)
+        {
+            var sampleData = data as SampleData;
+            if (sampleData != null)
+            {
+                var result = new Samples
+                    {
+                        Count = sampleData.Count,
+                        Exponent = sampleData.Exponent,
+                        BaseUnits = sampleData.BaseUnits
+                    };
+
+                if (sampleData.IsInt16)
+                {
+                    var segment = sampleData.Int16Samples;
+                    result.Int16 = segment.Offset == 0 ? segment.Array : sampleData.ToInt16Array();
+                }
+                else
+                {
+                    var segment = sampleData.DoubleSamples;
+                    result.Single = new float[segment.Count];
+                    for (int i = 0; i < segment.Count; i++)
+                    {
+                        result.Single[i] = (float) segment.Array[segment.Offset + i];
+                    }
+                }
+
+                return result;
+            }
+
+            string units = data.Count > 0 ? data[0].BaseUnits : Measurement.UNITLESS;
+            var values = new float[data.Count];
+            for (int i = 0; i < values.Length; i++)
+            {
+                var m = data[i];
+                if (m.BaseUnits != units)
+                    return null;
+
+                values[i] = (float) m.QuantityInBaseUnits;
+            }
+
+            return new Samples {Single = values, Count = values.Length, Exponent = 0, BaseUnits = units};
+        }
+
+        /// <summary>
+        /// Creates a Samples layout dataset of the given length (extensible if zero) holding samples like first.
+        /// </summary>
+        public static H5Dataset CreateSamplesDataset(H5Group container, string name, Samples first, long length,
+            long chunkSamples, uint compression)
+        {
+            var type = new H5Datatype(first.IsInt16 ? H5T.H5Type.NATIVE_SHORT : H5T.H5Type.NATIVE_FLOAT);
+            long chunk = length == 0 ? chunkSamples : Math.Max(1, Math.Min(length, chunkSamples));
+
+            var dataset = container.AddDataset(name, type, new[] {length}, length == 0 ? new[] {-1L} : null,
+                new[] {chunk}, compression);
+
+            dataset.Attributes[ScaleKey] = Math.Pow(10, first.Exponent);
+            dataset.Attributes[OffsetKey] = 0.0;
+            dataset.Attributes[SamplesUnitsKey] = first.BaseUnits;
+
+            return dataset;
+        }
+
+        /// <summary>
+        /// Writes the data segments to a new Samples layout dataset, or returns null (writing nothing) if
+        /// they have no common storage type, exponent and units.
+        /// </summary>
+        public static H5Dataset InsertSamples(H5Group container, string name, IList<IList<IMeasurement>> segments,
+            long chunkSamples, uint compression)
+        {
+            var samples = segments.Select(ToSamples).Where(d => d == null || d.Count > 0).ToList();
+            if (samples.Count == 0 || samples.Any(d => d == null || !d.IsCompatible(samples[0])))
+            {
+                // Mixed storage or exponents convert as a whole; mixed units cannot
+                var whole = ToSamples(segments.SelectMany(d => d).ToList());
+                if (whole == null || whole.Count == 0)
+                    return null;
+
+                samples = new List<Samples> {whole};
+            }
+
+            var dataset = CreateSamplesDataset(container, name, samples[0], samples.Sum(d => (long) d.Count),
+                chunkSamples, compression);
+
+            long start = 0;
+            foreach (var d in samples)
+            {
+                d.Write(dataset, start);
+                start += d.Count;
+            }
+
+            return dataset;
+        }
+
+        /// <summary>
+        /// Reads a Samples layout dataset. Samples are not converted to Measurements until enumerated.
+        /// </summary>
+        public static SampleData ReadSamples(H5Dataset dataset)
+        {
+            double scale = dataset.Attributes[ScaleKey];
+            double offset = dataset.Attributes[OffsetKey];
+            string units = dataset.Attributes[SamplesUnitsKey];
+
+            // A power of ten scale is kept as the exponent, so samples read back exactly
+            int exponent = scale > 0 ? (int) Math.Round(Math.Log10(scale)) : 0;
+            bool exact = offset == 0 && scale > 0 && Math.Abs(Math.Pow(10, exponent) - scale) <= 1e-12 * scale;
+
+            SampleData data;
+            if (dataset.DatatypeClass == H5T.H5TClass.INTEGER)
+            {
+                data = new SampleData(dataset.GetData<short>(), exact ? exponent : 0, units);
+            }
+            else
+            {
+                var values = Array.ConvertAll(dataset.GetData<float>(), v => (double) v);
+                data = new SampleData(values, exact ? exponent : 0, units);
+            }
+
+            return exact ? data : data.Scale(scale, offset, 0, units);
+        }
     }
 
 }
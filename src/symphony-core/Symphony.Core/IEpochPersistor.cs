@@ -1,5 +1,6 @@
 ﻿using System;
 using System.Collections.Generic;
+using System.Threading.Tasks;
 
 namespace Symphony.Core
 {
@@ -125,6 +126,13 @@ namespace Symphony.Core
         /// </summary>
         IPersistentEpochBlock CurrentEpochBlock { get; }
 
+        /// <summary>
+        /// Prepares to serialize an Epoch that is about to run. A persistor may begin writing the Epoch's
+        /// Response data as it is appended, rather than all at once when the Epoch is serialized.
+        /// </summary>
+        /// <param name="epoch">Epoch that will be serialized when complete</param>
+        void Prepare(Epoch epoch);
+
         /// <summary>
         /// Serializes an Epoch instance to some kind of persistent medium (file/database/etc).
         /// </summary>
@@ -132,6 +140,14 @@ namespace Symphony.Core
         /// <returns>The persistent Epoch created through serialization</returns>
         IPersistentEpoch Serialize(Epoch epoch);
 
+        /// <summary>
+        /// Begins serializing an Epoch without waiting for it to be written. Epochs are written in the
+        /// order they are passed.
+        /// </summary>
+        /// <param name="epoch">Epoch to serialize</param>
+        /// <returns>Task completed with the persistent Epoch once it is written</returns>
+        Task<IPersistentEpoch> SerializeAsync(Epoch epoch);
+
         /// <summary>
         /// Deletes the given persistent entity from the persistent medium.
         /// </summary>
@@ -16,7 +16,8 @@ namespace Symphony.Core
     {
 
         /// <summary>
-        /// The Data as a list of Measurement samples.
+        /// The Data as a list of Measurement samples. When the data is held as a primitive sample
+        /// array this is a SampleData, which creates Measurements only as they are read.
         /// </summary>
         IList<IMeasurement> Data { get; }
 
@@ -350,6 +351,41 @@ namespace Symphony.Core
     /// </summary>
     public abstract class IOData : IIOData
     {
+        /// <summary>
+        /// Splits data at numSamples. SampleData is split into O(1) views of the same array.
+        /// </summary>
+        protected static Tuple<IList<IMeasurement>, IList<IMeasurement>> Split(IList<IMeasurement> data, int numSamples)
+        {
+            // Out-of-range split points clamp, as Take/Skip do for lists
+            numSamples = Math.Max(0, Math.Min(numSamples, data.Count));
+
+            var samples = data as SampleData;
+            if (samples != null)
+            {
+                return Tuple.Create<IList<IMeasurement>, IList<IMeasurement>>(
+                    samples.Slice(0, numSamples),
+                    samples.Slice(numSamples, samples.Count - numSamples));
+            }
+
+            return Tuple.Create<IList<IMeasurement>, IList<IMeasurement>>(
+                data.Take(numSamples).ToList(),
+                data.Skip(numSamples).Take(data.Count() - numSamples).ToList());
+        }
+
+        /// <summary>
+        /// Converts data to the given units, in bulk when the data is SampleData with a bulk
+        /// conversion available (see Converters.TryConvert).
+        /// </summary>
+        protected static IList<IMeasurement> ConvertUnits(IList<IMeasurement> data, string units)
+        {
+            var samples = data as SampleData;
+            SampleData converted;
+            if (samples != null && Converters.TryConvert(samples, units, out converted))
+                return converted;
+
+            return data.Select(m => Converters.Convert(m, units)).ToList();
+        }
+
         public const string EXTERNAL_DEVICE_CONFIGURATION_NAME = "EXTERNAL_DEVICE";
         public const string STREAM_CONFIGURATION_NAME = "STREAM";
         public const string HARWARE_CONTROLLER_CONFIGURATION_NAME = "HARDWARE_CONTROLLER";
@@ -411,7 +447,8 @@ namespace Symphony.Core
             IEnumerable<IPipelineNodeConfiguration> configuration
             )
         {
-            this.Data = new List<IMeasurement>(data);
+            // SampleData is immutable, so it can be shared rather than copied
+            this.Data = data as SampleData ?? (IList<IMeasurement>) new List<IMeasurement>(data);
             this.SampleRate = sampleRate;
             this.Configuration = configuration ?? new List<IPipelineNodeConfiguration>();
         }
@@ -542,7 +579,13 @@ namespace Symphony.Core
             if (!this.SampleRate.Equals(o.SampleRate))
                 throw new ArgumentException("Sample rate mismatch");
 
-            return new OutputData(this.Data.Concat(o.Data).ToList(), this.SampleRate, this.IsLast || o.IsLast);
+            var samples = this.Data as SampleData;
+            var otherSamples = o.Data as SampleData;
+            IList<IMeasurement> data = samples != null && samples.IsCompatible(otherSamples)
+                ? SampleData.Concat(samples, otherSamples)
+                : (IList<IMeasurement>) this.Data.Concat(o.Data).ToList();
+
+            return new OutputData(data, this.SampleRate, this.IsLast || o.IsLast);
         }
 
         public IOutputData Zip(IOutputData o, Func<IMeasurement, IMeasurement, IMeasurement> resultSelector)
@@ -563,15 +606,17 @@ namespace Symphony.Core
                 throw new Exception("Range out-of-bounds.");
             }
 
-            var rangeData = this.Data.Skip(startSample).Take(numSamples);
-            IList<IMeasurement> subData = new List<IMeasurement>(rangeData);
+            var samples = this.Data as SampleData;
+            IList<IMeasurement> subData = samples != null
+                ? (IList<IMeasurement>)samples.Slice(startSample, numSamples)
+                : new List<IMeasurement>(this.Data.Skip(startSample).Take(numSamples));
 
             return new OutputData(this, subData);
         }
 
         public IOutputData DataWithUnits(string units)
         {
-            return DataWithConversion((m) => Converters.Convert(m, units));
+            return new OutputData(this, ConvertUnits(Data, units));
         }
 
         public IOutputData DataWithConversion(Func<IMeasurement, IMeasurement> conversion)
@@ -584,12 +629,11 @@ namespace Symphony.Core
             int requestedSamples = duration.Ticks == 0 ? 0 : (int)Math.Ceiling(duration.TotalSeconds * (double)SampleRate.QuantityInBaseUnits);
             int numSamples = Math.Min(requestedSamples, Data.Count);
 
-            var headData = Data.Take(numSamples).ToList();
-            var restData = Data.Skip(numSamples).Take(Data.Count() - numSamples).ToList();
+            var split = Split(Data, numSamples);
 
             return new OutputDataSplit(
-                new OutputData(this, headData),
-                new OutputData(this, restData)
+                new OutputData(this, split.Item1),
+                new OutputData(this, split.Item2)
             );
         }
 
@@ -659,7 +703,7 @@ namespace Symphony.Core
 
         public IInputData DataWithUnits(string units)
         {
-            return DataWithConversion(m => Converters.Convert(m, units));
+            return new InputData(this, ConvertUnits(Data, units));
         }
 
         public IInputData DataWithConversion(Func<IMeasurement, IMeasurement> conversion)
@@ -672,12 +716,11 @@ namespace Symphony.Core
             int numSamples = duration.Ticks == 0 ? 0 : (int)Math.Ceiling(duration.TotalSeconds * (double)SampleRate.QuantityInBaseUnits);
             numSamples = Math.Min(numSamples, Data.Count);
 
-            var headData = Data.Take(numSamples).ToList();
-            var restData = Data.Skip(numSamples).Take(Data.Count() - numSamples).ToList();
+            var split = Split(Data, numSamples);
 
             return new InputDataSplit(
-                new InputData(this, headData),
-                new InputData(this, restData)
+                new InputData(this, split.Item1),
+                new InputData(this, split.Item2)
             );
         }
 
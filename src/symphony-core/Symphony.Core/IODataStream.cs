@@ -326,6 +326,18 @@ namespace Symphony.Core
         /// <param name="stimulus">Stimulus to stream</param>
         /// <param name="blockDuration">Block duration to use for enumerating the stimulus data</param>
         public StimulusOutputDataStream(IStimulus stimulus, TimeSpan blockDuration)
+            : this(stimulus, blockDuration, null)
+        {
+        }
+
+        /// <summary>
+        /// Constructs an output data stream around a given Stimulus, enumerating the stimulus data
+        /// through the given cache (see StimulusCache).
+        /// </summary>
+        /// <param name="stimulus">Stimulus to stream</param>
+        /// <param name="blockDuration">Block duration to use for enumerating the stimulus data</param>
+        /// <param name="cache">Stimulus cache, or null to always generate the stimulus data</param>
+        public StimulusOutputDataStream(IStimulus stimulus, TimeSpan blockDuration, StimulusCache cache)
         {
             if (stimulus == null)
                 throw new ArgumentNullException("stimulus");
@@ -334,7 +346,9 @@ namespace Symphony.Core
                 throw new ArgumentOutOfRangeException("blockDuration");
 
             Stimulus = stimulus;
-            StimulusDataEnumerator = stimulus.DataBlocks(blockDuration).GetEnumerator();
+            StimulusDataEnumerator = (cache == null
+                ? stimulus.DataBlocks(blockDuration)
+                : cache.DataBlocks(stimulus, blockDuration)).GetEnumerator();
             Position = TimeSpan.Zero;
             OutputPosition = TimeSpan.Zero;
         }
@@ -0,0 +1,267 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading;
+using log4net;
+
+namespace Symphony.Core
+{
+    /// <summary>
+    /// Pushes the input read by each process loop iteration up the input pipeline off the process
+    /// loop thread.
+    ///
+    /// <para>Each input stream has its own worker thread, so the stream and device conversions of
+    /// different streams run in parallel while each stream's blocks are handled in order. Deliveries
+    /// to the Controller (Controller.PushInputData) are merged back into iteration order: a block is
+    /// delivered only once every block of earlier iterations has been, and deliveries are made one
+    /// at a time. The Controller thus sees input in timestamp order, as if the iterations had been
+    /// pushed serially.</para>
+    ///
+    /// <para>Exceptions thrown pushing a block are collected and rethrown, as an AggregateException,
+    /// by the next Push or by WaitForIdle. Later blocks are still pushed.</para>
+    /// </summary>
+    public sealed class InputPipeline
+    {
+        private sealed class Block
+        {
+            public long Sequence;
+            public IDAQInputStream Stream;
+            public IInputData Data;
+        }
+
+        private sealed class Lane
+        {
+            public readonly BlockingCollection<Block> Queue = new BlockingCollection<Block>();
+            public Thread Thread;
+        }
+
+        // The pipeline and iteration of the block being pushed on this thread
+        [ThreadStatic] private static InputPipeline _currentPipeline;
+        [ThreadStatic] private static long _currentSequence;
+
+        private readonly Dictionary<IDAQInputStream, Lane> _lanes = new Dictionary<IDAQInputStream, Lane>();
+
+        // Guards the sequence counters; signalled as iterations complete
+        private readonly object _lock = new object();
+        private readonly Dictionary<long, int> _remaining = new Dictionary<long, int>();
+        private long _pushed;
+        private long _delivered;
+
+        private readonly object _deliveryLock = new object();
+        private readonly ConcurrentQueue<Exception> _faults = new ConcurrentQueue<Exception>();
+
+        private static readonly ILog log = LogManager.GetLogger(typeof(InputPipeline));
+
+        /// <summary>
+        /// Number of iterations pushed but not yet completely delivered.
+        /// </summary>
+        public long Pending
+        {
+            get { lock (_lock) return _pushed - _delivered; }
+        }
+
+        /// <summary>
+        /// Queues one iteration's input, one block per stream, and returns without waiting for it.
+        /// </summary>
+        /// <exception cref="AggregateException">If pushing an earlier block failed</exception>
+        public void Push(IEnumerable<KeyValuePair<IDAQInputStream, IInputData>> incomingData)
+        {
+            ThrowIfFaulted();
+
+            var blocks = incomingData.ToList();
+
+            long sequence;
+            lock (_lock)
+            {
+                sequence = _pushed++;
+                _remaining[sequence] = blocks.Count;
+                if (blocks.Count == 0)
+                    Advance();
+            }
+
+            foreach (var kv in blocks)
+            {
+                LaneFor(kv.Key).Queue.Add(new Block {Sequence = sequence, Stream = kv.Key, Data = kv.Value});
+            }
+        }
+
+        /// <summary>
+        /// Blocks until every queued iteration has been delivered.
+        /// </summary>
+        /// <exception cref="AggregateException">If pushing a block failed</exception>
+        public void WaitForIdle()
+        {
+            lock (_lock)
+            {
+                while (_delivered < _pushed)
+                {
+                    Monitor.Wait(_lock);
+                }
+            }
+
+            ThrowIfFaulted();
+        }
+
+        /// <summary>
+        /// Lets the stream workers exit once their queued blocks are pushed. Blocks pushed later
+        /// start new workers.
+        /// </summary>
+        public void Close()
+        {
+            lock (_lanes)
+            {
+                foreach (var lane in _lanes.Values)
+                {
+                    lane.Queue.CompleteAdding();
+                }
+
+                _lanes.Clear();
+            }
+        }
+
+        /// <summary>
+        /// Discards exceptions collected from earlier pushes.
+        /// </summary>
+        public void ClearFaults()
+        {
+            Exception ignored;
+            while (_faults.TryDequeue(out ignored))
+            {
+            }
+        }
+
+        /// <summary>
+        /// Waits for the turn of the block being pushed on the calling thread to be delivered, and
+        /// holds it until the returned object is disposed. Returns null when not called from a
+        /// pipeline worker; such deliveries are not ordered.
+        /// </summary>
+        public static IDisposable BeginDelivery()
+        {
+            var pipeline = _currentPipeline;
+            if (pipeline == null)
+                return null;
+
+            return pipeline.WaitForTurn(_currentSequence);
+        }
+
+        private IDisposable WaitForTurn(long sequence)
+        {
+            lock (_lock)
+            {
+                while (_delivered < sequence)
+                {
+                    Monitor.Wait(_lock);
+                }
+            }
+
+            Monitor.Enter(_deliveryLock);
+            return new Delivery(_deliveryLock);
+        }
+
+        private sealed class Delivery : IDisposable
+        {
+            private object _deliveryLock;
+
+            public Delivery(object deliveryLock)
+            {
+                _deliveryLock = deliveryLock;
+            }
+
+            public void Dispose()
+            {
+                if (_deliveryLock != null)
+                {
+                    Monitor.Exit(_deliveryLock);
+                    _deliveryLock = null;
+                }
+            }
+        }
+
+        private void ThrowIfFaulted()
+        {
+            if (_faults.IsEmpty)
+                return;
+
+            var faults = new List<Exception>();
+            Exception e;
+            while (_faults.TryDequeue(out e))
+            {
+                faults.Add(e);
+            }
+
+            throw new AggregateException(faults);
+        }
+
+        private Lane LaneFor(IDAQInputStream stream)
+        {
+            lock (_lanes)
+            {
+                Lane lane;
+                if (!_lanes.TryGetValue(stream, out lane))
+                {
+                    lane = new Lane();
+                    var queue = lane.Queue;
+                    lane.Thread = new Thread(() => Work(queue))
+                        {
+                            IsBackground = true,
+                            Name = "Input: " + stream.Name
+                        };
+                    lane.Thread.Start();
+
+                    _lanes[stream] = lane;
+                }
+
+                return lane;
+            }
+        }
+
+        private void Work(BlockingCollection<Block> queue)
+        {
+            foreach (var block in queue.GetConsumingEnumerable())
+            {
+                _currentPipeline = this;
+                _currentSequence = block.Sequence;
+                try
+                {
+                    block.Stream.PushInputData(block.Data);
+                }
+                catch (Exception ex)
+                {
+                    log.ErrorFormat("An error occurred pushing input data from {0}: {1}", block.Stream.Name, ex);
+                    _faults.Enqueue(ex);
+                }
+                finally
+                {
+                    _currentPipeline = null;
+                    Complete(block.Sequence);
+                }
+            }
+        }
+
+        private void Complete(long sequence)
+        {
+            lock (_lock)
+            {
+                _remaining[sequence]--;
+                Advance();
+            }
+        }
+
+        // Moves past completed iterations; called holding _lock
+        private void Advance()
+        {
+            int remaining;
+            bool advanced = false;
+            while (_remaining.TryGetValue(_delivered, out remaining) && remaining == 0)
+            {
+                _remaining.Remove(_delivered);
+                _delivered++;
+                advanced = true;
+            }
+
+            if (advanced)
+                Monitor.PulseAll(_lock);
+        }
+    }
+}
@@ -1,6 +1,8 @@
 ﻿using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.Linq;
+using System.Threading;
 
 namespace Symphony.Core
 {
@@ -277,13 +279,40 @@ namespace Symphony.Core
     }
 
     /// <summary>
-    /// A light weight pool of measurements using a simple array-based hash table.
+    /// A light weight, thread-safe pool of measurements.
+    ///
+    /// <para>Measurements are pooled per (exponent, units) pair in a UnitPool, identified by an
+    /// interned integer Id. Each thread remembers the Id of the last pair it looked up, keyed by the
+    /// reference of the unit string, so the unit string is only hashed when a thread switches to a
+    /// different pair (or passes an equal string of another reference).
+    /// Integral quantities in the int16 range (DAQ counts) are looked up in a direct-indexed table
+    /// without hashing. Other quantities go to a concurrent dictionary that stops growing at
+    /// UnitPool.MaxEntries; lookups past that return unpooled Measurements rather than evicting.</para>
+    ///
+    /// <para>Lookups may race to create the same Measurement; one instance wins and is returned to
+    /// every caller after that.</para>
     /// </summary>
     public static class MeasurementPool
     {
-        private const int Size = 524309;
-        
-        private static readonly IMeasurement[] Measurements = new IMeasurement[Size];
+        private static readonly ConcurrentDictionary<UnitKey, UnitPool> Pools = new ConcurrentDictionary<UnitKey, UnitPool>();
+
+        // Pools by Id; replaced, never modified in place, as pools are added under PoolsLock
+        private static UnitPool[] _poolsById = new UnitPool[16];
+        private static int _poolCount;
+        private static readonly object PoolsLock = new object();
+
+        // Per-thread lookup state: the Id of the last (exponent, units) looked up and hit/miss
+        // counts, summed on read
+        internal sealed class ThreadState
+        {
+            public string LastUnits;
+            public int LastExponent;
+            public int LastId = -1;
+            public long Hits;
+            public long Misses;
+        }
+
+        private static readonly ThreadLocal<ThreadState> State = new ThreadLocal<ThreadState>(() => new ThreadState(), true);
 
         /// <summary>
         /// Gets a measurement from the pool.
@@ -293,26 +322,209 @@ namespace Symphony.Core
         /// <param name="u">The (whatever)s we have (howevermany)s of</param>
         public static IMeasurement GetMeasurement(decimal q, int e, string u)
         {
-            int hash = GetHash(q, e, u);
-            int index = (hash & 0x7FFFFFFF) % Size;
+            var state = State.Value;
+            return PoolFor(state, e, u).Get(q, state);
+        }
+
+        /// <summary>
+        /// Gets a measurement of an int16 quantity (e.g. a DAQ count) from the pool.
+        /// </summary>
+        public static IMeasurement GetMeasurement(short q, int e, string u)
+        {
+            var state = State.Value;
+            return PoolFor(state, e, u).Get(q, state);
+        }
+
+        /// <summary>
+        /// Gets the pool of measurements with the given exponent and units, for callers that look
+        /// up many quantities of the same units.
+        /// </summary>
+        public static UnitPool Units(int e, string u)
+        {
+            return PoolFor(State.Value, e, u);
+        }
+
+        /// <summary>
+        /// Gets the pool with the given UnitPool.Id.
+        /// </summary>
+        /// <exception cref="ArgumentOutOfRangeException">If no pool has the Id</exception>
+        public static UnitPool Units(int id)
+        {
+            var pools = Volatile.Read(ref _poolsById);
+            if (id < 0 || id >= pools.Length || pools[id] == null)
+                throw new ArgumentOutOfRangeException("id");
+
+            return pools[id];
+        }
+
+        /// <summary>
+        /// Number of lookups that returned a pooled measurement. Counts are kept per thread and are
+        /// approximate while lookups are running.
+        /// </summary>
+        public static long Hits
+        {
+            get { return State.Values.Sum(s => s.Hits); }
+        }
 
-            var m = Measurements[index];
-            if (m != null && m.Quantity == q && m.Exponent == e && m.BaseUnits == u)
-                return m;
+        /// <summary>
+        /// Number of lookups that created a measurement.
+        /// </summary>
+        public static long Misses
+        {
+            get { return State.Values.Sum(s => s.Misses); }
+        }
 
-            return Measurements[index] = new Measurement(q, e, u);
+        private static UnitPool PoolFor(ThreadState state, int e, string u)
+        {
+            if (state.LastId >= 0 && state.LastExponent == e && ReferenceEquals(state.LastUnits, u))
+                return Volatile.Read(ref _poolsById)[state.LastId];
+
+            UnitPool pool;
+            var key = new UnitKey(e, u);
+            if (!Pools.TryGetValue(key, out pool))
+                pool = AddPool(key);
+
+            state.LastUnits = u;
+            state.LastExponent = e;
+            state.LastId = pool.Id;
+            return pool;
         }
 
-        // http://stackoverflow.com/questions/263400/what-is-the-best-algorithm-for-an-overridden-system-object-gethashcode
-        private static int GetHash(decimal q, int e, string u)
+        private static UnitPool AddPool(UnitKey key)
         {
-            unchecked
+            lock (PoolsLock)
+            {
+                UnitPool pool;
+                if (Pools.TryGetValue(key, out pool))
+                    return pool;
+
+                pool = new UnitPool(_poolCount, key.Exponent, key.BaseUnits);
+
+                var pools = _poolsById;
+                if (_poolCount == pools.Length)
+                {
+                    Array.Resize(ref pools, pools.Length * 2);
+                }
+                pools[_poolCount++] = pool;
+                Volatile.Write(ref _poolsById, pools);
+
+                Pools[key] = pool;
+                return pool;
+            }
+        }
+
+        private struct UnitKey : IEquatable<UnitKey>
+        {
+            public readonly int Exponent;
+            public readonly string BaseUnits;
+
+            public UnitKey(int exponent, string baseUnits)
+            {
+                Exponent = exponent;
+                BaseUnits = baseUnits;
+            }
+
+            public bool Equals(UnitKey other)
+            {
+                return Exponent == other.Exponent && BaseUnits == other.BaseUnits;
+            }
+
+            public override bool Equals(object obj)
+            {
+                return obj is UnitKey && Equals((UnitKey)obj);
+            }
+
+            public override int GetHashCode()
+            {
+                unchecked
+                {
+                    return Exponent * 397 ^ (BaseUnits == null ? 0 : BaseUnits.GetHashCode());
+                }
+            }
+        }
+
+        /// <summary>
+        /// Pooled measurements of a single exponent and base units.
+        /// </summary>
+        public sealed class UnitPool
+        {
+            /// <summary>
+            /// Maximum number of non-int16 quantities pooled per unit.
+            /// </summary>
+            public const int MaxEntries = 1 << 18;
+
+            private const int Int16Offset = -short.MinValue;
+
+            private readonly IMeasurement[] _int16 = new IMeasurement[1 << 16];
+            private readonly ConcurrentDictionary<decimal, IMeasurement> _other = new ConcurrentDictionary<decimal, IMeasurement>();
+            private int _otherCount; // Entries in _other; ConcurrentDictionary.Count takes every lock
+
+            internal UnitPool(int id, int exponent, string baseUnits)
+            {
+                Id = id;
+                Exponent = exponent;
+                BaseUnits = baseUnits;
+            }
+
+            /// <summary>
+            /// Process-unique integer key of this exponent and units (see MeasurementPool.Units(int)).
+            /// </summary>
+            public int Id { get; private set; }
+
+            public int Exponent { get; private set; }
+            public string BaseUnits { get; private set; }
+
+            public IMeasurement Get(short q)
+            {
+                return Get(q, State.Value);
+            }
+
+            public IMeasurement Get(decimal q)
+            {
+                return Get(q, State.Value);
+            }
+
+            internal IMeasurement Get(short q, ThreadState state)
+            {
+                int index = q + Int16Offset;
+
+                var m = Volatile.Read(ref _int16[index]);
+                if (m != null)
+                {
+                    state.Hits++;
+                    return m;
+                }
+
+                state.Misses++;
+                m = new Measurement((decimal)q, Exponent, BaseUnits);
+                return Interlocked.CompareExchange(ref _int16[index], m, null) ?? m;
+            }
+
+            internal IMeasurement Get(decimal q, ThreadState state)
             {
-                int hash = 17;
-                hash = hash * 23 + q.GetHashCode();
-                hash = hash * 23 + e.GetHashCode();
-                hash = hash * 23 + u.GetHashCode();
-                return hash;
+                if (q >= short.MinValue && q <= short.MaxValue && decimal.Truncate(q) == q)
+                    return Get((short)q, state);
+
+                IMeasurement m;
+                if (_other.TryGetValue(q, out m))
+                {
+                    state.Hits++;
+                    return m;
+                }
+
+                state.Misses++;
+                m = new Measurement(q, Exponent, BaseUnits);
+                if (Volatile.Read(ref _otherCount) >= MaxEntries)
+                    return m;
+
+                if (_other.TryAdd(q, m))
+                {
+                    Interlocked.Increment(ref _otherCount);
+                    return m;
+                }
+
+                IMeasurement pooled;
+                return _other.TryGetValue(q, out pooled) ? pooled : m;
             }
         }
     }
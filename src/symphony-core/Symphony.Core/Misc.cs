@@ -5,6 +5,7 @@ using System.Collections;
 using System.Collections.Generic;
 using System.Diagnostics.Contracts;
 using System.Linq;
+using System.Threading;
 
 /*
  * These are "utility" constructs used elsewhere throughout the
@@ -212,6 +213,14 @@ namespace Symphony.Core
     /// <returns>The result of the conversion</returns>
     public delegate IMeasurement ConvertProc(IMeasurement input);
 
+    /// <summary>
+    /// Bulk form of ConvertProc for a whole block of SampleData. Must give the same results as the
+    /// ConvertProc registered for the same units, or return null to fall back to it.
+    /// </summary>
+    /// <param name="input">The samples to convert</param>
+    /// <returns>The converted samples, or null</returns>
+    public delegate SampleData BulkConvertProc(SampleData input);
+
     /// <summary>
     /// Conversion functions for use in Matlab.
     /// </summary>
@@ -305,6 +314,24 @@ namespace Symphony.Core
                 converters.Remove(new Tuple<string, string>(from, to));
 
             converters.Add(new Tuple<string, string>(from, to), proc);
+            Interlocked.Increment(ref _generation);
+
+            // A bulk converter registered earlier may not match the new proc
+            bulkConverters.Remove(new Tuple<string, string>(from, to));
+        }
+
+        /// <summary>
+        /// Register a BulkConvertProc used when converting a block of SampleData from the "from"
+        /// units to the "to" units. The per-Measurement ConvertProc for the same units must be
+        /// registered first; registering a new ConvertProc discards the bulk converter.
+        /// </summary>
+        /// <param name="from">The unit type converting from</param>
+        /// <param name="to">The unit type to conver to</param>
+        /// <param name="proc">The code to do the conversion</param>
+        public static void RegisterBulk(string from, string to, BulkConvertProc proc)
+        {
+            bulkConverters[new Tuple<string, string>(from, to)] = proc;
+            Interlocked.Increment(ref _generation);
         }
 
         /// <summary>
@@ -314,6 +341,17 @@ namespace Symphony.Core
         public static void Clear()
         {
             converters.Clear();
+            bulkConverters.Clear();
+            Interlocked.Increment(ref _generation);
+        }
+
+        /// <summary>
+        /// Changes each time a converter is registered or the converters are cleared, so memoized
+        /// conversions (see ConversionMemo) can tell they are stale.
+        /// </summary>
+        internal static int Generation
+        {
+            get { return Volatile.Read(ref _generation); }
         }
 
         /// <summary>
@@ -403,6 +441,45 @@ namespace Symphony.Core
                     from.BaseUnits, to));
         }
 
+        /// <summary>
+        /// Converts a whole block of SampleData without creating per-sample Measurements. Handles
+        /// the identity/exponent transformation and any registered BulkConvertProc.
+        /// </summary>
+        /// <param name="from">The samples to convert</param>
+        /// <param name="to">The units of measure to convert to</param>
+        /// <param name="result">The converted samples</param>
+        /// <returns>False if there is no bulk conversion, in which case the samples must be
+        /// converted one Measurement at a time with Convert</returns>
+        public static bool TryConvert(SampleData from, string to, out SampleData result)
+        {
+            if (from.Conversions != null)
+                return from.Conversions.TryConvert(from, to, out result);
+
+            return TryConvertSamples(from, to, out result);
+        }
+
+        internal static bool TryConvertSamples(SampleData from, string to, out SampleData result)
+        {
+            if (_SIUnits.BaseUnits(to) == from.BaseUnits)
+            {
+                var toExp = _SIUnits.Exponent(to);
+                result = toExp == from.Exponent
+                    ? from
+                    : from.Scale(Math.Pow(10, from.Exponent - toExp), 0, toExp, from.BaseUnits);
+                return true;
+            }
+
+            BulkConvertProc converter;
+            if (bulkConverters.TryGetValue(new Tuple<string, string>(from.BaseUnits, to), out converter))
+            {
+                result = converter(from);
+                return result != null;
+            }
+
+            result = null;
+            return false;
+        }
+
 
         /// <summary>
         /// The Dictionary that holds converters from "unit-type" to "unit-type"
@@ -412,5 +489,10 @@ namespace Symphony.Core
         /// </summary>
         static IDictionary<Tuple<string, string>, ConvertProc> converters =
             new Dictionary<Tuple<string, string>, ConvertProc>();
+
+        static IDictionary<Tuple<string, string>, BulkConvertProc> bulkConverters =
+            new Dictionary<Tuple<string, string>, BulkConvertProc>();
+
+        private static int _generation;
     }
 }
\ No newline at end of file
@@ -0,0 +1,222 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Runtime.ExceptionServices;
+using System.Threading;
+using System.Threading.Tasks;
+using log4net;
+
+namespace Symphony.Core
+{
+    /// <summary>
+    /// Snapshot of a PersistenceQueue's depth and backpressure.
+    /// </summary>
+    public struct PersistenceQueueStatus
+    {
+        /// <summary>
+        /// Most items the queue holds before TryEnqueue rejects and Enqueue blocks.
+        /// </summary>
+        public int Capacity { get; set; }
+
+        /// <summary>
+        /// Items queued but not yet committed, now and at most.
+        /// </summary>
+        public int Depth { get; set; }
+        public int MaxDepth { get; set; }
+
+        public long Committed { get; set; }
+
+        /// <summary>
+        /// Items TryEnqueue rejected because the queue was full.
+        /// </summary>
+        public long Rejected { get; set; }
+    }
+
+    /// <summary>
+    /// Decouples persistence from the threads producing data. Items go onto a bounded queue; a pool of
+    /// workers prepares them (e.g. converts measurements to their stored layout) in parallel, and a single
+    /// writer thread commits them in queue order.
+    /// </summary>
+    public sealed class PersistenceQueue : IDisposable
+    {
+        private readonly BlockingCollection<Item> _queue;
+        private readonly TaskFactory _workers;
+        private readonly Thread _writer;
+
+        private int _maxDepth;
+        private long _committed;
+        private long _rejected;
+
+        private static readonly ILog log = LogManager.GetLogger(typeof(PersistenceQueue));
+
+        /// <summary>
+        /// Starts the writer thread.
+        /// </summary>
+        /// <param name="capacity">Most items queued at once</param>
+        /// <param name="workers">Most items prepared at once</param>
+        public PersistenceQueue(int capacity, int workers)
+        {
+            if (capacity < 1)
+                throw new ArgumentOutOfRangeException("capacity");
+
+            _queue = new BlockingCollection<Item>(capacity);
+            _workers = new TaskFactory(new LimitedConcurrencyLevelTaskScheduler(workers));
+
+            _writer = new Thread(Run)
+                          {
+                              Name = "Persistence writer",
+                              IsBackground = true
+                          };
+            _writer.Start();
+        }
+
+        public PersistenceQueueStatus Status
+        {
+            get
+            {
+                return new PersistenceQueueStatus
+                           {
+                               Capacity = _queue.BoundedCapacity,
+                               Depth = _queue.Count,
+                               MaxDepth = Volatile.Read(ref _maxDepth),
+                               Committed = Interlocked.Read(ref _committed),
+                               Rejected = Interlocked.Read(ref _rejected)
+                           };
+            }
+        }
+
+        /// <summary>
+        /// Queues an item without blocking, for producers that must never wait on persistence.
+        /// </summary>
+        /// <param name="prepare">Run on a worker, or null</param>
+        /// <param name="commit">Run on the writer thread with the result of prepare</param>
+        /// <returns>False if the queue is full or closed; the item is then dropped</returns>
+        public bool TryEnqueue<T>(Func<T> prepare, Action<T> commit)
+        {
+            var item = new Item();
+            try
+            {
+                if (!_queue.TryAdd(item))
+                {
+                    Interlocked.Increment(ref _rejected);
+                    return false;
+                }
+            }
+            catch (InvalidOperationException)
+            {
+                // Closed
+                return false;
+            }
+
+            Start(item, prepare, commit);
+            return true;
+        }
+
+        /// <summary>
+        /// Queues an item, blocking while the queue is full.
+        /// </summary>
+        public void Enqueue<T>(Func<T> prepare, Action<T> commit)
+        {
+            var item = new Item();
+            _queue.Add(item);
+            Start(item, prepare, commit);
+        }
+
+        /// <summary>
+        /// Runs fn on the writer thread once everything already queued is committed, and returns its
+        /// result. Exceptions are rethrown on the caller.
+        /// </summary>
+        public T Invoke<T>(Func<T> fn)
+        {
+            if (Thread.CurrentThread == _writer)
+                return fn();
+
+            try
+            {
+                return InvokeAsync(fn).Result;
+            }
+            catch (AggregateException x)
+            {
+                ExceptionDispatchInfo.Capture(x.InnerException).Throw();
+                throw;
+            }
+        }
+
+        /// <summary>
+        /// Queues fn to run on the writer thread once everything already queued is committed. Blocks
+        /// only while the queue is full.
+        /// </summary>
+        /// <returns>Task completed with fn's result or exception</returns>
+        public Task<T> InvokeAsync<T>(Func<T> fn)
+        {
+            var done = new TaskCompletionSource<T>();
+            Enqueue<object>(null, (o) =>
+                                      {
+                                          try
+                                          {
+                                              done.SetResult(fn());
+                                          }
+                                          catch (Exception x)
+                                          {
+                                              done.SetException(x);
+                                          }
+                                      });
+
+            return done.Task;
+        }
+
+        /// <summary>
+        /// Commits everything queued, then stops the writer thread. Nothing may be queued once Dispose is.
+        /// </summary>
+        public void Dispose()
+        {
+            if (_queue.IsAddingCompleted)
+                return;
+
+            _queue.CompleteAdding();
+            _writer.Join();
+        }
+
+        private void Start<T>(Item item, Func<T> prepare, Action<T> commit)
+        {
+            int depth = _queue.Count;
+            int max;
+            while (depth > (max = Volatile.Read(ref _maxDepth)) &&
+                   Interlocked.CompareExchange(ref _maxDepth, depth, max) != max)
+            {
+            }
+
+            // The writer waits on Prepared, so it is set before the item can be taken
+            var prepared = prepare == null
+                               ? Task.FromResult(default(T))
+                               : _workers.StartNew(prepare);
+
+            item.Commit = () => commit(prepared.Result);
+            item.Ready.Set();
+        }
+
+        private void Run()
+        {
+            foreach (var item in _queue.GetConsumingEnumerable())
+            {
+                item.Ready.Wait();
+                try
+                {
+                    item.Commit();
+                }
+                catch (Exception x)
+                {
+                    log.ErrorFormat("Unable to commit persisted item: {0}", x);
+                }
+
+                item.Ready.Dispose();
+                Interlocked.Increment(ref _committed);
+            }
+        }
+
+        private sealed class Item
+        {
+            public readonly ManualResetEventSlim Ready = new ManualResetEventSlim(false);
+            public Action Commit;
+        }
+    }
+}
@@ -0,0 +1,142 @@
+﻿using System;
+using System.Diagnostics;
+using System.Threading;
+
+namespace Symphony.Core
+{
+    /// <summary>
+    /// Snapshot of DAQ process loop timing since the loop last started.
+    /// </summary>
+    public struct ProcessLoopStatistics
+    {
+        public long Iterations { get; set; }
+
+        /// <summary>
+        /// Mean and longest time spent in ProcessLoopIteration.
+        /// </summary>
+        public TimeSpan MeanIterationTime { get; set; }
+        public TimeSpan MaxIterationTime { get; set; }
+
+        /// <summary>
+        /// Largest difference between the time from one iteration start to the next and the process interval.
+        /// </summary>
+        public TimeSpan MaxPeriodJitter { get; set; }
+
+        /// <summary>
+        /// Largest and most recent time by which an iteration overran the process interval.
+        /// </summary>
+        public TimeSpan MaxDeficit { get; set; }
+        public TimeSpan LastDeficit { get; set; }
+    }
+
+    /// <summary>
+    /// Accumulates process loop timing without allocating. Recorded by the process loop thread;
+    /// Statistics may be read from any thread. Times are Stopwatch ticks.
+    /// </summary>
+    public sealed class ProcessLoopMonitor
+    {
+        private long _interval;
+        private long _iterations;
+        private long _iterationTicks;
+        private long _maxIterationTicks;
+        private long _maxJitter;
+        private long _maxDeficit;
+        private long _lastDeficit;
+
+        private long _iterationStart;
+        private long _previousStart;
+
+        /// <summary>
+        /// Clears all statistics for a loop with the given process interval.
+        /// </summary>
+        public void Reset(TimeSpan processInterval)
+        {
+            Interlocked.Exchange(ref _interval, (long)(processInterval.TotalSeconds * Stopwatch.Frequency));
+            Interlocked.Exchange(ref _iterations, 0);
+            Interlocked.Exchange(ref _iterationTicks, 0);
+            Interlocked.Exchange(ref _maxIterationTicks, 0);
+            Interlocked.Exchange(ref _maxJitter, 0);
+            Interlocked.Exchange(ref _maxDeficit, 0);
+            Interlocked.Exchange(ref _lastDeficit, 0);
+            _iterationStart = 0;
+            _previousStart = 0;
+        }
+
+        public void BeginIteration()
+        {
+            BeginIteration(Stopwatch.GetTimestamp());
+        }
+
+        /// <summary>
+        /// Marks the start of an iteration. The first period is not counted towards jitter, as the first
+        /// iteration includes starting the hardware (and waiting for any trigger).
+        /// </summary>
+        public void BeginIteration(long ticks)
+        {
+            if (_previousStart != 0)
+            {
+                Max(ref _maxJitter, Math.Abs(ticks - _iterationStart - _interval));
+            }
+
+            _previousStart = _iterationStart;
+            _iterationStart = ticks;
+        }
+
+        public void EndIteration()
+        {
+            EndIteration(Stopwatch.GetTimestamp());
+        }
+
+        /// <summary>
+        /// Marks the end of the ProcessLoopIteration begun by the last BeginIteration.
+        /// </summary>
+        public void EndIteration(long ticks)
+        {
+            long duration = ticks - _iterationStart;
+
+            Interlocked.Increment(ref _iterations);
+            Interlocked.Add(ref _iterationTicks, duration);
+            Max(ref _maxIterationTicks, duration);
+        }
+
+        public void RecordDeficit(TimeSpan deficit)
+        {
+            long ticks = (long)(deficit.TotalSeconds * Stopwatch.Frequency);
+
+            Interlocked.Exchange(ref _lastDeficit, ticks);
+            Max(ref _maxDeficit, ticks);
+        }
+
+        public ProcessLoopStatistics Statistics
+        {
+            get
+            {
+                long iterations = Interlocked.Read(ref _iterations);
+
+                return new ProcessLoopStatistics
+                    {
+                        Iterations = iterations,
+                        MeanIterationTime = iterations > 0 ? ToTimeSpan(Interlocked.Read(ref _iterationTicks) / iterations) : TimeSpan.Zero,
+                        MaxIterationTime = ToTimeSpan(Interlocked.Read(ref _maxIterationTicks)),
+                        MaxPeriodJitter = ToTimeSpan(Interlocked.Read(ref _maxJitter)),
+                        MaxDeficit = ToTimeSpan(Interlocked.Read(ref _maxDeficit)),
+                        LastDeficit = ToTimeSpan(Interlocked.Read(ref _lastDeficit))
+                    };
+            }
+        }
+
+        private static TimeSpan ToTimeSpan(long ticks)
+        {
+            return TimeSpan.FromTicks((long)Math.Round((double)ticks * TimeSpan.TicksPerSecond / Stopwatch.Frequency));
+        }
+
+        // Single writer, so a plain compare suffices
+        private static void Max(ref long value, long candidate)
+        {
+            if (candidate > Interlocked.Read(ref value))
+            {
+                Interlocked.Exchange(ref value, candidate);
+            }
+        }
+    }
+}
@@ -0,0 +1,382 @@
+﻿using System;
+using System.Collections;
+using System.Collections.Generic;
+
+namespace Symphony.Core
+{
+    /// <summary>
+    /// Read-only list of Measurements backed by a primitive sample array (short or double) with a
+    /// single exponent and base unit. Blocks of samples can move through the input/output pipelines
+    /// without a Measurement object per sample; Measurements are only created (via MeasurementPool)
+    /// when an element is read through the IList interface.
+    /// 
+    /// <para>SampleData never copies or modifies the array it is given and may share it with slices,
+    /// so callers must not modify the array afterwards.</para>
+    /// </summary>
+    public sealed class SampleData : IList<IMeasurement>
+    {
+        private readonly short[] _int16Samples;
+        private readonly double[] _doubleSamples;
+        private readonly int _offset;
+        private readonly ConversionMemo _conversions;
+        private MeasurementPool.UnitPool _pool;
+
+        /// <summary>
+        /// Constructs a SampleData over all of the given int16 samples.
+        /// </summary>
+        public SampleData(short[] samples, int exponent, string baseUnits)
+            : this(samples, 0, samples == null ? 0 : samples.Length, exponent, baseUnits)
+        {
+        }
+
+        /// <summary>
+        /// Constructs a SampleData over count int16 samples starting at offset.
+        /// </summary>
+        public SampleData(short[] samples, int offset, int count, int exponent, string baseUnits)
+        {
+            CheckSegment(samples, offset, count);
+
+            _int16Samples = samples;
+            _offset = offset;
+            Count = count;
+            Exponent = exponent;
+            BaseUnits = baseUnits;
+        }
+
+        /// <summary>
+        /// Constructs a SampleData over all of the given double samples.
+        /// </summary>
+        public SampleData(double[] samples, int exponent, string baseUnits)
+            : this(samples, 0, samples == null ? 0 : samples.Length, exponent, baseUnits)
+        {
+        }
+
+        /// <summary>
+        /// Constructs a SampleData over count double samples starting at offset.
+        /// </summary>
+        public SampleData(double[] samples, int offset, int count, int exponent, string baseUnits)
+        {
+            CheckSegment(samples, offset, count);
+
+            _doubleSamples = samples;
+            _offset = offset;
+            Count = count;
+            Exponent = exponent;
+            BaseUnits = baseUnits;
+        }
+
+        /// <summary>
+        /// Constructs a SampleData over the same samples as other whose unit conversions are
+        /// memoized in conversions (see StimulusCache). other must span its whole array.
+        /// </summary>
+        internal SampleData(SampleData other, ConversionMemo conversions)
+            : this(other._int16Samples, other._doubleSamples, other._offset, other.Count, other.Exponent, other.BaseUnits, conversions)
+        {
+        }
+
+        private SampleData(short[] int16Samples, double[] doubleSamples, int offset, int count, int exponent, string baseUnits, ConversionMemo conversions)
+        {
+            _int16Samples = int16Samples;
+            _doubleSamples = doubleSamples;
+            _offset = offset;
+            Count = count;
+            Exponent = exponent;
+            BaseUnits = baseUnits;
+            _conversions = conversions;
+        }
+
+        private static void CheckSegment(Array samples, int offset, int count)
+        {
+            if (samples == null)
+                throw new ArgumentNullException("samples");
+
+            if (offset < 0 || count < 0 || offset > samples.Length - count)
+                throw new ArgumentOutOfRangeException("count", "Sample range exceeds array length");
+        }
+
+        public int Count { get; private set; }
+
+        /// <summary>
+        /// Memo of conversions shared by every slice of a cached sample array, or null.
+        /// </summary>
+        internal ConversionMemo Conversions
+        {
+            get { return _conversions; }
+        }
+
+        /// <summary>
+        /// Index of the first sample in the backing array.
+        /// </summary>
+        internal int Offset
+        {
+            get { return _offset; }
+        }
+
+        /// <summary>
+        /// Length of the backing array.
+        /// </summary>
+        internal int ArrayLength
+        {
+            get { return IsInt16 ? _int16Samples.Length : _doubleSamples.Length; }
+        }
+
+        /// <summary>
+        /// Base-10 exponent of every sample relative to BaseUnits.
+        /// </summary>
+        public int Exponent { get; private set; }
+
+        /// <summary>
+        /// Base units of every sample.
+        /// </summary>
+        public string BaseUnits { get; private set; }
+
+        /// <summary>
+        /// True if samples are stored as int16, false if stored as double.
+        /// </summary>
+        public bool IsInt16
+        {
+            get { return _int16Samples != null; }
+        }
+
+        /// <summary>
+        /// The backing int16 array segment. Only valid if IsInt16. Must not be modified.
+        /// </summary>
+        public ArraySegment<short> Int16Samples
+        {
+            get
+            {
+                if (!IsInt16)
+                    throw new InvalidOperationException("Samples are not stored as int16");
+
+                return new ArraySegment<short>(_int16Samples, _offset, Count);
+            }
+        }
+
+        /// <summary>
+        /// The backing double array segment. Only valid if !IsInt16. Must not be modified.
+        /// </summary>
+        public ArraySegment<double> DoubleSamples
+        {
+            get
+            {
+                if (IsInt16)
+                    throw new InvalidOperationException("Samples are not stored as double");
+
+                return new ArraySegment<double>(_doubleSamples, _offset, Count);
+            }
+        }
+
+        /// <summary>
+        /// Quantity (relative to Exponent) of the sample at index.
+        /// </summary>
+        public double Value(int index)
+        {
+            if (index < 0 || index >= Count)
+                throw new ArgumentOutOfRangeException("index");
+
+            return IsInt16 ? _int16Samples[_offset + index] : _doubleSamples[_offset + index];
+        }
+
+        /// <summary>
+        /// Copies the samples as doubles (relative to Exponent) into a new array.
+        /// </summary>
+        public double[] ToDoubleArray()
+        {
+            var result = new double[Count];
+            if (IsInt16)
+            {
+                for (int i = 0; i < Count; i++)
+                {
+                    result[i] = _int16Samples[_offset + i];
+                }
+            }
+            else
+            {
+                Array.Copy(_doubleSamples, _offset, result, 0, Count);
+            }
+
+            return result;
+        }
+
+        /// <summary>
+        /// Copies int16 samples into a new array.
+        /// </summary>
+        /// <exception cref="InvalidOperationException">If samples are not stored as int16</exception>
+        public short[] ToInt16Array()
+        {
+            if (!IsInt16)
+                throw new InvalidOperationException("Samples are not stored as int16");
+
+            var result = new short[Count];
+            Array.Copy(_int16Samples, _offset, result, 0, Count);
+            return result;
+        }
+
+        /// <summary>
+        /// Returns a view of count samples starting at start. O(1); shares this instance's array.
+        /// </summary>
+        public SampleData Slice(int start, int count)
+        {
+            if (start < 0 || count < 0 || start > Count - count)
+                throw new ArgumentOutOfRangeException("count", "Slice exceeds sample count");
+
+            return new SampleData(_int16Samples, _doubleSamples, _offset + start, count, Exponent, BaseUnits, _conversions);
+        }
+
+        /// <summary>
+        /// Indicates if other holds samples of the same storage type, exponent and units, i.e. if
+        /// the two may be concatenated without conversion.
+        /// </summary>
+        public bool IsCompatible(SampleData other)
+        {
+            return other != null && IsInt16 == other.IsInt16 && Exponent == other.Exponent && BaseUnits == other.BaseUnits;
+        }
+
+        /// <summary>
+        /// Concatenates two compatible SampleData with a single bulk copy.
+        /// </summary>
+        /// <exception cref="ArgumentException">If a and b are not compatible</exception>
+        public static SampleData Concat(SampleData a, SampleData b)
+        {
+            if (!a.IsCompatible(b))
+                throw new ArgumentException("Sample storage, exponent and units must match", "b");
+
+            if (b.Count == 0)
+                return a;
+
+            if (a.Count == 0)
+                return b;
+
+            // Adjacent slices of one array (e.g. blocks of a cached stimulus) join without a copy
+            if (ReferenceEquals(a._int16Samples ?? (object)a._doubleSamples, b._int16Samples ?? (object)b._doubleSamples) &&
+                b._offset == a._offset + a.Count)
+            {
+                return new SampleData(a._int16Samples, a._doubleSamples, a._offset, a.Count + b.Count, a.Exponent, a.BaseUnits, a._conversions);
+            }
+
+            if (a.IsInt16)
+            {
+                var samples = new short[a.Count + b.Count];
+                Array.Copy(a._int16Samples, a._offset, samples, 0, a.Count);
+                Array.Copy(b._int16Samples, b._offset, samples, a.Count, b.Count);
+                return new SampleData(samples, a.Exponent, a.BaseUnits);
+            }
+            else
+            {
+                var samples = new double[a.Count + b.Count];
+                Array.Copy(a._doubleSamples, a._offset, samples, 0, a.Count);
+                Array.Copy(b._doubleSamples, b._offset, samples, a.Count, b.Count);
+                return new SampleData(samples, a.Exponent, a.BaseUnits);
+            }
+        }
+
+        /// <summary>
+        /// Returns a new double SampleData with every sample transformed by value * scale + offset.
+        /// </summary>
+        public SampleData Scale(double scale, double offset, int exponent, string baseUnits)
+        {
+            var result = new double[Count];
+            if (IsInt16)
+            {
+                for (int i = 0; i < Count; i++)
+                {
+                    result[i] = _int16Samples[_offset + i] * scale + offset;
+                }
+            }
+            else
+            {
+                for (int i = 0; i < Count; i++)
+                {
+                    result[i] = _doubleSamples[_offset + i] * scale + offset;
+                }
+            }
+
+            return new SampleData(result, exponent, baseUnits);
+        }
+
+        private IMeasurement MeasurementAt(int index)
+        {
+            var pool = _pool ?? (_pool = MeasurementPool.Units(Exponent, BaseUnits));
+            return IsInt16 ? pool.Get(_int16Samples[_offset + index]) : pool.Get((decimal)_doubleSamples[_offset + index]);
+        }
+
+        public IMeasurement this[int index]
+        {
+            get
+            {
+                if (index < 0 || index >= Count)
+                    throw new ArgumentOutOfRangeException("index");
+
+                return MeasurementAt(index);
+            }
+            set { throw new NotSupportedException("SampleData is read-only"); }
+        }
+
+        public IEnumerator<IMeasurement> GetEnumerator()
+        {
+            for (int i = 0; i < Count; i++)
+            {
+                yield return MeasurementAt(i);
+            }
+        }
+
+        IEnumerator IEnumerable.GetEnumerator()
+        {
+            return GetEnumerator();
+        }
+
+        public int IndexOf(IMeasurement item)
+        {
+            for (int i = 0; i < Count; i++)
+            {
+                if (MeasurementAt(i).Equals(item))
+                    return i;
+            }
+
+            return -1;
+        }
+
+        public bool Contains(IMeasurement item)
+        {
+            return IndexOf(item) >= 0;
+        }
+
+        public void CopyTo(IMeasurement[] array, int arrayIndex)
+        {
+            for (int i = 0; i < Count; i++)
+            {
+                array[arrayIndex + i] = MeasurementAt(i);
+            }
+        }
+
+        public bool IsReadOnly
+        {
+            get { return true; }
+        }
+
+        public void Add(IMeasurement item)
+        {
+            throw new NotSupportedException("SampleData is read-only");
+        }
+
+        public void Clear()
+        {
+            throw new NotSupportedException("SampleData is read-only");
+        }
+
+        public bool Remove(IMeasurement item)
+        {
+            throw new NotSupportedException("SampleData is read-only");
+        }
+
+        public void Insert(int index, IMeasurement item)
+        {
+            throw new NotSupportedException("SampleData is read-only");
+        }
+
+        public void RemoveAt(int index)
+        {
+            throw new NotSupportedException("SampleData is read-only");
+        }
+    }
+}
@@ -0,0 +1,464 @@
+﻿using System;
+using System.Collections;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Globalization;
+using System.Linq;
+using System.Runtime.CompilerServices;
+using System.Text;
+using System.Threading;
+
+namespace Symphony.Core
+{
+    /// <summary>
+    /// Cache of stimulus data for protocols that present the same stimulus in many epochs.
+    ///
+    /// <para>The first time a stimulus is streamed its blocks are generated as usual and kept; a
+    /// later stimulus with the same StimulusID, units, sample rate, duration and Parameters (and,
+    /// for a DelegatedStimulus, the same renderer) is streamed as slices of the kept samples without running its generator. Conversions of the
+    /// kept samples (by the devices and streams it passes through, e.g. V to DAQ counts) are
+    /// memoized per target units, so a repeated stimulus reaches the DAQ in its final units
+    /// without being converted again.</para>
+    ///
+    /// <para>Stimuli are assumed to be reproducible from their parameters (see IStimulus).
+    /// Indefinite stimuli, stimuli whose Data is persisted with them, and stimuli with parameter values that are not plain values (numbers,
+    /// strings, enums, times, or collections of them) are never cached. Nor are CombinedStimulus
+    /// and RenderedStimulus, whose samples also depend on their CombineProc or rendered data. Entries are dropped least
+    /// recently used first once the cache holds more than CapacityBytes.</para>
+    /// </summary>
+    public sealed class StimulusCache
+    {
+        public const long DefaultCapacityBytes = 256L << 20;
+
+        private sealed class Entry
+        {
+            public SampleData Samples;
+            public long Bytes;
+            public LinkedListNode<string> Node;
+        }
+
+        private readonly object _lock = new object();
+        private readonly Dictionary<string, Entry> _entries = new Dictionary<string, Entry>();
+        private readonly LinkedList<string> _lru = new LinkedList<string>();
+        private long _bytes;
+        private long _hits;
+        private long _misses;
+
+        // Ids of renderer methods and targets, for keys that hold no reference to them
+        private static readonly ConditionalWeakTable<object, object> RendererIds = new ConditionalWeakTable<object, object>();
+        private static long _lastRendererId;
+
+        public StimulusCache()
+            : this(DefaultCapacityBytes)
+        {
+        }
+
+        public StimulusCache(long capacityBytes)
+        {
+            if (capacityBytes <= 0)
+                throw new ArgumentOutOfRangeException("capacityBytes");
+
+            CapacityBytes = capacityBytes;
+        }
+
+        /// <summary>
+        /// Most bytes of samples (including memoized conversions) the cache holds.
+        /// </summary>
+        public long CapacityBytes { get; private set; }
+
+        public long Bytes
+        {
+            get { lock (_lock) return _bytes; }
+        }
+
+        public int Count
+        {
+            get { lock (_lock) return _entries.Count; }
+        }
+
+        /// <summary>
+        /// Number of cacheable stimuli streamed from the cache.
+        /// </summary>
+        public long Hits
+        {
+            get { return Interlocked.Read(ref _hits); }
+        }
+
+        /// <summary>
+        /// Number of cacheable stimuli not found in the cache, and so generated.
+        /// </summary>
+        public long Misses
+        {
+            get { return Interlocked.Read(ref _misses); }
+        }
+
+        public void Clear()
+        {
+            lock (_lock)
+            {
+                _entries.Clear();
+                _lru.Clear();
+                _bytes = 0;
+            }
+        }
+
+        /// <summary>
+        /// Returns the data blocks of stimulus, from the cache if an equivalent stimulus was
+        /// streamed before. Blocks are split as Stimulus.DataBlocks splits them.
+        /// </summary>
+        public IEnumerable<IOutputData> DataBlocks(IStimulus stimulus, TimeSpan blockDuration)
+        {
+            var key = KeyFor(stimulus);
+            if (key == null)
+                return stimulus.DataBlocks(blockDuration);
+
+            SampleData samples;
+            if (TryGet(key, out samples))
+            {
+                Interlocked.Increment(ref _hits);
+                return CachedBlocks(samples, stimulus.SampleRate, blockDuration);
+            }
+
+            Interlocked.Increment(ref _misses);
+            return RecordBlocks(key, stimulus, blockDuration);
+        }
+
+        private static IEnumerable<IOutputData> CachedBlocks(SampleData samples, IMeasurement sampleRate, TimeSpan blockDuration)
+        {
+            int blockSamples = Math.Max(1, (int)Math.Ceiling(blockDuration.TotalSeconds * (double)sampleRate.QuantityInBaseUnits));
+
+            for (int start = 0; start < samples.Count; start += blockSamples)
+            {
+                int count = Math.Min(blockSamples, samples.Count - start);
+                yield return new OutputData(samples.Slice(start, count), sampleRate, start + count >= samples.Count);
+            }
+        }
+
+        private IEnumerable<IOutputData> RecordBlocks(string key, IStimulus stimulus, TimeSpan blockDuration)
+        {
+            var blocks = new List<IList<IMeasurement>>();
+            long samples = 0;
+            var total = (long)((TimeSpan)stimulus.Duration).Samples(stimulus.SampleRate);
+
+            foreach (var block in stimulus.DataBlocks(blockDuration))
+            {
+                if (blocks != null)
+                {
+                    samples += block.Data.Count;
+                    if (samples * sizeof(double) <= CapacityBytes)
+                        blocks.Add(block.Data);
+                    else
+                        blocks = null;
+                }
+
+                // A stimulus is kept once its last block is rendered; the stream stops pulling once
+                // it has that block, so the enumeration may never run past it
+                if (blocks != null && samples > 0 && (block.IsLast || samples >= total))
+                {
+                    var flat = Flatten(blocks, (int)samples);
+                    if (flat != null)
+                        Add(key, flat);
+
+                    blocks = null;
+                }
+
+                yield return block;
+            }
+        }
+
+        // Copies the blocks into one array, or returns null if their units differ
+        private static SampleData Flatten(IList<IList<IMeasurement>> blocks, int count)
+        {
+            var first = blocks[0] as SampleData;
+            if (first != null && blocks.All(b => first.IsCompatible(b as SampleData)))
+            {
+                if (first.IsInt16)
+                {
+                    var int16 = new short[count];
+                    int i = 0;
+                    foreach (SampleData b in blocks)
+                    {
+                        var segment = b.Int16Samples;
+                        Array.Copy(segment.Array, segment.Offset, int16, i, segment.Count);
+                        i += segment.Count;
+                    }
+
+                    return new SampleData(int16, first.Exponent, first.BaseUnits);
+                }
+
+                var doubles = new double[count];
+                int j = 0;
+                foreach (SampleData b in blocks)
+                {
+                    var segment = b.DoubleSamples;
+                    Array.Copy(segment.Array, segment.Offset, doubles, j, segment.Count);
+                    j += segment.Count;
+                }
+
+                return new SampleData(doubles, first.Exponent, first.BaseUnits);
+            }
+
+            string units = null;
+            var values = new double[count];
+            int k = 0;
+            foreach (var m in blocks.SelectMany(b => b))
+            {
+                if (units == null)
+                    units = m.BaseUnits;
+                else if (units != m.BaseUnits)
+                    return null;
+
+                values[k++] = (double)m.QuantityInBaseUnits;
+            }
+
+            return new SampleData(values, 0, units);
+        }
+
+        private bool TryGet(string key, out SampleData samples)
+        {
+            lock (_lock)
+            {
+                Entry entry;
+                if (!_entries.TryGetValue(key, out entry))
+                {
+                    samples = null;
+                    return false;
+                }
+
+                _lru.Remove(entry.Node);
+                _lru.AddFirst(entry.Node);
+
+                samples = entry.Samples;
+                return true;
+            }
+        }
+
+        private void Add(string key, SampleData samples)
+        {
+            var entry = new Entry {Bytes = SizeOf(samples)};
+            entry.Samples = ConversionMemo.Memoize(samples, bytes => Grow(entry, bytes));
+
+            lock (_lock)
+            {
+                if (_entries.ContainsKey(key))
+                    return;
+
+                entry.Node = _lru.AddFirst(key);
+                _entries[key] = entry;
+                _bytes += entry.Bytes;
+
+                Trim();
+            }
+        }
+
+        private void Grow(Entry entry, long bytes)
+        {
+            lock (_lock)
+            {
+                entry.Bytes += bytes;
+                if (entry.Node.List != null)
+                {
+                    _bytes += bytes;
+                    Trim();
+                }
+            }
+        }
+
+        private void Trim()
+        {
+            // The most recent entry stays even if it alone is over capacity
+            while (_bytes > CapacityBytes && _lru.Count > 1)
+            {
+                var key = _lru.Last.Value;
+                _lru.RemoveLast();
+                _bytes -= _entries[key].Bytes;
+                _entries.Remove(key);
+            }
+        }
+
+        internal static long SizeOf(SampleData samples)
+        {
+            return (long)samples.Count * (samples.IsInt16 ? sizeof(short) : sizeof(double));
+        }
+
+        /// <summary>
+        /// Cache key of stimulus, or null if it cannot be cached.
+        /// </summary>
+        public static string KeyFor(IStimulus stimulus)
+        {
+            if (stimulus == null || !stimulus.Duration || stimulus.Data.IsSome())
+                return null;
+
+            if (stimulus is CombinedStimulus || stimulus is RenderedStimulus)
+                return null;
+
+            var key = new StringBuilder();
+            key.Append(stimulus.GetType().FullName).Append('|')
+               .Append(stimulus.StimulusID).Append('|')
+               .Append(stimulus.Units).Append('|')
+               .Append(Format(stimulus.SampleRate.QuantityInBaseUnits)).Append(stimulus.SampleRate.BaseUnits).Append('|')
+               .Append(((TimeSpan)stimulus.Duration).Ticks);
+
+            foreach (var p in stimulus.Parameters.OrderBy(p => p.Key, StringComparer.Ordinal))
+            {
+                key.Append('|').Append(p.Key).Append('=');
+                if (!AppendValue(key, p.Value))
+                    return null;
+            }
+
+            var delegated = stimulus as DelegatedStimulus;
+            if (delegated != null)
+            {
+                foreach (var renderer in delegated.Renderer.GetInvocationList())
+                {
+                    key.Append("|renderer=").Append(RendererId(renderer.Method));
+                    if (renderer.Target != null)
+                        key.Append('@').Append(RendererId(renderer.Target));
+                }
+            }
+
+            return key.ToString();
+        }
+
+        private static long RendererId(object o)
+        {
+            return (long)RendererIds.GetValue(o, _ => Interlocked.Increment(ref _lastRendererId));
+        }
+
+        private static bool AppendValue(StringBuilder key, object value)
+        {
+            if (value == null)
+            {
+                key.Append("null");
+                return true;
+            }
+
+            var s = value as string;
+            if (s != null)
+            {
+                key.Append('"').Append(s.Replace("\\", "\\\\").Replace("\"", "\\\"")).Append('"');
+                return true;
+            }
+
+            var type = value.GetType();
+            if (type.IsPrimitive || type.IsEnum || value is decimal || value is DateTime || value is DateTimeOffset || value is TimeSpan)
+            {
+                key.Append(type.Name).Append(':').Append(Format(value));
+                return true;
+            }
+
+            var m = value as IMeasurement;
+            if (m != null)
+            {
+                key.Append(Format(m.Quantity)).Append('e').Append(m.Exponent).Append(m.BaseUnits);
+                return true;
+            }
+
+            var items = value as IEnumerable;
+            if (items != null)
+            {
+                key.Append('[');
+                foreach (var item in items)
+                {
+                    if (!AppendValue(key, item))
+                        return false;
+                    key.Append(',');
+                }
+                key.Append(']');
+                return true;
+            }
+
+            return false;
+        }
+
+        private static string Format(object value)
+        {
+            if (value is double)
+                return ((double)value).ToString("R", CultureInfo.InvariantCulture);
+            if (value is float)
+                return ((float)value).ToString("R", CultureInfo.InvariantCulture);
+
+            var formattable = value as IFormattable;
+            return formattable != null ? formattable.ToString(null, CultureInfo.InvariantCulture) : value.ToString();
+        }
+    }
+
+    /// <summary>
+    /// Memoized unit conversions of a cached sample array, shared by all of its slices. A slice is
+    /// converted by converting the whole array once per target units and slicing the result.
+    /// </summary>
+    internal sealed class ConversionMemo
+    {
+        private sealed class Conversion
+        {
+            public int Generation;
+            public SampleData Samples; // null if there is no bulk conversion
+        }
+
+        private readonly Dictionary<string, Conversion> _conversions = new Dictionary<string, Conversion>();
+        private readonly Action<long> _grew;
+
+        /// <param name="grew">Called with the size of each conversion added</param>
+        public ConversionMemo(Action<long> grew)
+        {
+            _grew = grew;
+        }
+
+        /// <summary>
+        /// Returns root, which must span its whole array, memoizing its conversions in a new ConversionMemo.
+        /// </summary>
+        public static SampleData Memoize(SampleData root, Action<long> grew)
+        {
+            var memo = new ConversionMemo(grew);
+            var samples = new SampleData(root, memo);
+            memo.Root = samples;
+            return samples;
+        }
+
+        private SampleData Root { get; set; }
+
+        public bool TryConvert(SampleData from, string to, out SampleData result)
+        {
+            int generation = Converters.Generation;
+
+            Conversion conversion;
+            lock (_conversions)
+            {
+                if (!_conversions.TryGetValue(to, out conversion) || conversion.Generation != generation)
+                {
+                    SampleData converted;
+                    conversion = new Conversion {Generation = generation};
+                    if (Converters.TryConvertSamples(Root, to, out converted))
+                    {
+                        if (converted.Offset != 0 || converted.Count != Root.Count || converted.Count != converted.ArrayLength)
+                        {
+                            // Converts, but not to a whole array the slices can share
+                            return Converters.TryConvertSamples(from, to, out result);
+                        }
+
+                        if (ReferenceEquals(converted, Root))
+                        {
+                            conversion.Samples = Root;
+                        }
+                        else
+                        {
+                            conversion.Samples = Memoize(converted, _grew);
+                            _grew(StimulusCache.SizeOf(converted));
+                        }
+                    }
+
+                    _conversions[to] = conversion;
+                }
+            }
+
+            if (conversion.Samples == null)
+            {
+                result = null;
+                return false;
+            }
+
+            result = conversion.Samples.Slice(from.Offset, from.Count);
+            return true;
+        }
+    }
+}